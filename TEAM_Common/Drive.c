@@ -13,6 +13,12 @@
 #include "Tacho.h"
 #include "Pid.h"
 #include "Motor.h"
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  #include "MotorModel.h"
+#endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  #include "Profile.h"
+#endif
 #if PL_CONFIG_HAS_SHELL
   #include "CLS1.h"
 #endif
@@ -20,6 +26,12 @@
 #include "Q4CRight.h"
 #include "Shell.h"
 #include "WAIT1.h"
+#include "CS1.h"
+#include "Quad.h"
+#include "SeqLock.h"
+#if PL_CONFIG_HAS_ODOMETRY
+  #include "Odometry.h"
+#endif
 
 struct {
   DRV_Mode mode;
@@ -29,37 +41,203 @@ struct {
   struct {
     int32_t left, right;
   } pos;
+#if PL_CONFIG_HAS_ODOMETRY
+  struct {
+    uint32_t theta;     /* heading to turn to in DRV_MODE_POS */
+    uint32_t tolerance; /* 0 for a position move without a heading */
+  } heading;
+#endif
 } DRV_Status;
 
-typedef enum {
-  DRV_SET_MODE,
-  DRV_SET_SPEED,
-  DRV_SET_POS,
-} DRV_Commands;
+/* Speed and position setpoints go through a mailbox each, where only the newest value counts: a double
+ * buffer (SeqLock.h), so setters never wait for the drive task. */
+typedef struct {
+  int32_t left, right; /* speed or position of the wheels */
+  uint32_t heading, headingTolerance; /* position only: heading of DRV_SetPosHeading(), tolerance 0 for none */
+} DRV_Setpoint;
+
+typedef struct {
+  DRV_Setpoint val[2];
+  SEQ_Lock lock; /* number of values written */
+} DRV_Mailbox;
+
+static DRV_Mailbox DRV_SpeedBox, DRV_PosBox;
+static uint32_t DRV_SpeedSeq, DRV_PosSeq; /* sequence counter of the values taken over by the drive task */
+
+/* Mode changes go through a queue and are taken over in order. Setters never wait for the drive task: if
+ * the queue is full, the oldest mode gets overwritten, so the newest one (e.g. a stop) is always kept. */
+#define DRV_MODE_QUEUE_LENGTH  8 /* power of two, the counters wrap around */
+static struct {
+  DRV_Mode mode[DRV_MODE_QUEUE_LENGTH];
+  volatile uint32_t head; /* number of modes written */
+  volatile uint32_t tail; /* number of modes taken over or overwritten */
+} DRV_ModeQueue;
+static uint32_t DRV_NofModes; /* modes taken over by the drive task */
+static uint32_t DRV_NofSkipped; /* setpoints and modes overwritten before the drive task has seen them */
+#if PL_CONFIG_HAS_ODOMETRY
+static uint32_t DRV_NofHeadingMoves; /* position moves from the remaining heading error */
+#endif
+
+#define DRV_PERIOD_MS  5 /* period of the drive task */
+#if PL_CONFIG_HAS_DRIVE_ISR
+  #define DRV_CONTROL_PERIOD_US  DRV_ISR_PERIOD_US /* the wheel control loops run in the timer interrupt */
+#else
+  #define DRV_CONTROL_PERIOD_US  (DRV_PERIOD_MS*1000) /* the wheel control loops run in the drive task */
+#endif
 
+/* Statistics of the control loop: deviation of the period from the nominal one, and execution time */
+#define DRV_HIST_NOF_BINS  8
 typedef struct {
-  DRV_Commands cmd;
-  union {
-    DRV_Mode mode; /* DRV_SET_MODE */
-    struct {
-      int32_t left, right;
-    } speed; /* DRV_SET_SPEED */
-   struct {
-      int32_t left, right;
-    } pos; /* DRV_SET_POS */
-  } u;
-} DRV_Command;
-
-#define QUEUE_LENGTH      4 /* number of items in queue, that's my buffer size */
-#define QUEUE_ITEM_SIZE   sizeof(DRV_Command) /* each item is a single drive command */
-static xQueueHandle DRV_Queue;
+  const uint16_t *limits; /* upper limits of the bins in us, the last bin has no limit */
+  uint32_t cnt[DRV_HIST_NOF_BINS]; /* number of values per bin */
+  uint32_t max; /* largest value in us */
+} DRV_Histogram;
+
+static const uint16_t DRV_JitterLimits[DRV_HIST_NOF_BINS-1] = {1, 2, 5, 10, 20, 50, 100};
+static const uint16_t DRV_ExecLimits[DRV_HIST_NOF_BINS-1] = {5, 10, 20, 50, 100, 200, 500};
+static DRV_Histogram DRV_JitterHist = {DRV_JitterLimits}, DRV_ExecHist = {DRV_ExecLimits};
+static uint32_t DRV_LoopStart; /* QUAD_GetTime() of the last period */
+static bool DRV_LoopHasStart; /* if DRV_LoopStart is valid */
+static volatile bool DRV_LoopIsOn = FALSE; /* the timer interrupt fires before the driver is initialized */
+
+/* Completion conditions: the control loop checks them each period, the drive task publishes them in an
+ * event group where other tasks can wait for them. The bits are only set from the drive task, as
+ * xEventGroupSetBitsFromISR() needs the timer task. With the control loop in the timer interrupt,
+ * the interrupt wakes up the drive task as soon as a condition is met. */
+#define DRV_EVENT_ALL  (DRV_EVENT_STOPPED|DRV_EVENT_TARGET|DRV_EVENT_TAKEN_OVER|DRV_EVENT_HEADING)
+static EventGroupHandle_t DRV_Events;
+static volatile uint32_t DRV_LoopEvents; /* conditions met in the last period of the control loop */
+#if PL_CONFIG_HAS_DRIVE_ISR
+static xTaskHandle DRV_TaskHandle = NULL;
+#endif
+
+/*!
+ * \brief Adds a value to a histogram.
+ * \param hist Histogram
+ * \param us Value in microseconds
+ */
+static void DRV_HistAdd(DRV_Histogram *hist, uint32_t us) {
+  int i;
+
+  for(i=0; i<DRV_HIST_NOF_BINS-1 && us>hist->limits[i]; i++) {
+    /* find the bin */
+  }
+  hist->cnt[i]++;
+  if (us>hist->max) {
+    hist->max = us;
+  }
+}
+
+static void DRV_HistReset(DRV_Histogram *hist) {
+  int i;
+
+  for(i=0; i<DRV_HIST_NOF_BINS; i++) {
+    hist->cnt[i] = 0;
+  }
+  hist->max = 0;
+}
+
+static void DRV_LoopReset(void) {
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical();
+  DRV_HistReset(&DRV_JitterHist);
+  DRV_HistReset(&DRV_ExecHist);
+  DRV_LoopHasStart = FALSE; /* no jitter for the first period after the reset */
+  CS1_ExitCritical();
+}
+
+/*!
+ * \brief Writes a new value into a mailbox.
+ * \param box Mailbox
+ * \param left Value for the left wheel
+ * \param right Value for the right wheel
+ * \param heading Heading for a position move, see DRV_SetPosHeading()
+ * \param headingTolerance Tolerance of the heading, 0 for none
+ */
+static void DRV_MailboxPut(DRV_Mailbox *box, int32_t left, int32_t right, uint32_t heading, uint32_t headingTolerance) {
+  DRV_Setpoint *val;
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* any task can set: keep two setters from using the same buffer */
+  val = &box->val[SEQ_WriteIndex(&box->lock)];
+  val->left = left;
+  val->right = right;
+  val->heading = heading;
+  val->headingTolerance = headingTolerance;
+  SEQ_Publish(&box->lock);
+  CS1_ExitCritical();
+}
+
+/*!
+ * \brief Reads the newest value from a mailbox, if there is one not read yet.
+ * \param box Mailbox
+ * \param lastSeq Sequence counter of the last value read, gets updated
+ * \param val Where to store the value
+ * \return TRUE if there was a new value, FALSE otherwise
+ */
+static bool DRV_MailboxGet(DRV_Mailbox *box, uint32_t *lastSeq, DRV_Setpoint *val) {
+  uint32_t seq;
+
+  if (box->lock.seq==*lastSeq) {
+    return FALSE; /* nothing new */
+  }
+  seq = SEQ_Read(&box->lock, val, box->val, sizeof(*val));
+  DRV_NofSkipped += seq-*lastSeq-1;
+  *lastSeq = seq;
+  return TRUE;
+}
+
+/*!
+ * \brief Adds a mode change to the queue, overwrites the oldest one if the queue is full.
+ * \param mode New mode
+ */
+static void DRV_ModeQueuePut(DRV_Mode mode) {
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* any task can set */
+  if (DRV_ModeQueue.head-DRV_ModeQueue.tail==DRV_MODE_QUEUE_LENGTH) {
+    DRV_ModeQueue.tail++; /* full: drop the oldest */
+    DRV_NofSkipped++;
+  }
+  DRV_ModeQueue.mode[DRV_ModeQueue.head%DRV_MODE_QUEUE_LENGTH] = mode;
+  DRV_ModeQueue.head++;
+  CS1_ExitCritical();
+}
+
+/*!
+ * \brief Takes the oldest mode change out of the queue.
+ * \param mode Where to store the mode
+ * \return TRUE if there was a mode change, FALSE if the queue is empty
+ */
+static bool DRV_ModeQueueGet(DRV_Mode *mode) {
+  bool res = FALSE;
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* a setter might drop the oldest entry meanwhile */
+  if (DRV_ModeQueue.tail!=DRV_ModeQueue.head) {
+    *mode = DRV_ModeQueue.mode[DRV_ModeQueue.tail%DRV_MODE_QUEUE_LENGTH];
+    DRV_ModeQueue.tail++;
+    res = TRUE;
+  }
+  CS1_ExitCritical();
+  return res;
+}
+
+/*!
+ * \brief Checks if there are commands the drive task has not taken over yet.
+ * \return TRUE if something is pending
+ */
+static bool DRV_IsPending(void) {
+  return DRV_ModeQueue.head!=DRV_ModeQueue.tail || DRV_SpeedBox.lock.seq!=DRV_SpeedSeq || DRV_PosBox.lock.seq!=DRV_PosSeq;
+}
 
 bool DRV_IsStopped(void) {
   Q4CLeft_QuadCntrType leftPos;
   Q4CRight_QuadCntrType rightPos;
 
-  if (FRTOS1_uxQueueMessagesWaiting(DRV_Queue)>0) {
-    return FALSE; /* still messages in command queue, so there is something pending */
+  if (DRV_IsPending()) {
+    return FALSE; /* still commands not taken over by the drive task */
   }
   /* do *not* use/calculate speed: too slow! Use position encoder instead */
   leftPos = Q4CLeft_GetPos();
@@ -82,19 +260,50 @@ bool DRV_IsStopped(void) {
 
 uint8_t DRV_Stop(int32_t timeoutMs) {
   DRV_SetMode(DRV_MODE_STOP); /* stop it */
-  do {
-    if (DRV_IsStopped()) {
-      break;
-    }
-    WAIT1_WaitOSms(5);
-    timeoutMs -= 5;
-  } while (timeoutMs>0);
+  return DRV_WaitFor(DRV_EVENT_STOPPED, timeoutMs);
+}
+
+uint8_t DRV_WaitFor(uint32_t events, int32_t timeoutMs) {
+  EventBits_t bits;
+
   if (timeoutMs<0) {
+    timeoutMs = 0;
+  }
+  bits = FRTOS1_xEventGroupWaitBits(DRV_Events, events, pdFALSE, pdTRUE, timeoutMs/portTICK_PERIOD_MS); /* leave the bits set for other waiters */
+  if ((bits&events)!=events) {
     return ERR_BUSY; /* timeout */
   }
   return ERR_OK;
 }
 
+/*!
+ * \brief Clears the completion conditions, they belong to the previous command.
+ */
+static void DRV_ClearEvents(void) {
+  (void)FRTOS1_xEventGroupClearBits(DRV_Events, DRV_EVENT_ALL);
+}
+
+/*!
+ * \brief Copies the conditions found by the control loop into the event group. Called from the drive task only.
+ */
+static void DRV_PublishEvents(void) {
+  EventBits_t events;
+
+  FRTOS1_vTaskSuspendAll(); /* no task can set a new command between the check and the update */
+  if (DRV_IsPending()) {
+    events = 0; /* the conditions are still the ones of the previous command */
+  } else {
+    events = DRV_LoopEvents|DRV_EVENT_TAKEN_OVER;
+  }
+  if ((FRTOS1_xEventGroupGetBits(DRV_Events)&DRV_EVENT_ALL)!=events) {
+    (void)FRTOS1_xEventGroupClearBits(DRV_Events, DRV_EVENT_ALL&~events);
+    if (events!=0) {
+      (void)FRTOS1_xEventGroupSetBits(DRV_Events, events); /* waiters run after resuming the scheduler */
+    }
+  }
+  (void)FRTOS1_xTaskResumeAll();
+}
+
 bool DRV_IsDrivingBackward(void) {
   return DRV_Status.mode==DRV_MODE_SPEED
       && DRV_Status.speed.left<0
@@ -106,30 +315,68 @@ static bool match(int32_t pos, int32_t target) {
   return (pos>=target-MATCH_MARGIN && pos<=target+MATCH_MARGIN);
 }
 
-bool DRV_HasTurned(void) {
-  int32_t pos;
+#if PL_CONFIG_HAS_ODOMETRY
+/*!
+ * \brief Checks if the robot is at the heading of the position move.
+ * \param speedL Speed of the left wheel, steps/sec
+ * \param speedR Speed of the right wheel, steps/sec
+ * \return TRUE if the heading is within the tolerance and the robot turns slower than DRV_HEADING_RATE_MAX
+ */
+static bool DRV_IsAtHeading(int32_t speedL, int32_t speedR) {
+  ODO_Pose pose;
+  int32_t error, rate;
 
-  if (FRTOS1_uxQueueMessagesWaiting(DRV_Queue)>0) {
-    return FALSE; /* still messages in command queue, so there is something pending */
+  ODO_GetPose(&pose);
+  error = (int32_t)(DRV_Status.heading.theta-pose.theta);
+  if ((uint32_t)(error<0 ? -error : error)>DRV_Status.heading.tolerance) {
+    return FALSE;
   }
-  if (DRV_Status.mode==DRV_MODE_POS) {
-    #define DRV_TURN_SPEED_LOW 50
-    int32_t speedL, speedR;
-
-    speedL = TACHO_GetSpeed(TRUE);
-    speedR = TACHO_GetSpeed(FALSE);
-    if (speedL>-DRV_TURN_SPEED_LOW && speedL<DRV_TURN_SPEED_LOW && speedR>-DRV_TURN_SPEED_LOW && speedR<DRV_TURN_SPEED_LOW) { /* speed close to zero */
-      pos = Q4CLeft_GetPos();
-      if (match(pos, DRV_Status.pos.left)) {
-        pos = Q4CRight_GetPos();
-        if (match(pos, DRV_Status.pos.right)) {
-          return TRUE;
-        }
-      }
+  rate = (speedR-speedL)/2;
+  return rate>-DRV_HEADING_RATE_MAX && rate<DRV_HEADING_RATE_MAX;
+}
+#endif
+
+/*!
+ * \brief Checks the completion conditions for the current mode and setpoints.
+ * \return DRV_EVENT_* bits of the conditions met
+ */
+static uint32_t DRV_CheckEvents(void) {
+  #define DRV_TURN_SPEED_LOW 50
+  int32_t speedL, speedR;
+  uint32_t events = 0;
+
+  speedL = TACHO_GetSpeed(TRUE);
+  speedR = TACHO_GetSpeed(FALSE);
+  if (speedL>-DRV_TURN_SPEED_LOW && speedL<DRV_TURN_SPEED_LOW && speedR>-DRV_TURN_SPEED_LOW && speedR<DRV_TURN_SPEED_LOW) { /* speed close to zero */
+    events |= DRV_EVENT_STOPPED;
+  }
+#if PL_CONFIG_HAS_ODOMETRY
+  if (DRV_Status.mode!=DRV_MODE_POS || DRV_Status.heading.tolerance==0 || DRV_IsAtHeading(speedL, speedR)) {
+    events |= DRV_EVENT_HEADING;
+  }
+#else
+  events |= DRV_EVENT_HEADING; /* no move with a heading */
+#endif
+  if (DRV_Status.mode!=DRV_MODE_POS) {
+    events |= DRV_EVENT_TARGET; /* no position move */
+  } else if (events&DRV_EVENT_STOPPED) {
+#if PL_CONFIG_HAS_MOTION_PROFILE
+    if (PROF_IsEnabled() && !PROF_IsFinished()) {
+      return events; /* still on the way */
     }
-    return FALSE;
-  } /* if */
-  return TRUE;
+#endif
+    if (match((int32_t)Q4CLeft_GetPos(), DRV_Status.pos.left) && match((int32_t)Q4CRight_GetPos(), DRV_Status.pos.right)) {
+      events |= DRV_EVENT_TARGET;
+    }
+  }
+  return events;
+}
+
+bool DRV_HasTurned(void) {
+  if (DRV_IsPending()) {
+    return FALSE; /* still commands not taken over by the drive task */
+  }
+  return (DRV_CheckEvents()&DRV_EVENT_TARGET)!=0;
 }
 
 DRV_Mode DRV_GetMode(void) {
@@ -137,42 +384,33 @@ DRV_Mode DRV_GetMode(void) {
 }
 
 uint8_t DRV_SetMode(DRV_Mode mode) {
-  DRV_Command cmd;
-
-  cmd.cmd = DRV_SET_MODE;
-  cmd.u.mode = mode;
-  if (FRTOS1_xQueueSendToBack(DRV_Queue, &cmd, portMAX_DELAY)!=pdPASS) {
-    return ERR_FAILED;
-  }
-  FRTOS1_taskYIELD(); /* yield so drive task has a chance to read message */
+  DRV_ModeQueuePut(mode);
+  DRV_ClearEvents(); /* after queuing: the drive task does not report them again before it has taken the mode over */
   return ERR_OK;
 }
 
 uint8_t DRV_SetSpeed(int32_t left, int32_t right) {
-  DRV_Command cmd;
-
-  cmd.cmd = DRV_SET_SPEED;
-  cmd.u.speed.left = left;
-  cmd.u.speed.right = right;
-  if (FRTOS1_xQueueSendToBack(DRV_Queue, &cmd, portMAX_DELAY)!=pdPASS) {
-    return ERR_FAILED;
-  }
-  FRTOS1_taskYIELD(); /* yield so drive task has a chance to read message */
+  DRV_MailboxPut(&DRV_SpeedBox, left, right, 0, 0);
+  DRV_ClearEvents();
   return ERR_OK;
 }
 
 uint8_t DRV_SetPos(int32_t left, int32_t right) {
-  DRV_Command cmd;
+  DRV_MailboxPut(&DRV_PosBox, left, right, 0, 0);
+  DRV_ClearEvents();
+  return ERR_OK;
+}
 
-  cmd.cmd = DRV_SET_POS;
-  cmd.u.pos.left = left;
-  cmd.u.pos.right = right;
-  if (FRTOS1_xQueueSendToBack(DRV_Queue, &cmd, portMAX_DELAY)!=pdPASS) {
-    return ERR_FAILED;
+#if PL_CONFIG_HAS_ODOMETRY
+uint8_t DRV_SetPosHeading(int32_t left, int32_t right, uint32_t heading, uint32_t tolerance) {
+  if (tolerance==0) {
+    return ERR_FAILED; /* the heading would never be reached */
   }
-  FRTOS1_taskYIELD(); /* yield so drive task has a chance to read message */
+  DRV_MailboxPut(&DRV_PosBox, left, right, heading, tolerance);
+  DRV_ClearEvents();
   return ERR_OK;
 }
+#endif
 
 #if PL_CONFIG_HAS_SHELL
 static uint8_t *DRV_GetModeStr(DRV_Mode mode) {
@@ -192,6 +430,34 @@ static void DRV_PrintHelp(const CLS1_StdIOType *io) {
   CLS1_SendHelpStr((unsigned char*)"  speed <left> <right>", (unsigned char*)"Move left and right motors with given speed\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  pos <left> <right>", (unsigned char*)"Move left and right wheels to given position\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  pos reset", (unsigned char*)"Reset drive and wheel position\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  loop reset", (unsigned char*)"Reset control loop jitter and execution time statistics\r\n", io->stdOut);
+}
+
+static void DRV_PrintHist(const unsigned char *kind, const DRV_Histogram *hist, const CLS1_StdIOType *io) {
+  DRV_Histogram copy;
+  uint8_t buf[160];
+  int i;
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* the loop might update it meanwhile */
+  copy = *hist;
+  CS1_ExitCritical();
+  buf[0] = '\0';
+  for(i=0; i<DRV_HIST_NOF_BINS; i++) {
+    if (i<DRV_HIST_NOF_BINS-1) {
+      UTIL1_strcatNum16u(buf, sizeof(buf), copy.limits[i]);
+    } else {
+      UTIL1_chcat(buf, sizeof(buf), '>');
+      UTIL1_strcatNum16u(buf, sizeof(buf), copy.limits[i-1]);
+    }
+    UTIL1_chcat(buf, sizeof(buf), ':');
+    UTIL1_strcatNum32u(buf, sizeof(buf), copy.cnt[i]);
+    UTIL1_chcat(buf, sizeof(buf), ' ');
+  }
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"us (max ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), copy.max);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" us)\r\n");
+  CLS1_SendStatusStr(kind, buf, io->stdOut);
 }
 
 static void DRV_PrintStatus(const CLS1_StdIOType *io) {
@@ -225,6 +491,36 @@ static void DRV_PrintStatus(const CLS1_StdIOType *io) {
   UTIL1_strcatNum32s(buf, sizeof(buf), (int32_t)Q4CRight_GetPos());
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)")\r\n");
   CLS1_SendStatusStr((unsigned char*)"  pos right", buf, io->stdOut);
+
+#if PL_CONFIG_HAS_ODOMETRY
+  if (DRV_Status.heading.tolerance!=0) {
+    UTIL1_Num32sToStr(buf, sizeof(buf), ODO_THETA_TO_CENTIDEG(DRV_Status.heading.theta));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" cdeg +/- ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), ODO_THETA_TO_CENTIDEG(DRV_Status.heading.tolerance));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)", ");
+  } else {
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"none, ");
+  }
+  UTIL1_strcatNum32u(buf, sizeof(buf), DRV_NofHeadingMoves);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" corrections\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  heading", buf, io->stdOut);
+#endif
+
+  UTIL1_Num32uToStr(buf, sizeof(buf), DRV_SpeedSeq+DRV_PosSeq+DRV_NofModes);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" taken over, ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), DRV_NofSkipped);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" overwritten\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  setpoints", buf, io->stdOut);
+
+  UTIL1_Num32uToStr(buf, sizeof(buf), DRV_CONTROL_PERIOD_US);
+#if PL_CONFIG_HAS_DRIVE_ISR
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" us, timer interrupt\r\n");
+#else
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" us, drive task\r\n");
+#endif
+  CLS1_SendStatusStr((unsigned char*)"  loop", buf, io->stdOut);
+  DRV_PrintHist((unsigned char*)"  jitter", &DRV_JitterHist, io);
+  DRV_PrintHist((unsigned char*)"  exec time", &DRV_ExecHist, io);
 }
 
 uint8_t DRV_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
@@ -275,6 +571,9 @@ uint8_t DRV_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_Std
       CLS1_SendStr((unsigned char*)"Wrong argument(s)\r\n", io->stdErr);
       res = ERR_FAILED;
     }
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"drive loop reset")==0) {
+    DRV_LoopReset();
+    *handled = TRUE;
   } else if (UTIL1_strncmp((char*)cmd, (char*)"drive mode ", sizeof("drive mode ")-1)==0) {
     p = cmd+sizeof("drive mode");
     if (UTIL1_strcmp((char*)p, (char*)"none")==0) {
@@ -305,58 +604,231 @@ uint8_t DRV_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_Std
 }
 #endif /* PL_CONFIG_HAS_SHELL */
 
-static uint8_t GetCmd(void) {
-  DRV_Command cmd;
-  portBASE_TYPE res;
-
-  res = FRTOS1_xQueueReceive(DRV_Queue, &cmd, 0);
-  if (res==errQUEUE_EMPTY) {
-    return ERR_RXEMPTY; /* no command */
+static void GetCmd(void) {
+  DRV_Setpoint speed, pos; /* only read when the mailbox had a new value */
+  DRV_Mode mode, newMode = DRV_MODE_NONE;
+  bool newSpeed, newPos, newModeSet = FALSE, startProfile;
+  CS1_CriticalVariable()
+
+  /* newest setpoints first, so a mode change right after a setpoint uses it */
+  newSpeed = DRV_MailboxGet(&DRV_SpeedBox, &DRV_SpeedSeq, &speed);
+  newPos = DRV_MailboxGet(&DRV_PosBox, &DRV_PosSeq, &pos);
+  while (DRV_ModeQueueGet(&mode)) { /* in order, the last mode wins */
+    newMode = mode;
+    newModeSet = TRUE;
+    DRV_NofModes++;
+  }
+  startProfile = newPos || (newModeSet && newMode==DRV_MODE_POS); /* new target, or position mode set again */
+  CS1_EnterCritical(); /* the control loop might run in the timer interrupt: apply everything at once */
+  if (newSpeed) {
+    DRV_Status.speed.left = speed.left;
+    DRV_Status.speed.right = speed.right;
+  }
+  if (newPos) {
+    DRV_Status.pos.left = pos.left;
+    DRV_Status.pos.right = pos.right;
+#if PL_CONFIG_HAS_ODOMETRY
+    DRV_Status.heading.theta = pos.heading;
+    DRV_Status.heading.tolerance = pos.headingTolerance;
+#endif
   }
-  /* process command */
-  FRTOS1_taskENTER_CRITICAL();
-  if (cmd.cmd==DRV_SET_MODE) {
+  if (newModeSet) {
     PID_Start(); /* reset PID, especially integral counters */
-    DRV_Status.mode = cmd.u.mode;
-  } else if (cmd.cmd==DRV_SET_SPEED) {
-    DRV_Status.speed.left = cmd.u.speed.left;
-    DRV_Status.speed.right = cmd.u.speed.right;
-  } else if (cmd.cmd==DRV_SET_POS) {
-    DRV_Status.pos.left = cmd.u.pos.left;
-    DRV_Status.pos.right = cmd.u.pos.right;
-  }
-  FRTOS1_taskEXIT_CRITICAL();
-  return ERR_OK;
+    DRV_Status.mode = newMode;
+  }
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  if (startProfile) {
+    /* plan the way from where the wheels are now to the target */
+    PROF_Start((int32_t)Q4CLeft_GetPos(), (int32_t)Q4CRight_GetPos(), DRV_Status.pos.left, DRV_Status.pos.right);
+  }
+#else
+  (void)startProfile;
+#endif
+  if (newSpeed || newPos || newModeSet) {
+    DRV_LoopEvents = 0; /* unknown until the control loop has run with the new command */
+  }
+  CS1_ExitCritical();
 }
 
+#if PL_CONFIG_HAS_ODOMETRY
+/*!
+ * \brief Closes the loop on the heading of a position move with a heading: if the wheels have got to their
+ * positions, but the heading is not within the tolerance (e.g. wheel slip, or the rounding of the steps for
+ * the heading), the remaining heading error becomes a new position move. Called from the drive task.
+ */
+static void DRV_HeadingControl(void) {
+  ODO_Pose pose;
+  int32_t toGo;
+  CS1_CriticalVariable()
+
+  if (DRV_Status.mode!=DRV_MODE_POS || DRV_Status.heading.tolerance==0 || DRV_IsPending()
+      || (DRV_LoopEvents&(DRV_EVENT_TARGET|DRV_EVENT_HEADING))!=DRV_EVENT_TARGET)
+  {
+    return; /* no heading, or not at the wheel positions, or at the heading */
+  }
+  ODO_GetPose(&pose);
+  toGo = ODO_HeadingToSteps((int32_t)(DRV_Status.heading.theta-pose.theta)); /* per wheel, positive for counter clockwise */
+  CS1_EnterCritical();
+  DRV_Status.pos.left = (int32_t)Q4CLeft_GetPos()-toGo;
+  DRV_Status.pos.right = (int32_t)Q4CRight_GetPos()+toGo;
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  PROF_Start((int32_t)Q4CLeft_GetPos(), (int32_t)Q4CRight_GetPos(), DRV_Status.pos.left, DRV_Status.pos.right);
+#endif
+  DRV_LoopEvents = 0; /* unknown until the control loop has run with the new target */
+  DRV_NofHeadingMoves++;
+  CS1_ExitCritical();
+}
+#endif
+
+#if PL_CONFIG_HAS_MOTION_PROFILE
+#define DRV_PROFILE_POS_GAIN    10 /* speed correction in steps/sec per step behind the trajectory: higher rings with the dead time of the motors */
+#define DRV_PROFILE_POS_FILTER  3  /* at the target, stop correcting position errors below this */
+
+/*!
+ * \brief Speed for a wheel to follow the trajectory: the speed of the trajectory, corrected with the position error.
+ * \param set Setpoint from the profile
+ * \param pos Current position of the wheel
+ * \return Speed setpoint for the speed PID, in steps/sec
+ */
+static int32_t DRV_ProfileSpeed(const PROF_Setpoint *set, int32_t pos) {
+  int32_t error;
+
+  error = set->pos-pos;
+  if (set->speed==0 && error>-DRV_PROFILE_POS_FILTER && error<DRV_PROFILE_POS_FILTER) { /* avoid jitter at the target */
+    return 0;
+  }
+  return set->speed+error*DRV_PROFILE_POS_GAIN;
+}
+
+/*!
+ * \brief Position control along the trajectory, with the speed PID as inner loop.
+ * The speed and the acceleration of the trajectory go to the feedforward of the speed PID (PID_SpeedAccel()).
+ */
+static void DRV_FollowProfile(uint32_t periodUs) {
+  PROF_Setpoint left, right;
+
+  (void)PROF_Next(periodUs, &left, &right);
+  PID_SpeedAccel(TACHO_GetSpeed(TRUE), DRV_ProfileSpeed(&left, (int32_t)Q4CLeft_GetPos()), left.accel, TRUE, periodUs);
+  PID_SpeedAccel(TACHO_GetSpeed(FALSE), DRV_ProfileSpeed(&right, (int32_t)Q4CRight_GetPos()), right.accel, FALSE, periodUs);
+}
+#endif
+
+/*!
+ * \brief Closed loop control of both wheels for the current mode, for one period.
+ * \param periodUs Period in microseconds
+ */
+static void DRV_Control(uint32_t periodUs) {
+  if (DRV_Status.mode==DRV_MODE_SPEED) {
+    PID_Speed(TACHO_GetSpeed(TRUE), DRV_Status.speed.left, TRUE, periodUs);
+    PID_Speed(TACHO_GetSpeed(FALSE), DRV_Status.speed.right, FALSE, periodUs);
+  } else if (DRV_Status.mode==DRV_MODE_STOP) {
+    PID_Speed(TACHO_GetSpeed(TRUE), 0, TRUE, periodUs);
+    PID_Speed(TACHO_GetSpeed(FALSE), 0, FALSE, periodUs);
+  } else if (DRV_Status.mode==DRV_MODE_POS) {
+#if PL_CONFIG_HAS_MOTION_PROFILE
+    if (PROF_IsEnabled()) {
+      DRV_FollowProfile(periodUs);
+    } else
+#endif
+    {
+      PID_Pos(Q4CLeft_GetPos(), DRV_Status.pos.left, TRUE, periodUs);
+      PID_Pos(Q4CRight_GetPos(), DRV_Status.pos.right, FALSE, periodUs);
+    }
+  } else if (DRV_Status.mode==DRV_MODE_NONE) {
+    /* do nothing */
+  }
+}
+
+/*!
+ * \brief Runs one period of the wheel control loops and records the deviation from the nominal
+ * period and the execution time.
+ * \param periodUs Nominal period in microseconds
+ */
+static void DRV_Loop(uint32_t periodUs) {
+  uint32_t start, us, events;
+
+  start = QUAD_GetTime();
+  if (DRV_LoopHasStart) {
+    us = (start-DRV_LoopStart)/(QUAD_TIME_HZ/1000000);
+    DRV_HistAdd(&DRV_JitterHist, us>periodUs ? us-periodUs : periodUs-us);
+  }
+  DRV_LoopStart = start;
+  DRV_LoopHasStart = TRUE;
+#if PL_CONFIG_HAS_DRIVE_ISR
+  TACHO_Sample(); /* fresh speed for the PIDs */
+#if PL_CONFIG_HAS_ODOMETRY
+  ODO_Sample();
+#endif
+#endif
+  DRV_Control(periodUs);
+  events = DRV_CheckEvents();
+#if PL_CONFIG_HAS_DRIVE_ISR
+  if ((events&~DRV_LoopEvents)!=0 && DRV_TaskHandle!=NULL) { /* new condition met: publish it now, not in the next period of the drive task */
+    portBASE_TYPE higherPriorityTaskWoken = pdFALSE;
+
+    vTaskNotifyGiveFromISR(DRV_TaskHandle, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+  }
+#endif
+  DRV_LoopEvents = events;
+  DRV_HistAdd(&DRV_ExecHist, (QUAD_GetTime()-start)/(QUAD_TIME_HZ/1000000));
+}
+
+#if PL_CONFIG_HAS_DRIVE_ISR
+void DRV_OnTimer(void) {
+  if (DRV_LoopIsOn) {
+    DRV_Loop(DRV_ISR_PERIOD_US);
+  }
+}
+#endif
+
 static void DriveTask(void *pvParameters) {
   portTickType xLastWakeTime;
+#if PL_CONFIG_HAS_DRIVE_ISR
+  portTickType elapsed;
+#endif
 
   (void)pvParameters;
   xLastWakeTime = xTaskGetTickCount();
   for(;;) {
-    while (GetCmd()==ERR_OK) { /* returns ERR_RXEMPTY if queue is empty */
-      /* process incoming commands */
-    }
-    TACHO_CalcSpeed();
-    if (DRV_Status.mode==DRV_MODE_SPEED) {
-      PID_Speed(TACHO_GetSpeed(TRUE), DRV_Status.speed.left, TRUE);
-      PID_Speed(TACHO_GetSpeed(FALSE), DRV_Status.speed.right, FALSE);
-    } else if (DRV_Status.mode==DRV_MODE_STOP) {
-      PID_Speed(TACHO_GetSpeed(TRUE), 0, TRUE);
-      PID_Speed(TACHO_GetSpeed(FALSE), 0, FALSE);
-    } else if (DRV_Status.mode==DRV_MODE_POS) {
-      PID_Pos(Q4CLeft_GetPos(), DRV_Status.pos.left, TRUE);
-      PID_Pos(Q4CRight_GetPos(), DRV_Status.pos.right, FALSE);
-    } else if (DRV_Status.mode==DRV_MODE_NONE) {
-      /* do nothing */
+    GetCmd(); /* take over new mode and setpoints */
+#if PL_CONFIG_HAS_MOTOR_MODEL
+    MMOD_Update(DRV_PERIOD_MS); /* values applied in the last period, before the PID changes them */
+#endif
+#if !PL_CONFIG_HAS_DRIVE_ISR
+    DRV_Loop(DRV_CONTROL_PERIOD_US);
+#endif
+#if PL_CONFIG_HAS_ODOMETRY
+    DRV_HeadingControl();
+#endif
+    DRV_PublishEvents();
+#if PL_CONFIG_HAS_DRIVE_ISR
+    for(;;) { /* until the next period, publish whenever the timer interrupt finds a new condition */
+      elapsed = xTaskGetTickCount()-xLastWakeTime;
+      if (elapsed>=DRV_PERIOD_MS/portTICK_PERIOD_MS) {
+        break; /* late: catch up like vTaskDelayUntil() */
+      }
+      if (ulTaskNotifyTake(pdTRUE, DRV_PERIOD_MS/portTICK_PERIOD_MS-elapsed)==0) {
+        break; /* timeout: next period */
+      }
+#if PL_CONFIG_HAS_ODOMETRY
+      DRV_HeadingControl();
+#endif
+      DRV_PublishEvents();
     }
-    FRTOS1_vTaskDelayUntil(&xLastWakeTime, 5/portTICK_PERIOD_MS);
+    xLastWakeTime += DRV_PERIOD_MS/portTICK_PERIOD_MS;
+#else
+    FRTOS1_vTaskDelayUntil(&xLastWakeTime, DRV_PERIOD_MS/portTICK_PERIOD_MS);
+#endif
   } /* for */
 }
 
 void DRV_Deinit(void) {
-  FRTOS1_vQueueDelete(DRV_Queue);
+  DRV_LoopIsOn = FALSE;
+#if PL_CONFIG_HAS_DRIVE_ISR
+  DRV_TaskHandle = NULL;
+#endif
+  FRTOS1_vEventGroupDelete(DRV_Events);
 }
 
 void DRV_Init(void) {
@@ -365,13 +837,30 @@ void DRV_Init(void) {
   DRV_Status.speed.right = 0;
   DRV_Status.pos.left = 0;
   DRV_Status.pos.right = 0;
-  DRV_Queue = FRTOS1_xQueueCreate(QUEUE_LENGTH, QUEUE_ITEM_SIZE);
-  if (DRV_Queue==NULL) {
+#if PL_CONFIG_HAS_ODOMETRY
+  DRV_Status.heading.tolerance = 0;
+  DRV_NofHeadingMoves = 0;
+#endif
+  DRV_SpeedBox.lock.seq = DRV_SpeedSeq = 0;
+  DRV_PosBox.lock.seq = DRV_PosSeq = 0;
+  DRV_ModeQueue.head = DRV_ModeQueue.tail = 0;
+  DRV_NofModes = 0;
+  DRV_NofSkipped = 0;
+  DRV_Events = FRTOS1_xEventGroupCreate();
+  if (DRV_Events==NULL) {
     for(;;){} /* out of memory? */
   }
-  FRTOS1_vQueueAddToRegistry(DRV_Queue, "Drive");
+  DRV_LoopEvents = 0;
+  DRV_LoopReset();
+#if PL_CONFIG_HAS_DRIVE_ISR
+  if (FRTOS1_xTaskCreate(DriveTask, "Drive", configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY+4, &DRV_TaskHandle) != pdPASS) {
+    for(;;){} /* error */
+  }
+#else
   if (FRTOS1_xTaskCreate(DriveTask, "Drive", configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY+4, NULL) != pdPASS) {
     for(;;){} /* error */
   }
+#endif
+  DRV_LoopIsOn = TRUE; /* the timer interrupt runs already */
 }
 #endif /* PL_CONFIG_HAS_DRIVE */
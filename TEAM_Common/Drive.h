@@ -32,21 +32,86 @@ typedef enum {
   DRV_MODE_POS,
 } DRV_Mode;
 
+/*!
+ * \brief Sets the speed for DRV_MODE_SPEED. Does not block: the drive task takes over the newest value
+ * in its next period, values set before that are overwritten.
+ * \param left Speed of the left wheel in steps/sec
+ * \param right Speed of the right wheel in steps/sec
+ * \return ERR_OK
+ */
 uint8_t DRV_SetSpeed(int32_t left, int32_t right);
+
+/*!
+ * \brief Sets the target position for DRV_MODE_POS. Does not block: the drive task takes over the newest value
+ * in its next period, values set before that are overwritten.
+ * \param left Position of the left wheel in steps
+ * \param right Position of the right wheel in steps
+ * \return ERR_OK
+ */
 uint8_t DRV_SetPos(int32_t left, int32_t right);
+
+#if PL_CONFIG_HAS_ODOMETRY
+#define DRV_HEADING_RATE_MAX  100 /*!< for DRV_EVENT_HEADING the robot turns slower than this, steps/sec of each wheel */
+
+/*!
+ * \brief Sets the target position for DRV_MODE_POS together with a heading of the odometry to turn to. Whenever
+ * the wheels have got to their positions with the heading outside of the tolerance, the drive task starts a new
+ * move from the remaining heading error. DRV_EVENT_HEADING reports when the heading is within the tolerance,
+ * the wheels do not need to be at their positions for it. Does not block, like DRV_SetPos().
+ * \param left Position of the left wheel in steps
+ * \param right Position of the right wheel in steps
+ * \param heading Heading to turn to, binary angle as in ODO_Pose
+ * \param tolerance Largest heading error at the heading, binary angle
+ * \return ERR_OK, ERR_FAILED for a tolerance of 0
+ */
+uint8_t DRV_SetPosHeading(int32_t left, int32_t right, uint32_t heading, uint32_t tolerance);
+#endif
 bool DRV_IsDrivingBackward(void);
+
+/*!
+ * \brief Changes the drive mode. Does not block: mode changes are queued and taken over in order each period,
+ * after the newest setpoints. If the queue is full, the oldest mode change is dropped, never the newest one.
+ * Setting DRV_MODE_POS (again) starts a new move to the position setpoint.
+ * \param mode New mode
+ * \return ERR_OK
+ */
 uint8_t DRV_SetMode(DRV_Mode mode);
 DRV_Mode DRV_GetMode(void);
 bool DRV_IsStopped(void);
 bool DRV_HasTurned(void);
 
 /*!
- * \brief Stops the engines
+ * \brief Stops the engines and waits until both wheels stand still.
  * \param timoutMs timout in milliseconds for operation
  * \return ERR_OK if stopped, ERR_BUSY for timeout condition.
  */
 uint8_t DRV_Stop(int32_t timeoutMs);
 
+#define DRV_EVENT_STOPPED     (1<<0) /*!< both wheels stand still */
+#define DRV_EVENT_TARGET      (1<<1) /*!< position move done, same as DRV_HasTurned() */
+#define DRV_EVENT_TAKEN_OVER  (1<<2) /*!< the drive task has taken over all modes and setpoints set so far */
+#define DRV_EVENT_HEADING     (1<<3) /*!< at the heading of DRV_SetPosHeading(), or no position move with a heading */
+
+/*!
+ * \brief Blocks the calling task until the drive reports the condition. Setting a new mode or setpoint
+ * clears the conditions, they are reported again once the drive task has taken the command over and they are met.
+ * \param events DRV_EVENT_* bits, waits until all of them are set
+ * \param timeoutMs Timeout in milliseconds
+ * \return ERR_OK if the condition is met, ERR_BUSY for timeout condition.
+ */
+uint8_t DRV_WaitFor(uint32_t events, int32_t timeoutMs);
+
+#if PL_CONFIG_HAS_DRIVE_ISR
+#define DRV_ISR_PERIOD_US  1000
+  /*!< period of the TI1 timer interrupt, as configured in Processor Expert. Use 500 for 2 kHz */
+
+/*!
+ * \brief Runs the tacho sampling and the wheel control loops, and wakes up the drive task if a
+ * DRV_EVENT_* condition has been met. Called from the TI1 timer interrupt.
+ */
+void DRV_OnTimer(void);
+#endif
+
 /*!
  * \brief Driver initialization.
  */
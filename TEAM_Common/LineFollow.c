@@ -43,6 +43,10 @@ typedef enum {
 /* task notification bits */
 #define LF_START_FOLLOWING (1<<0)  /* start line following */
 #define LF_STOP_FOLLOWING  (1<<1)  /* stop line following */
+#define LF_NEW_REF_SAMPLE  (1<<2)  /* new reflectance sample available */
+
+#define LF_REF_PERIOD_MS   2  /* reflectance sampling period needed while following the line */
+#define LF_TASK_PERIOD_MS  5  /* task period if there is no new sample */
 
 static volatile StateType LF_currState = STATE_IDLE;
 static xTaskHandle LFTaskHandle;
@@ -71,13 +75,21 @@ static void StateMachine(void);
  * \return Returns TRUE if still on line segment
  */
 static bool FollowSegment(void) {
-  uint16_t currLine;
-  REF_LineKind currLineKind;
-
-  currLine = REF_GetLineValue();
-  currLineKind = REF_GetLineKind();
-  if (currLineKind==REF_LINE_STRAIGHT) {
-    PID_Line(currLine, REF_MIDDLE_LINE_VALUE); /* move along the line */
+  static uint32_t lastSeq = 0, lastTimestamp = 0;
+  uint32_t periodMs;
+  REF_Snapshot ref;
+
+  REF_GetSnapshot(&ref); /* line position and kind from the same sample */
+  if (ref.lineKind==REF_LINE_STRAIGHT || (ref.lineKind==REF_LINE_NONE && ref.lineHeld)) { /* on the line, or a short gap in it */
+    if (ref.seq!=lastSeq) { /* only run the controller on new samples */
+      periodMs = (ref.timestamp-lastTimestamp)*portTICK_PERIOD_MS; /* time between the samples */
+      if (periodMs==0 || periodMs>4*LF_TASK_PERIOD_MS) { /* first sample after a pause */
+        periodMs = LF_REF_PERIOD_MS;
+      }
+      lastSeq = ref.seq;
+      lastTimestamp = ref.timestamp;
+      PID_Line(ref.linePos, ref.lineVel, REF_MIDDLE_LINE_VALUE, (uint16_t)periodMs); /* move along the line */
+    }
     return TRUE;
   } else {
     return FALSE; /* intersection/change of direction or not on line any more */
@@ -85,7 +97,7 @@ static bool FollowSegment(void) {
 }
 
 static void StateMachine(void) {
-  REF_LineKind lineKind;
+  REF_Snapshot ref;
 
   switch (LF_currState) {
     case STATE_IDLE:
@@ -100,10 +112,10 @@ static void StateMachine(void) {
       break;
 
     case STATE_TURN:
-      lineKind = REF_GetLineKind();
-      if (lineKind==REF_LINE_FULL) {
+      REF_GetSnapshot(&ref);
+      if (ref.lineKind==REF_LINE_FULL) {
         LF_currState = STATE_FINISHED;
-      } if (lineKind==REF_LINE_NONE) {
+      } if (ref.lineKind==REF_LINE_NONE) {
         TURN_Turn(TURN_LEFT180, NULL);
         DRV_SetMode(DRV_MODE_NONE); /* disable position mode */
         LF_currState = STATE_FOLLOW_SEGMENT;
@@ -123,6 +135,7 @@ static void StateMachine(void) {
 #endif
       SHELL_SendString("Stopped!\r\n");
       TURN_Turn(TURN_STOP, NULL);
+      REF_Unsubscribe(LFTaskHandle);
       LF_currState = STATE_IDLE;
       break;
   } /* switch */
@@ -137,20 +150,22 @@ static void LineTask (void *pvParameters) {
 
   (void)pvParameters; /* not used */
   for(;;) {
-    (void)xTaskNotifyWait(0UL, LF_START_FOLLOWING|LF_STOP_FOLLOWING, &notifcationValue, 0); /* check flags */
+    if (xTaskNotifyWait(0UL, LF_START_FOLLOWING|LF_STOP_FOLLOWING|LF_NEW_REF_SAMPLE, &notifcationValue, LF_TASK_PERIOD_MS/portTICK_PERIOD_MS)!=pdTRUE) { /* wait for flags or new sample */
+      notifcationValue = 0; /* timeout */
+    }
     if (notifcationValue&LF_START_FOLLOWING) {
 #if 1
       RNETA_SendSignal('B'); /*! \todo */
 #endif
       DRV_SetMode(DRV_MODE_NONE); /* disable any drive mode */
       PID_Start();
+      (void)REF_Subscribe(LFTaskHandle, LF_NEW_REF_SAMPLE, LF_REF_PERIOD_MS); /* sample faster while following */
       LF_currState = STATE_FOLLOW_SEGMENT;
     }
     if (notifcationValue&LF_STOP_FOLLOWING) {
       LF_currState = STATE_STOP;
     }
     StateMachine();
-    FRTOS1_vTaskDelay(5/portTICK_PERIOD_MS);
   }
 }
 
@@ -22,13 +22,13 @@ static uint16_t SensorHistory[REF_NOF_SENSORS]; /* value of history while moving
 
 static void MAZE_SampleSensorHistory(void) {
   uint8_t i;
-  uint16_t val[REF_NOF_SENSORS];
+  REF_Snapshot ref;
 
-  REF_GetSensorValues(&val[0], REF_NOF_SENSORS);
+  REF_GetSnapshot(&ref);
   for(i=0; i<REF_NOF_SENSORS; i++) {
-    if (val[i]>=(MAZE_MIN_LINE_VAL)) { /* only count line values */
-      if (val[i]>SensorHistory[i]) {
-        SensorHistory[i] = val[i];
+    if (ref.calib[i]>=(MAZE_MIN_LINE_VAL)) { /* only count line values */
+      if (ref.calib[i]>SensorHistory[i]) {
+        SensorHistory[i] = ref.calib[i];
       }
     }
   }
@@ -49,7 +49,11 @@ static REF_LineKind MAZE_HistoryLineKind(void) {
   for(i=0;i<REF_NOF_SENSORS;i++) {
     if (SensorHistory[i]>MAZE_MIN_LINE_VAL) { /* count only line values */
       cnt++;
+#if REF_SENSOR1_IS_LEFT
       if (i<REF_NOF_SENSORS/2) {
+#else
+      if (i>=REF_NOF_SENSORS/2) {
+#endif
         cntLeft++;
       } else {
         cntRight++;
@@ -153,20 +157,21 @@ void MAZE_SimplifyPath(void) {
  * \return Returns TRUE while turn is still in progress.
  */
 uint8_t MAZE_EvaluteTurn(bool *finished) {
-  REF_LineKind historyLineKind, currLineKind;
+  REF_LineKind historyLineKind;
+  REF_Snapshot ref;
   TURN_Kind turn;
 
   *finished = FALSE;
-  currLineKind = REF_GetLineKind();
-  if (currLineKind==REF_LINE_NONE) { /* nothing, must be dead end */
+  REF_GetSnapshot(&ref);
+  if (ref.lineKind==REF_LINE_NONE) { /* nothing, must be dead end */
     turn = TURN_LEFT180;
   } else {
     MAZE_ClearSensorHistory(); /* clear history values */
     MAZE_SampleSensorHistory(); /* store current values */
     TURN_Turn(TURN_STEP_LINE_FW_POST_LINE, MAZE_SampleTurnStopFunction); /* do the line and beyond in one step */
     historyLineKind = MAZE_HistoryLineKind(); /* new read new values */
-    currLineKind = REF_GetLineKind();
-    turn = MAZE_SelectTurn(historyLineKind, currLineKind);
+    REF_GetSnapshot(&ref);
+    turn = MAZE_SelectTurn(historyLineKind, ref.lineKind);
   }
   if (turn==TURN_FINISHED) {
     *finished = TRUE;
@@ -0,0 +1,315 @@
+/**
+ * \file
+ * \brief Online motor model estimation.
+ *
+ * Model per wheel: v[k] = a*v[k-1] + b*u[k-1-d] + c*sign(u[k-1-d])
+ * with v the speed, u the PWM, d the dead time in samples and c for the deadband of the motor.
+ * The parameters are estimated with recursive least squares and a forgetting factor,
+ * so they follow changes of battery voltage, temperature or wear.
+ * All values are Q16 fixed point: the PWM is already Q16 (0xFFFF is full), the speed is scaled with 8192 steps/s as 1.0.
+ * From the model the speed PID is derived with the SIMC rule (PI, closed loop time constant equal to the dead time).
+ */
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_MOTOR_MODEL
+#include "MotorModel.h"
+#include "Motor.h"
+#include "Tacho.h"
+#include "Pid.h"
+#include "UTIL1.h"
+#include "CS1.h"
+#if PL_CONFIG_HAS_SHELL
+  #include "CLS1.h"
+#endif
+
+#define MMOD_NOF_PARAMS      3          /* a, b and c */
+#define MMOD_DELAY           5          /* dead time in samples between the PWM and the measured speed, 25 ms (Tools/motor_ident) */
+#define MMOD_SPEED_SCALE     8          /* speed to Q16: 8192 steps/s is 1.0 */
+#define MMOD_LAMBDA_Q16      65208      /* forgetting factor 0.995, about 200 samples memory */
+#define MMOD_INV_LAMBDA_Q16  65865      /* 1/lambda */
+#define MMOD_P_INIT_Q16      (100*65536) /* initial covariance, no knowledge about the parameters */
+#define MMOD_P_MAX_TRACE_Q16 (1000*65536) /* covariance limit, against windup without excitation */
+#define MMOD_MIN_SPEED       100        /* steps/s, no estimation around standstill */
+#define MMOD_ADAPT_SAMPLES   200        /* re-derive the speed PID every n estimation steps */
+
+typedef struct {
+  int32_t theta[MMOD_NOF_PARAMS]; /* a, b, c in Q16 */
+  int32_t P[MMOD_NOF_PARAMS][MMOD_NOF_PARAMS]; /* covariance in Q16 */
+  int32_t pwm[MMOD_DELAY+1]; /* history of the PWM applied, newest first */
+  int32_t lastSpeed; /* last speed in Q16 */
+  bool hasLastSpeed;
+  int32_t error; /* last prediction error, steps/s */
+  uint32_t nofUpdates; /* number of estimation steps */
+  uint16_t adaptCntr; /* estimation steps since the last PID adaption */
+  /* derived values, valid if isValid is TRUE */
+  bool isValid;
+  int32_t kQ16;    /* static gain, steps/s per PWM, Q16 */
+  int32_t tauMs;   /* time constant */
+  int32_t offset;  /* deadband in PWM */
+  int32_t pFactor100, iFactor100; /* speed PID factors from the model */
+} MMOD_Model;
+
+static MMOD_Model MMOD_Models[2]; /* left and right wheel */
+static bool MMOD_adapt = FALSE; /* if the speed PID gets re-derived from the model */
+
+static void MMOD_ResetModel(MMOD_Model *m) {
+  int i, j;
+
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    m->theta[i] = 0;
+    for(j=0; j<MMOD_NOF_PARAMS; j++) {
+      m->P[i][j] = i==j ? MMOD_P_INIT_Q16 : 0;
+    }
+  }
+  for(i=0; i<=MMOD_DELAY; i++) {
+    m->pwm[i] = 0;
+  }
+  m->lastSpeed = 0;
+  m->hasLastSpeed = FALSE;
+  m->error = 0;
+  m->nofUpdates = 0;
+  m->adaptCntr = 0;
+  m->isValid = FALSE;
+}
+
+/*!
+ * \brief Recursive least squares step with forgetting factor.
+ * \param m Model
+ * \param phi Regressor, Q16
+ * \param y Measured value, Q16
+ */
+static void MMOD_Rls(MMOD_Model *m, const int32_t phi[MMOD_NOF_PARAMS], int32_t y) {
+  int64_t pPhi[MMOD_NOF_PARAMS], den, acc, e, p;
+  int32_t k[MMOD_NOF_PARAMS];
+  bool forget;
+  int i, j;
+
+  /* P*phi and phi'*P*phi */
+  den = MMOD_LAMBDA_Q16;
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    acc = 0;
+    for(j=0; j<MMOD_NOF_PARAMS; j++) {
+      acc += (int64_t)m->P[i][j]*phi[j];
+    }
+    pPhi[i] = acc>>16;
+    den += (pPhi[i]*phi[i])>>16;
+  }
+  /* gain and prediction error */
+  acc = 0;
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    k[i] = (int32_t)((pPhi[i]<<16)/den);
+    acc += (int64_t)m->theta[i]*phi[i];
+  }
+  e = y-(acc>>16);
+  m->error = (int32_t)(e/MMOD_SPEED_SCALE);
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    m->theta[i] += (int32_t)(((int64_t)k[i]*e)>>16);
+  }
+  /* covariance update, only forget if the covariance is not too large already */
+  acc = 0;
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    acc += m->P[i][i];
+  }
+  forget = acc<MMOD_P_MAX_TRACE_Q16;
+  for(i=0; i<MMOD_NOF_PARAMS; i++) {
+    for(j=i; j<MMOD_NOF_PARAMS; j++) { /* symmetric: calculate upper half only */
+      p = m->P[i][j]-(((int64_t)k[i]*pPhi[j])>>16);
+      if (forget) {
+        p = (p*MMOD_INV_LAMBDA_Q16)>>16;
+      }
+      m->P[i][j] = m->P[j][i] = (int32_t)p;
+    }
+  }
+  m->nofUpdates++;
+}
+
+/*!
+ * \brief Derives the continuous model and the speed PID from the estimated parameters.
+ * \param m Model
+ * \param periodMs Sample period
+ */
+static void MMOD_Derive(MMOD_Model *m, uint16_t periodMs) {
+  int32_t a = m->theta[0], b = m->theta[1], c = m->theta[2];
+  int32_t thetaMs, tiMs;
+
+  m->isValid = FALSE;
+  if (a<=0 || a>=65536-16 || b<=0) { /* not stable or not identified yet */
+    return;
+  }
+  m->kQ16 = (int32_t)((((int64_t)b<<16)/(65536-a))/MMOD_SPEED_SCALE);
+  m->tauMs = (int32_t)(((int64_t)periodMs*a)/(65536-a));
+  m->offset = (int32_t)(-((int64_t)c<<16)/b);
+  if (m->kQ16<=0 || m->tauMs<=0) {
+    return;
+  }
+  /* dead time: delay of the PWM, the sample, and half a period for the sampled controller */
+  thetaMs = ((2*MMOD_DELAY+3)*periodMs)/2;
+  m->pFactor100 = (int32_t)((100LL*m->tauMs*65536)/((int64_t)m->kQ16*2*thetaMs));
+  tiMs = m->tauMs<8*thetaMs ? m->tauMs : 8*thetaMs;
+  m->iFactor100 = (m->pFactor100*PID_REF_PERIOD_MS)/tiMs;
+  m->isValid = TRUE;
+}
+
+static void MMOD_Adapt(MMOD_Model *m, PID_ConfigType type) {
+  PID_Config *config;
+  CS1_CriticalVariable()
+
+  if (!m->isValid || PID_GetPIDConfig(type, &config)!=ERR_OK) {
+    return;
+  }
+  CS1_EnterCritical(); /* the control loop might run in the timer interrupt: change all factors at once */
+  config->pFactor100 = m->pFactor100;
+  config->iFactor100 = m->iFactor100;
+  config->dFactor100 = 0;
+  if (config->ffGain100!=0) { /* feedforward is used: follow the gain of the model. The offset estimate is too noisy for it */
+    config->ffGain100 = (int32_t)((100LL*65536)/m->kQ16);
+  }
+  config->gains.periodUs = 0; /* recalculate gains with the new values */
+  CS1_ExitCritical();
+}
+
+static void MMOD_UpdateWheel(MMOD_Model *m, MOT_MotorDevice *motor, int32_t speed, uint16_t periodMs) {
+  int32_t phi[MMOD_NOF_PARAMS], y, u;
+  int i;
+
+  /* PWM applied since the last sample */
+  u = 0xFFFF-MOT_GetVal(motor);
+  if (MOT_GetDirection(motor)==MOT_DIR_BACKWARD) {
+    u = -u;
+  }
+  for(i=MMOD_DELAY; i>0; i--) {
+    m->pwm[i] = m->pwm[i-1];
+  }
+  m->pwm[0] = u;
+  y = speed*MMOD_SPEED_SCALE;
+  if (m->hasLastSpeed
+      && (speed>=MMOD_MIN_SPEED || speed<=-MMOD_MIN_SPEED)
+      && (m->lastSpeed>=MMOD_MIN_SPEED*MMOD_SPEED_SCALE || m->lastSpeed<=-MMOD_MIN_SPEED*MMOD_SPEED_SCALE))
+  {
+    u = m->pwm[MMOD_DELAY];
+    phi[0] = m->lastSpeed;
+    phi[1] = u;
+    phi[2] = u>0 ? 65536 : (u<0 ? -65536 : 0);
+    MMOD_Rls(m, phi, y);
+    m->adaptCntr++;
+  }
+  m->lastSpeed = y;
+  m->hasLastSpeed = TRUE;
+  if (m->adaptCntr>=MMOD_ADAPT_SAMPLES) {
+    m->adaptCntr = 0;
+    MMOD_Derive(m, periodMs);
+    if (MMOD_adapt) {
+      MMOD_Adapt(m, m==&MMOD_Models[0] ? PID_CONFIG_SPEED_LEFT : PID_CONFIG_SPEED_RIGHT);
+    }
+  }
+}
+
+void MMOD_Update(uint16_t periodMs) {
+  MMOD_UpdateWheel(&MMOD_Models[0], MOT_GetMotorHandle(MOT_MOTOR_LEFT), TACHO_GetSpeed(TRUE), periodMs);
+  MMOD_UpdateWheel(&MMOD_Models[1], MOT_GetMotorHandle(MOT_MOTOR_RIGHT), TACHO_GetSpeed(FALSE), periodMs);
+}
+
+void MMOD_Reset(void) {
+  MMOD_ResetModel(&MMOD_Models[0]);
+  MMOD_ResetModel(&MMOD_Models[1]);
+}
+
+#if PL_CONFIG_HAS_SHELL
+static void MMOD_PrintHelp(const CLS1_StdIOType *io) {
+  CLS1_SendHelpStr((unsigned char*)"model", (unsigned char*)"Group of motor model commands\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  help|status", (unsigned char*)"Shows motor model help or status\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  reset", (unsigned char*)"Restarts the estimation\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  adapt (on|off)", (unsigned char*)"Re-derive the speed PID from the model\r\n", io->stdOut);
+}
+
+static void MMOD_PrintModel(const MMOD_Model *m, const unsigned char *side, const CLS1_StdIOType *io) {
+  unsigned char buf[48];
+  unsigned char kindBuf[16];
+
+  UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  ");
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), side);
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), (unsigned char*)" a/b/c");
+  UTIL1_Num32sToStr(buf, sizeof(buf), m->theta[0]);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), m->theta[1]);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), m->theta[2]);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" (Q16)\r\n");
+  CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+
+  UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  ");
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), side);
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), (unsigned char*)" steps");
+  UTIL1_Num32uToStr(buf, sizeof(buf), m->nofUpdates);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)", error ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), m->error);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/s\r\n");
+  CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+
+  UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  ");
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), side);
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), (unsigned char*)" model");
+  if (m->isValid) {
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"K*10000 ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), (int32_t)(((int64_t)m->kQ16*10000)>>16));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" tau ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), m->tauMs);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms offset ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), m->offset);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  } else {
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"not identified\r\n");
+  }
+  CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+
+  if (m->isValid) {
+    UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  ");
+    UTIL1_strcat(kindBuf, sizeof(kindBuf), side);
+    UTIL1_strcat(kindBuf, sizeof(kindBuf), (unsigned char*)" PID");
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"p: ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), m->pFactor100);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" i: ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), m->iFactor100);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+    CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+  }
+}
+
+static void MMOD_PrintStatus(const CLS1_StdIOType *io) {
+  CLS1_SendStatusStr((unsigned char*)"model", (unsigned char*)"\r\n", io->stdOut);
+  CLS1_SendStatusStr((unsigned char*)"  adapt", MMOD_adapt?(unsigned char*)"on\r\n":(unsigned char*)"off\r\n", io->stdOut);
+  MMOD_PrintModel(&MMOD_Models[0], (unsigned char*)"L", io);
+  MMOD_PrintModel(&MMOD_Models[1], (unsigned char*)"R", io);
+}
+
+uint8_t MMOD_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_HELP)==0 || UTIL1_strcmp((char*)cmd, (char*)"model help")==0) {
+    MMOD_PrintHelp(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_STATUS)==0 || UTIL1_strcmp((char*)cmd, (char*)"model status")==0) {
+    MMOD_PrintStatus(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"model reset")==0) {
+    MMOD_Reset();
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"model adapt on")==0) {
+    MMOD_adapt = TRUE;
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"model adapt off")==0) {
+    MMOD_adapt = FALSE;
+    *handled = TRUE;
+  }
+  return ERR_OK;
+}
+#endif /* PL_CONFIG_HAS_SHELL */
+
+void MMOD_Deinit(void) {
+  /* nothing needed */
+}
+
+void MMOD_Init(void) {
+  MMOD_adapt = FALSE;
+  MMOD_Reset();
+}
+
+#endif /* PL_CONFIG_HAS_MOTOR_MODEL */
@@ -0,0 +1,45 @@
+/**
+ * \file
+ * \brief Online motor model estimation.
+ *
+ * Identifies per wheel a discrete first order model of the motor from the PWM and the
+ * measured speed with recursive least squares, and can re-derive the speed PID from it.
+ */
+
+#ifndef MOTORMODEL_H_
+#define MOTORMODEL_H_
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_MOTOR_MODEL
+
+#if PL_CONFIG_HAS_SHELL
+#include "CLS1.h"
+/*!
+ * \brief Shell command line parser.
+ * \param[in] cmd Pointer to command string
+ * \param[out] handled If command is handled by the parser
+ * \param[in] io Std I/O handler of shell
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t MMOD_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io);
+#endif
+
+/*!
+ * \brief Runs one estimation step for both wheels. Called from the drive task each period,
+ * after the speed has been calculated and before the motors get new values.
+ * \param periodMs Sample period in milliseconds
+ */
+void MMOD_Update(uint16_t periodMs);
+
+/*! \brief Resets the estimation of both wheels */
+void MMOD_Reset(void);
+
+/*! \brief Driver initialization */
+void MMOD_Init(void);
+
+/*! \brief Driver de-initialization */
+void MMOD_Deinit(void);
+
+#endif /* PL_CONFIG_HAS_MOTOR_MODEL */
+
+#endif /* MOTORMODEL_H_ */
@@ -35,9 +35,13 @@
   /*!< erased word in flash */
 
 #define NVMC_REFLECTANCE_DATA_START_ADDR  (NVMC_FLASH_START_ADDR)
-#define NVMC_REFLECTANCE_DATA_SIZE        (6*2*2) /* maximum of 6 sensors (min and max) values with 16 bits */
+#define NVMC_REFLECTANCE_DATA_SIZE        (8*2*2) /* maximum of 8 sensors (min and max) values with 16 bits */
 #define NVMC_REFLECTANCE_END_ADDR         (NVMC_REFLECTANCE_DATA_START_ADDR+NVMC_REFLECTANCE_DATA_SIZE)
 
+#define NVMC_PID_DATA_START_ADDR          (NVMC_REFLECTANCE_END_ADDR)
+#define NVMC_PID_DATA_SIZE                (128) /* PID factors and line schedule */
+#define NVMC_PID_END_ADDR                 (NVMC_PID_DATA_START_ADDR+NVMC_PID_DATA_SIZE)
+
 /*!
  * \brief Saves the reflectance calibration data
  * \param data Pointer to the data
@@ -52,6 +56,20 @@ uint8_t NVMC_SaveReflectanceData(void *data, uint16_t dataSize);
  */
 void *NVMC_GetReflectanceData(void);
 
+/*!
+ * \brief Saves the PID configuration data
+ * \param data Pointer to the data
+ * \param dataSize Size of data in bytes
+ * \return Error code, ERR_OK if everything is fine
+ */
+uint8_t NVMC_SavePidData(void *data, uint16_t dataSize);
+
+/*!
+ * \brief Returns the PID configuration data
+ * \return Pointer to data, or NULL for failure
+ */
+void *NVMC_GetPidData(void);
+
 /*! \brief Driver initialization  */
 void NVMC_Init(void);
 
@@ -0,0 +1,272 @@
+/**
+ * \file
+ * \brief Odometry of the differential drive.
+ *
+ * Each sample, the steps of both wheels since the last sample give the way of the robot (mean of both)
+ * and the change of the heading (difference divided by the track width). The way is split into x and y
+ * with the heading in the middle of the sample, which is exact enough for arcs at 1 ms. Everything
+ * is fixed point, with a sine table, so it does not take long in the interrupt.
+ */
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_ODOMETRY
+#include "Odometry.h"
+#include "Q4CLeft.h"
+#include "Q4CRight.h"
+#include "CS1.h"
+#include "UTIL1.h"
+#include "SeqLock.h"
+#if PL_CONFIG_HAS_SHELL
+  #include "CLS1.h"
+#endif
+
+#define ODO_STEPS_PER_REV       1000   /* encoder steps per wheel revolution */
+#define ODO_DEFAULT_RADIUS_UM   19250  /* wheel radius in micrometers */
+#define ODO_DEFAULT_TRACK_UM    110900 /* effective track width in micrometers: 720 steps per wheel turn by 90 degrees, as in Turn.c */
+#define ODO_MAX_STEPS           100    /* more steps in one sample: the encoder position has been set, not moved */
+#define ODO_MAX_RADIUS_UM       50000  /* limits of the geometry, */
+#define ODO_MIN_TRACK_UM        50000  /* so the heading change of a sample fits into 64bit */
+#define ODO_2PI_Q24             105414357LL /* 2*pi in Q24 */
+
+static int32_t ODO_radiusUm, ODO_trackUm; /* geometry */
+static int64_t ODO_umPerStepQ16;    /* way of a wheel per step, micrometers in Q16 */
+static int64_t ODO_thetaPerStepQ32; /* heading change per step difference of the wheels, binary angle in Q32 */
+
+typedef struct {
+  int32_t posL, posR; /* encoder positions of the last sample */
+  int64_t x, y;       /* micrometers in Q16 */
+  uint64_t theta;     /* binary angle in Q32 */
+  uint32_t seq;       /* number of samples */
+} ODO_State;
+
+static ODO_State ODO_state; /* only changed by ODO_Sample(), or with interrupts disabled */
+
+/* Poses are double buffered (SeqLock.h): ODO_Sample() is the writer, readers never wait for it. */
+static ODO_Pose ODO_poseBuf[2];
+static SEQ_Lock ODO_poseLock;
+
+/* first quarter of the sine, 256 segments, Q15 */
+static const uint16_t ODO_SinTable[257] = {
+      0,   201,   402,   603,   804,  1005,  1206,  1407,  1608,  1809,  2009,  2210,
+   2411,  2611,  2811,  3012,  3212,  3412,  3612,  3812,  4011,  4211,  4410,  4609,
+   4808,  5007,  5205,  5404,  5602,  5800,  5998,  6195,  6393,  6590,  6787,  6983,
+   7180,  7376,  7571,  7767,  7962,  8157,  8351,  8546,  8740,  8933,  9127,  9319,
+   9512,  9704,  9896, 10088, 10279, 10469, 10660, 10850, 11039, 11228, 11417, 11605,
+  11793, 11980, 12167, 12354, 12540, 12725, 12910, 13095, 13279, 13463, 13646, 13828,
+  14010, 14192, 14373, 14553, 14733, 14912, 15091, 15269, 15447, 15624, 15800, 15976,
+  16151, 16326, 16500, 16673, 16846, 17018, 17190, 17361, 17531, 17700, 17869, 18037,
+  18205, 18372, 18538, 18703, 18868, 19032, 19195, 19358, 19520, 19681, 19841, 20001,
+  20160, 20318, 20475, 20632, 20788, 20943, 21097, 21251, 21403, 21555, 21706, 21856,
+  22006, 22154, 22302, 22449, 22595, 22740, 22884, 23028, 23170, 23312, 23453, 23593,
+  23732, 23870, 24008, 24144, 24279, 24414, 24548, 24680, 24812, 24943, 25073, 25202,
+  25330, 25457, 25583, 25708, 25833, 25956, 26078, 26199, 26320, 26439, 26557, 26674,
+  26791, 26906, 27020, 27133, 27246, 27357, 27467, 27576, 27684, 27791, 27897, 28002,
+  28106, 28209, 28311, 28411, 28511, 28610, 28707, 28803, 28899, 28993, 29086, 29178,
+  29269, 29359, 29448, 29535, 29622, 29707, 29792, 29875, 29957, 30038, 30118, 30196,
+  30274, 30350, 30425, 30499, 30572, 30644, 30715, 30784, 30853, 30920, 30986, 31050,
+  31114, 31177, 31238, 31298, 31357, 31415, 31471, 31527, 31581, 31634, 31686, 31737,
+  31786, 31834, 31881, 31927, 31972, 32015, 32058, 32099, 32138, 32177, 32214, 32251,
+  32286, 32319, 32352, 32383, 32413, 32442, 32470, 32496, 32522, 32546, 32568, 32590,
+  32610, 32629, 32647, 32664, 32679, 32693, 32706, 32718, 32729, 32738, 32746, 32753,
+  32758, 32762, 32766, 32767, 32768
+};
+
+/*!
+ * \brief Sine with linear interpolation in the table.
+ * \param angle Binary angle, 2^32 is a full turn
+ * \return Sine in Q15
+ */
+static int32_t ODO_Sin(uint32_t angle) {
+  uint32_t pos, idx, frac;
+  int32_t val;
+
+  pos = angle&0x3FFFFFFF; /* angle in the quadrant */
+  if (angle&0x40000000) { /* second and fourth quadrant: mirrored */
+    pos = 0x40000000-pos;
+  }
+  idx = pos>>22;
+  frac = (pos>>6)&0xFFFF;
+  val = ODO_SinTable[idx];
+  if (frac!=0) {
+    val += ((int32_t)(ODO_SinTable[idx+1]-val)*(int32_t)frac)>>16;
+  }
+  if (angle&0x80000000) { /* third and fourth quadrant: negative */
+    val = -val;
+  }
+  return val;
+}
+
+static int32_t ODO_Cos(uint32_t angle) {
+  return ODO_Sin(angle+ODO_THETA_90_DEG);
+}
+
+static void ODO_Publish(const ODO_State *state) {
+  ODO_Pose *pose;
+
+  pose = &ODO_poseBuf[SEQ_WriteIndex(&ODO_poseLock)]; /* buffer not used by readers */
+  pose->x = (int32_t)(state->x>>16);
+  pose->y = (int32_t)(state->y>>16);
+  pose->theta = (uint32_t)(state->theta>>32);
+  pose->seq = state->seq;
+  SEQ_Publish(&ODO_poseLock);
+}
+
+void ODO_GetPose(ODO_Pose *pose) {
+  (void)SEQ_Read(&ODO_poseLock, pose, ODO_poseBuf, sizeof(*pose));
+}
+
+void ODO_Sample(void) {
+  ODO_State *s = &ODO_state;
+  int32_t posL, posR, dL, dR;
+  int64_t ds, dTheta;
+  uint32_t mid;
+
+  posL = (int32_t)Q4CLeft_GetPos();
+  posR = (int32_t)Q4CRight_GetPos();
+  dL = posL-s->posL;
+  dR = posR-s->posR;
+  s->posL = posL;
+  s->posR = posR;
+  if (dL>ODO_MAX_STEPS || dL<-ODO_MAX_STEPS || dR>ODO_MAX_STEPS || dR<-ODO_MAX_STEPS) {
+    dL = dR = 0; /* position has been set, e.g. with 'drive pos reset' */
+  }
+  if (dL!=0 || dR!=0) {
+    dTheta = (int64_t)(dR-dL)*ODO_thetaPerStepQ32;
+    mid = (uint32_t)((s->theta+(uint64_t)(dTheta/2))>>32); /* heading in the middle of the way */
+    ds = ((int64_t)(dL+dR)*ODO_umPerStepQ16)/2;
+    s->x += (ds*ODO_Cos(mid))>>15;
+    s->y += (ds*ODO_Sin(mid))>>15;
+    s->theta += (uint64_t)dTheta;
+  }
+  s->seq++;
+  ODO_Publish(s);
+}
+
+int32_t ODO_HeadingToSteps(int64_t theta) {
+  /* in place both wheels turn, so theta = 2*steps*thetaPerStep */
+  return (int32_t)((theta*65536)/(ODO_thetaPerStepQ32>>15));
+}
+
+void ODO_Reset(void) {
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* ODO_Sample() runs in an interrupt */
+  ODO_state.posL = (int32_t)Q4CLeft_GetPos();
+  ODO_state.posR = (int32_t)Q4CRight_GetPos();
+  ODO_state.x = ODO_state.y = 0;
+  ODO_state.theta = 0;
+  ODO_state.seq++;
+  ODO_Publish(&ODO_state);
+  CS1_ExitCritical();
+}
+
+/*!
+ * \brief Sets the geometry of the robot.
+ * \param radiusUm Wheel radius in micrometers
+ * \param trackUm Distance between the wheels in micrometers
+ */
+static void ODO_SetGeometry(int32_t radiusUm, int32_t trackUm) {
+  int64_t umPerStep, thetaPerStep;
+  CS1_CriticalVariable()
+
+  umPerStep = ((int64_t)radiusUm*ODO_2PI_Q24)/(ODO_STEPS_PER_REV<<8);
+  /* 2*pi*r/steps/track radians, with 2^64 for a full turn: r/(steps*track)*2^64 */
+  thetaPerStep = (int64_t)((((uint64_t)radiusUm<<40)/((uint64_t)ODO_STEPS_PER_REV*trackUm))<<24);
+  CS1_EnterCritical(); /* 64bit values used by ODO_Sample() */
+  ODO_radiusUm = radiusUm;
+  ODO_trackUm = trackUm;
+  ODO_umPerStepQ16 = umPerStep;
+  ODO_thetaPerStepQ32 = thetaPerStep;
+  CS1_ExitCritical();
+}
+
+#if PL_CONFIG_HAS_SHELL
+static void ODO_PrintHelp(const CLS1_StdIOType *io) {
+  CLS1_SendHelpStr((unsigned char*)"odo", (unsigned char*)"Group of odometry commands\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  help|status", (unsigned char*)"Print help or status information\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  reset", (unsigned char*)"Set the pose to zero at the current place\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  radius <um>", (unsigned char*)"Wheel radius in micrometers\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  track <um>", (unsigned char*)"Track width (distance between the wheels) in micrometers\r\n", io->stdOut);
+}
+
+static void ODO_PrintStatus(const CLS1_StdIOType *io) {
+  unsigned char buf[48];
+  ODO_Pose pose;
+
+  ODO_GetPose(&pose);
+  CLS1_SendStatusStr((unsigned char*)"odo", (unsigned char*)"\r\n", io->stdOut);
+
+  buf[0] = '\0';
+  UTIL1_strcatNum32sDotValue100(buf, sizeof(buf), pose.x/10);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" mm\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  x", buf, io->stdOut);
+  buf[0] = '\0';
+  UTIL1_strcatNum32sDotValue100(buf, sizeof(buf), pose.y/10);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" mm\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  y", buf, io->stdOut);
+  buf[0] = '\0';
+  UTIL1_strcatNum32sDotValue100(buf, sizeof(buf), ODO_THETA_TO_CENTIDEG(pose.theta));
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" deg\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  heading", buf, io->stdOut);
+
+  UTIL1_Num32sToStr(buf, sizeof(buf), ODO_radiusUm);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" um, ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), ODO_STEPS_PER_REV);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/rev\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  radius", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), ODO_trackUm);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" um\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  track", buf, io->stdOut);
+  UTIL1_Num32uToStr(buf, sizeof(buf), pose.seq);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  samples", buf, io->stdOut);
+}
+
+uint8_t ODO_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  uint8_t res = ERR_OK;
+  const unsigned char *p;
+  int32_t val;
+
+  if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_HELP)==0 || UTIL1_strcmp((char*)cmd, (char*)"odo help")==0) {
+    ODO_PrintHelp(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_STATUS)==0 || UTIL1_strcmp((char*)cmd, (char*)"odo status")==0) {
+    ODO_PrintStatus(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"odo reset")==0) {
+    ODO_Reset();
+    *handled = TRUE;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"odo radius ", sizeof("odo radius ")-1)==0) {
+    p = cmd+sizeof("odo radius ")-1;
+    if (UTIL1_xatoi(&p, &val)==ERR_OK && val>0 && val<=ODO_MAX_RADIUS_UM) {
+      ODO_SetGeometry(val, ODO_trackUm);
+    } else {
+      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
+      res = ERR_FAILED;
+    }
+    *handled = TRUE;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"odo track ", sizeof("odo track ")-1)==0) {
+    p = cmd+sizeof("odo track ")-1;
+    if (UTIL1_xatoi(&p, &val)==ERR_OK && val>=ODO_MIN_TRACK_UM) {
+      ODO_SetGeometry(ODO_radiusUm, val);
+    } else {
+      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
+      res = ERR_FAILED;
+    }
+    *handled = TRUE;
+  }
+  return res;
+}
+#endif /* PL_CONFIG_HAS_SHELL */
+
+void ODO_Deinit(void) {
+  /* nothing needed */
+}
+
+void ODO_Init(void) {
+  ODO_SetGeometry(ODO_DEFAULT_RADIUS_UM, ODO_DEFAULT_TRACK_UM);
+  ODO_state.seq = 0;
+  ODO_Reset();
+}
+
+#endif /* PL_CONFIG_HAS_ODOMETRY */
@@ -0,0 +1,73 @@
+/**
+ * \file
+ * \brief Odometry of the differential drive.
+ *
+ * Integrates the steps of both wheel encoders into the position and heading of the robot.
+ * The pose is relative to where it has been reset: x points forward, y to the left,
+ * and the heading is counter clockwise.
+ */
+
+#ifndef ODOMETRY_H_
+#define ODOMETRY_H_
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_ODOMETRY
+
+#if PL_CONFIG_HAS_SHELL
+#include "CLS1.h"
+/*!
+ * \brief Shell command line parser.
+ * \param[in] cmd Pointer to command string
+ * \param[out] handled If command is handled by the parser
+ * \param[in] io Std I/O handler of shell
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t ODO_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io);
+#endif
+
+#define ODO_THETA_90_DEG   ((uint32_t)0x40000000) /*!< heading of a quarter turn */
+
+/*! \brief Converts a heading (or a difference of two) into 1/100 degrees, -18000..17999 */
+#define ODO_THETA_TO_CENTIDEG(theta)  ((int32_t)(((int64_t)(int32_t)(theta)*36000)>>32))
+
+/*! \brief Pose of the robot */
+typedef struct {
+  int32_t x;      /*!< position in micrometers */
+  int32_t y;      /*!< position in micrometers */
+  uint32_t theta; /*!< heading as binary angle: 2^32 is a full turn, so differences wrap around correctly */
+  uint32_t seq;   /*!< number of samples since the start, to detect new ones */
+} ODO_Pose;
+
+/*!
+ * \brief Returns the latest pose. Can be called from any task, never waits for the sampling.
+ * \param pose Where to store the pose
+ */
+void ODO_GetPose(ODO_Pose *pose);
+
+/*!
+ * \brief Converts a heading change into the steps each wheel has to turn for it, turning in place.
+ * \param theta Heading change as binary angle, can be more than a full turn
+ * \return Steps of the right wheel, the left wheel turns the same backwards. Positive for counter clockwise
+ */
+int32_t ODO_HeadingToSteps(int64_t theta);
+
+/*!
+ * \brief Sets the pose back to zero at the current place.
+ */
+void ODO_Reset(void);
+
+/*!
+ * \brief Sampling routine to integrate the encoder steps, must be called periodically.
+ * Is called together with TACHO_Sample().
+ */
+void ODO_Sample(void);
+
+/*! \brief Driver initialization */
+void ODO_Init(void);
+
+/*! \brief Driver de-initialization */
+void ODO_Deinit(void);
+
+#endif /* PL_CONFIG_HAS_ODOMETRY */
+
+#endif /* ODOMETRY_H_ */
@@ -9,15 +9,68 @@
 #include "Pid.h"
 #include "Motor.h"
 #include "UTIL1.h"
+#include "CS1.h"
+#include <string.h> /* memcpy() */
 #if PL_CONFIG_HAS_SHELL
   #include "CLS1.h"
 #endif
 #include "Reflectance.h"
+#include "Cpu.h" /* DWT_CYCCNT */
+#if PL_CONFIG_HAS_MOTOR_TACHO
+  #include "Tacho.h"
+#endif
+#if PL_CONFIG_HAS_CONFIG_NVM
+  #include "NVM_Config.h"
+#endif
+#if PL_CONFIG_HAS_PID_TUNE
+  #include "PidTune.h"
+#endif
+
+#define PID_SPEED_USE_IDENT  (1) /* 1: speed PID factors from PidSpeedTuning.h, generated by Tools/motor_ident */
+#define PID_MEASURE_CYCLES   (1) /* 1: cycles of PID_Run() in the speed loop with the DWT cycle counter, for 'pid status'. The counter is enabled by Quad.c */
+#if PID_SPEED_USE_IDENT
+  #include "PidSpeedTuning.h"
+#endif
 
 /*! \todo Add your own additional configurations as needed */
 static PID_Config lineFwConfig;
 static PID_Config speedLeftConfig, speedRightConfig;
 static PID_Config posLeftConfig, posRightConfig;
+#if PID_MEASURE_CYCLES
+static uint32_t pidRunCycles, pidRunCyclesMax; /* last and longest PID_Run() of the speed loop */
+#endif
+
+#define PID_LINE_SCHED_NOF_POINTS  5    /* line schedule points, equally spaced over the line error from 0 to 100% */
+#define PID_LINE_VGAIN_NOF_POINTS  3    /* speed gain points, equally spaced over the wheel speed from 0 to PID_LINE_VGAIN_MAX_SPEED */
+#define PID_LINE_VGAIN_MAX_SPEED   4000 /* steps per second */
+
+typedef struct {
+  uint8_t speedPercent;   /* base speed in % of the maximum speed */
+  uint8_t gainPercent;    /* scale of the PID output in % */
+  int8_t innerMinPercent; /* lowest inner wheel speed in % of the base speed, negative to turn on the spot */
+} PID_LineSchedPoint;
+
+static PID_LineSchedPoint lineSched[PID_LINE_SCHED_NOF_POINTS]; /* line following gain schedule */
+static uint8_t lineSpeedGain[PID_LINE_VGAIN_NOF_POINTS]; /* line PID gain in % over the measured speed */
+
+#if PL_CONFIG_HAS_CONFIG_NVM
+typedef struct {
+  int32_t pFactor100;
+  int32_t iFactor100;
+  int32_t dFactor100;
+  int32_t iAntiWindup;
+  int32_t ffGain100;
+  int32_t ffOffset;
+  int32_t ffAccel100;
+} PID_NVMFactors;
+
+typedef struct {
+  uint32_t size; /* size of the structure, to detect a changed layout */
+  PID_NVMFactors speedLeft, speedRight;
+  PID_LineSchedPoint lineSched[PID_LINE_SCHED_NOF_POINTS];
+  uint8_t lineSpeedGain[PID_LINE_VGAIN_NOF_POINTS];
+} PID_NVMData;
+#endif
 
 uint8_t PID_GetPIDConfig(PID_ConfigType config, PID_Config **confP) {
   switch(config) {
@@ -42,31 +95,268 @@ uint8_t PID_GetPIDConfig(PID_ConfigType config, PID_Config **confP) {
   return ERR_OK;
 }
 
-static int32_t PID(int32_t currVal, int32_t setVal, PID_Config *config) {
-  int32_t error;
-  int32_t pid;
-  
-  /* perform PID closed control loop calculation */
-  error = setVal-currVal; /* calculate error */
-  pid = (error*config->pFactor100)/100; /* P part */
-  config->integral += error; /* integrate error */
-  if (config->integral>config->iAntiWindup) {
-    config->integral = config->iAntiWindup;
-  } else if (config->integral<-config->iAntiWindup) {
-    config->integral = -config->iAntiWindup;
-  }
-  pid += (config->integral*config->iFactor100)/100; /* add I part */
-  pid += ((error-config->lastError)*config->dFactor100)/100; /* add D part */
-  config->lastError = error; /* remember for next iteration of D part */
-  return pid;
-}
-
-static void PID_SpeedCfg(int32_t currSpeed, int32_t setSpeed, bool isLeft, PID_Config *config) {
+#define PID_BACK_CALC_SHIFT  1 /* feed back 1/2^n of the output saturation into the integral per sample */
+#define PID_INTEGRAL_MAX     (4*0xFFFF*256) /* limit of the integral, output units in Q8 */
+#define PID_RATE_SCALE_Q16   ((PID_REF_PERIOD_MS*65536)/1000) /* rate per second to change per reference period */
+#define PID_REF_PERIOD_US    (PID_REF_PERIOD_MS*1000)
+#define PID_GAIN_MAX         ((1L<<23)-1) /* limit of the Q16 gains, for PID_MulQ16() */
+#define PID_KI_MAX           ((1L<<19)-1) /* limit of the Q16 integral gain, for the Q8 product in PID_Run() */
+#define PID_BACK_CALC_MAX    (PID_INTEGRAL_MAX>>(8-PID_BACK_CALC_SHIFT)) /* saturation excess which unwinds the whole integral */
+#define PID_PERCENT_Q8_MAX   (INT32_MAX/10486) /* limit of the percentage of PercentQ8(), about 800% */
+
+/* Cortex-M4 DSP instructions for the products and sums of PID_Run(), so it needs no 64 bit arithmetic. Portable C on the host */
+/*!
+ * \brief Upper word of the 64 bit product, (a*b)>>32 (SMMUL).
+ */
+static inline int32_t PID_MulHi(int32_t a, int32_t b) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t res;
+
+  __asm("smmul %0, %1, %2" : "=r" (res) : "r" (a), "r" (b));
+  return res;
+#else
+  return (int32_t)(((int64_t)a*b)>>32);
+#endif
+}
+
+/*!
+ * \brief Sum saturated to 32 bits (QADD).
+ */
+static inline int32_t PID_QAdd(int32_t a, int32_t b) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t res;
+
+  __asm("qadd %0, %1, %2" : "=r" (res) : "r" (a), "r" (b));
+  return res;
+#else
+  int64_t res = (int64_t)a+b;
+
+  return res>INT32_MAX ? INT32_MAX : (res<INT32_MIN ? INT32_MIN : (int32_t)res);
+#endif
+}
+
+/*!
+ * \brief Difference saturated to 32 bits (QSUB).
+ */
+static inline int32_t PID_QSub(int32_t a, int32_t b) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t res;
+
+  __asm("qsub %0, %1, %2" : "=r" (res) : "r" (a), "r" (b));
+  return res;
+#else
+  int64_t res = (int64_t)a-b;
+
+  return res>INT32_MAX ? INT32_MAX : (res<INT32_MIN ? INT32_MIN : (int32_t)res);
+#endif
+}
+
+/*!
+ * \brief Value saturated to 24 bits (SSAT).
+ */
+static inline int32_t PID_Sat24(int32_t x) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t res;
+
+  __asm("ssat %0, #24, %1" : "=r" (res) : "r" (x));
+  return res;
+#else
+  return x>0x7FFFFF ? 0x7FFFFF : (x<-0x800000 ? -0x800000 : x);
+#endif
+}
+
+/*!
+ * \brief Value saturated to 20 bits (SSAT).
+ */
+static inline int32_t PID_Sat20(int32_t x) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  int32_t res;
+
+  __asm("ssat %0, #20, %1" : "=r" (res) : "r" (x));
+  return res;
+#else
+  return x>0x7FFFF ? 0x7FFFF : (x<-0x80000 ? -0x80000 : x);
+#endif
+}
+
+/*!
+ * \brief Q16 product (x*kQ16)>>16, with x saturated to 24 bits. The gain has to be within +/-PID_GAIN_MAX.
+ */
+static inline int32_t PID_MulQ16(int32_t x, int32_t kQ16) {
+  return PID_MulHi((int32_t)((uint32_t)PID_Sat24(x)<<8), (int32_t)((uint32_t)kQ16<<8));
+}
+
+/*! \brief Limits a gain to +/-max. */
+static int32_t PID_LimitGain(int64_t gain, int32_t max) {
+  if (gain>max) {
+    return max;
+  } else if (gain<-max) {
+    return -max;
+  }
+  return (int32_t)gain;
+}
+
+/*!
+ * \brief Calculates the fixed point gains for the sample period, so the loop does not need any divisions.
+ * The gains are limited to the range of the 32 bit products in PID_Run().
+ * Writers of the factors change them and reset gains.periodUs in a critical section, and the gains are
+ * calculated in one too: from a single set of factors, and a reset during the calculation does not get lost
+ * if the control loop runs in a task.
+ * \param config PID configuration
+ * \param periodUs Sample period in microseconds
+ */
+static void PID_UpdateGains(PID_Config *config, uint32_t periodUs) {
+  PID_Gains *g = &config->gains;
+  int64_t iMax;
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical();
+  g->kp = PID_LimitGain(((int64_t)config->pFactor100*65536)/100, PID_GAIN_MAX);
+  g->ki = PID_LimitGain(((int64_t)config->iFactor100*65536*periodUs)/(100*PID_REF_PERIOD_US), PID_KI_MAX);
+  g->kd = PID_LimitGain(((int64_t)config->dFactor100*65536)/100, PID_GAIN_MAX);
+  g->b = ((int32_t)config->setpointWeight100*65536)/100;
+  g->alpha = (int32_t)(((int64_t)periodUs*65536)/(periodUs+config->dFilterMs*1000UL)); /* 1.0 without filter */
+  g->dScale = PID_LimitGain(((int64_t)PID_REF_PERIOD_US*65536)/periodUs, PID_GAIN_MAX);
+  iMax = ((int64_t)config->iAntiWindup*config->iFactor100*256)/100; /* same I part limit as before: windup times I factor */
+  if (iMax>PID_INTEGRAL_MAX) { /* more than the output range does not make sense, and would overflow */
+    iMax = PID_INTEGRAL_MAX;
+  }
+  g->iMax = (int32_t)iMax;
+  g->ffGain = PID_LimitGain(((int64_t)config->ffGain100*65536)/100, PID_GAIN_MAX);
+  g->ffAccel = PID_LimitGain(((int64_t)config->ffAccel100*65536)/100, PID_GAIN_MAX);
+  g->periodUs = periodUs;
+  CS1_ExitCritical();
+}
+
+/*!
+ * \brief Resets the state of a PID controller.
+ * \param config PID configuration and state
+ */
+static void PID_Reset(PID_Config *config) {
+  config->lastError = 0;
+  config->integral = 0;
+  config->lastVal = 0;
+  config->derivative = 0;
+  config->hasLastVal = FALSE;
+}
+
+/*!
+ * \brief PID calculation in Q16 fixed point.
+ * The P part uses the weighted setpoint, the D part is on the filtered measured value (no kick on setpoint changes),
+ * and the integral is corrected by the amount the output exceeds the saturation (back-calculation).
+ * An optional feedforward from the setpoint and its acceleration is added, so the feedback only needs to correct the residual.
+ * It is for setpoints which the plant can follow (e.g. from the motion profile): on a setpoint step the integral still
+ * builds up over the dead time while the feedforward is already right, and the output overshoots.
+ * The acceleration comes from the caller, and is not derived from setpoint changes: a setpoint step would give an output spike.
+ * The feedforward is limited to the saturation first: the back-calculation only unwinds the integral by
+ * the excess of the feedback part, not by a feedforward which is beyond the saturation by itself.
+ * All arithmetic is 32 bit: the products are single SMMUL instructions on operands saturated to 24 bits (20 bits
+ * for the error in the integral), and the sums saturate instead of overflowing.
+ * \param config PID configuration and state
+ * \param setVal Desired value
+ * \param setAccel Change of setVal per second, for the acceleration feedforward, 0 if unknown
+ * \param useFF TRUE to add the feedforward from setVal and setAccel
+ * \param currVal Current measured value
+ * \param rate Change of currVal per second, only used if useRate is TRUE
+ * \param useRate TRUE to use rate for the D part instead of differentiating currVal
+ * \param periodUs Sample period in microseconds
+ * \param outMax Output saturation, the output is within -outMax..outMax
+ * \return Controller output
+ */
+static int32_t PID_Run(PID_Config *config, int32_t setVal, int32_t setAccel, bool useFF, int32_t currVal, int32_t rate, bool useRate, uint32_t periodUs, int32_t outMax) {
+  PID_Gains *g = &config->gains;
+  int32_t error, dVal, ff, out, outSat;
+
+  if (periodUs==0) {
+    periodUs = PID_REF_PERIOD_US;
+  }
+  if (g->periodUs!=periodUs) { /* parameters or sample period changed */
+    PID_UpdateGains(config, periodUs);
+  }
+  error = PID_QSub(setVal, currVal);
+  /* change of the measured value per reference period */
+  if (useRate) {
+    dVal = -PID_MulQ16(rate, PID_RATE_SCALE_Q16);
+  } else if (config->hasLastVal) {
+    dVal = PID_MulQ16(PID_QSub(config->lastVal, currVal), g->dScale);
+  } else {
+    dVal = 0;
+  }
+  /* feedforward from the setpoint */
+  ff = 0;
+  if (useFF) {
+    if (setVal>0) {
+      ff = config->ffOffset;
+    } else if (setVal<0) {
+      ff = -config->ffOffset;
+    } /* no offset at standstill */
+    ff = PID_QAdd(ff, PID_MulQ16(setVal, g->ffGain));
+    ff = PID_QAdd(ff, PID_MulQ16(setAccel, g->ffAccel));
+    if (ff>outMax) { /* the feedback gets what is left beside the feedforward */
+      ff = outMax;
+    } else if (ff<-outMax) {
+      ff = -outMax;
+    }
+  }
+  config->lastVal = currVal;
+  if (!config->hasLastVal) {
+    config->derivative = dVal; /* start filter without a step */
+    config->hasLastVal = TRUE;
+  }
+  config->derivative += PID_MulQ16(dVal-config->derivative, g->alpha);
+  /* integral in output units Q8: (error*ki)>>8 */
+  config->integral = PID_QAdd(config->integral, PID_MulHi((int32_t)((uint32_t)PID_Sat20(error)<<12), (int32_t)((uint32_t)g->ki<<12)));
+  if (config->integral>g->iMax) {
+    config->integral = g->iMax;
+  } else if (config->integral<-g->iMax) {
+    config->integral = -g->iMax;
+  }
+  out = ff;
+  out = PID_QAdd(out, PID_MulQ16(PID_MulQ16(setVal, g->b)-currVal, g->kp)); /* P part */
+  out = PID_QAdd(out, config->integral>>8); /* I part */
+  out = PID_QAdd(out, PID_MulQ16(config->derivative, g->kd)); /* D part */
+  if (out>outMax) {
+    outSat = outMax;
+  } else if (out<-outMax) {
+    outSat = -outMax;
+  } else {
+    outSat = out;
+  }
+  if (outSat!=out) { /* back-calculation: unwind the integral by the saturation excess of the feedback part */
+    int32_t excess = PID_QSub(outSat, out);
+
+    if (excess<-PID_BACK_CALC_MAX) { /* more would not change the clamped integral */
+      excess = -PID_BACK_CALC_MAX;
+    } else if (excess>PID_BACK_CALC_MAX) {
+      excess = PID_BACK_CALC_MAX;
+    }
+    config->integral += excess*(256>>PID_BACK_CALC_SHIFT);
+    if (config->integral>g->iMax) {
+      config->integral = g->iMax;
+    } else if (config->integral<-g->iMax) {
+      config->integral = -g->iMax;
+    }
+  }
+  config->lastError = error;
+  return outSat;
+}
+
+static void PID_SpeedCfg(int32_t currSpeed, int32_t setSpeed, int32_t setAccel, bool useFF, bool isLeft, uint32_t periodUs, PID_Config *config) {
   int32_t speed;
   MOT_Direction direction=MOT_DIR_FORWARD;
   MOT_MotorDevice *motHandle;
+#if PID_MEASURE_CYCLES
+  uint32_t cycles = DWT_CYCCNT;
+#endif
   
-  speed = PID(currSpeed, setSpeed, config);
+  speed = PID_Run(config, setSpeed, setAccel, useFF, currSpeed, 0, FALSE, periodUs, 0xFFFF);
+#if PID_MEASURE_CYCLES
+  cycles = DWT_CYCCNT-cycles;
+  pidRunCycles = cycles;
+  if (cycles>pidRunCyclesMax) {
+    pidRunCyclesMax = cycles;
+  }
+#endif
   if (speed>=0) {
     direction = MOT_DIR_FORWARD;
   } else { /* negative, make it positive */
@@ -105,79 +395,107 @@ static MOT_Direction AbsSpeed(int32_t *speedP) {
   return MOT_DIR_FORWARD;
 }
 
-/*! \brief returns error (always positive) percent */
-static uint8_t errorWithinPercent(int32_t error) {
-  if (error<0) {
-    error = -error;
+/*!
+ * \brief Returns the percentage of a value, without a division and with a single SMMUL.
+ * \param val Value, saturated to 24 bits
+ * \param percentQ8 Percentage in Q8, can be negative, within +/-PID_PERCENT_Q8_MAX
+ * \return val*percentQ8/25600
+ */
+static int32_t PercentQ8(int32_t val, int32_t percentQ8) {
+  /* (val*percentQ8*10486)>>28, with 10486/2^20 for 1/100: the shift by 4 of val makes it the upper word of the product */
+  return PID_MulHi((int32_t)((uint32_t)PID_Sat24(val)<<4), percentQ8*10486);
+}
+
+/*!
+ * \brief Linear interpolation between two table values, without rounding to the table unit.
+ * \param a Value at fraction 0
+ * \param b Value at fraction 256
+ * \param fracQ8 Fraction in Q8, 0..256
+ * \return Interpolated value in Q8
+ */
+static int32_t InterpolateQ8(int32_t a, int32_t b, int32_t fracQ8) {
+  return a*256+(b-a)*fracQ8;
+}
+
+/*!
+ * \brief Finds the table position for a value, for tables with equally spaced points.
+ * \param val Value, positive, saturated to 24 bits
+ * \param scaleQ16 Factor to get from the value to the table position in Q8, in Q16, up to PID_GAIN_MAX
+ * \param nofPoints Number of table points
+ * \param fracQ8 Returns the fraction between the point and the next one, in Q8
+ * \return Index of the table point, 0..nofPoints-2
+ */
+static int32_t TablePos(int32_t val, int32_t scaleQ16, int32_t nofPoints, int32_t *fracQ8) {
+  int32_t posQ8, idx;
+
+  posQ8 = PID_MulQ16(val, scaleQ16);
+  if (posQ8>(nofPoints-1)*256) { /* beyond the last point */
+    posQ8 = (nofPoints-1)*256;
   }
-  return error/(REF_MAX_LINE_VALUE/2/100);
+  idx = posQ8>>8;
+  if (idx>nofPoints-2) { /* last point: interpolate to the end of the segment before */
+    idx = nofPoints-2;
+  }
+  *fracQ8 = posQ8-idx*256;
+  return idx;
 }
 
-static void PID_LineCfg(uint16_t currLine, uint16_t setLine, PID_Config *config) {
-  int32_t pid, speed, speedL, speedR;
-  uint8_t errorPercent;
-  MOT_Direction directionL=MOT_DIR_FORWARD, directionR=MOT_DIR_FORWARD;
+/* line error 0..100% (half of the line range) to the position in the line schedule table, Q16 */
+#define PID_LINE_ERR_TO_POS_Q16    (((PID_LINE_SCHED_NOF_POINTS-1)*256L*65536L)/(REF_MAX_LINE_VALUE/2))
+/* measured speed to the position in the speed gain table, Q16 */
+#define PID_LINE_SPEED_TO_POS_Q16  (((PID_LINE_VGAIN_NOF_POINTS-1)*256L*65536L)/PID_LINE_VGAIN_MAX_SPEED)
 
-  pid = PID(currLine, setLine, config);
-  errorPercent = errorWithinPercent(currLine-setLine);
+static void PID_LineCfg(uint16_t currLine, int32_t currLineVel, uint16_t setLine, uint16_t periodMs, PID_Config *config) {
+  int32_t pid, error, maxSpeed, speed, steer, gain, innerMin, inner, outer, speedL, speedR, idx, frac;
+  const PID_LineSchedPoint *pt;
+  MOT_Direction directionL, directionR;
 
-  /* transform into different speed for motors. The PID is used as difference value to the motor PWM */
-  if (errorPercent <= 20) { /* pretty on center: move forward both motors with base speed */
-    speed = ((int32_t)config->maxSpeedPercent)*(0xffff/100); /* 100% */
-    pid = Limit(pid, -speed, speed);
-    if (pid<0) { /* turn right */
-      speedR = speed;
-      speedL = speed-pid;
-    } else { /* turn left */
-      speedR = speed+pid;
-      speedL = speed;
-    }
-  } else if (errorPercent <= 40) {
-    /* outside left/right halve position from center, slow down one motor and speed up the other */
-    speed = ((int32_t)config->maxSpeedPercent)*(0xffff/100)*8/10; /* 80% */
-    pid = Limit(pid, -speed, speed);
-    if (pid<0) { /* turn right */
-      speedR = speed+pid; /* decrease speed */
-      speedL = speed-pid; /* increase speed */
-    } else { /* turn left */
-      speedR = speed+pid; /* increase speed */
-      speedL = speed-pid; /* decrease speed */
-    }
-  } else if (errorPercent <= 70) {
-    speed = ((int32_t)config->maxSpeedPercent)*(0xffff/100)*6/10; /* %60 */
-    pid = Limit(pid, -speed, speed);
-    if (pid<0) { /* turn right */
-      speedR = 0 /*maxSpeed+pid*/; /* decrease speed */
-      speedL = speed-pid; /* increase speed */
-    } else { /* turn left */
-      speedR = speed+pid; /* increase speed */
-      speedL = 0 /*maxSpeed-pid*/; /* decrease speed */
-    }
-  } else  {
-    /* line is far to the left or right: use backward motor motion */
-    speed = ((int32_t)config->maxSpeedPercent)*(0xffff/100)*10/10; /* %80 */
-    if (pid<0) { /* turn right */
-      speedR = -speed+pid; /* decrease speed */
-      speedL = speed-pid; /* increase speed */
-    } else { /* turn left */
-      speedR = speed+pid; /* increase speed */
-      speedL = -speed-pid; /* decrease speed */
-    }
-    speedL = Limit(speedL, -speed, speed);
-    speedR = Limit(speedR, -speed, speed);
-    directionL = AbsSpeed(&speedL);
-    directionR = AbsSpeed(&speedR);
+  maxSpeed = ((int32_t)config->maxSpeedPercent)*(0xffff/100);
+  /* D part from the line velocity of the tracker */
+  pid = PID_Run(config, setLine, 0, FALSE, currLine, currLineVel, TRUE, periodMs*1000UL, maxSpeed);
+
+  /* schedule base speed, gain and inner wheel limit over the line error */
+  error = (int32_t)currLine-setLine;
+  if (error<0) {
+    error = -error;
+  }
+  idx = TablePos(error, PID_LINE_ERR_TO_POS_Q16, PID_LINE_SCHED_NOF_POINTS, &frac);
+  pt = &lineSched[idx];
+  speed = PercentQ8(maxSpeed, InterpolateQ8(pt[0].speedPercent, pt[1].speedPercent, frac));
+  gain = InterpolateQ8(pt[0].gainPercent, pt[1].gainPercent, frac); /* Q8 */
+  innerMin = PercentQ8(speed, InterpolateQ8(pt[0].innerMinPercent, pt[1].innerMinPercent, frac));
+#if PL_CONFIG_HAS_MOTOR_TACHO
+  /* and the gain over the measured speed */
+  speedL = (TACHO_GetSpeed(TRUE)+TACHO_GetSpeed(FALSE))/2;
+  if (speedL<0) {
+    speedL = -speedL;
   }
+  idx = TablePos(speedL, PID_LINE_SPEED_TO_POS_Q16, PID_LINE_VGAIN_NOF_POINTS, &frac);
+  gain = PercentQ8(gain, InterpolateQ8(lineSpeedGain[idx], lineSpeedGain[idx+1], frac));
+#endif
+
+  /* transform into different speed for motors: speed up the outer wheel, slow down the inner one */
+  steer = PercentQ8(pid<0 ? -pid : pid, gain); /* the same for both sides, the rounding would not be */
+  outer = speed+steer;
+  inner = speed-steer;
+  if (inner<innerMin) {
+    inner = innerMin;
+  }
+  if (pid<0) { /* turn right */
+    speedL = outer;
+    speedR = inner;
+  } else { /* turn left */
+    speedL = inner;
+    speedR = outer;
+  }
+  directionL = AbsSpeed(&speedL);
+  directionR = AbsSpeed(&speedR);
   /* speed is now always positive, make sure it is within 16bit PWM boundary */
   if (speedL>0xFFFF) {
     speedL = 0xFFFF;
-  } else if (speedL<0) {
-    speedL = 0;
   }
   if (speedR>0xFFFF) {
     speedR = 0xFFFF;
-  } else if (speedR<0) {
-    speedR = 0;
   }
   /* send new speed values to motor */
   MOT_SetVal(MOT_GetMotorHandle(MOT_MOTOR_LEFT), 0xFFFF-speedL); /* PWM is low active */
@@ -186,19 +504,27 @@ static void PID_LineCfg(uint16_t currLine, uint16_t setLine, PID_Config *config)
   MOT_SetDirection(MOT_GetMotorHandle(MOT_MOTOR_RIGHT), directionR);
 }
 
-void PID_Line(uint16_t currLine, uint16_t setLine) {
-  PID_LineCfg(currLine, setLine, &lineFwConfig);
+void PID_Line(uint16_t currLine, int32_t currLineVel, uint16_t setLine, uint16_t periodMs) {
+  PID_LineCfg(currLine, currLineVel, setLine, periodMs, &lineFwConfig);
 }
 
-void PID_Speed(int32_t currSpeed, int32_t setSpeed, bool isLeft) {
+void PID_Speed(int32_t currSpeed, int32_t setSpeed, bool isLeft, uint32_t periodUs) {
   if (isLeft) {
-    PID_SpeedCfg(currSpeed, setSpeed, isLeft, &speedLeftConfig);
+    PID_SpeedCfg(currSpeed, setSpeed, 0, FALSE, isLeft, periodUs, &speedLeftConfig);
   } else {
-    PID_SpeedCfg(currSpeed, setSpeed, isLeft, &speedRightConfig);
+    PID_SpeedCfg(currSpeed, setSpeed, 0, FALSE, isLeft, periodUs, &speedRightConfig);
   }
 }
 
-static void PID_PosCfg(int32_t currPos, int32_t setPos, bool isLeft, PID_Config *config) {
+void PID_SpeedAccel(int32_t currSpeed, int32_t setSpeed, int32_t setAccel, bool isLeft, uint32_t periodUs) {
+  if (isLeft) {
+    PID_SpeedCfg(currSpeed, setSpeed, setAccel, TRUE, isLeft, periodUs, &speedLeftConfig);
+  } else {
+    PID_SpeedCfg(currSpeed, setSpeed, setAccel, TRUE, isLeft, periodUs, &speedRightConfig);
+  }
+}
+
+static void PID_PosCfg(int32_t currPos, int32_t setPos, bool isLeft, uint32_t periodUs, PID_Config *config) {
   int32_t speed, val;
   MOT_Direction direction=MOT_DIR_FORWARD;
   MOT_MotorDevice *motHandle;
@@ -209,7 +535,8 @@ static void PID_PosCfg(int32_t currPos, int32_t setPos, bool isLeft, PID_Config
   if (error>-POS_FILTER && error<POS_FILTER) { /* avoid jitter around zero */
     setPos = currPos;
   }
-  speed = PID(currPos, setPos, config);
+  val = ((int32_t)config->maxSpeedPercent)*(0xffff/100); /* 100% */
+  speed = PID_Run(config, setPos, 0, FALSE, currPos, 0, FALSE, periodUs, (val+999)/1000); /* saturate at the speed limit, so the integral does not wind up */
   /* transform into motor speed */
   speed *= 1000; /* scale PID, otherwise we need high PID constants */
   if (speed>=0) {
@@ -224,7 +551,6 @@ static void PID_PosCfg(int32_t currPos, int32_t setPos, bool isLeft, PID_Config
   }
 #if 1
   /* limit speed to maximum value */
-  val = ((int32_t)config->maxSpeedPercent)*(0xffff/100); /* 100% */
   speed = Limit(speed, -val, val);
 #else
   /* limit speed to maximum value */
@@ -241,14 +567,74 @@ static void PID_PosCfg(int32_t currPos, int32_t setPos, bool isLeft, PID_Config
   MOT_UpdatePercent(motHandle, direction);
 }
 
-void PID_Pos(int32_t currPos, int32_t setPos, bool isLeft) {
+void PID_Pos(int32_t currPos, int32_t setPos, bool isLeft, uint32_t periodUs) {
   if (isLeft) {
-    PID_PosCfg(currPos, setPos, isLeft, &posLeftConfig);
+    PID_PosCfg(currPos, setPos, isLeft, periodUs, &posLeftConfig);
   } else {
-    PID_PosCfg(currPos, setPos, isLeft, &posRightConfig);
+    PID_PosCfg(currPos, setPos, isLeft, periodUs, &posRightConfig);
   }
 }
 
+static void PID_SetLineSchedPoint(int idx, uint8_t speedPercent, uint8_t gainPercent, int8_t innerMinPercent) {
+  lineSched[idx].speedPercent = speedPercent;
+  lineSched[idx].gainPercent = gainPercent;
+  lineSched[idx].innerMinPercent = innerMinPercent;
+}
+
+#if PL_CONFIG_HAS_CONFIG_NVM
+static void PID_StoreFactors(const PID_Config *config, PID_NVMFactors *factors) {
+  factors->pFactor100 = config->pFactor100;
+  factors->iFactor100 = config->iFactor100;
+  factors->dFactor100 = config->dFactor100;
+  factors->iAntiWindup = config->iAntiWindup;
+  factors->ffGain100 = config->ffGain100;
+  factors->ffOffset = config->ffOffset;
+  factors->ffAccel100 = config->ffAccel100;
+}
+
+static void PID_LoadFactors(PID_Config *config, const PID_NVMFactors *factors) {
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical(); /* the control loop might run in the timer interrupt: change all factors at once */
+  config->pFactor100 = factors->pFactor100;
+  config->iFactor100 = factors->iFactor100;
+  config->dFactor100 = factors->dFactor100;
+  config->iAntiWindup = factors->iAntiWindup;
+  config->ffGain100 = factors->ffGain100;
+  config->ffOffset = factors->ffOffset;
+  config->ffAccel100 = factors->ffAccel100;
+  config->gains.periodUs = 0; /* recalculate gains with the new values */
+  CS1_ExitCritical();
+}
+
+static void PID_LoadConfig(void) {
+  const PID_NVMData *data;
+
+  data = (const PID_NVMData*)NVMC_GetPidData();
+  if (data!=NULL && data->size==sizeof(PID_NVMData)) {
+    PID_LoadFactors(&speedLeftConfig, &data->speedLeft);
+    PID_LoadFactors(&speedRightConfig, &data->speedRight);
+    memcpy(lineSched, data->lineSched, sizeof(lineSched));
+    memcpy(lineSpeedGain, data->lineSpeedGain, sizeof(lineSpeedGain));
+  }
+}
+#endif /* PL_CONFIG_HAS_CONFIG_NVM */
+
+uint8_t PID_SaveConfig(void) {
+#if PL_CONFIG_HAS_CONFIG_NVM
+  PID_NVMData data;
+
+  data.size = sizeof(PID_NVMData);
+  PID_StoreFactors(&speedLeftConfig, &data.speedLeft);
+  PID_StoreFactors(&speedRightConfig, &data.speedRight);
+  memcpy(data.lineSched, lineSched, sizeof(data.lineSched));
+  memcpy(data.lineSpeedGain, lineSpeedGain, sizeof(data.lineSpeedGain));
+  return NVMC_SavePidData(&data, sizeof(data));
+#else
+  return ERR_FAILED;
+#endif
+}
+
 #if PL_CONFIG_HAS_SHELL
 static void PID_PrintHelp(const CLS1_StdIOType *io) {
   CLS1_SendHelpStr((unsigned char*)"pid", (unsigned char*)"Group of PID commands\r\n", io->stdOut);
@@ -259,6 +645,15 @@ static void PID_PrintHelp(const CLS1_StdIOType *io) {
   CLS1_SendHelpStr((unsigned char*)"  pos speed <value>", (unsigned char*)"Maximum speed % value\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  fw (p|i|d|w) <value>", (unsigned char*)"Sets P, I, D or anti-Windup line value\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  fw speed <value>", (unsigned char*)"Maximum speed % value\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  fw sched <pt> <sp> <g> <in>", (unsigned char*)"Line schedule point (0..4 for 0..100% error): speed %, gain %, inner wheel minimum %\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  fw vgain <pt> <g>", (unsigned char*)"Line gain % over the wheel speed (0..2 for 0..4000 steps/s)\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  (speed (L|R)|pos (L|R)|fw) b <val>", (unsigned char*)"Setpoint weight % for the P part (0..100)\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  (speed (L|R)|pos (L|R)|fw) f <ms>", (unsigned char*)"Derivative filter time constant, 0 for no filter\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  speed (L|R) (ffg|ffo|ffa) <val>", (unsigned char*)"Feedforward gain*100, deadband offset or acceleration gain*100\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  save", (unsigned char*)"Stores the speed PID, feedforward and line schedule in NVM\r\n", io->stdOut);
+#if PL_CONFIG_HAS_PID_TUNE
+  PIDT_PrintHelp(io);
+#endif
 }
 
 static void PrintPIDstatus(PID_Config *config, const unsigned char *kindStr, const CLS1_StdIOType *io) {
@@ -277,6 +672,29 @@ static void PrintPIDstatus(PID_Config *config, const unsigned char *kindStr, con
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
   CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
 
+  UTIL1_strcpy(kindBuf, sizeof(buf), (unsigned char*)"  ");
+  UTIL1_strcat(kindBuf, sizeof(buf), kindStr);
+  UTIL1_strcat(kindBuf, sizeof(buf), (unsigned char*)" b/f");
+  UTIL1_Num8uToStr(buf, sizeof(buf), config->setpointWeight100);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"% filter ");
+  UTIL1_strcatNum8u(buf, sizeof(buf), config->dFilterMs);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms\r\n");
+  CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+
+  if (config->ffGain100!=0 || config->ffOffset!=0 || config->ffAccel100!=0) {
+    UTIL1_strcpy(kindBuf, sizeof(buf), (unsigned char*)"  ");
+    UTIL1_strcat(kindBuf, sizeof(buf), kindStr);
+    UTIL1_strcat(kindBuf, sizeof(buf), (unsigned char*)" ff");
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"g: ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), config->ffGain100);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" o: ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), config->ffOffset);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" a: ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), config->ffAccel100);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+    CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+  }
+
   UTIL1_strcpy(kindBuf, sizeof(buf), (unsigned char*)"  ");
   UTIL1_strcat(kindBuf, sizeof(buf), kindStr);
   UTIL1_strcat(kindBuf, sizeof(buf), (unsigned char*)" windup");
@@ -294,7 +712,7 @@ static void PrintPIDstatus(PID_Config *config, const unsigned char *kindStr, con
   UTIL1_strcpy(kindBuf, sizeof(buf), (unsigned char*)"  ");
   UTIL1_strcat(kindBuf, sizeof(buf), kindStr);
   UTIL1_strcat(kindBuf, sizeof(buf), (unsigned char*)" integral");
-  UTIL1_Num32sToStr(buf, sizeof(buf), config->integral);
+  UTIL1_Num32sToStr(buf, sizeof(buf), config->integral>>8);
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
   CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
 
@@ -306,13 +724,88 @@ static void PrintPIDstatus(PID_Config *config, const unsigned char *kindStr, con
   CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
 }
 
+static void PrintLineSchedule(const CLS1_StdIOType *io) {
+  unsigned char buf[48];
+  unsigned char kindBuf[24];
+  int i;
+
+  for(i=0; i<PID_LINE_SCHED_NOF_POINTS; i++) {
+    UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  fw sched ");
+    UTIL1_strcatNum16u(kindBuf, sizeof(kindBuf), i*100/(PID_LINE_SCHED_NOF_POINTS-1));
+    UTIL1_strcat(kindBuf, sizeof(kindBuf), (unsigned char*)"%");
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"speed ");
+    UTIL1_strcatNum8u(buf, sizeof(buf), lineSched[i].speedPercent);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"% gain ");
+    UTIL1_strcatNum8u(buf, sizeof(buf), lineSched[i].gainPercent);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"% inner ");
+    UTIL1_strcatNum16s(buf, sizeof(buf), lineSched[i].innerMinPercent);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"%\r\n");
+    CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+  }
+  buf[0] = '\0';
+  for(i=0; i<PID_LINE_VGAIN_NOF_POINTS; i++) {
+    UTIL1_strcatNum16u(buf, sizeof(buf), i*(PID_LINE_VGAIN_MAX_SPEED/(PID_LINE_VGAIN_NOF_POINTS-1)));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)": ");
+    UTIL1_strcatNum8u(buf, sizeof(buf), lineSpeedGain[i]);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"% ");
+  }
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  fw vgain", buf, io->stdOut);
+}
+
+static uint8_t ParseLineSchedule(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  const unsigned char *p;
+  int32_t pt, speed, gain, inner;
+
+  if (UTIL1_strncmp((char*)cmd, (char*)"sched ", sizeof("sched ")-1)==0) {
+    p = cmd+sizeof("sched");
+    if (UTIL1_xatoi(&p, &pt)==ERR_OK && pt>=0 && pt<PID_LINE_SCHED_NOF_POINTS
+        && UTIL1_xatoi(&p, &speed)==ERR_OK && speed>=0 && speed<=100
+        && UTIL1_xatoi(&p, &gain)==ERR_OK && gain>=0 && gain<=255
+        && UTIL1_xatoi(&p, &inner)==ERR_OK && inner>=-100 && inner<=100)
+    {
+      lineSched[pt].speedPercent = (uint8_t)speed;
+      lineSched[pt].gainPercent = (uint8_t)gain;
+      lineSched[pt].innerMinPercent = (int8_t)inner;
+      *handled = TRUE;
+    } else {
+      CLS1_SendStr((unsigned char*)"Wrong argument(s)\r\n", io->stdErr);
+      return ERR_FAILED;
+    }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"vgain ", sizeof("vgain ")-1)==0) {
+    p = cmd+sizeof("vgain");
+    if (UTIL1_xatoi(&p, &pt)==ERR_OK && pt>=0 && pt<PID_LINE_VGAIN_NOF_POINTS
+        && UTIL1_xatoi(&p, &gain)==ERR_OK && gain>=0 && gain<=255)
+    {
+      lineSpeedGain[pt] = (uint8_t)gain;
+      *handled = TRUE;
+    } else {
+      CLS1_SendStr((unsigned char*)"Wrong argument(s)\r\n", io->stdErr);
+      return ERR_FAILED;
+    }
+  }
+  return ERR_OK;
+}
+
 static void PID_PrintStatus(const CLS1_StdIOType *io) {
   CLS1_SendStatusStr((unsigned char*)"pid", (unsigned char*)"\r\n", io->stdOut);
   PrintPIDstatus(&lineFwConfig, (unsigned char*)"fw", io);
+  PrintLineSchedule(io);
   PrintPIDstatus(&speedLeftConfig, (unsigned char*)"speed L", io);
   PrintPIDstatus(&speedRightConfig, (unsigned char*)"speed R", io);
   PrintPIDstatus(&posLeftConfig, (unsigned char*)"pos L", io);
   PrintPIDstatus(&posRightConfig, (unsigned char*)"pos R", io);
+#if PID_MEASURE_CYCLES
+  {
+    unsigned char buf[32];
+
+    UTIL1_Num32uToStr(buf, sizeof(buf), pidRunCycles);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" max ");
+    UTIL1_strcatNum32u(buf, sizeof(buf), pidRunCyclesMax);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" cycles\r\n");
+    CLS1_SendStatusStr((unsigned char*)"  speed run", buf, io->stdOut);
+  }
+#endif
 }
 
 static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
@@ -320,14 +813,15 @@ static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, b
   uint8_t val8u;
   uint32_t val32u;
   uint8_t res = ERR_OK;
+  CS1_CriticalVariable()
 
+  CS1_EnterCritical(); /* the control loop might run in the timer interrupt: change the factor and recalculate the gains together */
   if (UTIL1_strncmp((char*)cmd, (char*)"p ", sizeof("p ")-1)==0) {
     p = cmd+sizeof("p");
     if (UTIL1_ScanDecimal32uNumber(&p, &val32u)==ERR_OK) {
       config->pFactor100 = val32u;
       *handled = TRUE;
     } else {
-      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
       res = ERR_FAILED;
     }
   } else if (UTIL1_strncmp((char*)cmd, (char*)"i ", sizeof("i ")-1)==0) {
@@ -336,7 +830,6 @@ static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, b
       config->iFactor100 = val32u;
       *handled = TRUE;
     } else {
-      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
       res = ERR_FAILED;
     }
   } else if (UTIL1_strncmp((char*)cmd, (char*)"d ", sizeof("d ")-1)==0) {
@@ -345,7 +838,6 @@ static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, b
       config->dFactor100 = val32u;
       *handled = TRUE;
     } else {
-      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
       res = ERR_FAILED;
     }
   } else if (UTIL1_strncmp((char*)cmd, (char*)"w ", sizeof("w ")-1)==0) {
@@ -354,7 +846,6 @@ static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, b
       config->iAntiWindup = val32u;
       *handled = TRUE;
     } else {
-      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
       res = ERR_FAILED;
     }
   } else if (UTIL1_strncmp((char*)cmd, (char*)"speed ", sizeof("speed ")-1)==0) {
@@ -363,9 +854,55 @@ static uint8_t ParsePidParameter(PID_Config *config, const unsigned char *cmd, b
       config->maxSpeedPercent = val8u;
       *handled = TRUE;
     } else {
-      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
       res = ERR_FAILED;
     }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"b ", sizeof("b ")-1)==0) {
+    p = cmd+sizeof("b");
+    if (UTIL1_ScanDecimal8uNumber(&p, &val8u)==ERR_OK && val8u<=100) {
+      config->setpointWeight100 = val8u;
+      *handled = TRUE;
+    } else {
+      res = ERR_FAILED;
+    }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"ffg ", sizeof("ffg ")-1)==0) {
+    p = cmd+sizeof("ffg");
+    if (UTIL1_ScanDecimal32uNumber(&p, &val32u)==ERR_OK) {
+      config->ffGain100 = val32u;
+      *handled = TRUE;
+    } else {
+      res = ERR_FAILED;
+    }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"ffo ", sizeof("ffo ")-1)==0) {
+    p = cmd+sizeof("ffo");
+    if (UTIL1_ScanDecimal32uNumber(&p, &val32u)==ERR_OK && val32u<=0xFFFF) {
+      config->ffOffset = val32u;
+      *handled = TRUE;
+    } else {
+      res = ERR_FAILED;
+    }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"ffa ", sizeof("ffa ")-1)==0) {
+    p = cmd+sizeof("ffa");
+    if (UTIL1_ScanDecimal32uNumber(&p, &val32u)==ERR_OK) {
+      config->ffAccel100 = val32u;
+      *handled = TRUE;
+    } else {
+      res = ERR_FAILED;
+    }
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"f ", sizeof("f ")-1)==0) {
+    p = cmd+sizeof("f");
+    if (UTIL1_ScanDecimal8uNumber(&p, &val8u)==ERR_OK) {
+      config->dFilterMs = val8u;
+      *handled = TRUE;
+    } else {
+      res = ERR_FAILED;
+    }
+  }
+  if (*handled) {
+    config->gains.periodUs = 0; /* recalculate gains with the new values */
+  }
+  CS1_ExitCritical();
+  if (res!=ERR_OK) {
+    CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
   }
   return res;
 }
@@ -388,7 +925,20 @@ uint8_t PID_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_Std
   } else if (UTIL1_strncmp((char*)cmd, (char*)"pid pos R ", sizeof("pid pos R ")-1)==0) {
     res = ParsePidParameter(&posRightConfig, cmd+sizeof("pid pos R ")-1, handled, io);
   } else if (UTIL1_strncmp((char*)cmd, (char*)"pid fw ", sizeof("pid fw ")-1)==0) {
-    res = ParsePidParameter(&lineFwConfig, cmd+sizeof("pid fw ")-1, handled, io);
+    res = ParseLineSchedule(cmd+sizeof("pid fw ")-1, handled, io);
+    if (!*handled && res==ERR_OK) {
+      res = ParsePidParameter(&lineFwConfig, cmd+sizeof("pid fw ")-1, handled, io);
+    }
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"pid save")==0) {
+    res = PID_SaveConfig();
+    if (res!=ERR_OK) {
+      CLS1_SendStr((unsigned char*)"failed\r\n", io->stdErr);
+    }
+    *handled = TRUE;
+#if PL_CONFIG_HAS_PID_TUNE
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"pid autotune ", sizeof("pid autotune ")-1)==0) {
+    res = PIDT_ParseCommand(cmd, handled, io);
+#endif
   }
   return res;
 }
@@ -396,17 +946,11 @@ uint8_t PID_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_Std
 
 void PID_Start(void) {
   /* reset the 'memory' values of the structure back to zero */
-  lineFwConfig.lastError = 0;
-  lineFwConfig.integral = 0;
-
-  speedLeftConfig.lastError = 0;
-  speedLeftConfig.integral = 0;
-  speedRightConfig.lastError = 0;
-  speedRightConfig.integral = 0;
-  posLeftConfig.lastError = 0;
-  posLeftConfig.integral = 0;
-  posRightConfig.lastError = 0;
-  posRightConfig.integral = 0;
+  PID_Reset(&lineFwConfig);
+  PID_Reset(&speedLeftConfig);
+  PID_Reset(&speedRightConfig);
+  PID_Reset(&posLeftConfig);
+  PID_Reset(&posRightConfig);
 }
 
 void PID_Deinit(void) {
@@ -421,24 +965,51 @@ void PID_Init(void) {
   speedLeftConfig.dFactor100 = 1;
   speedLeftConfig.iAntiWindup = 40000;
   speedLeftConfig.maxSpeedPercent = 100;
+  speedLeftConfig.setpointWeight100 = 100;
+  speedLeftConfig.dFilterMs = 0;
+  speedLeftConfig.ffGain100 = 0; /* feedforward only from the motor identification, see PidSpeedTuning.h */
+  speedLeftConfig.ffOffset = 0;
+  speedLeftConfig.ffAccel100 = 0;
+  speedLeftConfig.gains.periodUs = 0;
+  PID_Reset(&speedLeftConfig);
 
-  speedLeftConfig.lastError = 0;
-  speedLeftConfig.integral = 0;
-
-  speedRightConfig.pFactor100 = speedLeftConfig.pFactor100;
-  speedRightConfig.iFactor100 = speedLeftConfig.iFactor100;
-  speedRightConfig.dFactor100 = speedLeftConfig.dFactor100;
-  speedRightConfig.iAntiWindup = speedLeftConfig.iAntiWindup;
-  speedRightConfig.lastError = 0;
-  speedRightConfig.integral = 0;
+  speedRightConfig = speedLeftConfig;
+#if PID_SPEED_USE_IDENT
+  speedLeftConfig.pFactor100 = PID_SPEED_LEFT_P_FACTOR100;
+  speedLeftConfig.iFactor100 = PID_SPEED_LEFT_I_FACTOR100;
+  speedLeftConfig.dFactor100 = PID_SPEED_LEFT_D_FACTOR100;
+  speedRightConfig.pFactor100 = PID_SPEED_RIGHT_P_FACTOR100;
+  speedRightConfig.iFactor100 = PID_SPEED_RIGHT_I_FACTOR100;
+  speedRightConfig.dFactor100 = PID_SPEED_RIGHT_D_FACTOR100;
+  /* PID_Speed() has no feedforward: the I part alone has to reach full PWM */
+  speedLeftConfig.iAntiWindup = 0xFFFF*100/PID_SPEED_LEFT_I_FACTOR100;
+  speedRightConfig.iAntiWindup = 0xFFFF*100/PID_SPEED_RIGHT_I_FACTOR100;
+  speedLeftConfig.ffGain100 = PID_SPEED_LEFT_FF_GAIN100;
+  speedLeftConfig.ffOffset = PID_SPEED_LEFT_FF_OFFSET;
+  speedLeftConfig.ffAccel100 = PID_SPEED_LEFT_FF_ACCEL100;
+  speedRightConfig.ffGain100 = PID_SPEED_RIGHT_FF_GAIN100;
+  speedRightConfig.ffOffset = PID_SPEED_RIGHT_FF_OFFSET;
+  speedRightConfig.ffAccel100 = PID_SPEED_RIGHT_FF_ACCEL100;
+#endif
 
   lineFwConfig.pFactor100 = 0;
   lineFwConfig.iFactor100 = 0;
   lineFwConfig.dFactor100 = 0;
   lineFwConfig.iAntiWindup = 0;
   lineFwConfig.maxSpeedPercent = 0;
-  lineFwConfig.lastError = 0;
-  lineFwConfig.integral = 0;
+  lineFwConfig.setpointWeight100 = 100;
+  lineFwConfig.dFilterMs = 0;
+  lineFwConfig.gains.periodUs = 0;
+  PID_Reset(&lineFwConfig);
+  /* line schedule: on the line only speed up the outer wheel, further away slow down and turn on the spot */
+  PID_SetLineSchedPoint(0, 100, 100, 100); /*   0% */
+  PID_SetLineSchedPoint(1, 100, 100, 50);  /*  25% */
+  PID_SetLineSchedPoint(2, 80, 100, 0);    /*  50% */
+  PID_SetLineSchedPoint(3, 60, 100, 0);    /*  75% */
+  PID_SetLineSchedPoint(4, 100, 200, -100); /* 100% */
+  lineSpeedGain[0] = 100;
+  lineSpeedGain[1] = 100;
+  lineSpeedGain[2] = 100;
 
   posLeftConfig.pFactor100 = 1000;
   posLeftConfig.iFactor100 = 0;
@@ -452,15 +1023,15 @@ void PID_Init(void) {
   posLeftConfig.iAntiWindup = 200;
   posLeftConfig.maxSpeedPercent = 40;
 */
-  posLeftConfig.lastError = 0;
-  posLeftConfig.integral = 0;
-  posRightConfig.pFactor100 = posLeftConfig.pFactor100;
-  posRightConfig.iFactor100 = posLeftConfig.iFactor100;
-  posRightConfig.dFactor100 = posLeftConfig.dFactor100;
-  posRightConfig.iAntiWindup = posLeftConfig.iAntiWindup;
-  posRightConfig.lastError = posLeftConfig.lastError;
-  posRightConfig.integral = posLeftConfig.integral;
-  posRightConfig.maxSpeedPercent = posLeftConfig.maxSpeedPercent;
+  posLeftConfig.setpointWeight100 = 100;
+  posLeftConfig.dFilterMs = 0;
+  posLeftConfig.gains.periodUs = 0;
+  PID_Reset(&posLeftConfig);
+
+  posRightConfig = posLeftConfig;
+#if PL_CONFIG_HAS_CONFIG_NVM
+  PID_LoadConfig(); /* stored values, e.g. from auto-tuning */
+#endif
 }
 
 #endif /* PL_CONFIG_HAS_PID */
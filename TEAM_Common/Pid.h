@@ -19,18 +19,49 @@ typedef enum {
   PID_CONFIG_SPEED_RIGHT
 } PID_ConfigType;
 
+#define PID_REF_PERIOD_MS  5  /* the P, I and D factors are given for this sample period, and get scaled for other periods */
+
+/* Q16 fixed point values derived from the factors, calculated for the actual sample period */
+typedef struct {
+  int32_t kp;        /* proportional gain */
+  int32_t ki;        /* integral gain per sample */
+  int32_t kd;        /* derivative gain */
+  int32_t b;         /* setpoint weight for the P part */
+  int32_t alpha;     /* derivative low pass filter coefficient */
+  int32_t dScale;    /* scales the change of the measured value per sample to the reference period */
+  int32_t iMax;      /* integral limit, output units in Q8 */
+  int32_t ffGain;    /* feedforward output per setpoint unit */
+  int32_t ffAccel;   /* feedforward output per setpoint acceleration (change per second) */
+  uint32_t periodUs; /* sample period the values are calculated for, 0 if they need to be recalculated */
+} PID_Gains;
+
 typedef struct {
   int32_t pFactor100;
   int32_t iFactor100;
   int32_t dFactor100;
   int32_t iAntiWindup;
   uint8_t maxSpeedPercent; /* max speed if 100% on the line, 0xffff would be full speed */
+  uint8_t setpointWeight100; /* weight of the setpoint in the P part, 100 for the classic PID */
+  uint8_t dFilterMs; /* time constant of the derivative filter, 0 for no filtering */
+  int32_t ffGain100; /* feedforward output per setpoint unit, times 100 */
+  int32_t ffOffset; /* feedforward output added for a non-zero setpoint, e.g. for the motor deadband */
+  int32_t ffAccel100; /* feedforward output per setpoint acceleration (change per second), times 100 */
   int32_t lastError;
-  int32_t integral;
+  int32_t integral; /* integral part, output units in Q8 */
+  int32_t lastVal; /* last measured value for the D part */
+  int32_t derivative; /* filtered change of the measured value per reference period */
+  bool hasLastVal; /* FALSE after a reset, lastVal is not valid yet */
+  PID_Gains gains;
 } PID_Config;
 
 uint8_t PID_GetPIDConfig(PID_ConfigType config, PID_Config **confP);
 
+/*!
+ * \brief Stores the speed PID factors in NVM, they get loaded in PID_Init().
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t PID_SaveConfig(void);
+
 #if PL_CONFIG_HAS_SHELL
 #include "CLS1.h"
 /*!
@@ -43,27 +74,43 @@ uint8_t PID_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_Std
 #endif
 
 /*!
- * \brief Performs PID closed loop calculation for the speed
+ * \brief Performs PID closed loop calculation for the speed, with the feedback alone: for setpoint steps,
+ * where the feedforward would overshoot with the factors tuned for the feedback
+ * \param currSpeed Current speed of motor
+ * \param setSpeed desired speed of motor
+ * \param isLeft TRUE if is for the left motor, otherwise for the right motor
+ * \param periodUs Sample period in microseconds
+ */
+void PID_Speed(int32_t currSpeed, int32_t setSpeed, bool isLeft, uint32_t periodUs);
+
+/*!
+ * \brief Performs PID closed loop calculation for the speed, with the speed and acceleration feedforward.
+ * For setpoints the motor can follow, e.g. from the motion profile
  * \param currSpeed Current speed of motor
  * \param setSpeed desired speed of motor
+ * \param setAccel desired acceleration of motor in steps/sec^2, e.g. from the motion profile
  * \param isLeft TRUE if is for the left motor, otherwise for the right motor
+ * \param periodUs Sample period in microseconds
  */
-void PID_Speed(int32_t currSpeed, int32_t setSpeed, bool isLeft);
+void PID_SpeedAccel(int32_t currSpeed, int32_t setSpeed, int32_t setAccel, bool isLeft, uint32_t periodUs);
 
 /*!
  * \brief Performs PID closed loop calculation for the line position
  * \param currPos Current position of wheel
  * \param setPos Desired wheel position
  * \param isLeft TRUE if is for the left wheel, otherwise for the right wheel
+ * \param periodUs Sample period in microseconds
  */
-void PID_Pos(int32_t currPos, int32_t setPos, bool isLeft);
+void PID_Pos(int32_t currPos, int32_t setPos, bool isLeft, uint32_t periodUs);
 
 /*!
  * \brief Performs PID closed loop calculation for line following
  * \param currLine Current line position
+ * \param currLineVel Current lateral velocity of the line (line units per second), used for the D part
  * \param setLine Desired line position
+ * \param periodMs Sample period in milliseconds
  */
-void PID_Line(uint16_t currLine, uint16_t setLine);
+void PID_Line(uint16_t currLine, int32_t currLineVel, uint16_t setLine, uint16_t periodMs);
 
 /*! \brief Driver re-init and reset */
 void PID_Start(void);
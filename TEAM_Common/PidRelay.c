@@ -0,0 +1,127 @@
+/**
+ * \file
+ * \brief Relay feedback experiment and PID tuning rules.
+ *
+ * The relay switches the output between bias+amplitude and bias-amplitude whenever the
+ * measured value crosses the operating point (with hysteresis). This results in a limit cycle
+ * at the ultimate period Tu, and the describing function gives the ultimate gain
+ * Ku = 4*d/(pi*sqrt(a^2-e^2)), with a the oscillation amplitude and e the hysteresis.
+ */
+
+#include "PidRelay.h"
+#include <math.h>
+
+#define PIDR_PI       3.14159265f
+#define PIDR_NOF_SKIP 1 /* first period is not a steady oscillation yet */
+
+void PIDR_Init(PIDR_Relay *relay, int32_t setVal, int32_t bias, int32_t amplitude, int32_t hysteresis, uint8_t nofCycles) {
+  relay->setVal = setVal;
+  relay->bias = bias;
+  relay->amplitude = amplitude;
+  relay->hysteresis = hysteresis;
+  relay->nofSkip = PIDR_NOF_SKIP;
+  relay->nofCycles = nofCycles;
+  relay->high = 1; /* start with pushing the value up */
+  relay->nofPeriods = 0;
+  relay->lastRiseMs = 0;
+  relay->max = INT32_MIN;
+  relay->min = INT32_MAX;
+  relay->periodSumMs = 0;
+  relay->peakPeakSum = 0;
+  relay->outSum = 0;
+  relay->valSum = 0;
+  relay->nofSamples = 0;
+}
+
+int32_t PIDR_Step(PIDR_Relay *relay, int32_t val, uint32_t timeMs) {
+  int32_t out;
+
+  if (val>relay->max) {
+    relay->max = val;
+  }
+  if (val<relay->min) {
+    relay->min = val;
+  }
+  if (relay->high && val>relay->setVal+relay->hysteresis) {
+    relay->high = 0;
+  } else if (!relay->high && val<relay->setVal-relay->hysteresis) {
+    relay->high = 1; /* start of a new period */
+    if (relay->nofPeriods>relay->nofSkip && !PIDR_IsDone(relay)) {
+      relay->periodSumMs += timeMs-relay->lastRiseMs;
+      relay->peakPeakSum += relay->max-relay->min;
+    }
+    relay->nofPeriods++;
+    relay->lastRiseMs = timeMs;
+    relay->max = val;
+    relay->min = val;
+  }
+  out = relay->high ? relay->bias+relay->amplitude : relay->bias-relay->amplitude;
+  if (relay->nofPeriods>relay->nofSkip && !PIDR_IsDone(relay)) { /* only use full periods of the settled oscillation */
+    relay->outSum += out;
+    relay->valSum += val;
+    relay->nofSamples++;
+  }
+  return out;
+}
+
+uint8_t PIDR_IsDone(const PIDR_Relay *relay) {
+  return relay->nofPeriods>relay->nofSkip+relay->nofCycles;
+}
+
+uint8_t PIDR_GetResult(const PIDR_Relay *relay, PIDR_Result *result) {
+  float a, e;
+
+  if (!PIDR_IsDone(relay) || relay->nofSamples==0 || relay->outSum==0) {
+    return 0;
+  }
+  a = (float)relay->peakPeakSum/(2.0f*relay->nofCycles); /* average amplitude */
+  e = (float)relay->hysteresis;
+  if (a<=e) {
+    return 0; /* no oscillation beyond the hysteresis */
+  }
+  result->ku = (4.0f*relay->amplitude)/(PIDR_PI*sqrtf(a*a-e*e));
+  result->tu = (float)relay->periodSumMs/(1000.0f*relay->nofCycles);
+  result->k = (float)relay->valSum/(float)relay->outSum; /* includes a possible deadband, only used for SIMC */
+  return 1;
+}
+
+uint8_t PIDR_CalcFactors(const PIDR_Result *result, PIDR_Rule rule, uint16_t refPeriodMs, PIDR_Factors *factors) {
+  float kp, ti, td, w, x, tau, theta, tRef;
+
+  switch(rule) {
+    case PIDR_RULE_ZN:
+      kp = 0.6f*result->ku;
+      ti = 0.5f*result->tu;
+      td = 0.125f*result->tu;
+      break;
+    case PIDR_RULE_TL:
+      kp = result->ku/2.2f;
+      ti = 2.2f*result->tu;
+      td = result->tu/6.3f;
+      break;
+    case PIDR_RULE_SIMC:
+      /* first order plus dead time model K*e^(-theta*s)/(tau*s+1) with the same ultimate point */
+      w = 2.0f*PIDR_PI/result->tu;
+      x = result->ku*result->k;
+      if (x<=1.0f) {
+        return 0; /* static gain does not match the ultimate gain */
+      }
+      tau = sqrtf(x*x-1.0f)/w;
+      theta = (PIDR_PI-atanf(w*tau))/w;
+      kp = tau/(2.0f*result->k*theta); /* closed loop time constant tc=theta */
+      ti = tau<8.0f*theta ? tau : 8.0f*theta;
+      td = 0.0f;
+      break;
+    default:
+      return 0;
+  }
+  if (ti<=0.0f) {
+    return 0;
+  }
+  /* factors are per sample: I part sums the error each sample, D part uses the change per sample */
+  tRef = refPeriodMs/1000.0f;
+  factors->pFactor100 = (int32_t)(kp*100.0f+0.5f);
+  factors->iFactor100 = (int32_t)(kp*tRef/ti*100.0f+0.5f);
+  factors->dFactor100 = (int32_t)(kp*td/tRef*100.0f+0.5f);
+  return 1;
+}
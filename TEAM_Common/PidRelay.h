@@ -0,0 +1,97 @@
+/**
+ * \file
+ * \brief Relay feedback experiment and PID tuning rules.
+ *
+ * Implements the Astrom-Hagglund relay experiment to find the ultimate gain and period
+ * of a plant, and calculates PID factors from them.
+ * The module does not depend on the platform or RTOS, so it can be used on the host too.
+ */
+
+#ifndef PIDRELAY_H_
+#define PIDRELAY_H_
+
+#include <stdint.h>
+
+typedef enum {
+  PIDR_RULE_ZN,   /* Ziegler-Nichols */
+  PIDR_RULE_TL,   /* Tyreus-Luyben, less overshoot */
+  PIDR_RULE_SIMC  /* Skogestad IMC (PI) on a first order plus dead time model derived from the experiment */
+} PIDR_Rule;
+
+typedef struct {
+  /* configuration */
+  int32_t setVal;     /* operating point of the measured value */
+  int32_t bias;       /* output at the operating point */
+  int32_t amplitude;  /* relay amplitude, output is bias+/-amplitude */
+  int32_t hysteresis; /* switching hysteresis of the measured value */
+  uint8_t nofSkip;    /* number of periods to skip until the oscillation has settled */
+  uint8_t nofCycles;  /* number of periods to average */
+  /* state */
+  uint8_t high;       /* 1 if the output is high */
+  uint8_t nofPeriods; /* number of periods seen so far */
+  uint32_t lastRiseMs; /* time of the last switch to high */
+  int32_t max, min;   /* extremes of the measured value in the current period */
+  uint32_t periodSumMs; /* sum of the measured periods */
+  int32_t peakPeakSum; /* sum of the peak to peak values */
+  int64_t outSum, valSum; /* output and measured value sums for the static gain */
+  uint32_t nofSamples;
+} PIDR_Relay;
+
+typedef struct {
+  float ku; /* ultimate gain, output units per measured unit */
+  float tu; /* ultimate period in seconds */
+  float k;  /* static gain (measured value per output unit) at the operating point */
+} PIDR_Result;
+
+typedef struct {
+  int32_t pFactor100;
+  int32_t iFactor100;
+  int32_t dFactor100;
+} PIDR_Factors;
+
+/*!
+ * \brief Prepares a relay experiment.
+ * \param relay Relay experiment
+ * \param setVal Operating point of the measured value
+ * \param bias Output at the operating point
+ * \param amplitude Relay amplitude
+ * \param hysteresis Switching hysteresis of the measured value
+ * \param nofCycles Number of oscillation periods to measure
+ */
+void PIDR_Init(PIDR_Relay *relay, int32_t setVal, int32_t bias, int32_t amplitude, int32_t hysteresis, uint8_t nofCycles);
+
+/*!
+ * \brief Runs one sample of the relay experiment.
+ * \param relay Relay experiment
+ * \param val Measured value
+ * \param timeMs Time of the sample in milliseconds
+ * \return New output value
+ */
+int32_t PIDR_Step(PIDR_Relay *relay, int32_t val, uint32_t timeMs);
+
+/*!
+ * \brief Returns if enough periods have been measured.
+ * \param relay Relay experiment
+ * \return 1 if done, 0 otherwise
+ */
+uint8_t PIDR_IsDone(const PIDR_Relay *relay);
+
+/*!
+ * \brief Calculates the ultimate gain and period from a finished experiment.
+ * \param relay Relay experiment
+ * \param result Where to store the result
+ * \return 1 for success, 0 if the experiment did not show a usable oscillation
+ */
+uint8_t PIDR_GetResult(const PIDR_Relay *relay, PIDR_Result *result);
+
+/*!
+ * \brief Calculates PID factors with a tuning rule.
+ * \param result Result of the relay experiment
+ * \param rule Tuning rule
+ * \param refPeriodMs Sample period the factors are given for (PID_REF_PERIOD_MS)
+ * \param factors Where to store the factors
+ * \return 1 for success, 0 if the rule cannot be applied to the result
+ */
+uint8_t PIDR_CalcFactors(const PIDR_Result *result, PIDR_Rule rule, uint16_t refPeriodMs, PIDR_Factors *factors);
+
+#endif /* PIDRELAY_H_ */
@@ -0,0 +1,26 @@
+/**
+ * \file
+ * \brief Speed PID factors from the motor identification.
+ *
+ * Generated by Tools/motor_ident with rule 'simc' (SIMC PI, tc=theta) for a 5 ms period, do not edit.
+ * left: K=0.10575 tau=23.0 ms theta=30.2 ms, tau1=16.1 ms tau2=13.4 ms theta=22.7 ms
+ * right: K=0.10275 tau=23.6 ms theta=27.3 ms, tau1=22.7 ms tau2=5.3 ms theta=22.6 ms
+ */
+
+#ifndef PIDSPEEDTUNING_H_
+#define PIDSPEEDTUNING_H_
+
+#define PID_SPEED_LEFT_P_FACTOR100  333
+#define PID_SPEED_LEFT_I_FACTOR100  72
+#define PID_SPEED_LEFT_D_FACTOR100  0
+#define PID_SPEED_LEFT_FF_GAIN100   946
+#define PID_SPEED_LEFT_FF_OFFSET    699
+#define PID_SPEED_LEFT_FF_ACCEL100  22
+#define PID_SPEED_RIGHT_P_FACTOR100  384
+#define PID_SPEED_RIGHT_I_FACTOR100  82
+#define PID_SPEED_RIGHT_D_FACTOR100  0
+#define PID_SPEED_RIGHT_FF_GAIN100   973
+#define PID_SPEED_RIGHT_FF_OFFSET    0
+#define PID_SPEED_RIGHT_FF_ACCEL100  23
+
+#endif /* PIDSPEEDTUNING_H_ */
@@ -0,0 +1,200 @@
+/**
+ * \file
+ * \brief PID auto-tuning on the robot.
+ *
+ * The wheel is first run with the speed PID at the operating point to find the PWM bias.
+ * Then the drive loop is disabled and the relay experiment drives the motor directly,
+ * with the speed from the tachometer as feedback.
+ */
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_PID_TUNE
+#include "PidTune.h"
+#include "PidRelay.h"
+#include "Pid.h"
+#include "Drive.h"
+#include "Motor.h"
+#include "Tacho.h"
+#include "FRTOS1.h"
+#include "UTIL1.h"
+#include "CS1.h"
+#if PL_CONFIG_HAS_SHELL
+  #include "CLS1.h"
+#endif
+
+#define PIDT_SPEED              2000 /* operating point in steps per second */
+#define PIDT_AMPLITUDE_PERCENT    20 /* relay amplitude in % of the full PWM */
+#define PIDT_MIN_AMPLITUDE    0x0800 /* minimal relay amplitude, below the oscillation gets lost in the tacho noise */
+#define PIDT_HYSTERESIS           50 /* steps per second, above the tacho noise */
+#define PIDT_NOF_CYCLES            4 /* number of oscillation periods to average */
+#define PIDT_SETTLE_MS          1000 /* time for the speed PID to reach the operating point */
+#define PIDT_TIMEOUT_MS         5000 /* maximum time of the relay experiment */
+#define PIDT_PERIOD_MS             5 /* sample period, same as for the drive loop */
+
+static void PIDT_SetMotor(MOT_MotorDevice *motHandle, int32_t val) {
+  if (val<0) {
+    val = 0;
+  } else if (val>0xFFFF) {
+    val = 0xFFFF;
+  }
+  MOT_SetVal(motHandle, 0xFFFF-val); /* PWM is low active */
+  MOT_SetDirection(motHandle, MOT_DIR_FORWARD);
+  MOT_UpdatePercent(motHandle, MOT_DIR_FORWARD);
+}
+
+uint8_t PIDT_AutoTuneSpeed(bool isLeft, PIDR_Rule rule, PIDR_Result *result, PIDR_Factors *factors) {
+  MOT_MotorDevice *motHandle;
+  PIDR_Relay relay;
+  int32_t bias, amplitude;
+  portTickType xLastWakeTime, startTime;
+  uint32_t timeMs;
+  uint8_t res = ERR_OK;
+
+  motHandle = MOT_GetMotorHandle(isLeft?MOT_MOTOR_LEFT:MOT_MOTOR_RIGHT);
+  /* closed loop to the operating point: the PWM there is the bias of the relay */
+  if (DRV_SetMode(DRV_MODE_SPEED)!=ERR_OK || DRV_SetSpeed(isLeft?PIDT_SPEED:0, isLeft?0:PIDT_SPEED)!=ERR_OK) {
+    return ERR_FAILED;
+  }
+  FRTOS1_vTaskDelay(PIDT_SETTLE_MS/portTICK_PERIOD_MS);
+  if (MOT_GetDirection(motHandle)!=MOT_DIR_FORWARD) {
+    (void)DRV_Stop(1000);
+    return ERR_FAILED; /* did not reach the operating point */
+  }
+  bias = 0xFFFF-MOT_GetVal(motHandle);
+  amplitude = PIDT_AMPLITUDE_PERCENT*(0xFFFF/100);
+  if (amplitude>bias) { /* stay in forward direction */
+    amplitude = bias;
+  }
+  if (amplitude>0xFFFF-bias) {
+    amplitude = 0xFFFF-bias;
+  }
+  if (amplitude<PIDT_MIN_AMPLITUDE) {
+    (void)DRV_Stop(1000);
+    return ERR_RANGE;
+  }
+  /* take over the motor: the drive task does not touch the motors any more, the speed is still measured */
+  if (DRV_SetMode(DRV_MODE_NONE)!=ERR_OK) {
+    return ERR_FAILED;
+  }
+  FRTOS1_vTaskDelay((2*PIDT_PERIOD_MS)/portTICK_PERIOD_MS); /* give the drive task time to switch the mode */
+  PIDR_Init(&relay, PIDT_SPEED, bias, amplitude, PIDT_HYSTERESIS, PIDT_NOF_CYCLES);
+  startTime = xLastWakeTime = FRTOS1_xTaskGetTickCount();
+  while (!PIDR_IsDone(&relay)) {
+    timeMs = (FRTOS1_xTaskGetTickCount()-startTime)*portTICK_PERIOD_MS;
+    if (timeMs>PIDT_TIMEOUT_MS) {
+      res = ERR_FAILED; /* no stable oscillation */
+      break;
+    }
+    PIDT_SetMotor(motHandle, PIDR_Step(&relay, TACHO_GetSpeed(isLeft), timeMs));
+    FRTOS1_vTaskDelayUntil(&xLastWakeTime, PIDT_PERIOD_MS/portTICK_PERIOD_MS);
+  }
+  PIDT_SetMotor(motHandle, 0);
+  (void)DRV_SetSpeed(0, 0);
+  (void)DRV_Stop(1000);
+  if (res!=ERR_OK) {
+    return res;
+  }
+  if (!PIDR_GetResult(&relay, result) || !PIDR_CalcFactors(result, rule, PID_REF_PERIOD_MS, factors)) {
+    return ERR_FAILED;
+  }
+  return ERR_OK;
+}
+
+#if PL_CONFIG_HAS_SHELL
+void PIDT_PrintHelp(const CLS1_StdIOType *io) {
+  CLS1_SendHelpStr((unsigned char*)"  autotune speed (L|R) [zn|tl|simc] [save]", (unsigned char*)"Relay auto-tuning of the speed PID (lift the robot!), optionally store in NVM\r\n", io->stdOut);
+}
+
+static void PIDT_PrintResult(const PIDR_Result *result, const PIDR_Factors *factors, const CLS1_StdIOType *io) {
+  unsigned char buf[32];
+
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)(result->ku*100.0f));
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  Ku*100", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)(result->tu*1000.0f));
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  Tu", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)(result->k*10000.0f));
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  K*10000", buf, io->stdOut);
+  UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"p: ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), factors->pFactor100);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" i: ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), factors->iFactor100);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" d: ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), factors->dFactor100);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  PID", buf, io->stdOut);
+}
+
+uint8_t PIDT_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  const unsigned char *p;
+  bool isLeft, save = FALSE;
+  PIDR_Rule rule = PIDR_RULE_ZN;
+  PIDR_Result result;
+  PIDR_Factors factors;
+  PID_Config *config;
+  uint8_t res;
+  CS1_CriticalVariable()
+
+  if (UTIL1_strncmp((char*)cmd, (char*)"pid autotune speed L", sizeof("pid autotune speed L")-1)==0) {
+    isLeft = TRUE;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"pid autotune speed R", sizeof("pid autotune speed R")-1)==0) {
+    isLeft = FALSE;
+  } else {
+    return ERR_OK; /* not for us */
+  }
+  *handled = TRUE;
+  p = cmd+sizeof("pid autotune speed L")-1;
+  while (*p==' ') {
+    p++;
+    if (UTIL1_strncmp((char*)p, (char*)"zn", sizeof("zn")-1)==0) {
+      rule = PIDR_RULE_ZN;
+      p += sizeof("zn")-1;
+    } else if (UTIL1_strncmp((char*)p, (char*)"tl", sizeof("tl")-1)==0) {
+      rule = PIDR_RULE_TL;
+      p += sizeof("tl")-1;
+    } else if (UTIL1_strncmp((char*)p, (char*)"simc", sizeof("simc")-1)==0) {
+      rule = PIDR_RULE_SIMC;
+      p += sizeof("simc")-1;
+    } else if (UTIL1_strncmp((char*)p, (char*)"save", sizeof("save")-1)==0) {
+      save = TRUE;
+      p += sizeof("save")-1;
+    } else {
+      break;
+    }
+  }
+  if (*p!='\0') {
+    CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
+    return ERR_FAILED;
+  }
+  CLS1_SendStr((unsigned char*)"running relay experiment...\r\n", io->stdOut);
+  res = PIDT_AutoTuneSpeed(isLeft, rule, &result, &factors);
+  if (res!=ERR_OK) {
+    CLS1_SendStr((unsigned char*)"auto-tuning failed\r\n", io->stdErr);
+    return res;
+  }
+  PIDT_PrintResult(&result, &factors, io);
+  if (PID_GetPIDConfig(isLeft?PID_CONFIG_SPEED_LEFT:PID_CONFIG_SPEED_RIGHT, &config)!=ERR_OK) {
+    return ERR_FAILED;
+  }
+  CS1_EnterCritical(); /* the control loop might run in the timer interrupt: change all factors at once */
+  config->pFactor100 = factors.pFactor100;
+  config->iFactor100 = factors.iFactor100;
+  config->dFactor100 = factors.dFactor100;
+  if (factors.iFactor100>0) { /* the I part alone has to be able to reach full PWM, whatever the I factor is */
+    config->iAntiWindup = (0xFFFF*100+factors.iFactor100-1)/factors.iFactor100;
+  }
+  config->gains.periodUs = 0; /* recalculate gains with the new values */
+  CS1_ExitCritical();
+  if (save) {
+    res = PID_SaveConfig();
+    if (res!=ERR_OK) {
+      CLS1_SendStr((unsigned char*)"saving failed\r\n", io->stdErr);
+    }
+  }
+  return res;
+}
+#endif /* PL_CONFIG_HAS_SHELL */
+
+#endif /* PL_CONFIG_HAS_PID_TUNE */
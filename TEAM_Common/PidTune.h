@@ -0,0 +1,47 @@
+/**
+ * \file
+ * \brief PID auto-tuning on the robot.
+ *
+ * Runs a relay feedback experiment through the motor and tachometer path
+ * and calculates the speed PID factors from it.
+ */
+
+#ifndef PIDTUNE_H_
+#define PIDTUNE_H_
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_PID_TUNE
+#include "PidRelay.h"
+
+#if PL_CONFIG_HAS_SHELL
+#include "CLS1.h"
+/*!
+ * \brief Shell command line parser for the 'pid autotune' commands.
+ * \param[in] cmd Pointer to command string
+ * \param[out] handled If command is handled by the parser
+ * \param[in] io Std I/O handler of shell
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t PIDT_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io);
+
+/*!
+ * \brief Prints the help text for the 'pid autotune' commands.
+ * \param io Std I/O handler of shell
+ */
+void PIDT_PrintHelp(const CLS1_StdIOType *io);
+#endif
+
+/*!
+ * \brief Runs the relay experiment on a wheel and calculates the speed PID factors.
+ * Blocks the caller for a few seconds. The robot should be lifted, as one wheel is turning.
+ * \param isLeft TRUE for the left wheel, FALSE for the right wheel
+ * \param rule Tuning rule to apply
+ * \param result Where to store the ultimate gain and period
+ * \param factors Where to store the calculated PID factors
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t PIDT_AutoTuneSpeed(bool isLeft, PIDR_Rule rule, PIDR_Result *result, PIDR_Factors *factors);
+
+#endif /* PL_CONFIG_HAS_PID_TUNE */
+
+#endif /* PIDTUNE_H_ */
@@ -45,6 +45,9 @@
 #if PL_CONFIG_HAS_MOTOR
   #include "Motor.h"
 #endif
+#if PL_CONFIG_HAS_QUADRATURE
+  #include "Quad.h"
+#endif
 #if PL_CONFIG_HAS_MOTOR_TACHO
   #include "Tacho.h"
 #endif
@@ -54,6 +57,15 @@
 #if PL_CONFIG_HAS_DRIVE
   #include "Drive.h"
 #endif
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  #include "MotorModel.h"
+#endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  #include "Profile.h"
+#endif
+#if PL_CONFIG_HAS_ODOMETRY
+  #include "Odometry.h"
+#endif
 #if PL_CONFIG_HAS_LINE_FOLLOW
   #include "LineFollow.h"
 #endif
@@ -125,15 +137,27 @@ void PL_Init(void) {
 #if PL_CONFIG_HAS_MOTOR
   MOT_Init();
 #endif
+#if PL_CONFIG_HAS_QUADRATURE
+  QUAD_Init();
+#endif
 #if PL_CONFIG_HAS_MOTOR_TACHO
   TACHO_Init();
 #endif
+#if PL_CONFIG_HAS_ODOMETRY
+  ODO_Init();
+#endif
 #if PL_CONFIG_HAS_PID
   PID_Init();
 #endif
 #if PL_CONFIG_HAS_DRIVE
   DRV_Init();
 #endif
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  MMOD_Init();
+#endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  PROF_Init();
+#endif
 #if PL_CONFIG_HAS_LINE_FOLLOW
   LF_Init();
 #endif
@@ -197,15 +221,27 @@ void PL_Deinit(void) {
 #if PL_CONFIG_HAS_LINE_FOLLOW
   LF_Deinit();
 #endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  PROF_Deinit();
+#endif
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  MMOD_Deinit();
+#endif
 #if PL_CONFIG_HAS_DRIVE
   DRV_Deinit();
 #endif
 #if PL_CONFIG_HAS_PID
   PID_Deinit();
 #endif
+#if PL_CONFIG_HAS_ODOMETRY
+  ODO_Deinit();
+#endif
 #if PL_CONFIG_HAS_MOTOR_TACHO
   TACHO_Deinit();
 #endif
+#if PL_CONFIG_HAS_QUADRATURE
+  QUAD_Deinit();
+#endif
 #if PL_CONFIG_HAS_MOTOR
   MOT_Deinit();
 #endif
@@ -91,6 +91,11 @@
 #define PL_CONFIG_HAS_QUAD_CALIBRATION  (1 && !defined(PL_LOCAL_CONFIG_HAS_QUAD_CALIBRATION_DISABLED) && PL_CONFIG_HAS_MCP4728)
 #define PL_CONFIG_HAS_PID               (1 && !defined(PL_LOCAL_CONFIG_HAS_PID_DISABLED) && PL_CONFIG_HAS_QUADRATURE)
 #define PL_CONFIG_HAS_DRIVE             (1 && !defined(PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED) && PL_CONFIG_HAS_PID)
+#define PL_CONFIG_HAS_PID_TUNE          (1 && !defined(PL_LOCAL_CONFIG_HAS_PID_TUNE_DISABLED) && PL_CONFIG_HAS_DRIVE && PL_CONFIG_HAS_MOTOR_TACHO) /* relay auto-tuning of the speed PID */
+#define PL_CONFIG_HAS_MOTOR_MODEL       (1 && !defined(PL_LOCAL_CONFIG_HAS_MOTOR_MODEL_DISABLED) && PL_CONFIG_HAS_DRIVE && PL_CONFIG_HAS_MOTOR_TACHO) /* online motor model and adaptive speed PID */
+#define PL_CONFIG_HAS_MOTION_PROFILE    (1 && !defined(PL_LOCAL_CONFIG_HAS_MOTION_PROFILE_DISABLED) && PL_CONFIG_HAS_DRIVE && PL_CONFIG_HAS_MOTOR_TACHO) /* speed, acceleration and jerk limited position moves */
+#define PL_CONFIG_HAS_DRIVE_ISR         (1 && !defined(PL_LOCAL_CONFIG_HAS_DRIVE_ISR_DISABLED) && PL_CONFIG_HAS_DRIVE && PL_CONFIG_HAS_MOTOR_TACHO) /* wheel control loops in the TI1 timer interrupt instead of the drive task */
+#define PL_CONFIG_HAS_ODOMETRY          (1 && !defined(PL_LOCAL_CONFIG_HAS_ODOMETRY_DISABLED) && PL_CONFIG_HAS_QUADRATURE) /* pose of the robot from the wheel encoders */
 #define PL_CONFIG_HAS_REFLECTANCE       (1 && !defined(PL_LOCAL_CONFIG_HAS_REFLECTANCE_DISABLED) && PL_CONFIG_BOARD_IS_ROBO)
 #define PL_CONFIG_HAS_LINE_FOLLOW       (1 && !defined(PL_LOCAL_CONFIG_HAS_LINE_FOLLOW_DISABLED)/* && PL_CONFIG_HAS_DRIVE*/)
 #define PL_CONFIG_HAS_TURN              (1 && !defined(PL_LOCAL_CONFIG_HAS_TURN_DISABLED) && PL_CONFIG_HAS_QUADRATURE)
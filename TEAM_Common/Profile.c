@@ -0,0 +1,297 @@
+/**
+ * \file
+ * \brief Motion profile generator.
+ *
+ * The trajectory is planned at the start of the move for the wheel with the longer way, rest to rest,
+ * with the usual seven phases: jerk up, constant acceleration, jerk down, constant speed and the same
+ * mirrored for the deceleration. If the way is too short, the constant phases get dropped and the
+ * reached speed and acceleration are lower. Both wheels follow the same trajectory, scaled to their way.
+ */
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_MOTION_PROFILE
+#include "Profile.h"
+#include "UTIL1.h"
+#include <math.h> /* sqrtf(), cbrtf(), ceilf() */
+#if PL_CONFIG_HAS_SHELL
+  #include "CLS1.h"
+#endif
+
+#define PROF_DEFAULT_SPEED  2500   /* steps/sec */
+#define PROF_DEFAULT_ACCEL  12000  /* steps/sec^2: more overshoots by more than MATCH_MARGIN with the 25 ms dead time of the motors */
+#define PROF_DEFAULT_JERK   400000 /* steps/sec^3, 0 for a trapezoidal profile */
+
+static bool PROF_isEnabled; /* if the drive uses the profile for position moves */
+static int32_t PROF_maxSpeed, PROF_maxAccel, PROF_maxJerk; /* limits, for the wheel with the longer way */
+
+typedef struct {
+  int32_t from[2]; /* start position of the left and right wheel */
+  int32_t dist[2]; /* way of the left and right wheel */
+  float len;       /* longest way, the trajectory is planned for it */
+  float tj;        /* duration of a jerk phase */
+  float ta;        /* duration of the acceleration, including the jerk phases */
+  float tv;        /* duration of the constant speed phase */
+  float jerk;      /* jerk used */
+  float accel;     /* acceleration reached */
+  float speed;     /* speed reached */
+  float t;         /* time since the start */
+  bool isFinished;
+} PROF_Trajectory;
+
+static PROF_Trajectory PROF_traj; /* only changed by the drive task */
+
+bool PROF_IsEnabled(void) {
+  return PROF_isEnabled;
+}
+
+bool PROF_IsFinished(void) {
+  return PROF_traj.isFinished;
+}
+
+/*!
+ * \brief Plans the phases of the trajectory for the way len, with the current limits.
+ * \param traj Trajectory, with len set
+ */
+static void PROF_Plan(PROF_Trajectory *traj) {
+  float v = (float)PROF_maxSpeed, a = (float)PROF_maxAccel, j = (float)PROF_maxJerk;
+
+  traj->jerk = j;
+  if (j>0.0f) { /* S-curve */
+    if (v*j>=a*a) { /* the acceleration limit is reached */
+      traj->tj = a/j;
+      traj->ta = traj->tj+v/a;
+    } else { /* reaches the speed before the acceleration limit */
+      traj->tj = sqrtf(v/j);
+      traj->ta = 2.0f*traj->tj;
+    }
+  } else { /* trapezoidal */
+    traj->tj = 0.0f;
+    traj->ta = v/a;
+  }
+  traj->tv = traj->len/v-traj->ta;
+  if (traj->tv<0.0f) { /* too short to reach the speed limit */
+    traj->tv = 0.0f;
+    if (j>0.0f) {
+      traj->tj = a/j;
+      traj->ta = (a*a/j+sqrtf(a*a*a*a/(j*j)+4.0f*a*traj->len))/(2.0f*a);
+      if (traj->ta<2.0f*traj->tj) { /* not even the acceleration limit is reached */
+        traj->tj = cbrtf(traj->len/(2.0f*j));
+        traj->ta = 2.0f*traj->tj;
+      }
+    } else {
+      traj->ta = sqrtf(traj->len/a);
+    }
+  }
+  traj->accel = j>0.0f ? j*traj->tj : a;
+  traj->speed = traj->accel*(traj->ta-traj->tj);
+}
+
+/*!
+ * \brief Position, speed and acceleration during the acceleration, the deceleration is the same mirrored.
+ * \param traj Trajectory
+ * \param t Time since the start, 0..ta
+ * \param pos Where to store the position
+ * \param speed Where to store the speed
+ * \param accel Where to store the acceleration
+ */
+static void PROF_EvalAccel(const PROF_Trajectory *traj, float t, float *pos, float *speed, float *accel) {
+  float r;
+
+  if (t<traj->tj) { /* jerk up */
+    *pos = traj->jerk*t*t*t/6.0f;
+    *speed = traj->jerk*t*t/2.0f;
+    *accel = traj->jerk*t;
+  } else if (t<traj->ta-traj->tj) { /* constant acceleration */
+    *pos = traj->accel/6.0f*(3.0f*t*t-3.0f*traj->tj*t+traj->tj*traj->tj);
+    *speed = traj->accel*(t-traj->tj/2.0f);
+    *accel = traj->accel;
+  } else { /* jerk down */
+    r = traj->ta-t;
+    *pos = traj->speed*(traj->ta/2.0f-r)+traj->jerk*r*r*r/6.0f;
+    *speed = traj->speed-traj->jerk*r*r/2.0f;
+    *accel = traj->jerk*r;
+  }
+}
+
+/*!
+ * \brief Position, speed and acceleration on the trajectory.
+ * \param traj Trajectory
+ * \param t Time since the start
+ * \param pos Where to store the position, 0..len
+ * \param speed Where to store the speed
+ * \param accel Where to store the acceleration
+ */
+static void PROF_Eval(const PROF_Trajectory *traj, float t, float *pos, float *speed, float *accel) {
+  float total = 2.0f*traj->ta+traj->tv;
+
+  if (t<traj->ta) {
+    PROF_EvalAccel(traj, t, pos, speed, accel);
+  } else if (t<traj->ta+traj->tv) {
+    *pos = traj->speed*(traj->ta/2.0f+t-traj->ta);
+    *speed = traj->speed;
+    *accel = 0.0f;
+  } else {
+    PROF_EvalAccel(traj, total-t, pos, speed, accel);
+    *pos = traj->len-*pos;
+    *accel = -*accel;
+  }
+}
+
+void PROF_Start(int32_t fromL, int32_t fromR, int32_t toL, int32_t toR) {
+  PROF_Trajectory *traj = &PROF_traj;
+  int32_t lenL, lenR;
+
+  traj->from[0] = fromL;
+  traj->from[1] = fromR;
+  traj->dist[0] = toL-fromL;
+  traj->dist[1] = toR-fromR;
+  lenL = traj->dist[0]<0 ? -traj->dist[0] : traj->dist[0];
+  lenR = traj->dist[1]<0 ? -traj->dist[1] : traj->dist[1];
+  traj->len = (float)(lenL>lenR ? lenL : lenR);
+  traj->t = 0.0f;
+  traj->isFinished = traj->len==0.0f || PROF_maxSpeed<=0 || PROF_maxAccel<=0;
+  if (!traj->isFinished) {
+    PROF_Plan(traj);
+  }
+}
+
+uint32_t PROF_DurationMs(int32_t distL, int32_t distR) {
+  PROF_Trajectory traj;
+
+  distL = distL<0 ? -distL : distL;
+  distR = distR<0 ? -distR : distR;
+  traj.len = (float)(distL>distR ? distL : distR);
+  if (traj.len==0.0f || PROF_maxSpeed<=0 || PROF_maxAccel<=0) {
+    return 0;
+  }
+  PROF_Plan(&traj);
+  return (uint32_t)ceilf((2.0f*traj.ta+traj.tv)*1000.0f);
+}
+
+bool PROF_Next(uint32_t periodUs, PROF_Setpoint *left, PROF_Setpoint *right) {
+  PROF_Trajectory *traj = &PROF_traj;
+  float pos, speed, accel, scale;
+
+  if (!traj->isFinished) {
+    traj->t += (float)periodUs/1000000.0f;
+    if (traj->t>=2.0f*traj->ta+traj->tv) {
+      traj->isFinished = TRUE;
+    }
+  }
+  if (traj->isFinished) { /* at the target */
+    left->pos = traj->from[0]+traj->dist[0];
+    left->speed = 0;
+    left->accel = 0;
+    right->pos = traj->from[1]+traj->dist[1];
+    right->speed = 0;
+    right->accel = 0;
+    return FALSE;
+  }
+  PROF_Eval(traj, traj->t, &pos, &speed, &accel);
+  scale = (float)traj->dist[0]/traj->len;
+  left->pos = traj->from[0]+(int32_t)(pos*scale);
+  left->speed = (int32_t)(speed*scale);
+  left->accel = (int32_t)(accel*scale);
+  scale = (float)traj->dist[1]/traj->len;
+  right->pos = traj->from[1]+(int32_t)(pos*scale);
+  right->speed = (int32_t)(speed*scale);
+  right->accel = (int32_t)(accel*scale);
+  return TRUE;
+}
+
+#if PL_CONFIG_HAS_SHELL
+static void PROF_PrintHelp(const CLS1_StdIOType *io) {
+  CLS1_SendHelpStr((unsigned char*)"profile", (unsigned char*)"Group of motion profile commands\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  help|status", (unsigned char*)"Shows motion profile help or status\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  (on|off)", (unsigned char*)"Use the profile for position moves\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  speed <value>", (unsigned char*)"Maximum speed in steps/sec\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  accel <value>", (unsigned char*)"Maximum acceleration in steps/sec^2\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  jerk <value>", (unsigned char*)"Maximum jerk in steps/sec^3, 0 for a trapezoidal profile\r\n", io->stdOut);
+}
+
+static void PROF_PrintStatus(const CLS1_StdIOType *io) {
+  unsigned char buf[48];
+
+  CLS1_SendStatusStr((unsigned char*)"profile", (unsigned char*)"\r\n", io->stdOut);
+  CLS1_SendStatusStr((unsigned char*)"  enabled", PROF_isEnabled?(unsigned char*)"on\r\n":(unsigned char*)"off\r\n", io->stdOut);
+
+  UTIL1_Num32sToStr(buf, sizeof(buf), PROF_maxSpeed);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/sec\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  speed", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), PROF_maxAccel);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/sec^2\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  accel", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), PROF_maxJerk);
+  UTIL1_strcat(buf, sizeof(buf), PROF_maxJerk==0?(unsigned char*)" (trapezoidal)\r\n":(unsigned char*)" steps/sec^3\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  jerk", buf, io->stdOut);
+
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)PROF_traj.len);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps, ");
+  if (PROF_traj.isFinished) {
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"finished\r\n");
+  } else {
+    UTIL1_strcatNum32s(buf, sizeof(buf), (int32_t)(PROF_traj.t*1000.0f));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" of ");
+    UTIL1_strcatNum32s(buf, sizeof(buf), (int32_t)((2.0f*PROF_traj.ta+PROF_traj.tv)*1000.0f));
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms\r\n");
+  }
+  CLS1_SendStatusStr((unsigned char*)"  move", buf, io->stdOut);
+}
+
+uint8_t PROF_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  uint8_t res = ERR_OK;
+  const unsigned char *p;
+  int32_t val;
+  int32_t *limit = NULL;
+
+  if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_HELP)==0 || UTIL1_strcmp((char*)cmd, (char*)"profile help")==0) {
+    PROF_PrintHelp(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_STATUS)==0 || UTIL1_strcmp((char*)cmd, (char*)"profile status")==0) {
+    PROF_PrintStatus(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"profile on")==0) {
+    PROF_isEnabled = TRUE;
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"profile off")==0) {
+    PROF_isEnabled = FALSE;
+    *handled = TRUE;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"profile speed ", sizeof("profile speed ")-1)==0) {
+    p = cmd+sizeof("profile speed ")-1;
+    limit = &PROF_maxSpeed;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"profile accel ", sizeof("profile accel ")-1)==0) {
+    p = cmd+sizeof("profile accel ")-1;
+    limit = &PROF_maxAccel;
+  } else if (UTIL1_strncmp((char*)cmd, (char*)"profile jerk ", sizeof("profile jerk ")-1)==0) {
+    p = cmd+sizeof("profile jerk ")-1;
+    limit = &PROF_maxJerk;
+  }
+  if (limit!=NULL) { /* new limit, used from the next move on */
+    if (UTIL1_xatoi(&p, &val)==ERR_OK && (val>0 || (val==0 && limit==&PROF_maxJerk))) {
+      *limit = val;
+    } else {
+      CLS1_SendStr((unsigned char*)"Wrong argument\r\n", io->stdErr);
+      res = ERR_FAILED;
+    }
+    *handled = TRUE;
+  }
+  return res;
+}
+#endif /* PL_CONFIG_HAS_SHELL */
+
+void PROF_Deinit(void) {
+  /* nothing needed */
+}
+
+void PROF_Init(void) {
+  PROF_isEnabled = TRUE;
+  PROF_maxSpeed = PROF_DEFAULT_SPEED;
+  PROF_maxAccel = PROF_DEFAULT_ACCEL;
+  PROF_maxJerk = PROF_DEFAULT_JERK;
+  PROF_traj.len = 0.0f;
+  PROF_traj.isFinished = TRUE;
+  PROF_traj.from[0] = PROF_traj.from[1] = 0;
+  PROF_traj.dist[0] = PROF_traj.dist[1] = 0;
+}
+
+#endif /* PL_CONFIG_HAS_MOTION_PROFILE */
@@ -0,0 +1,82 @@
+/**
+ * \file
+ * \brief Motion profile generator.
+ *
+ * Turns a position move of both wheels into a trajectory with limited speed, acceleration
+ * and jerk (S-curve), or a trapezoidal speed profile with the jerk limit set to zero.
+ * Both wheels use the same time base, so they start and arrive at the same time.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_MOTION_PROFILE
+
+#if PL_CONFIG_HAS_SHELL
+#include "CLS1.h"
+/*!
+ * \brief Shell command line parser.
+ * \param[in] cmd Pointer to command string
+ * \param[out] handled If command is handled by the parser
+ * \param[in] io Std I/O handler of shell
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t PROF_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io);
+#endif
+
+/*! \brief Setpoint of a wheel on the trajectory */
+typedef struct {
+  int32_t pos;   /*!< position in steps */
+  int32_t speed; /*!< speed in steps/sec */
+  int32_t accel; /*!< acceleration in steps/sec^2, for the feedforward of the speed PID */
+} PROF_Setpoint;
+
+/*!
+ * \brief Returns if position moves shall use the profile.
+ * \return TRUE if enabled, FALSE if the position setpoint jumps to the target
+ */
+bool PROF_IsEnabled(void);
+
+/*!
+ * \brief Starts a new move from standstill. The wheel with the longer way runs at the limits,
+ * the other one is scaled down to arrive at the same time.
+ * \param fromL Start position of the left wheel
+ * \param fromR Start position of the right wheel
+ * \param toL Target position of the left wheel
+ * \param toR Target position of the right wheel
+ */
+void PROF_Start(int32_t fromL, int32_t fromR, int32_t toL, int32_t toR);
+
+/*!
+ * \brief Returns the duration of a move from standstill with the current limits, as PROF_Start() would plan it.
+ * \param distL Way of the left wheel in steps
+ * \param distR Way of the right wheel in steps
+ * \return Duration of the trajectory in milliseconds, rounded up
+ */
+uint32_t PROF_DurationMs(int32_t distL, int32_t distR);
+
+/*!
+ * \brief Advances the trajectory by one period and returns the setpoints for it.
+ * \param periodUs Period in microseconds
+ * \param left Where to store the setpoint of the left wheel
+ * \param right Where to store the setpoint of the right wheel
+ * \return TRUE if still moving, FALSE if the target has been reached: the setpoints are the target with zero speed and acceleration
+ */
+bool PROF_Next(uint32_t periodUs, PROF_Setpoint *left, PROF_Setpoint *right);
+
+/*!
+ * \brief Returns if the trajectory is at the target.
+ * \return TRUE if finished, FALSE while moving
+ */
+bool PROF_IsFinished(void);
+
+/*! \brief Driver initialization */
+void PROF_Init(void);
+
+/*! \brief Driver de-initialization */
+void PROF_Deinit(void);
+
+#endif /* PL_CONFIG_HAS_MOTION_PROFILE */
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,197 @@
+/**
+ * \file
+ * \brief Quadrature encoder edge timestamps and interrupt load.
+ *
+ * The DWT cycle counter of the Cortex-M4 is the time base, both for the edge timestamps
+ * and for the load of the encoder interrupts.
+ */
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_QUADRATURE
+#include "Quad.h"
+#include "Q4CLeft.h"
+#include "Q4CRight.h"
+#include "CS1.h"
+#include "FRTOS1.h"
+#include "UTIL1.h"
+#include "Cpu.h"
+#if PL_CONFIG_HAS_SHELL
+  #include "CLS1.h"
+#endif
+
+#define QUAD_DEMCR_TRCENA_MASK    (1u<<24) /* trace enable in DEMCR, needed for the DWT */
+#define QUAD_DWT_CYCCNTENA_MASK   (1u<<0)  /* cycle counter enable in DWT_CTRL */
+
+static volatile uint32_t QUAD_isrCount; /* number of encoder interrupts since the last reset */
+static volatile uint64_t QUAD_isrCycles; /* cycles spent in encoder interrupts since the last reset */
+static volatile uint32_t QUAD_isrMaxCycles; /* longest encoder interrupt since the last reset */
+static volatile uint32_t QUAD_nofChanges; /* samples with a changed counter since the last reset */
+static portTickType QUAD_loadStartTicks; /* start of the load measurement */
+
+typedef struct {
+  int32_t pos;   /* position after the last edge */
+  uint32_t time; /* time of the last edge */
+  int8_t dir;    /* direction of the last edge, 0 if none yet */
+} QUAD_Edge;
+
+static volatile QUAD_Edge QUAD_edges[2]; /* left and right */
+static int32_t QUAD_lastCnt[2]; /* counters of the last sample, only used in QUAD_SampleEdges() */
+
+uint32_t QUAD_GetTime(void) {
+  return DWT_CYCCNT;
+}
+
+uint32_t QUAD_IsrStart(void) {
+  return QUAD_GetTime();
+}
+
+void QUAD_IsrEnd(uint32_t start) {
+  uint32_t cycles = DWT_CYCCNT-start;
+
+  QUAD_isrCycles += cycles;
+  if (cycles>QUAD_isrMaxCycles) {
+    QUAD_isrMaxCycles = cycles;
+  }
+  QUAD_isrCount++;
+}
+
+static void QUAD_ResetLoad(void) {
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical();
+  QUAD_isrCount = 0;
+  QUAD_isrCycles = 0;
+  QUAD_isrMaxCycles = 0;
+  QUAD_nofChanges = 0;
+  CS1_ExitCritical();
+  QUAD_loadStartTicks = FRTOS1_xTaskGetTickCount();
+}
+
+static void QUAD_UpdateEdge(volatile QUAD_Edge *edge, int32_t pos, uint32_t time) {
+  int32_t delta = pos-edge->pos;
+
+  if (delta==0) {
+    return;
+  }
+  /* a single step back is ignored: an encoder sitting on an edge chatters between two positions */
+  if ((delta>0 && edge->dir>=0) || (delta<0 && edge->dir<=0) || delta>=2 || delta<=-2) {
+    edge->pos = pos;
+    edge->time = time;
+    edge->dir = delta>0 ? 1 : -1;
+  }
+}
+
+void QUAD_SampleEdges(void) {
+  int32_t left = (int32_t)Q4CLeft_GetPos(), right = (int32_t)Q4CRight_GetPos();
+  uint32_t time;
+
+  if (left==QUAD_lastCnt[0] && right==QUAD_lastCnt[1]) {
+    return; /* no edge in most samples: nothing to timestamp */
+  }
+  time = QUAD_GetTime();
+  QUAD_lastCnt[0] = left;
+  QUAD_lastCnt[1] = right;
+  QUAD_UpdateEdge(&QUAD_edges[0], left, time);
+  QUAD_UpdateEdge(&QUAD_edges[1], right, time);
+  QUAD_nofChanges++;
+}
+
+void QUAD_GetLastEdge(bool isLeft, int32_t *pos, uint32_t *time, int8_t *dir) {
+  volatile QUAD_Edge *edge = &QUAD_edges[isLeft?0:1];
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical();
+  *pos = edge->pos;
+  *time = edge->time;
+  *dir = edge->dir;
+  CS1_ExitCritical();
+}
+
+#if PL_CONFIG_HAS_SHELL
+static void QUAD_PrintHelp(const CLS1_StdIOType *io) {
+  CLS1_SendHelpStr((unsigned char*)"quad", (unsigned char*)"Group of quadrature encoder commands\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  help|status", (unsigned char*)"Shows quadrature help or status\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  reset", (unsigned char*)"Restarts the interrupt load measurement\r\n", io->stdOut);
+}
+
+static void QUAD_PrintStatus(const CLS1_StdIOType *io) {
+  unsigned char buf[32];
+  uint32_t count, elapsedMs, load, maxCycles, changes;
+  uint64_t cycles;
+  CS1_CriticalVariable()
+
+  CS1_EnterCritical();
+  count = QUAD_isrCount;
+  cycles = QUAD_isrCycles;
+  maxCycles = QUAD_isrMaxCycles;
+  changes = QUAD_nofChanges;
+  CS1_ExitCritical();
+  elapsedMs = (FRTOS1_xTaskGetTickCount()-QUAD_loadStartTicks)*portTICK_PERIOD_MS;
+
+  CLS1_SendStatusStr((unsigned char*)"quad", (unsigned char*)"\r\n", io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)Q4CLeft_GetPos());
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  L pos", buf, io->stdOut);
+  UTIL1_Num32sToStr(buf, sizeof(buf), (int32_t)Q4CRight_GetPos());
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  R pos", buf, io->stdOut);
+
+  UTIL1_Num32uToStr(buf, sizeof(buf), count);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" in ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), elapsedMs);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  ISR count", buf, io->stdOut);
+  if (count>0) {
+    UTIL1_Num32uToStr(buf, sizeof(buf), (uint32_t)(cycles/count));
+  } else {
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"-");
+  }
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" cycles, max ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), maxCycles);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  ISR time", buf, io->stdOut);
+  UTIL1_Num32uToStr(buf, sizeof(buf), changes);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" timestamped\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  ISR edges", buf, io->stdOut);
+  if (elapsedMs>0) {
+    load = (uint32_t)((cycles*10000)/((uint64_t)elapsedMs*(CPU_CORE_CLK_HZ/1000))); /* in 0.01% */
+    UTIL1_Num32uToStr(buf, sizeof(buf), load/100);
+    UTIL1_strcat(buf, sizeof(buf), (unsigned char*)(load%100<10 ? ".0" : "."));
+    UTIL1_strcatNum32u(buf, sizeof(buf), load%100);
+  } else {
+    UTIL1_strcpy(buf, sizeof(buf), (unsigned char*)"-");
+  }
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" %\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  ISR load", buf, io->stdOut);
+}
+
+uint8_t QUAD_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io) {
+  if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_HELP)==0 || UTIL1_strcmp((char*)cmd, (char*)"quad help")==0) {
+    QUAD_PrintHelp(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)CLS1_CMD_STATUS)==0 || UTIL1_strcmp((char*)cmd, (char*)"quad status")==0) {
+    QUAD_PrintStatus(io);
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"quad reset")==0) {
+    QUAD_ResetLoad();
+    *handled = TRUE;
+  }
+  return ERR_OK;
+}
+#endif /* PL_CONFIG_HAS_SHELL */
+
+void QUAD_Deinit(void) {
+  /* nothing to do */
+}
+
+void QUAD_Init(void) {
+  DEMCR |= QUAD_DEMCR_TRCENA_MASK; /* enable the cycle counter for the load measurement */
+  DWT_CTRL |= QUAD_DWT_CYCCNTENA_MASK;
+  QUAD_edges[0].pos = QUAD_lastCnt[0] = (int32_t)Q4CLeft_GetPos();
+  QUAD_edges[1].pos = QUAD_lastCnt[1] = (int32_t)Q4CRight_GetPos();
+  QUAD_edges[0].time = QUAD_edges[1].time = QUAD_GetTime();
+  QUAD_edges[0].dir = QUAD_edges[1].dir = 0;
+  QUAD_ResetLoad();
+}
+
+#endif /* PL_CONFIG_HAS_QUADRATURE */
@@ -0,0 +1,73 @@
+/**
+ * \file
+ * \brief Quadrature encoder edge timestamps and interrupt load.
+ *
+ * Timestamps the encoder edges for the speed measurement and measures the interrupt load
+ * of the encoder decoding. The encoders themselves are decoded by the Q4CLeft/Q4CRight components,
+ * sampled from the QuadInt timer interrupt.
+ */
+
+#ifndef QUAD_H_
+#define QUAD_H_
+
+#include "Platform.h"
+#if PL_CONFIG_HAS_QUADRATURE
+#include "PE_Types.h"
+
+#if PL_CONFIG_HAS_SHELL
+#include "CLS1.h"
+/*!
+ * \brief Shell command line parser.
+ * \param[in] cmd Pointer to command string
+ * \param[out] handled If command is handled by the parser
+ * \param[in] io Std I/O handler of shell
+ * \return Error code, ERR_OK if everything was fine
+ */
+uint8_t QUAD_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOType *io);
+#endif
+
+#define QUAD_TIME_HZ   CPU_CORE_CLK_HZ /*!< frequency of the time base for timestamps */
+
+/*!
+ * \brief Returns the free running time base used for the edge timestamps, wraps around.
+ * \return Time in 1/QUAD_TIME_HZ seconds
+ */
+uint32_t QUAD_GetTime(void);
+
+/*!
+ * \brief Timestamps the encoder edges. To be called from the sampling interrupt, after sampling the encoders.
+ * Reads the time base only if one of the counters has changed since the last sample.
+ */
+void QUAD_SampleEdges(void);
+
+/*!
+ * \brief Returns the position and the time of the last encoder edge.
+ * \param isLeft TRUE for the left encoder, FALSE for the right one
+ * A single step back after an edge is not counted as an edge, so the position can differ by one from the counter.
+ * \param pos Where to store the position after the last edge
+ * \param time Where to store the time of the last edge, in 1/QUAD_TIME_HZ seconds
+ * \param dir Where to store the direction of the last edge: 1 counting up, -1 counting down, 0 no edge yet
+ */
+void QUAD_GetLastEdge(bool isLeft, int32_t *pos, uint32_t *time, int8_t *dir);
+
+/*!
+ * \brief To be called at the start of an encoder interrupt, for the load measurement.
+ * \return Cycle counter value, to be passed to QUAD_IsrEnd()
+ */
+uint32_t QUAD_IsrStart(void);
+
+/*!
+ * \brief To be called at the end of an encoder interrupt, for the load measurement.
+ * \param start Value returned by QUAD_IsrStart()
+ */
+void QUAD_IsrEnd(uint32_t start);
+
+/*! \brief Driver initialization */
+void QUAD_Init(void);
+
+/*! \brief Driver de-initialization */
+void QUAD_Deinit(void);
+
+#endif /* PL_CONFIG_HAS_QUADRATURE */
+
+#endif /* QUAD_H_ */
@@ -16,27 +16,70 @@
 #include "IR2.h"
 #include "IR3.h"
 #include "IR4.h"
-#include "IR5.h"
-#include "IR6.h"
+#if REF_NOF_SENSORS>4
+  #include "IR5.h"
+  #include "IR6.h"
+#endif
+#if REF_NOF_SENSORS>6
+  #include "IR7.h"
+  #include "IR8.h"
+#endif
 #include "UTIL1.h"
 #include "FRTOS1.h"
 #include "Application.h"
 #include "Event.h"
 #include "Shell.h"
+#include "SeqLock.h"
 #if PL_CONFIG_HAS_BUZZER
   #include "Buzzer.h"
 #endif
 #if PL_CONFIG_HAS_CONFIG_NVM
   #include "NVM_Config.h"
 #endif
+#if PL_CONFIG_HAS_DRIVE
+  #include "Drive.h"
+#endif
 
-#define REF_NOF_SENSORS       6 /* number of sensors */
-#define REF_SENSOR1_IS_LEFT   1 /* sensor number one is on the left side */
-#define REF_MIN_NOISE_VAL     0x40   /* values below this are not added to the weighted sum */
 #define REF_USE_WHITE_LINE    0  /* if set to 1, then the robot is using a white (on black) line, otherwise a black (on white) line */
 #define SUMO_LINE_THRESHOLD   500
+#define REF_SENSOR_TIMEOUT_US 1500 /* timeout for the discharge measurement */
+#define REF_LED_SETTLE_US     200  /* time for the IR LED's to settle before the discharge */
+#define REF_AMBIENT_COMPENSATION  1  /* if set to 1, ambient light measured with the IR LED's off is removed from the measurement */
+#define REF_AMBIENT_INTERVAL  8    /* every n-th measurement is an ambient frame: the sensors discharge in the dark while the IR LED's settle */
+#define REF_AMBIENT_FILTER    4    /* low pass filter factor for the ambient light, power of two */
+#define REF_AMBIENT_MAX_CHANGE 16  /* an ambient frame is only used if the measurements around it differ by less than 1/n */
+#define REF_MIN_PERIOD_MS     2    /* fastest sampling period, a measurement needs up to 1.75 ms */
+#define REF_IDLE_PERIOD_MS    100  /* sampling period without subscribers */
+#define REF_CALIB_PERIOD_MS   10   /* sampling period while calibrating */
+#define REF_MAX_SUBSCRIBERS   4    /* maximum number of tasks subscribed to new samples */
+#define REF_TRACK_ALPHA_Q8    128  /* line tracker position gain, 0.5 in Q8 */
+#define REF_TRACK_BETA_Q8     43   /* line tracker velocity gain, alpha^2/(2-alpha)=0.167 in Q8 */
+#define REF_TRACK_HOLD_MS     50   /* time the line tracker holds its estimate if the line is lost */
+#define REF_TRACK_MAX_VEL     100000 /* maximum line velocity (line units per second) of the tracker */
+
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+  #include "PORT_PDD.h"
+  #define REF_SENSOR_PORT         PORTD_BASE_PTR /* all sensor lines of REF_SENSOR_TABLE are on port D */
+#elif REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+  #include "GPIO_PDD.h"
+  #define REF_SENSOR_GPIO         PTD_BASE_PTR /* all sensor lines of REF_SENSOR_TABLE are on port D */
+#endif
 
 #define REF_START_STOP_CALIB      1 /* start/stop calibration commands */
+#define REF_RECORDER              (1 && PL_CONFIG_HAS_SHELL) /* ring buffer recorder of the samples, with binary dump */
+#if REF_RECORDER
+  #define REF_REC_DEPTH           ((28*1024)/(4+4*REF_NOF_SENSORS+4)) /* number of samples in the recorder (28 KByte), see REF_RecFrame */
+  #define REF_REC_SECTION         ".m_data_20000000_noinit" /* upper 32 KByte SRAM block, not used otherwise. NOLOAD section: no ROM image, not cleared */
+  #define REF_REC_MAGIC           "REFR" /* start of the binary dump */
+  #define REF_REC_VERSION         1 /* binary dump format version */
+#endif
+#define REF_AUTO_CALIB            (1 && PL_CONFIG_HAS_DRIVE) /* calibration while spinning on the spot */
+#if REF_AUTO_CALIB
+  #define REF_AUTO_CALIB_SPEED      2000 /* wheel speed for the spin, in steps per second */
+  #define REF_AUTO_CALIB_MIN_RANGE  REF_US_TO_CNT(100) /* minimum difference between min and max value of a sensor */
+  #define REF_AUTO_CALIB_SETTLE_MS  100  /* keep spinning after all sensors have seen the line, to get the full extremes */
+  #define REF_AUTO_CALIB_TIMEOUT_MS 3000 /* give up if not all sensors have seen the line */
+#endif
 #if REF_START_STOP_CALIB
   static xSemaphoreHandle REF_StartStopSem = NULL;
 #endif
@@ -50,6 +93,10 @@ typedef enum {
   REF_STATE_START_CALIBRATION,
   REF_STATE_CALIBRATING,
   REF_STATE_STOP_CALIBRATION,
+#if REF_AUTO_CALIB
+  REF_STATE_START_AUTO_CALIBRATION,
+  REF_STATE_AUTO_CALIBRATING,
+#endif
   REF_STATE_READY
 } RefStateType;
 static volatile RefStateType refState = REF_STATE_INIT; /* state machine state */
@@ -65,6 +112,7 @@ typedef struct SensorFctType_ {
 
 typedef uint16_t SensorTimeType;
 #define MAX_SENSOR_VALUE  ((SensorTimeType)-1)
+#define REF_US_TO_CNT(us) (((RefCnt_CNT_INP_FREQ_U_0/1000)*(us))/1000) /* microseconds translated into timer ticks */
 
 /* calibration min/max values */
 typedef struct SensorCalibT_ {
@@ -72,57 +120,251 @@ typedef struct SensorCalibT_ {
   SensorTimeType maxVal[REF_NOF_SENSORS];
 } SensorCalibT;
 
-static int16_t refCenterLineVal=0; /* 0 means no line, >0 means line is below sensor 0, 1000 below sensor 1 and so on */
 static SensorCalibT SensorCalibMinMax; /* min/max calibration data in SRAM */
+
+/* per sensor normalization derived from the calibration data, so no division is needed for each sample */
+typedef struct SensorScaleT_ {
+  SensorTimeType offset[REF_NOF_SENSORS]; /* calibrated min value */
+  SensorTimeType range[REF_NOF_SENSORS];  /* max-min, 0 if not calibrated */
+  uint32_t recip[REF_NOF_SENSORS];        /* reciprocal ceil(1000*2^(32-shift)/range), see REF_UpdateScale() */
+  uint8_t shift[REF_NOF_SENSORS];         /* pre-shift of raw-min, so the result is the upper word of the 64bit product */
+} SensorScaleT;
+
+static SensorScaleT SensorScale; /* updated from SensorCalibMinMax with REF_UpdateScale() */
+
+/* alpha-beta tracker of the line position */
+typedef struct REF_TrackerT_ {
+  bool valid;           /* TRUE if we have an estimate */
+  int32_t posQ8;        /* estimated line position, Q8 */
+  int32_t vel;          /* estimated line velocity, line units per second */
+  uint8_t confidence;   /* confidence in percent */
+  bool held;            /* TRUE if the line is not seen in the last sample, and the estimate is extrapolated */
+  TickType_t lastTick;  /* time of last update */
+  TickType_t seenTick;  /* time the line has been seen the last time */
+} REF_TrackerT;
+
+static REF_TrackerT refTracker;
 static SensorTimeType SensorRaw[REF_NOF_SENSORS]; /* raw sensor values */
 static SensorTimeType SensorCalibrated[REF_NOF_SENSORS]; /* 0 means white/min value, 1000 means black/max value */
 
-/* Functions as wrapper around macro. */
-static void S1_SetOutput(void) { IR1_SetOutput(); }
-static void S1_SetInput(void) { IR1_SetInput(); }
-static void S1_SetVal(void) { IR1_SetVal(); }
-static bool S1_GetVal(void) { return IR1_GetVal(); }
-
-static void S2_SetOutput(void) { IR2_SetOutput(); }
-static void S2_SetInput(void) { IR2_SetInput(); }
-static void S2_SetVal(void) { IR2_SetVal(); }
-static bool S2_GetVal(void) { return IR2_GetVal(); }
-
-static void S3_SetOutput(void) { IR3_SetOutput(); }
-static void S3_SetInput(void) { IR3_SetInput(); }
-static void S3_SetVal(void) { IR3_SetVal(); }
-static bool S3_GetVal(void) { return IR3_GetVal(); }
-
-static void S4_SetOutput(void) { IR4_SetOutput(); }
-static void S4_SetInput(void) { IR4_SetInput(); }
-static void S4_SetVal(void) { IR4_SetVal(); }
-static bool S4_GetVal(void) { return IR4_GetVal(); }
-
-static void S5_SetOutput(void) { IR5_SetOutput(); }
-static void S5_SetInput(void) { IR5_SetInput(); }
-static void S5_SetVal(void) { IR5_SetVal(); }
-static bool S5_GetVal(void) { return IR5_GetVal(); }
-
-static void S6_SetOutput(void) { IR6_SetOutput(); }
-static void S6_SetInput(void) { IR6_SetInput(); }
-static void S6_SetVal(void) { IR6_SetVal(); }
-static bool S6_GetVal(void) { return IR6_GetVal(); }
+/* Functions as wrapper around macro, one set for each sensor of REF_SENSOR_TABLE. */
+#define REF_SENSOR_WRAPPERS(pos, nr, pin) \
+  static void S##nr##_SetOutput(void) { IR##nr##_SetOutput(); } \
+  static void S##nr##_SetInput(void) { IR##nr##_SetInput(); } \
+  static void S##nr##_SetVal(void) { IR##nr##_SetVal(); } \
+  static bool S##nr##_GetVal(void) { return IR##nr##_GetVal(); }
+REF_SENSOR_TABLE(REF_SENSOR_WRAPPERS)
 
+#define REF_SENSOR_FCT_ENTRY(pos, nr, pin)  [pos] = {S##nr##_SetOutput, S##nr##_SetInput, S##nr##_SetVal, S##nr##_GetVal},
 static const SensorFctType SensorFctArray[REF_NOF_SENSORS] = {
-  {S1_SetOutput, S1_SetInput, S1_SetVal, S1_GetVal},
-  {S2_SetOutput, S2_SetInput, S2_SetVal, S2_GetVal},
-  {S3_SetOutput, S3_SetInput, S3_SetVal, S3_GetVal},
-  {S4_SetOutput, S4_SetInput, S4_SetVal, S4_GetVal},
-  {S5_SetOutput, S5_SetInput, S5_SetVal, S5_GetVal},
-  {S6_SetOutput, S6_SetInput, S6_SetVal, S6_GetVal},
+  REF_SENSOR_TABLE(REF_SENSOR_FCT_ENTRY)
 };
 
-#if 1 | PL_CONFIG_HAS_LINE_MAZE
-void REF_GetSensorValues(uint16_t *values, int nofValues) {
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR || REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+#define REF_SENSOR_PIN_ENTRY(pos, nr, pin)  [pos] = pin,
+static const uint8_t SensorPinArray[REF_NOF_SENSORS] = { /* port pin number of each sensor */
+  REF_SENSOR_TABLE(REF_SENSOR_PIN_ENTRY)
+};
+#endif
+
+#if REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+#define REF_SENSOR_MASK_ENTRY(pos, nr, pin)  [pos] = 1U<<(pin),
+static const uint32_t SensorPinMask[REF_NOF_SENSORS] = { /* GPIO bit mask of each sensor */
+  REF_SENSOR_TABLE(REF_SENSOR_MASK_ENTRY)
+};
+#endif
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR || REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+#define REF_SENSOR_PORT_MASK(pos, nr, pin)   |(1U<<(pin))
+static const uint32_t SensorPortMask = 0 REF_SENSOR_TABLE(REF_SENSOR_PORT_MASK); /* port bit mask of all sensors */
+#endif
+
+#if REF_MEASURE_METHOD==REF_MEASURE_POLL_FCT || REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+static uint16_t refPollLoopCnt = 0; /* number of sampling loop iterations of the last measurement */
+#endif
+
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+#define REF_ALL_SENSORS_MASK  ((1U<<REF_NOF_SENSORS)-1) /* one bit for each sensor */
+static volatile uint8_t refCapturePending = 0; /* bit set for each sensor still waiting for its discharge edge */
+static SensorTimeType *volatile refCaptureRaw = NULL; /* where the interrupt stores the time stamps */
+static xTaskHandle refCaptureTask = NULL; /* task waiting for the capture to complete */
+#endif
+
+/* Snapshots are double buffered (SeqLock.h): the writer is ReflTask, readers never wait for it. */
+static REF_Snapshot refSnapshotBuf[2];
+static SEQ_Lock refSnapshotLock; /* number of published snapshots */
+
+void REF_GetSnapshot(REF_Snapshot *snapshot) {
+  (void)SEQ_Read(&refSnapshotLock, snapshot, refSnapshotBuf, sizeof(*snapshot));
+}
+
+static void REF_PublishSnapshot(SensorTimeType calib[REF_NOF_SENSORS], int16_t lineValue, REF_LineKind lineKind) {
+  REF_Snapshot *snapshot;
   int i;
 
-  for(i=0;i<nofValues && i<REF_NOF_SENSORS;i++) {
-    values[i] = SensorCalibrated[i];
+  snapshot = &refSnapshotBuf[SEQ_WriteIndex(&refSnapshotLock)]; /* buffer not used by readers */
+  snapshot->seq = refSnapshotLock.seq+1;
+  snapshot->timestamp = xTaskGetTickCount();
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    snapshot->calib[i] = calib[i];
+  }
+  snapshot->lineValue = lineValue;
+  snapshot->lineKind = lineKind;
+  snapshot->linePos = refTracker.posQ8>>8;
+  snapshot->lineVel = refTracker.vel;
+  snapshot->lineConfidence = refTracker.confidence;
+  snapshot->lineHeld = refTracker.held;
+  SEQ_Publish(&refSnapshotLock);
+}
+
+/* tasks which get notified for each new sample, and the sampling period they need */
+typedef struct {
+  xTaskHandle task;     /* subscribed task, NULL for a free entry */
+  uint32_t notifyBits;  /* notification bits set in the task for a new sample */
+  uint16_t periodMs;    /* sampling period requested */
+} REF_SubscriberT;
+
+static REF_SubscriberT refSubscribers[REF_MAX_SUBSCRIBERS];
+static xSemaphoreHandle refWakeSem = NULL; /* wakes up ReflTask if the sampling period has changed */
+static uint16_t refPeriodMs = REF_IDLE_PERIOD_MS; /* current sampling period */
+static uint16_t refSampleRate = 0; /* effective number of samples per second */
+static uint32_t refMissedDeadlines = 0; /* number of samples not taken in time */
+
+uint8_t REF_Subscribe(xTaskHandle task, uint32_t notifyBits, uint16_t periodMs) {
+  int i, freeIdx = -1;
+  uint8_t res = ERR_FAILED;
+
+  if (periodMs<REF_MIN_PERIOD_MS) {
+    periodMs = REF_MIN_PERIOD_MS;
+  }
+  taskENTER_CRITICAL();
+  for(i=0;i<REF_MAX_SUBSCRIBERS;i++) {
+    if (refSubscribers[i].task==task) { /* already subscribed: update */
+      freeIdx = i;
+      break;
+    } else if (refSubscribers[i].task==NULL && freeIdx<0) {
+      freeIdx = i;
+    }
+  }
+  if (freeIdx>=0) {
+    refSubscribers[freeIdx].task = task;
+    refSubscribers[freeIdx].notifyBits = notifyBits;
+    refSubscribers[freeIdx].periodMs = periodMs;
+    res = ERR_OK;
+  }
+  taskEXIT_CRITICAL();
+  if (res==ERR_OK) {
+    (void)xSemaphoreGive(refWakeSem); /* apply new period */
+  }
+  return res;
+}
+
+void REF_Unsubscribe(xTaskHandle task) {
+  int i;
+
+  taskENTER_CRITICAL();
+  for(i=0;i<REF_MAX_SUBSCRIBERS;i++) {
+    if (refSubscribers[i].task==task) {
+      refSubscribers[i].task = NULL;
+    }
+  }
+  taskEXIT_CRITICAL();
+}
+
+/*!
+ * \brief Returns the sampling period needed by the subscribers and the calibration.
+ * \param nofSubscribers Where to store the number of subscribers, or NULL.
+ */
+static uint16_t REF_GetPeriodMs(uint8_t *nofSubscribers) {
+  int i;
+  uint16_t period = REF_IDLE_PERIOD_MS;
+  uint8_t cnt = 0;
+
+  if (refState==REF_STATE_CALIBRATING && REF_CALIB_PERIOD_MS<period) {
+    period = REF_CALIB_PERIOD_MS;
+  }
+#if REF_AUTO_CALIB
+  if (refState==REF_STATE_START_AUTO_CALIBRATION || refState==REF_STATE_AUTO_CALIBRATING) {
+    period = REF_MIN_PERIOD_MS; /* as many samples as possible during the spin */
+  }
+#endif
+  taskENTER_CRITICAL();
+  for(i=0;i<REF_MAX_SUBSCRIBERS;i++) {
+    if (refSubscribers[i].task!=NULL) {
+      cnt++;
+      if (refSubscribers[i].periodMs<period) {
+        period = refSubscribers[i].periodMs;
+      }
+    }
+  }
+  taskEXIT_CRITICAL();
+  if (nofSubscribers!=NULL) {
+    *nofSubscribers = cnt;
+  }
+  return period;
+}
+
+/*!
+ * \brief Tells all subscribers that a new sample is available.
+ */
+static void REF_NotifySubscribers(void) {
+  int i;
+  xTaskHandle task;
+  uint32_t bits;
+
+  for(i=0;i<REF_MAX_SUBSCRIBERS;i++) {
+    taskENTER_CRITICAL();
+    task = refSubscribers[i].task;
+    bits = refSubscribers[i].notifyBits;
+    taskEXIT_CRITICAL();
+    if (task!=NULL) {
+      (void)xTaskNotify(task, bits, eSetBits);
+    }
+  }
+}
+
+#if REF_AUTO_CALIB
+static volatile bool refAutoCalibRequest = FALSE; /* set by REF_CalibrateAuto() */
+static RefStateType refAutoCalibPrevState; /* state to return to if the calibration fails */
+static SensorCalibT refAutoCalibPrevData; /* calibration data to restore if the calibration fails */
+static TickType_t refAutoCalibStartTick; /* start time of the spin */
+static TickType_t refAutoCalibDoneTick; /* time when all sensors have seen the line */
+static bool refAutoCalibDone; /* TRUE if all sensors have seen the line */
+
+uint8_t REF_CalibrateAuto(void) {
+  if (refState!=REF_STATE_NOT_CALIBRATED && refState!=REF_STATE_READY) {
+    return ERR_BUSY;
+  }
+  refAutoCalibRequest = TRUE;
+  (void)xSemaphoreGive(refWakeSem); /* do not wait for the idle period */
+  return ERR_OK;
+}
+
+/*!
+ * \brief Checks if every sensor has seen both the line and the background.
+ * \return TRUE if all sensors have a sufficient min/max range.
+ */
+static bool REF_CalibHasConverged(void) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (SensorCalibMinMax.maxVal[i]<SensorCalibMinMax.minVal[i]+REF_AUTO_CALIB_MIN_RANGE) {
+      return FALSE;
+    }
+    if (SensorCalibMinMax.maxVal[i]<2*SensorCalibMinMax.minVal[i]) { /* line needs at least twice the discharge time */
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/*!
+ * \brief Checks if an automatic calibration has been requested, and starts it.
+ */
+static void REF_CheckAutoCalibRequest(void) {
+  if (refAutoCalibRequest) {
+    refAutoCalibRequest = FALSE;
+    refAutoCalibPrevState = refState;
+    refState = REF_STATE_START_AUTO_CALIBRATION;
   }
 }
 #endif
@@ -131,29 +373,214 @@ void REF_GetSensorValues(uint16_t *values, int nofValues) {
 void REF_CalibrateStartStop(void) {
   if (refState==REF_STATE_NOT_CALIBRATED || refState==REF_STATE_CALIBRATING || refState==REF_STATE_READY) {
     (void)xSemaphoreGive(REF_StartStopSem);
+    (void)xSemaphoreGive(refWakeSem); /* do not wait for the idle period */
   }
 }
 #endif
 
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
 /*!
- * \brief Measures the time until the sensor discharges
+ * \brief Stores the time stamp for all sensors which have a pending capture and an edge flag set.
+ * \param pending Bit set of sensors still waiting for the discharge, updated
+ * \param edgeSensors Bit set of sensors which have seen the falling edge
+ * \param timerVal Time stamp of the edge(s)
  * \param raw Array to store the raw values.
- * \return ERR_OVERFLOW if there is a timeout, ERR_OK otherwise
+ * \return Bit set of sensors which got a time stamp.
  */
-static void REF_MeasureRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
+static uint8_t REF_CaptureEdges(volatile uint8_t *pending, uint8_t edgeSensors, SensorTimeType timerVal, SensorTimeType raw[REF_NOF_SENSORS]) {
+  uint8_t i, captured;
+
+  captured = (*pending)&edgeSensors;
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (captured&(1<<i)) {
+      raw[i] = timerVal;
+    }
+  }
+  *pending &= ~captured;
+  return captured;
+}
+
+/*!
+ * \brief Checks the captured values after the capture has been finished or timed out.
+ * Sensors without a capture, or with a capture after the timeout, are marked with MAX_SENSOR_VALUE.
+ * \param raw Array with the raw values.
+ * \param timeoutCntVal Timeout in timer ticks.
+ * \return TRUE if at least one sensor did not discharge within the timeout.
+ */
+static bool REF_CaptureFinish(SensorTimeType raw[REF_NOF_SENSORS], RefCnt_TValueType timeoutCntVal) {
+  uint8_t i;
+  bool isTimeout = FALSE;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (raw[i]==MAX_SENSOR_VALUE || raw[i]>timeoutCntVal) { /* no edge, or too late */
+      raw[i] = MAX_SENSOR_VALUE;
+      isTimeout = TRUE;
+    }
+  }
+  return isTimeout;
+}
+
+void REF_OnPortInterrupt(void) {
+  /* called from the port interrupt: the first thing is to get the time stamp */
+  RefCnt_TValueType timerVal = RefCnt_GetCounterValue(timerHandle);
+  uint32_t flags;
+  uint8_t i, edgeSensors, captured;
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+
+  flags = PORT_PDD_GetInterruptFlags(REF_SENSOR_PORT)&SensorPortMask; /* other pins of the port are not ours */
+  PORT_PDD_ClearInterruptFlags(REF_SENSOR_PORT, flags);
+  edgeSensors = 0;
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (flags&(1U<<SensorPinArray[i])) {
+      edgeSensors |= (1<<i);
+    }
+  }
+  if (refCaptureRaw==NULL) {
+    return; /* no measurement active */
+  }
+  captured = REF_CaptureEdges(&refCapturePending, edgeSensors, (SensorTimeType)timerVal, refCaptureRaw);
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (captured&(1<<i)) { /* only one edge per sensor and measurement */
+      PORT_PDD_SetPinInterruptConfiguration(REF_SENSOR_PORT, SensorPinArray[i], PORT_PDD_INTERRUPT_DMA_DISABLED);
+    }
+  }
+  if (captured!=0 && refCapturePending==0 && refCaptureTask!=NULL) { /* all values are in */
+    vTaskNotifyGiveFromISR(refCaptureTask, &higherPriorityTaskWoken);
+    portYIELD_FROM_ISR(higherPriorityTaskWoken);
+  }
+}
+
+/*!
+ * \brief Measures the discharge time with the port interrupt. Interrupts stay enabled, and the task is blocked until all sensors have discharged or the timeout has expired.
+ * The task blocks for the full tick periods within the timeout, and busy waits the rest of it on the timer counter, so the measurement never takes longer than the timeout.
+ * \param raw Array to store the raw values.
+ * \param timeoutUs Timeout in microseconds.
+ * \param darkUs 0, or the time after the start of the discharge the IR LED's are switched on (busy waited).
+ * \param ledOnCnt Where to store the timer value at which the IR LED's have been switched on, if darkUs is not 0.
+ * \return TRUE if there was a timeout.
+ */
+static bool REF_MeasureCapture(SensorTimeType raw[REF_NOF_SENSORS], uint16_t timeoutUs, uint16_t darkUs, RefCnt_TValueType *ledOnCnt) {
+  uint8_t i;
+  const RefCnt_TValueType timeoutCntVal = REF_US_TO_CNT(timeoutUs);
+  const TickType_t timeoutTicks = (timeoutUs-darkUs)/(1000*portTICK_PERIOD_MS); /* the next tick might be right ahead: the block ends before the timeout */
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    SensorFctArray[i].SetOutput(); /* turn I/O line as output */
+    SensorFctArray[i].SetVal(); /* put high */
+    raw[i] = MAX_SENSOR_VALUE;
+  }
+  (void)ulTaskNotifyTake(pdTRUE, 0); /* clear any notification left over from a previous measurement */
+  refCaptureTask = xTaskGetCurrentTaskHandle();
+  WAIT1_Waitus(50); /* give at least 10 us to charge the capacitor */
+  taskENTER_CRITICAL(); /* only for the switch to input, so all sensors start at the same time */
+  refCaptureRaw = raw;
+  refCapturePending = REF_ALL_SENSORS_MASK;
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    PORT_PDD_SetPinInterruptConfiguration(REF_SENSOR_PORT, SensorPinArray[i], PORT_PDD_INTERRUPT_ON_FALLING);
+    PORT_PDD_ClearPinInterruptFlag(REF_SENSOR_PORT, SensorPinArray[i]);
+  }
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    SensorFctArray[i].SetInput(); /* turn I/O line as input */
+  }
+  (void)RefCnt_ResetCounter(timerHandle); /* reset timer counter */
+  taskEXIT_CRITICAL();
+  if (darkUs!=0) {
+    while (RefCnt_GetCounterValue(timerHandle)<REF_US_TO_CNT(darkUs)) {
+      /* busy wait, the interrupt takes the time stamps of sensors discharged by the ambient light alone */
+    }
+    taskENTER_CRITICAL(); /* the timer value has to be the one of the switch */
+    LED_IR_On(); /* IR LED's on */
+    *ledOnCnt = RefCnt_GetCounterValue(timerHandle);
+    taskEXIT_CRITICAL();
+  }
+  if (timeoutTicks>0) {
+    (void)ulTaskNotifyTake(pdTRUE, timeoutTicks); /* notified by the interrupt if all sensors are done */
+  }
+  while (refCapturePending!=0 && RefCnt_GetCounterValue(timerHandle)<=timeoutCntVal) {
+    /* busy wait the rest of the timeout, the interrupt keeps taking the time stamps meanwhile */
+  }
+  taskENTER_CRITICAL();
+  for(i=0;i<REF_NOF_SENSORS;i++) { /* stop capture for the ones still pending */
+    PORT_PDD_SetPinInterruptConfiguration(REF_SENSOR_PORT, SensorPinArray[i], PORT_PDD_INTERRUPT_DMA_DISABLED);
+  }
+  refCapturePending = 0;
+  refCaptureRaw = NULL;
+  taskEXIT_CRITICAL();
+  return REF_CaptureFinish(raw, timeoutCntVal);
+}
+#elif REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+/*!
+ * \brief Measures the discharge time by polling the sensor port with interrupts disabled.
+ * The data input register is read once per loop iteration, and all sensors discharged since the last iteration get the same time stamp.
+ * \param raw Array to store the raw values.
+ * \param timeoutUs Timeout in microseconds.
+ * \param darkUs 0, or the time after the start of the discharge the IR LED's are switched on.
+ * \param ledOnCnt Where to store the timer value at which the IR LED's have been switched on, if darkUs is not 0.
+ * \return TRUE if there was a timeout.
+ */
+static bool REF_MeasurePoll(SensorTimeType raw[REF_NOF_SENSORS], uint16_t timeoutUs, uint16_t darkUs, RefCnt_TValueType *ledOnCnt) {
+  uint8_t i;
+  uint16_t loops = 0;
+  uint32_t pending, discharged;
+  RefCnt_TValueType timerVal;
+  const RefCnt_TValueType timeoutCntVal = REF_US_TO_CNT(timeoutUs);
+  RefCnt_TValueType ledOnCntVal = darkUs!=0 ? REF_US_TO_CNT(darkUs) : (RefCnt_TValueType)-1; /* -1: never */
+  bool isTimeout = FALSE;
+
+  taskENTER_CRITICAL();
+  GPIO_PDD_SetPortDataOutputMask(REF_SENSOR_GPIO, SensorPortMask); /* put high */
+  GPIO_PDD_SetPortOutputDirectionMask(REF_SENSOR_GPIO, SensorPortMask); /* turn I/O lines as output */
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    raw[i] = MAX_SENSOR_VALUE;
+  }
+  WAIT1_Waitus(50); /* give at least 10 us to charge the capacitor */
+  GPIO_PDD_SetPortInputDirectionMask(REF_SENSOR_GPIO, SensorPortMask); /* turn all I/O lines as input with one write */
+  (void)RefCnt_ResetCounter(timerHandle); /* reset timer counter */
+  pending = SensorPortMask;
+  do {
+    timerVal = RefCnt_GetCounterValue(timerHandle);
+    loops++;
+    if (timerVal>=ledOnCntVal) { /* end of the dark part of an ambient frame */
+      LED_IR_On(); /* IR LED's on */
+      *ledOnCnt = timerVal;
+      ledOnCntVal = (RefCnt_TValueType)-1;
+    }
+    if (timerVal>timeoutCntVal) {
+      isTimeout = TRUE;
+      break; /* get out of while loop */
+    }
+    discharged = pending&~GPIO_PDD_GetPortDataInput(REF_SENSOR_GPIO); /* all sensors with one read */
+    if (discharged!=0) {
+      pending &= ~discharged;
+      for(i=0;i<REF_NOF_SENSORS;i++) {
+        if (discharged&SensorPinMask[i]) {
+          raw[i] = (SensorTimeType)timerVal;
+        }
+      }
+    }
+  } while(pending!=0);
+  taskEXIT_CRITICAL();
+  refPollLoopCnt = loops;
+  return isTimeout;
+}
+#else
+/*!
+ * \brief Measures the discharge time by polling the sensor lines with interrupts disabled.
+ * \param raw Array to store the raw values.
+ * \param timeoutUs Timeout in microseconds.
+ * \param darkUs 0, or the time after the start of the discharge the IR LED's are switched on.
+ * \param ledOnCnt Where to store the timer value at which the IR LED's have been switched on, if darkUs is not 0.
+ * \return TRUE if there was a timeout.
+ */
+static bool REF_MeasurePoll(SensorTimeType raw[REF_NOF_SENSORS], uint16_t timeoutUs, uint16_t darkUs, RefCnt_TValueType *ledOnCnt) {
   uint8_t cnt; /* number of sensor */
   uint8_t i;
+  uint16_t loops = 0;
   RefCnt_TValueType timerVal;
-  /*! \todo Consider reentrancy and mutual exclusion! */
-#if 1 /*! \todo added timout */
-  #define REF_SENSOR_TIMEOUT_US  1500
-  const RefCnt_TValueType timeoutCntVal = ((RefCnt_CNT_INP_FREQ_U_0/1000)*REF_SENSOR_TIMEOUT_US)/1000 /* REF_SENSOR_TIMEOUT_US translated into timeout ticks */;
+  const RefCnt_TValueType timeoutCntVal = REF_US_TO_CNT(timeoutUs);
+  RefCnt_TValueType ledOnCntVal = darkUs!=0 ? REF_US_TO_CNT(darkUs) : (RefCnt_TValueType)-1; /* -1: never */
   bool isTimeout = FALSE;
-#endif
 
-  (void)xSemaphoreTake(mutexHandle, portMAX_DELAY);
-  LED_IR_On(); /* IR LED's on */
-  WAIT1_Waitus(200);
   taskENTER_CRITICAL();
   for(i=0;i<REF_NOF_SENSORS;i++) {
     SensorFctArray[i].SetOutput(); /* turn I/O line as output */
@@ -167,12 +594,16 @@ static void REF_MeasureRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
   (void)RefCnt_ResetCounter(timerHandle); /* reset timer counter */
   do {
     timerVal = RefCnt_GetCounterValue(timerHandle);
-#if 1 /*! \todo add timeout */
+    loops++;
+    if (timerVal>=ledOnCntVal) { /* end of the dark part of an ambient frame */
+      LED_IR_On(); /* IR LED's on */
+      *ledOnCnt = timerVal;
+      ledOnCntVal = (RefCnt_TValueType)-1;
+    }
     if (timerVal>timeoutCntVal) {
       isTimeout = TRUE;
       break; /* get out of while loop */
     }
-#endif
     cnt = 0;
     for(i=0;i<REF_NOF_SENSORS;i++) {
       if (raw[i]==MAX_SENSOR_VALUE) { /* not measured yet? */
@@ -185,8 +616,190 @@ static void REF_MeasureRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
     }
   } while(cnt!=REF_NOF_SENSORS);
   taskEXIT_CRITICAL();
+  refPollLoopCnt = loops;
+  return isTimeout;
+}
+#endif
+
+/*!
+ * \brief Measures the discharge time with the selected method.
+ * \param raw Array to store the raw values, MAX_SENSOR_VALUE if not discharged within the timeout.
+ * \param timeoutUs Timeout in microseconds, from the start of the discharge.
+ * \param darkUs 0 if the IR LED's are already on, else the time after the start of the discharge to switch them on.
+ * \param ledOnCnt Where to store the timer value at which the IR LED's have been switched on, if darkUs is not 0.
+ * \return TRUE if there was a timeout.
+ */
+static bool REF_MeasureDischarge(SensorTimeType raw[REF_NOF_SENSORS], uint16_t timeoutUs, uint16_t darkUs, RefCnt_TValueType *ledOnCnt) {
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+  return REF_MeasureCapture(raw, timeoutUs, darkUs, ledOnCnt);
+#else
+  return REF_MeasurePoll(raw, timeoutUs, darkUs, ledOnCnt);
+#endif
+}
+
+#if REF_AMBIENT_COMPENSATION
+/* The discharge time is inversely proportional to the light on the sensor. Ambient light is handled as intensity
+ * (REF_AMBIENT_SCALE/discharge time), so it can be subtracted from the intensity measured with the IR LED's on.
+ * It is measured without a discharge of its own: in an ambient frame the sensors start to discharge in the dark, and
+ * the IR LED's are switched on D=REF_LED_SETTLE_US later. With the intensities A (ambient) and L (IR), a sensor
+ * discharges at t=(SCALE+L*D)/(A+L) then, and at t0=SCALE/(A+L) with the IR LED's on all the time. The difference
+ * t-t0=D*L/(A+L) is the IR share of the light, so A=(SCALE/t0)*(D-(t-t0))/D, for weak and strong ambient light alike.
+ * t0 is the mean of the measurements before and after the ambient frame, and the frame is not used if they differ:
+ * a sensor moving over a line changes its light in between. */
+#define REF_AMBIENT_SCALE   (1UL<<24)
+static uint32_t refAmbient[REF_NOF_SENSORS]; /* filtered ambient light intensity of each sensor */
+static SensorTimeType refAmbientLit[REF_NOF_SENSORS]; /* discharge time of the last measurement with the IR LED's on, not compensated, 0 for none */
+static SensorTimeType refAmbientFrame[REF_NOF_SENSORS]; /* discharge time in the last ambient frame, 0 if used or discharged in the dark */
+static RefCnt_TValueType refAmbientLedOnCnt; /* timer value at which the IR LED's have been switched on in the last ambient frame */
+static uint8_t refAmbientCnt = 0; /* measurement counter for the ambient frames */
+
+/*!
+ * \brief Discharge time a sensor would have with the IR light only.
+ * \param intensity Intensity of all light on the sensor.
+ * \param ambient Intensity of the ambient light on the sensor.
+ * \param timeoutCntVal Timeout in timer ticks.
+ * \return Discharge time in timer ticks, MAX_SENSOR_VALUE if not within the timeout.
+ */
+static SensorTimeType REF_IrOnlyTime(uint32_t intensity, uint32_t ambient, RefCnt_TValueType timeoutCntVal) {
+  uint32_t time;
+
+  if (intensity<=ambient) { /* no IR light left */
+    return MAX_SENSOR_VALUE;
+  }
+  time = REF_AMBIENT_SCALE/(intensity-ambient);
+  if (time>timeoutCntVal) {
+    return MAX_SENSOR_VALUE;
+  }
+  return (SensorTimeType)time;
+}
+
+/*!
+ * \brief Updates the filtered ambient intensity of a sensor from the last ambient frame and the measurements around it.
+ * \param i Sensor index.
+ * \param before Discharge time before the ambient frame, not compensated.
+ * \param after Discharge time after the ambient frame, not compensated.
+ */
+static void REF_UpdateAmbient(uint8_t i, SensorTimeType before, SensorTimeType after) {
+  int32_t lit, shift, intensity;
+  const int32_t ledOnCnt = refAmbientLedOnCnt;
+
+  if (before==0 || before==MAX_SENSOR_VALUE || after==MAX_SENSOR_VALUE) {
+    return;
+  }
+  lit = ((int32_t)before+(int32_t)after)/2;
+  if ((int32_t)before-(int32_t)after>lit/REF_AMBIENT_MAX_CHANGE || (int32_t)after-(int32_t)before>lit/REF_AMBIENT_MAX_CHANGE) {
+    return; /* the light has changed */
+  }
+  shift = (int32_t)refAmbientFrame[i]-lit; /* D*L/(A+L) */
+  if (shift<0) {
+    shift = 0;
+  } else if (shift>ledOnCnt) {
+    shift = ledOnCnt;
+  }
+  intensity = (int32_t)(((REF_AMBIENT_SCALE/ledOnCnt)*(ledOnCnt-shift))/lit);
+  refAmbient[i] += (intensity-(int32_t)refAmbient[i])/REF_AMBIENT_FILTER;
+}
+
+/*!
+ * \brief Ambient frame: measures with the IR LED's switched on REF_LED_SETTLE_US after the start of the discharge, so it takes
+ * no longer than a measurement with the IR LED's settling before it. Sensors discharged in the dark give the ambient intensity
+ * right away, the others with the next measurement. The ambient light is removed from the measurement.
+ * \param raw Array to store the raw values, with the IR light only.
+ * \return TRUE if there was a timeout.
+ */
+static bool REF_MeasureAmbient(SensorTimeType raw[REF_NOF_SENSORS]) {
+  const RefCnt_TValueType timeoutCntVal = REF_US_TO_CNT(REF_SENSOR_TIMEOUT_US);
+  RefCnt_TValueType ledOnCnt = (RefCnt_TValueType)-1; /* stays if all sensors discharged in the dark */
+  int32_t intensity;
+  uint8_t i;
+  bool isTimeout = FALSE;
+
+  (void)REF_MeasureDischarge(raw, REF_LED_SETTLE_US+REF_SENSOR_TIMEOUT_US, REF_LED_SETTLE_US, &ledOnCnt);
   LED_IR_Off(); /* IR LED's off */
-#if 1 /*! \todo added timeout */
+  refAmbientLedOnCnt = ledOnCnt;
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    refAmbientFrame[i] = 0;
+    if (raw[i]==MAX_SENSOR_VALUE) { /* no edge: nothing to learn */
+      isTimeout = TRUE;
+      continue;
+    }
+    if (raw[i]<=ledOnCnt) { /* discharged in the dark, by the ambient light alone */
+      intensity = REF_AMBIENT_SCALE/(raw[i]!=0?raw[i]:1);
+      refAmbient[i] += (intensity-(int32_t)refAmbient[i])/REF_AMBIENT_FILTER;
+      if (refAmbientLit[i]!=0 && refAmbientLit[i]!=MAX_SENSOR_VALUE) { /* the IR light of the last measurement instead */
+        raw[i] = REF_IrOnlyTime(REF_AMBIENT_SCALE/refAmbientLit[i], refAmbient[i], timeoutCntVal);
+      } else {
+        raw[i] = MAX_SENSOR_VALUE;
+      }
+    } else {
+      refAmbientFrame[i] = raw[i]; /* used with the next measurement */
+      if (refAmbient[i]<REF_AMBIENT_SCALE/ledOnCnt) { /* intensity of all light, as if the IR LED's had been on from the start */
+        raw[i] = REF_IrOnlyTime((REF_AMBIENT_SCALE-refAmbient[i]*ledOnCnt)/(raw[i]-ledOnCnt), refAmbient[i], timeoutCntVal);
+      } else { /* the ambient light alone should have discharged it in the dark */
+        raw[i] = MAX_SENSOR_VALUE;
+      }
+    }
+    if (raw[i]==MAX_SENSOR_VALUE) {
+      isTimeout = TRUE;
+    }
+  }
+  return isTimeout;
+}
+
+/*!
+ * \brief Removes the ambient light from the discharge times measured with the IR LED's on.
+ * \param raw Discharge times, replaced by the times the sensors would have with the IR light only.
+ * \param timeoutCntVal Timeout in timer ticks.
+ * \return TRUE if a sensor gets a timeout because of the compensation.
+ */
+static bool REF_CompensateAmbient(SensorTimeType raw[REF_NOF_SENSORS], RefCnt_TValueType timeoutCntVal) {
+  uint8_t i;
+  bool isTimeout = FALSE;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (refAmbientFrame[i]!=0) { /* first measurement after an ambient frame */
+      REF_UpdateAmbient(i, refAmbientLit[i], raw[i]);
+      refAmbientFrame[i] = 0;
+    }
+    refAmbientLit[i] = raw[i]; /* for the next ambient frame */
+    if (refAmbient[i]!=0 && raw[i]!=MAX_SENSOR_VALUE) {
+      raw[i] = REF_IrOnlyTime(REF_AMBIENT_SCALE/(raw[i]!=0?raw[i]:1), refAmbient[i], timeoutCntVal);
+      if (raw[i]==MAX_SENSOR_VALUE) {
+        isTimeout = TRUE;
+      }
+    }
+  }
+  return isTimeout;
+}
+#endif
+
+static void REF_MeasureRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
+  uint8_t i;
+  bool isTimeout;
+
+  (void)xSemaphoreTake(mutexHandle, portMAX_DELAY);
+#if REF_AMBIENT_COMPENSATION
+  if (refAmbientCnt==0) { /* discharge in the dark while the IR LED's settle */
+    isTimeout = REF_MeasureAmbient(raw);
+  } else
+#endif
+  {
+    LED_IR_On(); /* IR LED's on */
+    WAIT1_Waitus(REF_LED_SETTLE_US);
+    isTimeout = REF_MeasureDischarge(raw, REF_SENSOR_TIMEOUT_US, 0, NULL);
+    LED_IR_Off(); /* IR LED's off */
+#if REF_AMBIENT_COMPENSATION
+    if (REF_CompensateAmbient(raw, REF_US_TO_CNT(REF_SENSOR_TIMEOUT_US))) {
+      isTimeout = TRUE;
+    }
+#endif
+  }
+#if REF_AMBIENT_COMPENSATION
+  refAmbientCnt++;
+  if (refAmbientCnt>=REF_AMBIENT_INTERVAL) {
+    refAmbientCnt = 0;
+  }
+#endif
   if (isTimeout) {
     for(i=0;i<REF_NOF_SENSORS;i++) {
       if (raw[i]==MAX_SENSOR_VALUE) { /* not measured yet? */
@@ -194,7 +807,6 @@ static void REF_MeasureRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
       }
     } /* for */
   }
-#endif
   (void)xSemaphoreGive(mutexHandle);
 }
 
@@ -212,29 +824,69 @@ static void REF_CalibrateMinMax(SensorTimeType min[REF_NOF_SENSORS], SensorTimeT
   }
 }
 
-static void ReadCalibrated(SensorTimeType calib[REF_NOF_SENSORS], SensorTimeType raw[REF_NOF_SENSORS]) {
+/*!
+ * \brief Calculates the scale factors for ReadCalibratedLine() from the min/max calibration values.
+ * Needs to be called each time SensorCalibMinMax has been changed.
+ *
+ * With L=ceil(log2(range)) (at least 1), k=2*L and recip=ceil(1000*2^k/range), (n*recip)>>k is exactly
+ * (n*1000)/range for all 0<=n<range: the reciprocal is too high by less than range/2^k per count, so for
+ * n<range the error stays below 1/range, the smallest distance of n*1000/range to the next integer.
+ * recip is below 2000*2^L, which fits into 32 bits, and n<<(32-k) is below 2^(32-L). So the kernel shifts
+ * n by 32-k and takes the upper word of the 64bit product (one UMULL on the Cortex-M4), without a correction.
+ */
+static void REF_UpdateScale(void) {
   int i;
-  int32_t x, denominator;
+  SensorTimeType range;
+  uint8_t log2;
 
-  REF_MeasureRaw(raw);
   for(i=0;i<REF_NOF_SENSORS;i++) {
-    x = 0;
-    denominator = SensorCalibMinMax.maxVal[i]-SensorCalibMinMax.minVal[i];
-    if (denominator!=0) {
-      x = (((int32_t)raw[i]-SensorCalibMinMax.minVal[i])*1000)/denominator;
-    }
-    if (x<0) {
-      x = 0;
-    } else if (x>1000) {
-      x = 1000;
+    SensorScale.offset[i] = SensorCalibMinMax.minVal[i];
+    if (SensorCalibMinMax.maxVal[i]>SensorCalibMinMax.minVal[i]) {
+      range = SensorCalibMinMax.maxVal[i]-SensorCalibMinMax.minVal[i];
+      log2 = 1;
+      while ((1UL<<log2)<range) {
+        log2++;
+      }
+      SensorScale.range[i] = range;
+      SensorScale.shift[i] = 32-2*log2;
+      SensorScale.recip[i] = (uint32_t)(((1000ULL<<(2*log2))+range-1)/range); /* rounded up */
+    } else { /* not calibrated: all values will be zero */
+      SensorScale.range[i] = 0;
+      SensorScale.recip[i] = 0;
+      SensorScale.shift[i] = 0;
     }
-    calib[i] = x;
   }
 }
 
+#if REF_SENSOR1_IS_LEFT
+  #define REF_WEIGHT(i)   (((i)+1)*1000)
+#else
+  #define REF_WEIGHT(i)   ((REF_NOF_SENSORS-(i))*1000)
+#endif
+
+/* weight of each sensor for the line position, in pairs of two for the dual 16bit multiply-accumulate */
+#define REF_SENSOR_WEIGHT_ENTRY(pos, nr, pin)  [pos] = REF_WEIGHT(pos),
+static const uint16_t SensorWeight[REF_NOF_SENSORS+1] = {
+  REF_SENSOR_TABLE(REF_SENSOR_WEIGHT_ENTRY)
+  [REF_NOF_SENSORS] = 0 /* padding for an odd number of sensors */
+};
+
+/*!
+ * \brief Dual 16bit multiply-accumulate: acc + x.lo*y.lo + x.hi*y.hi. All values have to be positive and below 0x8000.
+ */
+static inline uint32_t REF_MulAcc2(uint32_t acc, uint32_t x, uint32_t y) {
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  __asm("smlad %0, %1, %2, %3" : "=r" (acc) : "r" (x), "r" (y), "r" (acc));
+  return acc;
+#else
+  return acc + (x&0xffff)*(y&0xffff) + (x>>16)*(y>>16);
+#endif
+}
+
 /*
- * Operates the same as read calibrated, but also returns an
- * estimated position of the robot with respect to a line. The
+ * Normalizes the raw values measured with REF_MeasureRaw() with the calibration
+ * data to 0 (white/min value) to 1000 (black/max value). Additionally it
+ * returns an estimated position of the robot with respect to a line. The
  * estimate is made using a weighted average of the sensor indices
  * multiplied by 1000, so that a return value of 1000 indicates that
  * the line is directly below sensor 0, a return value of 2000
@@ -251,48 +903,54 @@ static void ReadCalibrated(SensorTimeType calib[REF_NOF_SENSORS], SensorTimeType
  * surrounded by white (low values). If your line is light on
  * black, set the optional second argument white_line to true. In
  * this case, each sensor value will be replaced by (1000-value)
- * before the averaging.
+ * before the averaging. Values not above REF_MIN_NOISE_VAL are not
+ * taken into account, and if no sensor is above it, zero (no line) is returned.
+ *
+ * The normalization uses the reciprocal scale factors from REF_UpdateScale()
+ * and returns the same values as ((raw-min)*1000)/(max-min), clamped to 0..1000.
  */
-static int ReadLine(SensorTimeType calib[REF_NOF_SENSORS], SensorTimeType raw[REF_NOF_SENSORS], bool white_line) {
+static int ReadCalibratedLine(SensorTimeType calib[REF_NOF_SENSORS], const SensorTimeType raw[REF_NOF_SENSORS], bool white_line) {
   int i;
-  unsigned long avg; /* this is for the weighted total, which is long */
-  /* before division */
-  unsigned int sum; /* this is for the denominator which is <= 64000 */
-  unsigned int mul; /* multiplication factor, 0, 1000, 2000, 3000 ... */
-  int value;
+  int32_t n;
+  uint32_t x, d;
+  uint16_t value[REF_NOF_SENSORS+1]; /* noise gated values, with padding for an odd number of sensors */
+  uint32_t avg; /* weighted total, <= REF_NOF_SENSORS*1000*REF_NOF_SENSORS*1000 */
+  uint32_t sum; /* denominator, <= REF_NOF_SENSORS*1000 */
 
-  (void)raw; /* unused */
-  avg = 0;
-  sum = 0;
-  mul = 1000;
-#if REF_SENSOR1_IS_LEFT
   for(i=0;i<REF_NOF_SENSORS;i++) {
-#else
-  for(i=REF_NOF_SENSORS-1;i>=0;i--) {
-#endif
-    value = calib[i];
-    if(white_line) {
-      value = 1000-value;
+    n = (int32_t)raw[i]-SensorScale.offset[i];
+    d = SensorScale.range[i];
+    if (n<0) { /* clamp to 0..range: gives 0..1000, and 0 if not calibrated (recip is 0) */
+      n = 0;
+    } else if ((uint32_t)n>d) {
+      n = d;
     }
-    /* only average in values that are above a noise threshold */
-    if(value > REF_MIN_NOISE_VAL) {
-      avg += ((long)value)*mul;
-      sum += value;
+    x = (uint32_t)(((uint64_t)((uint32_t)n<<SensorScale.shift[i])*SensorScale.recip[i])>>32); /* exact for n<=d */
+    calib[i] = x;
+    if (white_line) {
+      x = 1000-x;
     }
-    mul += 1000;
+    /* only average in values that are above a noise threshold */
+    value[i] = (x>REF_MIN_NOISE_VAL)?x:0;
+  }
+  value[REF_NOF_SENSORS] = 0;
+  avg = 0;
+  sum = 0;
+  for(i=0;i<REF_NOF_SENSORS;i+=2) {
+    x = value[i]|((uint32_t)value[i+1]<<16);
+    avg = REF_MulAcc2(avg, x, SensorWeight[i]|((uint32_t)SensorWeight[i+1]<<16));
+    sum = REF_MulAcc2(sum, x, 0x00010001);
+  }
+  if (sum==0) { /* nothing above noise level */
+    return 0;
   }
   return avg/sum;
 }
 
-uint16_t REF_GetLineValue(void) {
-  return refCenterLineVal;
-}
-
 #if 1 || PL_CONFIG_HAS_LINE_FOLLOW
 static REF_LineKind ReadLineKind(SensorTimeType val[REF_NOF_SENSORS]) {
   uint32_t sum, sumLeft, sumRight, outerLeft, outerRight;
   int i;
-  #define REF_MIN_LINE_VAL      0x60   /* minimum value indicating a line */
 
   for(i=0;i<REF_NOF_SENSORS;i++) {
     if (val[i]<REF_MIN_LINE_VAL) { /* smaller value? White seen! */
@@ -354,20 +1012,220 @@ static REF_LineKind ReadLineKind(SensorTimeType val[REF_NOF_SENSORS]) {
 }
 #endif
 
-#if 1 || PL_CONFIG_HAS_LINE_FOLLOW
-static REF_LineKind refLineKind = REF_LINE_NONE;
+#define REF_WEIGHT_STEP   (REF_WEIGHT(1)-REF_WEIGHT(0)) /* line value distance between two sensors */
+#define REF_MIN_POS       (REF_WEIGHT_STEP>0?REF_WEIGHT(0):REF_WEIGHT(REF_NOF_SENSORS-1))
+#define REF_MAX_POS       (REF_WEIGHT_STEP>0?REF_WEIGHT(REF_NOF_SENSORS-1):REF_WEIGHT(0))
+
+/*!
+ * \brief Estimates the line position with sub-sensor resolution, using a parabola through the strongest sensor and its neighbours.
+ * \param calib Calibrated sensor values
+ * \param white_line TRUE for a white line on black
+ * \param pos Where to store the line position, same scale as ReadCalibratedLine()
+ * \param peak Where to store the value of the strongest sensor
+ * \return TRUE if a line has been found, FALSE otherwise
+ */
+static bool REF_PeakPosition(const SensorTimeType calib[REF_NOF_SENSORS], bool white_line, int32_t *pos, int32_t *peak) {
+  int i, k;
+  int32_t val[REF_NOF_SENSORS];
+  int32_t ym, yp, den, delta;
+
+  k = 0;
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    val[i] = white_line?1000-calib[i]:calib[i];
+    if (val[i]>val[k]) {
+      k = i;
+    }
+  }
+  if (val[k]<=REF_MIN_NOISE_VAL) {
+    return FALSE; /* no line */
+  }
+  ym = (k>0)?val[k-1]:0; /* missing neighbour beyond the array is white */
+  yp = (k<REF_NOF_SENSORS-1)?val[k+1]:0;
+  den = 2*(ym-2*val[k]+yp); /* <=0, as val[k] is the maximum */
+  delta = 0;
+  if (den<0) {
+    delta = (1000*(ym-yp))/den; /* vertex offset in 1/1000 of the sensor distance */
+    if (delta>500) {
+      delta = 500;
+    } else if (delta<-500) {
+      delta = -500;
+    }
+  }
+  *pos = REF_WEIGHT(k)+(delta*REF_WEIGHT_STEP)/1000;
+  *peak = val[k];
+  return TRUE;
+}
 
-REF_LineKind REF_GetLineKind(void) {
-  return refLineKind;
+static int32_t REF_LimitPosQ8(int32_t posQ8) {
+  if (posQ8<(REF_MIN_POS<<8)) {
+    return REF_MIN_POS<<8;
+  } else if (posQ8>(REF_MAX_POS<<8)) {
+    return REF_MAX_POS<<8;
+  }
+  return posQ8;
+}
+
+/*!
+ * \brief Updates the alpha-beta line tracker with a new sample. If the line is lost, the
+ * estimate is extrapolated for REF_TRACK_HOLD_MS, and marked as held meanwhile.
+ * \param calib Calibrated sensor values
+ */
+static void REF_TrackLine(const SensorTimeType calib[REF_NOF_SENSORS]) {
+  TickType_t now;
+  int32_t dt, meas, peak, predQ8, resQ8;
+
+  now = FRTOS1_xTaskGetTickCount();
+  dt = (now-refTracker.lastTick)*portTICK_PERIOD_MS;
+  refTracker.lastTick = now;
+  if (dt<=0) {
+    dt = 1;
+  }
+  if (REF_PeakPosition(calib, REF_USE_WHITE_LINE, &meas, &peak)) {
+    if (!refTracker.valid || dt>REF_TRACK_HOLD_MS) { /* (re-)start tracking */
+      refTracker.posQ8 = meas<<8;
+      refTracker.vel = 0;
+      refTracker.valid = TRUE;
+    } else {
+      predQ8 = refTracker.posQ8+(refTracker.vel*dt*256)/1000;
+      resQ8 = (meas<<8)-predQ8;
+      refTracker.posQ8 = REF_LimitPosQ8(predQ8+(REF_TRACK_ALPHA_Q8*resQ8)/256);
+      refTracker.vel += ((REF_TRACK_BETA_Q8*resQ8)/256)*1000/(dt*256);
+      if (refTracker.vel>REF_TRACK_MAX_VEL) {
+        refTracker.vel = REF_TRACK_MAX_VEL;
+      } else if (refTracker.vel<-REF_TRACK_MAX_VEL) {
+        refTracker.vel = -REF_TRACK_MAX_VEL;
+      }
+    }
+    refTracker.confidence = peak/10;
+    refTracker.held = FALSE;
+    refTracker.seenTick = now;
+  } else if (refTracker.valid && (now-refTracker.seenTick)*portTICK_PERIOD_MS<=REF_TRACK_HOLD_MS) {
+    /* brief dropout: coast with the last velocity */
+    refTracker.posQ8 = REF_LimitPosQ8(refTracker.posQ8+(refTracker.vel*dt*256)/1000);
+    refTracker.confidence /= 2;
+    refTracker.held = TRUE;
+  } else { /* line lost */
+    refTracker.valid = FALSE;
+    refTracker.vel = 0;
+    refTracker.confidence = 0;
+    refTracker.held = FALSE;
+  }
+}
+
+#if REF_RECORDER
+/* one recorded sample. Dumped as is (little endian), so do not change without changing REF_REC_VERSION and the decoder */
+typedef struct {
+  uint32_t timestamp;                    /* RTOS tick count */
+  SensorTimeType raw[REF_NOF_SENSORS];   /* raw values (timer ticks) */
+  SensorTimeType calib[REF_NOF_SENSORS]; /* calibrated values */
+  uint16_t lineValue;                    /* line value (weighted average) */
+  uint8_t lineKind;                      /* REF_LineKind */
+  uint8_t reserved;                      /* padding, zero */
+} REF_RecFrame;
+
+/* compile time check that the recorder fits into the upper SRAM block */
+typedef char REF_RecSizeCheck[(sizeof(REF_RecFrame)*REF_REC_DEPTH<=0x8000)?1:-1];
+
+static REF_RecFrame refRecBuf[REF_REC_DEPTH] __attribute__((section(REF_REC_SECTION))); /* ring buffer */
+static volatile bool refRecActive = FALSE; /* TRUE if recording */
+static uint16_t refRecHead = 0; /* index of the next frame to write */
+static uint32_t refRecCount = 0; /* number of frames recorded since start */
+static uint16_t refRecMaxTicks = 0; /* maximum time needed to record a sample, in RefCnt ticks */
+
+/*!
+ * \brief Stores the current sample in the recorder. Constant time: one frame is copied.
+ */
+static void REF_Record(int16_t lineValue, REF_LineKind lineKind) {
+  REF_RecFrame *frame;
+  RefCnt_TValueType start, ticks;
+  int i;
+
+  if (!refRecActive) {
+    return;
+  }
+  start = RefCnt_GetCounterValue(timerHandle);
+  frame = &refRecBuf[refRecHead];
+  frame->timestamp = FRTOS1_xTaskGetTickCount();
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    frame->raw[i] = SensorRaw[i];
+    frame->calib[i] = SensorCalibrated[i];
+  }
+  frame->lineValue = lineValue;
+  frame->lineKind = lineKind;
+  frame->reserved = 0;
+  refRecHead++;
+  if (refRecHead==REF_REC_DEPTH) {
+    refRecHead = 0;
+  }
+  refRecCount++;
+  ticks = (RefCnt_TValueType)(RefCnt_GetCounterValue(timerHandle)-start); /* counter is free running after the measurement */
+  if (ticks>refRecMaxTicks) {
+    refRecMaxTicks = ticks;
+  }
+}
+
+static void REF_RecSendBytes(const uint8_t *data, size_t size, uint16_t *checksum, const CLS1_StdIOType *io) {
+  while(size>0) {
+    io->stdOut(*data);
+    *checksum += *data;
+    data++;
+    size--;
+  }
+}
+
+/*!
+ * \brief Stops the recorder and dumps the recorded frames as binary stream, oldest frame first.
+ * Format: magic "REFR", version (u8), number of sensors (u8), frame size (u16), number of frames (u16),
+ * tick period in ms (u16), frames, sum of all bytes before (u16). All values little endian.
+ */
+static void REF_RecDump(const CLS1_StdIOType *io) {
+  uint16_t nofFrames, idx, checksum = 0;
+  uint8_t hdr[12];
+  int i;
+
+  refRecActive = FALSE;
+  if (refRecCount<REF_REC_DEPTH) {
+    nofFrames = refRecCount;
+    idx = 0;
+  } else {
+    nofFrames = REF_REC_DEPTH;
+    idx = refRecHead; /* oldest frame */
+  }
+  for(i=0;i<4;i++) {
+    hdr[i] = REF_REC_MAGIC[i];
+  }
+  hdr[4] = REF_REC_VERSION;
+  hdr[5] = REF_NOF_SENSORS;
+  hdr[6] = sizeof(REF_RecFrame)&0xff; hdr[7] = sizeof(REF_RecFrame)>>8;
+  hdr[8] = nofFrames&0xff; hdr[9] = nofFrames>>8;
+  hdr[10] = portTICK_PERIOD_MS&0xff; hdr[11] = portTICK_PERIOD_MS>>8;
+  REF_RecSendBytes(hdr, sizeof(hdr), &checksum, io);
+  while(nofFrames>0) {
+    REF_RecSendBytes((const uint8_t*)&refRecBuf[idx], sizeof(REF_RecFrame), &checksum, io);
+    idx++;
+    if (idx==REF_REC_DEPTH) {
+      idx = 0;
+    }
+    nofFrames--;
+  }
+  hdr[0] = checksum&0xff; hdr[1] = checksum>>8;
+  REF_RecSendBytes(hdr, 2, &checksum, io);
 }
 #endif
 
 static void REF_Measure(void) {
-  ReadCalibrated(SensorCalibrated, SensorRaw);
-  refCenterLineVal = ReadLine(SensorCalibrated, SensorRaw, REF_USE_WHITE_LINE);
-#if 1 || PL_CONFIG_HAS_LINE_FOLLOW
-  refLineKind = ReadLineKind(SensorCalibrated);
+  int16_t lineValue; /* 0 means no line, >0 means line is below sensor 0, 1000 below sensor 1 and so on */
+  REF_LineKind lineKind;
+
+  REF_MeasureRaw(SensorRaw);
+  lineValue = ReadCalibratedLine(SensorCalibrated, SensorRaw, REF_USE_WHITE_LINE);
+  lineKind = ReadLineKind(SensorCalibrated);
+  REF_TrackLine(SensorCalibrated);
+  REF_PublishSnapshot(SensorCalibrated, lineValue, lineKind);
+#if REF_RECORDER
+  REF_Record(lineValue, lineKind);
 #endif
+  REF_NotifySubscribers();
 }
 
 static uint8_t PrintHelp(const CLS1_StdIOType *io) {
@@ -375,6 +1233,13 @@ static uint8_t PrintHelp(const CLS1_StdIOType *io) {
   CLS1_SendHelpStr((unsigned char*)"  help|status", (unsigned char*)"Print help or status information\r\n", io->stdOut);
 #if REF_START_STOP_CALIB
   CLS1_SendHelpStr((unsigned char*)"  calib (start|stop)", (unsigned char*)"Start/Stop calibrating while moving sensor over line\r\n", io->stdOut);
+#endif
+#if REF_RECORDER
+  CLS1_SendHelpStr((unsigned char*)"  rec (start|stop)", (unsigned char*)"Start/Stop recording samples into the RAM ring buffer\r\n", io->stdOut);
+  CLS1_SendHelpStr((unsigned char*)"  rec dump", (unsigned char*)"Stop recording and dump the samples as binary stream, use Tools/ref_decode.py\r\n", io->stdOut);
+#endif
+#if REF_AUTO_CALIB
+  CLS1_SendHelpStr((unsigned char*)"  calib auto", (unsigned char*)"Calibrate while spinning on the spot over a line, stores the data when done\r\n", io->stdOut);
 #endif
   return ERR_OK;
 }
@@ -386,6 +1251,10 @@ static unsigned char*REF_GetStateString(void) {
     case REF_STATE_START_CALIBRATION:   return (unsigned char*)"START CALIBRATION";
     case REF_STATE_CALIBRATING:         return (unsigned char*)"CALIBRATING";
     case REF_STATE_STOP_CALIBRATION:    return (unsigned char*)"STOP CALIBRATION";
+#if REF_AUTO_CALIB
+    case REF_STATE_START_AUTO_CALIBRATION: return (unsigned char*)"START AUTO CALIBRATION";
+    case REF_STATE_AUTO_CALIBRATING:    return (unsigned char*)"AUTO CALIBRATING";
+#endif
     case REF_STATE_READY:               return (unsigned char*)"READY";
     default:
       break;
@@ -413,8 +1282,13 @@ static unsigned char *REF_LineKindStr(REF_LineKind line) {
 #endif
 
 static uint8_t PrintStatus(const CLS1_StdIOType *io) {
-  unsigned char buf[24];
+  unsigned char buf[48];
   int i;
+  REF_Snapshot snapshot;
+  uint8_t nofSubscribers;
+
+  REF_GetSnapshot(&snapshot);
+  (void)REF_GetPeriodMs(&nofSubscribers);
 
   CLS1_SendStatusStr((unsigned char*)"reflectance", (unsigned char*)"\r\n", io->stdOut);
   
@@ -426,6 +1300,12 @@ static uint8_t PrintStatus(const CLS1_StdIOType *io) {
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
   CLS1_SendStatusStr((unsigned char*)"  min noise", buf, io->stdOut);
 
+#if REF_MEASURE_METHOD==REF_MEASURE_POLL_FCT || REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT
+  UTIL1_Num16uToStr(buf, sizeof(buf), refPollLoopCnt);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  poll loops", buf, io->stdOut);
+#endif
+
   CLS1_SendStatusStr((unsigned char*)"  raw val", (unsigned char*)"", io->stdOut);
   for (i=0;i<REF_NOF_SENSORS;i++) {
     if (i==0) {
@@ -438,6 +1318,18 @@ static uint8_t PrintStatus(const CLS1_StdIOType *io) {
   }
   CLS1_SendStr((unsigned char*)"\r\n", io->stdOut);
   
+#if REF_AMBIENT_COMPENSATION
+  CLS1_SendStatusStr((unsigned char*)"  ambient", (unsigned char*)"", io->stdOut);
+  for (i=0;i<REF_NOF_SENSORS;i++) {
+    if (i!=0) {
+      CLS1_SendStr((unsigned char*)" ", io->stdOut);
+    }
+    buf[0] = '\0'; UTIL1_strcatNum32u(buf, sizeof(buf), refAmbient[i]);
+    CLS1_SendStr(buf, io->stdOut);
+  }
+  CLS1_SendStr((unsigned char*)"\r\n", io->stdOut);
+#endif
+
   CLS1_SendStatusStr((unsigned char*)"  min val", (unsigned char*)"", io->stdOut);
   for (i=0;i<REF_NOF_SENSORS;i++) {
     if (i==0) {
@@ -468,20 +1360,55 @@ static uint8_t PrintStatus(const CLS1_StdIOType *io) {
     } else {
       CLS1_SendStr((unsigned char*)" 0x", io->stdOut);
     }
-    buf[0] = '\0'; UTIL1_strcatNum16Hex(buf, sizeof(buf), SensorCalibrated[i]);
+    buf[0] = '\0'; UTIL1_strcatNum16Hex(buf, sizeof(buf), snapshot.calib[i]);
     CLS1_SendStr(buf, io->stdOut);
   }
   CLS1_SendStr((unsigned char*)"\r\n", io->stdOut);
 
   CLS1_SendStatusStr((unsigned char*)"  line val", (unsigned char*)"", io->stdOut);
-  buf[0] = '\0'; UTIL1_strcatNum16s(buf, sizeof(buf), refCenterLineVal);
+  buf[0] = '\0'; UTIL1_strcatNum16s(buf, sizeof(buf), snapshot.lineValue);
   CLS1_SendStr(buf, io->stdOut);
   CLS1_SendStr((unsigned char*)"\r\n", io->stdOut);
 
+  UTIL1_Num16uToStr(buf, sizeof(buf), snapshot.linePos);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)", ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), snapshot.lineVel);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"/s, ");
+  UTIL1_strcatNum8u(buf, sizeof(buf), snapshot.lineConfidence);
+  UTIL1_strcat(buf, sizeof(buf), snapshot.lineHeld ? (unsigned char*)"%, held\r\n" : (unsigned char*)"%\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  line track", buf, io->stdOut);
+
 #if 1 || PL_CONFIG_HAS_LINE_FOLLOW
-  CLS1_SendStatusStr((unsigned char*)"  line kind", REF_LineKindStr(refLineKind), io->stdOut);
+  CLS1_SendStatusStr((unsigned char*)"  line kind", REF_LineKindStr(snapshot.lineKind), io->stdOut);
   CLS1_SendStr((unsigned char*)"\r\n", io->stdOut);
 #endif
+
+  UTIL1_Num16uToStr(buf, sizeof(buf), refSampleRate);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" Hz (");
+  UTIL1_strcatNum16u(buf, sizeof(buf), refPeriodMs);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms, ");
+  UTIL1_strcatNum8u(buf, sizeof(buf), nofSubscribers);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" subscr.)\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  rate", buf, io->stdOut);
+
+  UTIL1_Num32uToStr(buf, sizeof(buf), refMissedDeadlines);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  missed", buf, io->stdOut);
+
+#if REF_RECORDER
+  UTIL1_strcpy(buf, sizeof(buf), refRecActive?(unsigned char*)"on, ":(unsigned char*)"off, ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), refRecCount);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" frames, max ");
+  UTIL1_strcatNum16u(buf, sizeof(buf), (refRecMaxTicks*1000UL)/(RefCnt_CNT_INP_FREQ_U_0/1000));
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" us\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  recorder", buf, io->stdOut);
+#endif
+
+  UTIL1_Num32uToStr(buf, sizeof(buf), snapshot.seq);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" @ ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), snapshot.timestamp);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)"\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  sample", buf, io->stdOut);
 return ERR_OK;
 }
 
@@ -511,6 +1438,33 @@ byte REF_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOT
     }
     *handled = TRUE;
     return ERR_OK;
+#endif
+#if REF_RECORDER
+  } else if (UTIL1_strcmp((char*)cmd, "ref rec start")==0) {
+    *handled = TRUE;
+    refRecActive = FALSE;
+    refRecHead = 0;
+    refRecCount = 0;
+    refRecMaxTicks = 0;
+    refRecActive = TRUE;
+    return ERR_OK;
+  } else if (UTIL1_strcmp((char*)cmd, "ref rec stop")==0) {
+    *handled = TRUE;
+    refRecActive = FALSE;
+    return ERR_OK;
+  } else if (UTIL1_strcmp((char*)cmd, "ref rec dump")==0) {
+    *handled = TRUE;
+    REF_RecDump(io);
+    return ERR_OK;
+#endif
+#if REF_AUTO_CALIB
+  } else if (UTIL1_strcmp((char*)cmd, "ref calib auto")==0) {
+    *handled = TRUE;
+    if (REF_CalibrateAuto()!=ERR_OK) {
+      CLS1_SendStr((unsigned char*)"ERROR: cannot start calibration, must not be calibrating or be ready.\r\n", io->stdErr);
+      return ERR_FAILED;
+    }
+    return ERR_OK;
 #endif
   }
   return ERR_OK;
@@ -519,6 +1473,9 @@ byte REF_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_StdIOT
 
 static void REF_StateMachine(void) {
   int i;
+#if REF_AUTO_CALIB
+  unsigned char buf[16];
+#endif
 
   switch (refState) {
     case REF_STATE_INIT:
@@ -529,6 +1486,7 @@ static void REF_StateMachine(void) {
       ptr = (SensorCalibT*)NVMC_GetReflectanceData();
       if (ptr!=NULL) { /* valid data */
         SensorCalibMinMax = *ptr;
+        REF_UpdateScale();
         refState = REF_STATE_READY;
       } else {
         refState = REF_STATE_NOT_CALIBRATED;
@@ -547,6 +1505,9 @@ static void REF_StateMachine(void) {
       if (FRTOS1_xSemaphoreTake(REF_StartStopSem, 0)==pdTRUE) {
         refState = REF_STATE_START_CALIBRATION;
       }
+#endif
+#if REF_AUTO_CALIB
+      REF_CheckAutoCalibRequest();
 #endif
       break;
     
@@ -572,8 +1533,51 @@ static void REF_StateMachine(void) {
 #endif
       break;
     
+#if REF_AUTO_CALIB
+    case REF_STATE_START_AUTO_CALIBRATION:
+      SHELL_SendString((unsigned char*)"start auto calibration...\r\n");
+      refAutoCalibPrevData = SensorCalibMinMax;
+      for(i=0;i<REF_NOF_SENSORS;i++) {
+        SensorCalibMinMax.minVal[i] = MAX_SENSOR_VALUE;
+        SensorCalibMinMax.maxVal[i] = 0;
+      }
+      refAutoCalibDone = FALSE;
+      refAutoCalibStartTick = FRTOS1_xTaskGetTickCount();
+      (void)DRV_SetMode(DRV_MODE_SPEED);
+      (void)DRV_SetSpeed(REF_AUTO_CALIB_SPEED, -REF_AUTO_CALIB_SPEED); /* spin on the spot */
+      refState = REF_STATE_AUTO_CALIBRATING;
+      break;
+
+    case REF_STATE_AUTO_CALIBRATING:
+      REF_CalibrateMinMax(SensorCalibMinMax.minVal, SensorCalibMinMax.maxVal, SensorRaw);
+      if (!refAutoCalibDone) {
+        if (REF_CalibHasConverged()) {
+          refAutoCalibDone = TRUE;
+          refAutoCalibDoneTick = FRTOS1_xTaskGetTickCount();
+        } else if ((FRTOS1_xTaskGetTickCount()-refAutoCalibStartTick)>=pdMS_TO_TICKS(REF_AUTO_CALIB_TIMEOUT_MS)) {
+          (void)DRV_SetMode(DRV_MODE_STOP);
+          SHELL_SendString((unsigned char*)"Auto calibration FAILED, not all sensors have seen the line!\r\n");
+          SensorCalibMinMax = refAutoCalibPrevData; /* restore previous data */
+          refState = refAutoCalibPrevState;
+        }
+      } else if ((FRTOS1_xTaskGetTickCount()-refAutoCalibDoneTick)>=pdMS_TO_TICKS(REF_AUTO_CALIB_SETTLE_MS)) {
+        (void)DRV_SetMode(DRV_MODE_STOP);
+#if PL_CONFIG_HAS_BUZZER
+        (void)BUZ_Beep(300, 100);
+#endif
+        UTIL1_Num32uToStr(buf, sizeof(buf), (FRTOS1_xTaskGetTickCount()-refAutoCalibStartTick)*portTICK_PERIOD_MS);
+        UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" ms");
+        SHELL_SendString((unsigned char*)"Auto calibration done in ");
+        SHELL_SendString(buf);
+        SHELL_SendString((unsigned char*)".\r\n");
+        refState = REF_STATE_STOP_CALIBRATION; /* stores the data */
+      }
+      break;
+#endif
+
     case REF_STATE_STOP_CALIBRATION:
       SHELL_SendString((unsigned char*)"...stopping calibration.\r\n");
+      REF_UpdateScale();
 #if PL_CONFIG_HAS_CONFIG_NVM
       if (NVMC_SaveReflectanceData(&SensorCalibMinMax, sizeof(SensorCalibMinMax))!=ERR_OK) {
         SHELL_SendString((unsigned char*)"Flashing calibration data FAILED!\r\n");
@@ -591,6 +1595,9 @@ static void REF_StateMachine(void) {
       if (FRTOS1_xSemaphoreTake(REF_StartStopSem, 0)==pdTRUE) {
         refState = REF_STATE_START_CALIBRATION;
       }
+#endif
+#if REF_AUTO_CALIB
+      REF_CheckAutoCalibRequest();
 #endif
       break;
   } /* switch */
@@ -601,10 +1608,37 @@ bool REF_IsReady(void) {
 }
 
 static void ReflTask (void *pvParameters) {
+  TickType_t lastWakeTime, now, period;
+  TickType_t rateStartTime;
+  uint16_t rateCnt = 0;
+
   (void)pvParameters; /* not used */
+  lastWakeTime = rateStartTime = FRTOS1_xTaskGetTickCount();
   for(;;) {
     REF_StateMachine();
-    FRTOS1_vTaskDelay(10/portTICK_PERIOD_MS);
+    /* effective sampling rate, updated every second */
+    rateCnt++;
+    now = FRTOS1_xTaskGetTickCount();
+    if ((now-rateStartTime)>=pdMS_TO_TICKS(1000)) {
+      refSampleRate = (rateCnt*1000UL)/((now-rateStartTime)*portTICK_PERIOD_MS);
+      rateCnt = 0;
+      rateStartTime = now;
+    }
+    /* wait for the next sample time, or until woken up by a new subscriber */
+    refPeriodMs = REF_GetPeriodMs(NULL);
+    period = pdMS_TO_TICKS(refPeriodMs);
+    if (period==0) {
+      period = 1;
+    }
+    lastWakeTime += period;
+    if ((int32_t)(now-lastWakeTime)>0) { /* already late: skip the deadline and restart from now */
+      refMissedDeadlines++;
+      lastWakeTime = now;
+    } else if (lastWakeTime!=now) {
+      if (FRTOS1_xSemaphoreTake(refWakeSem, lastWakeTime-now)==pdTRUE) {
+        lastWakeTime = FRTOS1_xTaskGetTickCount(); /* changed demand: sample now */
+      }
+    }
   }
 }
 
@@ -620,6 +1654,12 @@ void REF_Init(void) {
   (void)xSemaphoreTake(REF_StartStopSem, 0); /* empty token */
   vQueueAddToRegistry(REF_StartStopSem, "RefStartStopSem");
 #endif
+  vSemaphoreCreateBinary(refWakeSem);
+  if (refWakeSem==NULL) { /* semaphore creation failed */
+    for(;;){} /* error */
+  }
+  (void)xSemaphoreTake(refWakeSem, 0); /* empty token */
+  vQueueAddToRegistry(refWakeSem, "RefWakeSem");
   /*! \todo add extra mutex if needed */
   mutexHandle = xSemaphoreCreateMutex();
   if (mutexHandle==NULL) {
@@ -11,11 +11,58 @@
 
 #include "Platform.h"
 #if PL_CONFIG_HAS_REFLECTANCE
+#include "FRTOS1.h"
 
-#define REF_NOF_SENSORS 6
+/* Sensor array description. Each entry is X(pos, nr, pin): pos is the position in the array (0 to REF_NOF_SENSORS-1),
+ * nr the number of the Processor Expert BitIO component IR<nr> and pin its pin number on the sensor port.
+ * Everything else (pin wrappers, masks, weights) is derived from this table at compile time. */
+#ifndef REF_NOF_SENSORS
+  #define REF_NOF_SENSORS      6 /* number of sensors: 4, 6 or 8 */
+#endif
+#ifndef REF_SENSOR1_IS_LEFT
+  #define REF_SENSOR1_IS_LEFT  1 /* sensor at position 0 is on the left side */
+#endif
+#define REF_MIN_NOISE_VAL      0x40 /* calibrated values below this are not added to the weighted sum */
+#define REF_MIN_LINE_VAL       0x60 /* minimum calibrated value indicating a line */
+
+#if REF_NOF_SENSORS==4
+  #define REF_SENSOR_TABLE(X) \
+    X(0, 1, 2) \
+    X(1, 2, 3) \
+    X(2, 3, 4) \
+    X(3, 4, 5)
+#elif REF_NOF_SENSORS==6
+  #define REF_SENSOR_TABLE(X) \
+    X(0, 1, 2) /* IR1 on PTD2 */ \
+    X(1, 2, 3) \
+    X(2, 3, 4) \
+    X(3, 4, 5) \
+    X(4, 5, 6) \
+    X(5, 6, 7) /* IR6 on PTD7 */
+#elif REF_NOF_SENSORS==8
+  #define REF_SENSOR_TABLE(X) \
+    X(0, 1, 0) \
+    X(1, 2, 1) \
+    X(2, 3, 2) \
+    X(3, 4, 3) \
+    X(4, 5, 4) \
+    X(5, 6, 5) \
+    X(6, 7, 6) \
+    X(7, 8, 7)
+#else
+  #error "unsupported number of sensors"
+#endif
 #define REF_MIDDLE_LINE_VALUE  ((REF_NOF_SENSORS+1)*1000/2)
 #define REF_MAX_LINE_VALUE     ((REF_NOF_SENSORS-1)*1000) /* maximum value for REF_GetLine() */
 
+#define REF_MEASURE_POLL_FCT   0 /* poll each sensor with GetVal() inside a critical section */
+#define REF_MEASURE_PORT_ISR   1 /* time stamp the discharge edges in the port interrupt, interrupts stay enabled */
+#define REF_MEASURE_POLL_PORT  2 /* poll all sensors with a single read of the GPIO data input register inside a critical section */
+#ifndef REF_MEASURE_METHOD
+  #define REF_MEASURE_METHOD   REF_MEASURE_PORT_ISR /* method used to measure the sensor discharge time */
+  /*!< REF_MEASURE_PORT_ISR uses the RefInt InterruptVector component for INT_PORTD, with RefInt_OnInterrupt() in Events.c */
+#endif
+
 typedef enum {
   REF_LINE_NONE=0,     /* no line, sensors do not see a line */
   REF_LINE_STRAIGHT=1, /* forward line |, sensors see a line underneath */
@@ -25,9 +72,42 @@ typedef enum {
   REF_NOF_LINES        /* Sentinel */
 } REF_LineKind;
 
-REF_LineKind REF_GetLineKind(void);
+/*!
+ * \brief One coherent sample of the reflectance sensor array.
+ */
+typedef struct {
+  uint32_t seq;                      /* sequence number, incremented for each new sample. 0 means no sample yet */
+  uint32_t timestamp;                /* RTOS tick count when the sample has been taken */
+  uint16_t calib[REF_NOF_SENSORS];   /* calibrated values: 0 means white/min value, 1000 means black/max value */
+  uint16_t lineValue;                /* line position (weighted average): 0 means no line, 1000 means line is below sensor 0, 2000 below sensor 1 and so on */
+  REF_LineKind lineKind;             /* kind of line seen */
+  uint16_t linePos;                  /* tracked line position with sub-sensor resolution, same scale as lineValue */
+  int32_t lineVel;                   /* lateral velocity of the line, in lineValue units per second */
+  uint8_t lineConfidence;            /* confidence of linePos in percent, 0 if the line has been lost */
+  bool lineHeld;                     /* TRUE if the line is not seen in this sample: linePos is extrapolated, for at most REF_TRACK_HOLD_MS */
+} REF_Snapshot;
 
-void REF_GetSensorValues(uint16_t *values, int nofValues);
+/*!
+ * \brief Returns the latest sample of the reflectance sensors. Never blocks, and all values are from the same sample.
+ * \param snapshot Where to store the sample.
+ */
+void REF_GetSnapshot(REF_Snapshot *snapshot);
+
+/*!
+ * \brief Subscribes a task to new samples. The task gets notified (xTaskNotify() with eSetBits) for each new
+ * sample, and the sensors are sampled at least with the requested period. Subscribing again updates the entry.
+ * \param task Task to be notified.
+ * \param notifyBits Notification bits to set in the task.
+ * \param periodMs Sampling period needed by the task, in milliseconds.
+ * \return ERR_OK, or ERR_FAILED if there are too many subscribers.
+ */
+uint8_t REF_Subscribe(xTaskHandle task, uint32_t notifyBits, uint16_t periodMs);
+
+/*!
+ * \brief Removes the subscription of a task. Without subscribers the sensors are sampled at a low idle rate.
+ * \param task Task to unsubscribe.
+ */
+void REF_Unsubscribe(xTaskHandle task);
 
 #if PL_CONFIG_HAS_SHELL
   #include "CLS1.h"
@@ -46,15 +126,24 @@ void REF_GetSensorValues(uint16_t *values, int nofValues);
   #define REF_PARSE_COMMAND_ENABLED 0
 #endif
 
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+/*!
+ * \brief Called from the interrupt of the sensor port, stores the time stamp of the discharged sensors.
+ */
+void REF_OnPortInterrupt(void);
+#endif
+
 /*!
  * \brief Starts or stops the calibration.
  */
 void REF_CalibrateStartStop(void);
 
 /*!
- * \brief returns the current line value (weighted average).
+ * \brief Starts the automatic calibration: the robot spins on the spot over a line until every sensor has
+ * seen the line and the background, and stores the calibration data.
+ * \return ERR_OK, or ERR_BUSY if already calibrating.
  */
-uint16_t REF_GetLineValue(void);
+uint8_t REF_CalibrateAuto(void);
 
 /*!
  * \brief Determines if the line sensor is calibrated or not
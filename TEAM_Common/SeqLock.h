@@ -0,0 +1,70 @@
+/**
+ * \file
+ * \brief Double buffer with a sequence counter, for values written by one side and read by others without locking.
+ *
+ * The writer fills the buffer not in use and then increments the sequence counter. A reader copies the
+ * current buffer and retries if the counter has changed meanwhile. Readers never wait for the writer,
+ * even if they have preempted it. Only one writer at a time: several writers need a critical section
+ * around SEQ_WriteIndex() and SEQ_Publish().
+ */
+
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef SEQ_MEMORY_BARRIER
+  #if defined(__arm__)
+    #define SEQ_MEMORY_BARRIER()  __asm volatile("dmb" ::: "memory") /* keep the order of the buffer and sequence counter accesses */
+  #else /* host build */
+    #define SEQ_MEMORY_BARRIER()  __sync_synchronize()
+  #endif
+#endif
+
+typedef struct {
+  volatile uint32_t seq; /*!< number of values published, the newest one is in buffer seq&1 */
+} SEQ_Lock;
+
+/*!
+ * \brief Index of the buffer the writer fills next, not used by the readers.
+ * \param lock Sequence counter of the buffers
+ * \return 0 or 1
+ */
+static inline unsigned int SEQ_WriteIndex(const SEQ_Lock *lock) {
+  return (lock->seq+1)&1;
+}
+
+/*!
+ * \brief Publishes the buffer filled by the writer.
+ * \param lock Sequence counter of the buffers
+ */
+static inline void SEQ_Publish(SEQ_Lock *lock) {
+  uint32_t seq = lock->seq+1;
+
+  SEQ_MEMORY_BARRIER();
+  lock->seq = seq;
+}
+
+/*!
+ * \brief Copies the newest value.
+ * \param lock Sequence counter of the buffers
+ * \param dst Where to store the value
+ * \param bufs The two buffers
+ * \param size Size of one buffer
+ * \return Sequence counter of the value copied
+ */
+static inline uint32_t SEQ_Read(const SEQ_Lock *lock, void *dst, const void *bufs, size_t size) {
+  uint32_t seq;
+
+  do {
+    seq = lock->seq;
+    SEQ_MEMORY_BARRIER();
+    memcpy(dst, (const uint8_t*)bufs+(seq&1)*size, size);
+    SEQ_MEMORY_BARRIER();
+  } while(seq!=lock->seq); /* published again while we were copying: buffer might have been overwritten */
+  return seq;
+}
+
+#endif /* SEQLOCK_H_ */
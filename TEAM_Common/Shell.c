@@ -38,6 +38,7 @@
 #if PL_CONFIG_HAS_QUADRATURE
   #include "Q4CLeft.h"
   #include "Q4CRight.h"
+  #include "Quad.h"
 #endif
 #if PL_CONFIG_HAS_QUAD_CALIBRATION
   #include "QuadCalib.h"
@@ -54,6 +55,15 @@
 #if PL_CONFIG_HAS_DRIVE
   #include "Drive.h"
 #endif
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  #include "MotorModel.h"
+#endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  #include "Profile.h"
+#endif
+#if PL_CONFIG_HAS_ODOMETRY
+  #include "Odometry.h"
+#endif
 #if PL_CONFIG_HAS_TURN
   #include "Turn.h"
 #endif
@@ -245,6 +255,7 @@ static const CLS1_ParseCommandCallback CmdParserTable[] =
 #if PL_CONFIG_HAS_QUADRATURE
   Q4CLeft_ParseCommand,
   Q4CRight_ParseCommand,
+  QUAD_ParseCommand,
 #endif
 #if PL_CONFIG_HAS_QUAD_CALIBRATION
    QUADCALIB_ParseCommand,
@@ -267,6 +278,15 @@ static const CLS1_ParseCommandCallback CmdParserTable[] =
 #if PL_CONFIG_HAS_DRIVE
   DRV_ParseCommand,
 #endif
+#if PL_CONFIG_HAS_MOTOR_MODEL
+  MMOD_ParseCommand,
+#endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  PROF_ParseCommand,
+#endif
+#if PL_CONFIG_HAS_ODOMETRY
+  ODO_ParseCommand,
+#endif
 #if PL_CONFIG_HAS_TURN
   TURN_ParseCommand,
 #endif
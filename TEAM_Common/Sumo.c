@@ -23,6 +23,7 @@
 #define MAXSPEED 10000
 #define TURN 0.7f
 #define TASKMS 10
+#define REF_PERIOD_MS 5 /* reflectance sampling period needed to detect the ring border */
 #define ESCAPE_TURN_ANGLE 130
 bool handleLine = TRUE;
 
@@ -67,6 +68,7 @@ static TaskHandle_t sumoTaskHndl;
 #define SUMO_LINE_LEFT  (1<<3)
 #define SUMO_LINE_RIGHT (1<<4)
 #define SUMO_RUN		(1<<5)
+#define SUMO_REF_SAMPLE (1<<6)  /* new reflectance sample available */
 #define SUMO_ALL_FLAGS  (0xFFFF)
 
 
@@ -102,18 +104,18 @@ void SUMO_StartStopSumo(void) {
 
 static SUMO_Turn_t SumoCheckLine(uint16_t lineThreshold){
 	SUMO_Turn_t line = SUMO_TURN_NOT;
-	uint16_t refSens[REF_NOF_SENSORS];
-	REF_GetSensorValues(refSens, REF_NOF_SENSORS);
+	REF_Snapshot ref;
+	REF_GetSnapshot(&ref);
 
 	//LED_Off(1);
 	//LED_Off(2);
 
-	if (refSens[0] < lineThreshold){
+	if (ref.calib[0] < lineThreshold){
 		//(void)xTaskNotify(sumoTaskHndl, SUMO_ALARM_LINE & SUMO_LINE_LEFT, eSetBits);
 		//LED_On(1);
 		line = SUMO_TURN_LEFT;
 	}
-	if ((refSens[REF_NOF_SENSORS-1]) < lineThreshold){
+	if ((ref.calib[REF_NOF_SENSORS-1]) < lineThreshold){
 		//(void)xTaskNotify(sumoTaskHndl, SUMO_ALARM_LINE & SUMO_LINE_RIGHT, eSetBits);
 		//LED_On(2);
 		line = SUMO_TURN_RIGHT;
@@ -266,8 +268,7 @@ static void SumoAttack(OPP_POS_t opp){
 	}
 }
 
-static void SumoFSM_Attack(void){
-	uint32_t notify;
+static void SumoFSM_Attack(uint32_t notify){
 	OPP_POS_t opp;
 	SUMO_Turn_t turn;
 
@@ -285,13 +286,10 @@ static void SumoFSM_Attack(void){
 		}
 	}
 
-	/* Get Flags */
-	(void) xTaskNotifyWait(0UL, SUMO_START_SUMO | SUMO_STOP_SUMO | SUMO_ALARM_LINE, &notify, 0); /* check flags */
-
-
 	  /* Check Stop Flag */
 	  if (notify & SUMO_STOP_SUMO) {
 	     DRV_SetMode(DRV_MODE_STOP);
+	     REF_Unsubscribe(sumoTaskHndl);
 	     sumoState = SUMO_STATE_IDLE;
 	  }
 
@@ -300,6 +298,7 @@ static void SumoFSM_Attack(void){
 		switch (sumoState) {
 		case SUMO_STATE_IDLE:
 			if ((notify & SUMO_START_SUMO)) {
+				(void)REF_Subscribe(sumoTaskHndl, SUMO_REF_SAMPLE, REF_PERIOD_MS);
 				sumoState = SUMO_STATE_SEARCHING;
 				break; /* handle next state */
 			}
@@ -337,14 +336,18 @@ static void SumoFSM_Attack(void){
 }
 
 static void SumoTask(void* param) {
+  uint32_t notify;
+
   sumoState = SUMO_STATE_IDLE;
 
   for(;;) {
+    /* wait for flags or a new reflectance sample */
+    if (xTaskNotifyWait(0UL, SUMO_ALL_FLAGS, &notify, pdMS_TO_TICKS(TASKMS))!=pdTRUE) {
+      notify = 0; /* timeout */
+    }
 
-	  SumoFSM_Attack();
+	  SumoFSM_Attack(notify);
 	  //SumoFSM_Brick();
-
-    vTaskDelay(pdMS_TO_TICKS(10));
   }
 }
 
@@ -4,6 +4,11 @@
  * \author Erich Styger, erich.styger@hslu.ch
  *
  * Module to calculate the speed based on the quadrature counter.
+ * Each wheel has an alpha-beta-gamma observer for position, speed and acceleration,
+ * updated with every sample. The measured position is refined with the timestamp of the
+ * last encoder edge: the wheel was exactly on the edge at that time, and has moved on since
+ * then as fast as over the edge interval before (but less than one step). The observer speed
+ * is not used for this, as it would close a second loop around the observer.
  */
 
 #include "Platform.h" /* interface to the platform */
@@ -17,116 +22,205 @@
 #include "UTIL1.h"
 #include "FRTOS1.h"
 #include "Timer.h"
+#include "Quad.h"
 
+#if PL_CONFIG_HAS_DRIVE_ISR
+#include "Drive.h"
+#define TACHO_SAMPLE_PERIOD_US DRV_ISR_PERIOD_US
+  /*!< sampled by the drive control interrupt, right before the control loops run */
+#else
 #define TACHO_SAMPLE_PERIOD_MS (1)
-  /*!< \todo speed sample period in ms. Make sure that speed is sampled at the given rate. */
-#define NOF_HISTORY (16U+1U)
-  /*!< number of samples for speed calculation (>0):the more, the better, but the slower. */
+  /*!< speed sample period in ms. Make sure that speed is sampled at the given rate. */
+#define TACHO_SAMPLE_PERIOD_US (TACHO_SAMPLE_PERIOD_MS*1000)
+#endif
+#ifndef TACHO_OBS_POLE
+#define TACHO_OBS_POLE         (0.8)
+#endif
+  /*!< closed loop pole (triple) of the observer: 0.8 is about 220 rad/s at 1 ms. Higher is smoother, but slower.
+   * The overshoot on a speed step does not depend on it: about 23% for any triple pole (tacho_lag_test, 0.7 to 0.9).
+   * The pole sets the rise time against the noise: 0.75 has 45% more RMS error with edge jitter at 2950 steps/s
+   * (tacho_edge_test), 0.85 misses a 1000 steps/s^2 ramp's acceleration by 13%. */
+#define TACHO_OBS_SHIFT        (24)
+  /*!< fixed point of the observer gains */
+#define TACHO_OBS_ALPHA        ((int32_t)((1.0-TACHO_OBS_POLE*TACHO_OBS_POLE*TACHO_OBS_POLE)*(1L<<TACHO_OBS_SHIFT)+0.5))
+  /*!< position gain */
+#define TACHO_OBS_BETA         ((int32_t)(1.5*(1.0-TACHO_OBS_POLE)*(1.0-TACHO_OBS_POLE)*(1.0+TACHO_OBS_POLE)*(1L<<TACHO_OBS_SHIFT)+0.5))
+  /*!< speed gain */
+#define TACHO_OBS_GAMMA2       ((int32_t)((1.0-TACHO_OBS_POLE)*(1.0-TACHO_OBS_POLE)*(1.0-TACHO_OBS_POLE)*(1L<<TACHO_OBS_SHIFT)+0.5))
+  /*!< acceleration gain (2*gamma) */
+#define TACHO_OBS_RESET_STEPS  (100)
+  /*!< if the measurement is that far off, the position has been set: restart the observer there */
 
-/*! \todo Check types for position: code shall use the same type as the quadrature counter!!!!! */
-static volatile Q4CLeft_QuadCntrType TACHO_LeftPosHistory[NOF_HISTORY], TACHO_RightPosHistory[NOF_HISTORY];
-  /*!< for better accuracy, we calculate the speed over some samples */
-static volatile uint8_t TACHO_PosHistory_Index = 0;
-  /*!< position index in history */
+typedef struct {
+  uint32_t pos;  /*!< position in steps, Q16: wraps around like the quadrature counter */
+  int32_t speed; /*!< speed in steps per sample, Q16 */
+  int32_t accel; /*!< acceleration in steps per sample^2, Q16 */
+  bool isInit;   /*!< if the observer has been started */
+  int32_t edgePos;    /*!< position after the last edge */
+  uint32_t edgeTime;  /*!< time of the last edge */
+  uint32_t edgeDelta; /*!< time per step between the last two edges in the same direction, 0 if unknown */
+  uint32_t edgeRecip; /*!< 0xFFFFFFFF/edgeDelta, to get the fraction of a step without a division in each sample */
+} TACHO_Observer;
 
-static int32_t TACHO_currLeftSpeed = 0, TACHO_currRightSpeed = 0;
-  /*!< current speed for each wheel */
+static TACHO_Observer TACHO_Observers[2]; /*!< left and right observer, only used in TACHO_Sample() */
+static volatile TACHO_State TACHO_States[2]; /*!< published state of the left and right wheel */
+static volatile uint32_t TACHO_SampleCycles, TACHO_SampleMaxCycles;
+  /*!< cycles for the last and the longest TACHO_Sample() */
+
+void TACHO_GetState(bool isLeft, TACHO_State *state) {
+  EnterCritical();
+  *state = TACHO_States[isLeft?0:1];
+  ExitCritical();
+}
 
 int32_t TACHO_GetSpeed(bool isLeft) {
-  if (isLeft) {
-    return TACHO_currLeftSpeed;
-  } else {
-    return TACHO_currRightSpeed;
-  }
+  return TACHO_States[isLeft?0:1].speed; /* single word: no need to lock */
 }
 
-void TACHO_CalcSpeed(void) {
-  /*! \todo Implement/change function as needed, make sure implementation below matches your needs */
-  /* we calculate the speed as follow:
-                              1000         
-  steps/sec =  delta * ----------------- 
-                       samplePeriod (ms) 
-  As this function may be called very frequently, it is important to make it as efficient as possible!
-   */
-  int32_t deltaLeft, deltaRight, newLeft, newRight, oldLeft, oldRight;
-  int32_t speedLeft, speedRight;
-  bool negLeft, negRight;
+/*!
+ * \brief Measured position: the position after the last edge, plus the distance since then.
+ * \param obs Observer, with the last edge interval
+ * \param edgeDir Direction of the last edge, 0 if unknown
+ * \param now Current time, in cycles of the time base
+ * \return Position in steps, Q16
+ */
+static uint32_t TACHO_Measure(const TACHO_Observer *obs, int8_t edgeDir, uint32_t now) {
+  uint32_t since, dist;
 
-  EnterCritical();
-  oldLeft = (int32_t)TACHO_LeftPosHistory[TACHO_PosHistory_Index]; /* oldest left entry */
-  oldRight = (int32_t)TACHO_RightPosHistory[TACHO_PosHistory_Index]; /* oldest right entry */
-  if (TACHO_PosHistory_Index==0) { /* get newest entry */
-    newLeft = (int32_t)TACHO_LeftPosHistory[NOF_HISTORY-1];
-    newRight = (int32_t)TACHO_RightPosHistory[NOF_HISTORY-1];
-  } else {
-    newLeft = (int32_t)TACHO_LeftPosHistory[TACHO_PosHistory_Index-1];
-    newRight = (int32_t)TACHO_RightPosHistory[TACHO_PosHistory_Index-1];
+  if (edgeDir==0) { /* no edge seen yet: middle of the step */
+    return ((uint32_t)obs->edgePos<<16)+0x8000;
   }
-  ExitCritical();
-  deltaLeft = oldLeft-newLeft; /* delta of oldest position and most recent one */
-  /* use unsigned arithmetic */
-  if (deltaLeft < 0) {
-    deltaLeft = -deltaLeft;
-    negLeft = TRUE;
-  } else {
-    negLeft = FALSE;
+  since = now-obs->edgeTime;
+  if (obs->edgeDelta==0) { /* direction just changed: middle of the step */
+    dist = 0x8000;
+  } else if (since>=obs->edgeDelta) { /* slower than before: not yet at the next edge */
+    dist = 0xFFFF;
+  } else { /* fraction of a step moved since the edge: since<edgeDelta, so the product fits into 32 bit */
+    dist = (since*obs->edgeRecip)>>16;
   }
-  deltaRight = oldRight-newRight; /* delta of oldest position and most recent one */
-  /* use unsigned arithmetic */
-  if (deltaRight < 0) {
-    deltaRight = -deltaRight;
-    negRight = TRUE;
-  } else {
-    negRight = FALSE;
+  if (edgeDir>0) { /* counted up: the edge is at the start of the step */
+    return ((uint32_t)obs->edgePos<<16)+dist;
+  } else { /* counted down: the edge is at the end of the step */
+    return ((uint32_t)(obs->edgePos+1)<<16)-dist;
   }
-  /* calculate speed. this is based on the delta and the time (number of samples or entries in the history table) */
-  speedLeft = (int32_t)(deltaLeft * 1000/(TACHO_SAMPLE_PERIOD_MS*(NOF_HISTORY-1)));
-  if (negLeft) {
-    speedLeft = -speedLeft;
+}
+
+/*!
+ * \brief One observer step: prediction and correction with the measured position.
+ * \param obs Observer
+ * \param meas Measured position in steps, Q16
+ */
+static void TACHO_ObserverUpdate(TACHO_Observer *obs, uint32_t meas) {
+  int32_t residual;
+
+  /* prediction */
+  obs->pos += (uint32_t)(obs->speed+obs->accel/2);
+  obs->speed += obs->accel;
+  /* correction */
+  residual = (int32_t)(meas-obs->pos);
+  if (!obs->isInit || residual>(TACHO_OBS_RESET_STEPS<<16) || residual<-(TACHO_OBS_RESET_STEPS<<16)) {
+    obs->pos = meas;
+    obs->speed = 0;
+    obs->accel = 0;
+    obs->isInit = TRUE;
+    return;
   }
-  speedRight = (int32_t)(deltaRight * 1000/(TACHO_SAMPLE_PERIOD_MS*(NOF_HISTORY-1)));
-  if (negRight) {
-    speedRight = -speedRight;
+  obs->pos += (uint32_t)(int32_t)(((int64_t)TACHO_OBS_ALPHA*residual)>>TACHO_OBS_SHIFT);
+  obs->speed += (int32_t)(((int64_t)TACHO_OBS_BETA*residual)>>TACHO_OBS_SHIFT);
+  obs->accel += (int32_t)(((int64_t)TACHO_OBS_GAMMA2*residual)>>TACHO_OBS_SHIFT);
+}
+
+static void TACHO_SampleWheel(bool isLeft, uint32_t now) {
+  TACHO_Observer *obs = &TACHO_Observers[isLeft?0:1];
+  volatile TACHO_State *state = &TACHO_States[isLeft?0:1];
+  int32_t edgePos;
+  uint32_t edgeTime;
+  int8_t edgeDir;
+  int32_t steps;
+
+  QUAD_GetLastEdge(isLeft, &edgePos, &edgeTime, &edgeDir);
+  if (edgeTime!=obs->edgeTime) { /* new edge */
+    steps = (edgePos-obs->edgePos)*edgeDir;
+    if (steps>0) { /* moved on in the same direction: the interval is known */
+      obs->edgeDelta = (edgeTime-obs->edgeTime)/(uint32_t)steps;
+      if (obs->edgeDelta!=0) {
+        obs->edgeRecip = 0xFFFFFFFFu/obs->edgeDelta; /* once per edge, not in every sample */
+      }
+    } else {
+      obs->edgeDelta = 0;
+    }
+    obs->edgePos = edgePos;
+    obs->edgeTime = edgeTime;
+  } else if (edgePos!=obs->edgePos) { /* position set without an edge */
+    obs->edgePos = edgePos;
+    obs->edgeDelta = 0;
   }
-  TACHO_currLeftSpeed = -speedLeft; /* store current speed in global variable */
-  TACHO_currRightSpeed = -speedRight; /* store current speed in global variable */
+  TACHO_ObserverUpdate(obs, TACHO_Measure(obs, edgeDir, now));
+  /* publish: the sample runs in an interrupt, so readers with interrupts disabled get a consistent state */
+  state->pos = edgePos+((int32_t)(obs->pos-((uint32_t)edgePos<<16))>>16);
+  state->speed = (int32_t)(((int64_t)obs->speed*(1000000/TACHO_SAMPLE_PERIOD_US))>>16);
+  state->accel = (int32_t)(((int64_t)obs->accel*(1000000/TACHO_SAMPLE_PERIOD_US)*(1000000/TACHO_SAMPLE_PERIOD_US))>>16);
 }
 
 void TACHO_Sample(void) {
-  /*! \todo Implement/change function as needed, make sure implementation below matches your needs */
+#if !PL_CONFIG_HAS_DRIVE_ISR
   static int cnt = 0;
+#endif
+  uint32_t start;
+
+#if !PL_CONFIG_HAS_DRIVE_ISR
   /* get called from the RTOS tick counter. Divide the frequency. */
   cnt += TMR_TICK_MS;
   if (cnt < TACHO_SAMPLE_PERIOD_MS) {
     return;
   }
   cnt = 0; /* reset counter */
-  /* left */
-  TACHO_LeftPosHistory[TACHO_PosHistory_Index] = Q4CLeft_GetPos();
-  TACHO_RightPosHistory[TACHO_PosHistory_Index] = Q4CRight_GetPos();
-  TACHO_PosHistory_Index++;
-  if (TACHO_PosHistory_Index >= NOF_HISTORY) {
-    TACHO_PosHistory_Index = 0;
+#endif
+  start = QUAD_GetTime();
+  TACHO_SampleWheel(TRUE, start);
+  TACHO_SampleWheel(FALSE, start);
+  TACHO_SampleCycles = QUAD_GetTime()-start;
+  if (TACHO_SampleCycles>TACHO_SampleMaxCycles) {
+    TACHO_SampleMaxCycles = TACHO_SampleCycles;
   }
 }
 
 #if PL_CONFIG_HAS_SHELL
+static void TACHO_PrintState(const unsigned char *side, bool isLeft, const CLS1_StdIOType *io) {
+  TACHO_State state;
+  unsigned char buf[48];
+  unsigned char kindBuf[16];
+
+  TACHO_GetState(isLeft, &state);
+  UTIL1_strcpy(kindBuf, sizeof(kindBuf), (unsigned char*)"  ");
+  UTIL1_strcat(kindBuf, sizeof(kindBuf), side);
+  UTIL1_Num32sToStr(buf, sizeof(buf), state.pos);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps, ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), state.speed);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/sec, ");
+  UTIL1_strcatNum32s(buf, sizeof(buf), state.accel);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps/sec^2\r\n");
+  CLS1_SendStatusStr(kindBuf, buf, io->stdOut);
+}
+
 /*!
  * \brief Prints the system low power status
  * \param io I/O channel to use for printing status
  */
 static void TACHO_PrintStatus(const CLS1_StdIOType *io) {
-  TACHO_CalcSpeed(); /*! \todo only temporary until this is done periodically */
+  unsigned char buf[32];
+
   CLS1_SendStatusStr((unsigned char*)"Tacho", (unsigned char*)"\r\n", io->stdOut);
-  CLS1_SendStatusStr((unsigned char*)"  L speed", (unsigned char*)"", io->stdOut);
-  CLS1_SendNum32s(TACHO_GetSpeed(TRUE), io->stdOut);
-  CLS1_SendStr((unsigned char*)" steps/sec\r\n", io->stdOut);
-  CLS1_SendStatusStr((unsigned char*)"  R speed", (unsigned char*)"", io->stdOut);
-  CLS1_SendNum32s(TACHO_GetSpeed(FALSE), io->stdOut);
-  CLS1_SendStr((unsigned char*)" steps/sec\r\n", io->stdOut);
+  TACHO_PrintState((unsigned char*)"L", TRUE, io);
+  TACHO_PrintState((unsigned char*)"R", FALSE, io);
+  UTIL1_Num32uToStr(buf, sizeof(buf), TACHO_SampleCycles);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" cycles (max ");
+  UTIL1_strcatNum32u(buf, sizeof(buf), TACHO_SampleMaxCycles);
+  UTIL1_strcat(buf, sizeof(buf), (unsigned char*)")\r\n");
+  CLS1_SendStatusStr((unsigned char*)"  sample", buf, io->stdOut);
 }
 
-/*! 
+/*!
  * \brief Prints the help text to the console
  * \param io I/O channel to be used
  */
@@ -151,10 +245,19 @@ void TACHO_Deinit(void) {
 }
 
 void TACHO_Init(void) {
-  TACHO_currLeftSpeed = 0;
-  TACHO_currRightSpeed = 0;
-  TACHO_PosHistory_Index = 0;
+  uint8_t i;
+
+  for(i=0; i<2; i++) {
+    TACHO_Observers[i].isInit = FALSE; /* starts with the first sample */
+    TACHO_Observers[i].edgePos = 0;
+    TACHO_Observers[i].edgeTime = 0;
+    TACHO_Observers[i].edgeDelta = 0;
+    TACHO_Observers[i].edgeRecip = 0;
+    TACHO_States[i].pos = 0;
+    TACHO_States[i].speed = 0;
+    TACHO_States[i].accel = 0;
+  }
+  TACHO_SampleCycles = TACHO_SampleMaxCycles = 0;
 }
 
 #endif /* PL_CONFIG_HAS_MOTOR_TACHO */
-
@@ -10,6 +10,20 @@
 #include "Platform.h"
 
 #if PL_CONFIG_HAS_MOTOR_TACHO
+/*! \brief State of a wheel, as estimated by the observer */
+typedef struct {
+  int32_t pos;   /*!< position in steps */
+  int32_t speed; /*!< speed in steps/sec */
+  int32_t accel; /*!< acceleration in steps/sec^2 */
+} TACHO_State;
+
+/*!
+ * \brief Returns the estimated state of a wheel. All values are from the same sample.
+ * \param isLeft TRUE for the left wheel, FALSE for the right wheel
+ * \param state Where to store the state
+ */
+void TACHO_GetState(bool isLeft, TACHO_State *state);
+
 /*!
  * \brief Returns the previously calculated speed of the motor.
  * \param isLeft TRUE for left speed, FALSE for right speed.
@@ -18,12 +32,8 @@
 int32_t TACHO_GetSpeed(bool isLeft);
 
 /*!
- * \brief Calculates the speed based on the position information from the encoder.
- */
-void TACHO_CalcSpeed(void);
-
-/*!
- * \brief Sampling routine to calculate speed, must be called periodically with a fixed frequency.
+ * \brief Sampling routine to update the observers, must be called periodically with a fixed frequency.
+ * Is called from the RTOS tick hook, or with PL_CONFIG_HAS_DRIVE_ISR from the drive timer interrupt.
  */
 void TACHO_Sample(void);
 
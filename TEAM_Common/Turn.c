@@ -25,6 +25,15 @@
 #if PL_CONFIG_HAS_DRIVE
   #include "Drive.h"
 #endif
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  #include "Profile.h"
+#endif
+#if PL_CONFIG_HAS_ODOMETRY && PL_CONFIG_HAS_DRIVE
+  #include "Odometry.h"
+  #define TURN_HAS_HEADING  1 /* turns are closed loop on the heading */
+#else
+  #define TURN_HAS_HEADING  0
+#endif
 
 /*! \todo adopt the values for your robot */
 #define TURN_STEPS_90         720
@@ -37,11 +46,19 @@
 #define TURN_STEPS_LINE_TIMEOUT_MS      200
 #define TURN_STEPS_POST_LINE_TIMEOUT_MS 200
 #define TURN_STEPS_STOP_TIMEOUT_MS      150
+#define TURN_SETTLE_TIMEOUT_MS          250 /* with the motion profile: time after the trajectory for the wheels to settle at the target */
+#define TURN_STOP_CHECK_PERIOD_MS       1  /* period to check the stop condition while moving */
 
 static int32_t TURN_Steps90 = TURN_STEPS_90;
 static int32_t TURN_StepsLine = TURN_STEPS_LINE;
 static int32_t TURN_StepsPostLine = TURN_STEPS_POST_LINE;
 
+#if TURN_HAS_HEADING
+#define TURN_HEADING_TOLERANCE_CDEG 100   /* the turn is done within this heading error, 1/100 degree */
+
+static bool TURN_UseHeading = TRUE; /* if angle turns use the heading instead of fixed steps */
+#endif
+
 /*!
  * \brief Translate a turn kind into a string
  * \return Returns a descriptive string
@@ -67,78 +84,154 @@ const unsigned char *TURN_TurnKindStr(TURN_Kind kind) {
   }
 }
 
-void TURN_MoveToPos(int32_t targetLPos, int32_t targetRPos, bool wait, TURN_StopFct stopIt, int32_t timeoutMs) {
-  (void)DRV_SetPos(targetLPos, targetRPos);
-  (void)DRV_SetMode(DRV_MODE_POS);
-  for(;;) { /* breaks */
-    if (stopIt!=NULL) {
-      if (stopIt()) { /* check stop condition */
-        break;
-      }
+/*!
+ * \brief Waits until the drive reports an event or the stop condition is met.
+ * \param event DRV_EVENT_* bit to wait for
+ * \param stopIt Callback to stop waiting, or NULL
+ * \param timeoutMs Timeout in milliseconds
+ * \return ERR_OK, ERR_BUSY for a timeout
+ */
+static uint8_t TURN_WaitFor(uint32_t event, TURN_StopFct stopIt, int32_t timeoutMs) {
+  if (stopIt==NULL) {
+    return DRV_WaitFor(event, timeoutMs); /* sleeps until the drive task reports the event */
+  }
+  for(;;) {
+    if (stopIt()) { /* check stop condition */
+      return ERR_OK;
     }
-    WAIT1_WaitOSms(1); /* wait some time, and give Drive module enough time to use new value */
-    timeoutMs--;
     if (timeoutMs<=0) {
-      break; /* timeout */
+      return ERR_BUSY; /* timeout */
     }
-    if (wait && DRV_HasTurned()) {
-      break;
-    }
-    if (!wait) {
-      break;
+    /* the stop condition is polled, so wake up for it each millisecond */
+    if (DRV_WaitFor(event, TURN_STOP_CHECK_PERIOD_MS)==ERR_OK) {
+      return ERR_OK;
     }
+    timeoutMs -= TURN_STOP_CHECK_PERIOD_MS;
   } /* for */
+}
+
+void TURN_MoveToPos(int32_t targetLPos, int32_t targetRPos, bool wait, TURN_StopFct stopIt, int32_t timeoutMs) {
+  uint8_t res;
+
+  (void)DRV_SetPos(targetLPos, targetRPos);
+  (void)DRV_SetMode(DRV_MODE_POS);
+  if (!wait) {
+    WAIT1_WaitOSms(1); /* give Drive module enough time to use new value */
+    return;
+  }
+  res = TURN_WaitFor(DRV_EVENT_TARGET, stopIt, timeoutMs);
 #if PL_CONFIG_HAS_SHELL
-  if (timeoutMs<=0) {
+  if (res!=ERR_OK) {
     SHELL_SendString((unsigned char*)"MoveToPos Timeout.\r\n");
   }
 #endif
 }
 
+/*!
+ * \brief Timeout for a position move.
+ * \param stepsL Way of the left wheel
+ * \param stepsR Way of the right wheel
+ * \param fixedMs Timeout without the motion profile
+ * \return With the motion profile its planned duration plus TURN_SETTLE_TIMEOUT_MS, else fixedMs
+ */
+static int32_t MoveTimeoutMs(int32_t stepsL, int32_t stepsR, int32_t fixedMs) {
+#if PL_CONFIG_HAS_MOTION_PROFILE
+  if (PROF_IsEnabled()) {
+    return (int32_t)PROF_DurationMs(stepsL, stepsR)+TURN_SETTLE_TIMEOUT_MS;
+  }
+#else
+  (void)stepsL;
+  (void)stepsR;
+#endif
+  return fixedMs;
+}
+
 static void StepsTurn(int32_t stepsL, int32_t stepsR, TURN_StopFct stopIt, int32_t timeOutMS) {
   int32_t currLPos, currRPos, targetLPos, targetRPos;
-  /* stop before turn */
-  int timeout = TURN_STEPS_STOP_TIMEOUT_MS;
-  
-  DRV_SetMode(DRV_MODE_STOP); /* stop it */
-  WAIT1_WaitOSms(5);
 
-  while (timeout>0 && !DRV_IsStopped()) {
-    /* wait until stopped */
-    timeout-=5;
-    WAIT1_WaitOSms(5);
-  }
+  /* stop before turn: the position control brakes the wheels, no need to wait for standstill */
+  (void)DRV_SetMode(DRV_MODE_STOP);
+  if (DRV_WaitFor(DRV_EVENT_TAKEN_OVER, TURN_STEPS_STOP_TIMEOUT_MS)!=ERR_OK) {
 #if PL_CONFIG_HAS_SHELL
-  if (timeout<=0) {
     SHELL_SendString((unsigned char*)"StepsTurn Stopping Timeout.\r\n");
-  }
 #endif
+  }
   currLPos = Q4CLeft_GetPos();
   currRPos = Q4CRight_GetPos();
   targetLPos = currLPos+stepsL;
   targetRPos = currRPos+stepsR;
-  TURN_MoveToPos(targetLPos, targetRPos, TRUE, stopIt, timeOutMS); /* go to final position */
+  TURN_MoveToPos(targetLPos, targetRPos, TRUE, stopIt, MoveTimeoutMs(stepsL, stepsR, timeOutMS)); /* go to final position */
+}
+
+#if TURN_HAS_HEADING
+/*!
+ * \brief Turns to a heading of the odometry. Does not stop before: the position move with the motion profile
+ * of the drive starts at once from where the wheels are, and the position control takes the forward speed
+ * down while turning. The drive corrects the wheel positions with the remaining heading error
+ * (DRV_SetPosHeading()). The turn is done as soon as the heading is within TURN_HEADING_TOLERANCE_CDEG and the
+ * robot has nearly stopped turning (DRV_EVENT_HEADING), without waiting for each wheel to match its position.
+ * On a timeout the drive keeps turning to the heading.
+ * \param angle Angle in degrees, negative is left (counter clockwise)
+ * \param stopIt Callback to stop waiting for the heading, or NULL
+ * \param timeoutMs Timeout in milliseconds, without the motion profile
+ */
+static void HeadingTurn(int32_t angle, TURN_StopFct stopIt, int32_t timeoutMs) {
+  ODO_Pose pose;
+  int64_t target;
+  int32_t toGo;
+
+  ODO_GetPose(&pose);
+  target = -((int64_t)angle*ODO_THETA_90_DEG)/90; /* heading is counter clockwise */
+  toGo = ODO_HeadingToSteps(target); /* per wheel, positive for counter clockwise */
+  (void)DRV_SetPosHeading((int32_t)Q4CLeft_GetPos()-toGo, (int32_t)Q4CRight_GetPos()+toGo, pose.theta+(uint32_t)target,
+      (uint32_t)(((int64_t)TURN_HEADING_TOLERANCE_CDEG*ODO_THETA_90_DEG)/9000));
+  (void)DRV_SetMode(DRV_MODE_POS);
+  if (TURN_WaitFor(DRV_EVENT_HEADING, stopIt, MoveTimeoutMs(toGo, toGo, timeoutMs))!=ERR_OK) {
+#if PL_CONFIG_HAS_SHELL
+    SHELL_SendString((unsigned char*)"HeadingTurn Timeout.\r\n");
+#endif
+  }
+}
+#endif /* TURN_HAS_HEADING */
+
+/*!
+ * \brief Turns by an angle, closed loop on the heading if available, else with fixed steps.
+ * \param angle Angle in degrees, negative is left (counter clockwise)
+ * \param stopIt Callback to stop turning, or NULL
+ * \param timeoutMs Timeout in milliseconds, without the motion profile
+ */
+static void AngleTurn(int32_t angle, TURN_StopFct stopIt, int32_t timeoutMs) {
+  int32_t steps;
+
+#if TURN_HAS_HEADING
+  if (TURN_UseHeading) {
+    HeadingTurn(angle, stopIt, timeoutMs);
+    return;
+  }
+#endif
+  steps = (angle*TURN_Steps90)/90;
+  StepsTurn(steps, -steps, stopIt, timeoutMs);
 }
 
 void TURN_Turn(TURN_Kind kind, TURN_StopFct stopIt) {
   switch(kind) {
     case TURN_LEFT45:
-      StepsTurn(-TURN_Steps90/2, TURN_Steps90/2, stopIt, TURN_STEPS_90_TIMEOUT_MS/2);
+      AngleTurn(-45, stopIt, TURN_STEPS_90_TIMEOUT_MS/2);
       break;
     case TURN_RIGHT45:
-      StepsTurn(TURN_Steps90/2, -TURN_Steps90/2, stopIt, TURN_STEPS_90_TIMEOUT_MS/2);
+      AngleTurn(45, stopIt, TURN_STEPS_90_TIMEOUT_MS/2);
       break;
     case TURN_LEFT90:
-      StepsTurn(-TURN_Steps90, TURN_Steps90, stopIt, TURN_STEPS_90_TIMEOUT_MS);
+      AngleTurn(-90, stopIt, TURN_STEPS_90_TIMEOUT_MS);
       break;
     case TURN_RIGHT90:
-      StepsTurn(TURN_Steps90, -TURN_Steps90, stopIt, TURN_STEPS_90_TIMEOUT_MS);
+      AngleTurn(90, stopIt, TURN_STEPS_90_TIMEOUT_MS);
       break;
     case TURN_LEFT180:
-      StepsTurn(-(2*TURN_Steps90), 2*TURN_Steps90, stopIt, TURN_STEPS_90_TIMEOUT_MS*2);
+      AngleTurn(-180, stopIt, TURN_STEPS_90_TIMEOUT_MS*2);
      break;
     case TURN_RIGHT180:
-      StepsTurn(2*TURN_Steps90, -(2*TURN_Steps90), stopIt, TURN_STEPS_90_TIMEOUT_MS*2);
+      AngleTurn(180, stopIt, TURN_STEPS_90_TIMEOUT_MS*2);
      break;
     case TURN_STEP_BORDER_BW:
       StepsTurn(-(3*TURN_StepsLine), -(3*TURN_StepsLine), stopIt, TURN_STEPS_LINE_TIMEOUT_MS);
@@ -178,18 +271,12 @@ void TURN_Turn(TURN_Kind kind, TURN_StopFct stopIt) {
 
 void TURN_TurnAngle(int16_t angle, TURN_StopFct stopIt) {
   bool isLeft = angle<0;
-  uint32_t steps;
   
   if (isLeft) {
     angle = -angle; /* make it positive */
   }
   angle %= 360; /* keep it inside 360 */
-  steps = (angle*TURN_Steps90)/90;
-  if (isLeft) {
-    StepsTurn(-steps, steps, stopIt, ((angle/90)+1)*TURN_STEPS_90_TIMEOUT_MS);
-  } else { /* right */
-    StepsTurn(steps, -steps, stopIt, ((angle/90)+1)*TURN_STEPS_90_TIMEOUT_MS);
-  }
+  AngleTurn(isLeft?-angle:angle, stopIt, ((angle/90)+1)*TURN_STEPS_90_TIMEOUT_MS);
 }
 
 #if PL_CONFIG_HAS_SHELL
@@ -203,6 +290,9 @@ static void TURN_PrintHelp(const CLS1_StdIOType *io) {
   CLS1_SendHelpStr((unsigned char*)"  steps90 <steps>", (unsigned char*)"Number of steps for a 90 degree turn\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  stepsline <steps>", (unsigned char*)"Number of steps for stepping over line\r\n", io->stdOut);
   CLS1_SendHelpStr((unsigned char*)"  stepspostline <steps>", (unsigned char*)"Number of steps for a step post the line\r\n", io->stdOut);
+#if TURN_HAS_HEADING
+  CLS1_SendHelpStr((unsigned char*)"  heading on|off", (unsigned char*)"Turn closed loop on the heading, or with the steps for 90 degree\r\n", io->stdOut);
+#endif
 }
 
 static void TURN_PrintStatus(const CLS1_StdIOType *io) {
@@ -220,6 +310,9 @@ static void TURN_PrintStatus(const CLS1_StdIOType *io) {
   UTIL1_Num32sToStr(buf, sizeof(buf), TURN_StepsPostLine);
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)" steps\r\n");
   CLS1_SendStatusStr((unsigned char*)"  postline", buf, io->stdOut);
+#if TURN_HAS_HEADING
+  CLS1_SendStatusStr((unsigned char*)"  heading", TURN_UseHeading?(unsigned char*)"on\r\n":(unsigned char*)"off\r\n", io->stdOut);
+#endif
 
   UTIL1_Num32sToStr(buf, sizeof(buf), Q4CLeft_GetPos());
   UTIL1_strcat(buf, sizeof(buf), (unsigned char*)", ");
@@ -278,6 +371,14 @@ uint8_t TURN_ParseCommand(const unsigned char *cmd, bool *handled, const CLS1_St
     TURN_Turn(TURN_STEP_LINE_BW, NULL);
     TURN_Turn(TURN_STOP, NULL);
     *handled = TRUE;
+#if TURN_HAS_HEADING
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"turn heading on")==0) {
+    TURN_UseHeading = TRUE;
+    *handled = TRUE;
+  } else if (UTIL1_strcmp((char*)cmd, (char*)"turn heading off")==0) {
+    TURN_UseHeading = FALSE;
+    *handled = TRUE;
+#endif
   } else if (UTIL1_strncmp((char*)cmd, (char*)"turn steps90 ", sizeof("turn steps90 ")-1)==0) {
     p = cmd+sizeof("turn steps90");
     if (UTIL1_ScanDecimal16uNumber(&p, &val16u)==ERR_OK) {
@@ -317,5 +418,8 @@ void TURN_Init(void) {
   TURN_Steps90 = TURN_STEPS_90;
   TURN_StepsPostLine = TURN_STEPS_POST_LINE;
   TURN_StepsLine = TURN_STEPS_LINE;
+#if TURN_HAS_HEADING
+  TURN_UseHeading = TRUE;
+#endif
 }
 #endif /* PL_CONFIG_HAS_TURN */
@@ -42,6 +42,18 @@ extern "C" {
 #if PL_CONFIG_HAS_MOTOR_TACHO
 #include "Tacho.h"
 #endif
+#if PL_CONFIG_HAS_QUADRATURE
+#include "Quad.h"
+#endif
+#if PL_CONFIG_HAS_REFLECTANCE
+#include "Reflectance.h"
+#endif
+#if PL_CONFIG_HAS_DRIVE_ISR
+#include "Drive.h"
+#endif
+#if PL_CONFIG_HAS_ODOMETRY
+#include "Odometry.h"
+#endif
 
 /*
 ** ===================================================================
@@ -82,6 +94,9 @@ void TI1_OnInterrupt(void)
 //  TMR_OnInterrupt();
 //#endif
   TmDt1_AddTick();
+#if PL_CONFIG_HAS_DRIVE_ISR
+  DRV_OnTimer();
+#endif
 }
 
 /*
@@ -127,9 +142,12 @@ void FRTOS1_vApplicationStackOverflowHook(TaskHandle_t pxTask, char *pcTaskName)
 void FRTOS1_vApplicationTickHook(void)
 {
   /* Called for every RTOS tick. */
-#if PL_CONFIG_HAS_MOTOR_TACHO
+#if PL_CONFIG_HAS_MOTOR_TACHO && !PL_CONFIG_HAS_DRIVE_ISR /* otherwise sampled by the drive timer interrupt */
 	TACHO_Sample();
 #endif
+#if PL_CONFIG_HAS_ODOMETRY && !PL_CONFIG_HAS_DRIVE_ISR
+  ODO_Sample();
+#endif
 
 #if PL_CONFIG_HAS_TIMER
   TMR_OnInterrupt();
@@ -223,8 +241,12 @@ void QuadInt_OnInterrupt(void)
   SYS1_RecordEnterISR(); /* cannot use this, as it would use RTOS API calls above max syscall level! */
 #endif
 #if PL_CONFIG_HAS_QUADRATURE
+  uint32_t start = QUAD_IsrStart();
+
   Q4CLeft_Sample();
   Q4CRight_Sample();
+  QUAD_SampleEdges();
+  QUAD_IsrEnd(start);
 #endif
 #if 0 && configUSE_SEGGER_SYSTEM_VIEWER_HOOKS
   //SEGGER_SYSVIEW_OnUserStop(0);
@@ -232,6 +254,28 @@ void QuadInt_OnInterrupt(void)
 #endif
 }
 
+/*
+** ===================================================================
+**     ISR         :  RefInt_OnInterrupt (module Events)
+**
+**     Component   :  RefInt [InterruptVector]
+**     Description :
+**         Interrupt service routine of the port interrupt (INT_PORTD)
+**         of the IR reflectance sensor lines, set as 'Handle' of the
+**         RefInt component. The interrupt priority (medium) is below
+**         configMAX_SYSCALL_INTERRUPT_PRIORITY, as it uses the RTOS to
+**         wake up the reflectance task.
+**     Parameters  : None
+**     Returns     : Nothing
+** ===================================================================
+*/
+void RefInt_OnInterrupt(void)
+{
+#if PL_CONFIG_HAS_REFLECTANCE && REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+  REF_OnPortInterrupt();
+#endif
+}
+
 /*
 ** ===================================================================
 **     Event       :  SW1_OnInterrupt (module Events)
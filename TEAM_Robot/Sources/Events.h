@@ -250,6 +250,20 @@ void PTRC1_OnTraceWrap(void);
 */
 void QuadInt_OnInterrupt(void);
 
+/*
+** ===================================================================
+**     ISR         :  RefInt_OnInterrupt (module Events)
+**
+**     Component   :  RefInt [InterruptVector]
+**     Description :
+**         Interrupt service routine of the port interrupt (INT_PORTD)
+**         of the IR reflectance sensor lines.
+**     Parameters  : None
+**     Returns     : Nothing
+** ===================================================================
+*/
+void RefInt_OnInterrupt(void);
+
 void SW1_OnInterrupt(void);
 /*
 ** ===================================================================
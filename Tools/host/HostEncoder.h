@@ -0,0 +1,86 @@
+/**
+ * \file
+ * \brief Simulated wheel encoders and their sampling interrupt, for the host tests.
+ *
+ * Include it once in the test program, after the modules under test (Quad.c, Tacho.c) and HostRtos.h.
+ * Replaces the Q4CLeft/Q4CRight components: each wheel moves with a speed and an acceleration set by the
+ * test, and the counter is the position rounded down to full steps. The QuadInt interrupt runs every
+ * HOST_ENCODER_PERIOD_NS as a hardware event of HostRtos.h, and timestamps the edges with
+ * QUAD_SampleEdges() as in Events.c. The cycle counter for the timestamps is in stubs/Cpu.h.
+ * An edge jitter (uniform noise on the position of the edges, in steps) simulates unevenly spaced
+ * encoder marks and an encoder sitting on an edge: the counter then chatters between two values.
+ */
+#ifndef HOST_ENCODER_H_
+#define HOST_ENCODER_H_
+
+#include <math.h>
+#include "Q4CLeft.h"
+#include "Q4CRight.h"
+
+#define HOST_ENCODER_PERIOD_NS  80000 /* QuadInt sampling period */
+
+typedef struct {
+  double pos;      /* actual wheel position, steps */
+  double speed;    /* steps per second */
+  double accel;    /* steps per second^2 */
+  double jitter;   /* edge jitter, steps: the counter sees the position with +/- jitter/2 noise */
+  int32_t offset;  /* counter minus position, changed by SetPos() */
+  int32_t cnt;     /* counter value of the last sample */
+} HOST_Encoder;
+
+static HOST_Encoder HOST_Encoders[2]; /* left and right */
+static uint64_t HOST_EncoderNextNs, HOST_EncoderLastNs;
+uint32_t HOST_DEMCR, HOST_DWT_CTRL; /* see stubs/Cpu.h */
+
+/*! \brief Counter value for the actual position. */
+static int32_t HOST_EncoderCount(const HOST_Encoder *e) {
+  double noise = e->jitter>0 ? e->jitter*((double)rand()/RAND_MAX-0.5) : 0;
+
+  return (int32_t)floor(e->pos+noise)+e->offset;
+}
+
+static uint64_t HOST_EncoderNextEvent(void) {
+  return HOST_EncoderNextNs;
+}
+
+/*! \brief QuadInt interrupt: moves the wheels to the current time, samples the counters and timestamps the edges. */
+static void HOST_EncoderOnEvent(void) {
+  uint32_t start = QUAD_IsrStart(); /* as Events.c */
+  double dt = (HOST_TimeNs-HOST_EncoderLastNs)/1e9;
+  int i;
+
+  for(i=0;i<2;i++) {
+    HOST_Encoder *e = &HOST_Encoders[i];
+
+    e->pos += e->speed*dt+e->accel*dt*dt/2;
+    e->speed += e->accel*dt;
+    e->cnt = HOST_EncoderCount(e);
+  }
+  HOST_EncoderLastNs = HOST_TimeNs;
+  HOST_EncoderNextNs += HOST_ENCODER_PERIOD_NS;
+  QUAD_SampleEdges();
+  QUAD_IsrEnd(start);
+}
+
+/*! \brief Stops both wheels at position 0 and starts the sampling interrupt. */
+static void HOST_EncoderInit(void) {
+  memset(HOST_Encoders, 0, sizeof(HOST_Encoders));
+  HOST_EncoderLastNs = HOST_TimeNs;
+  HOST_EncoderNextNs = HOST_TimeNs+HOST_ENCODER_PERIOD_NS;
+  HOST_NextEventNs = HOST_EncoderNextEvent;
+  HOST_OnEvent = HOST_EncoderOnEvent;
+}
+
+/* Q4CLeft and Q4CRight replacement */
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void) { return (Q4CLeft_QuadCntrType)HOST_Encoders[0].cnt; }
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos) { HOST_Encoders[0].offset += (int32_t)pos-HOST_Encoders[0].cnt; HOST_Encoders[0].cnt = (int32_t)pos; }
+uint16_t Q4CLeft_NofErrors(void) { return 0; }
+void Q4CLeft_Sample(void) {}
+uint8_t Q4CLeft_SwapPins(bool swap) { (void)swap; return ERR_OK; }
+Q4CRight_QuadCntrType Q4CRight_GetPos(void) { return (Q4CRight_QuadCntrType)HOST_Encoders[1].cnt; }
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos) { HOST_Encoders[1].offset += (int32_t)pos-HOST_Encoders[1].cnt; HOST_Encoders[1].cnt = (int32_t)pos; }
+uint16_t Q4CRight_NofErrors(void) { return 0; }
+void Q4CRight_Sample(void) {}
+uint8_t Q4CRight_SwapPins(bool swap) { (void)swap; return ERR_OK; }
+
+#endif /* HOST_ENCODER_H_ */
@@ -0,0 +1,113 @@
+/**
+ * \file
+ * \brief Simulated motors and wheels, for the host tests.
+ *
+ * Include it once in the test program, after the module under test. Replaces the Motor module
+ * (MOT_GetMotorHandle(), MOT_SetVal(), MOT_SetDirection(), ...): the PWM value and direction set by
+ * the module drive a first order plus dead time model of each motor,
+ *   speed = K*(pwm-deadband) with the time constant tau, after the dead time theta,
+ * in steps per second, and the wheel position in steps is the integral of the speed. The model is
+ * advanced with HOST_MotorOnMs(), which a test sets as HOST_OnMs (or calls from its own callback).
+ * The default parameters are the ones identified by Tools/motor_ident from the step responses in
+ * TEAM_Robot/Regler (see PidSpeedTuning.h), with the dead time rounded to the millisecond and an
+ * assumed deadband: a test can change them, e.g. to simulate a load or a different motor.
+ */
+#ifndef HOST_MOTOR_H_
+#define HOST_MOTOR_H_
+
+#include <math.h>
+#include "Motor.h"
+
+#define HOST_MOTOR_MAX_DEAD_MS  100 /* longest dead time of the model */
+
+typedef struct {
+  double k;        /* steps per second per PWM unit */
+  double tauMs;    /* time constant */
+  int deadMs;      /* dead time, 0..HOST_MOTOR_MAX_DEAD_MS */
+  double deadband; /* PWM which does not move the motor yet (static friction) */
+  double load;     /* speed lost to a load, in steps per second, against the direction of motion */
+  double speed;    /* actual speed, steps per second */
+  double pos;      /* actual wheel position, steps */
+  int32_t pwm;     /* PWM applied, -0xFFFF..0xFFFF, negative is backward */
+  int32_t delayed[HOST_MOTOR_MAX_DEAD_MS]; /* PWM values on the way through the dead time */
+  unsigned int delayIdx;
+} HOST_Motor;
+
+static MOT_MotorDevice HOST_MotorDev[2]; /* MOT_MOTOR_LEFT, MOT_MOTOR_RIGHT */
+static MOT_Direction HOST_MotorDir[2];
+static HOST_Motor HOST_Motors[2];
+
+/*! \brief Sets both motors to the identified model and stops them. */
+static void HOST_MotorInit(void) {
+  int i;
+
+  memset(HOST_Motors, 0, sizeof(HOST_Motors));
+  memset(HOST_MotorDev, 0, sizeof(HOST_MotorDev));
+  for(i=0;i<2;i++) {
+    HOST_MotorDev[i].currPWMvalue = 0xFFFF; /* low active: stopped */
+    HOST_MotorDir[i] = MOT_DIR_FORWARD;
+    HOST_Motors[i].deadMs = 25;
+    HOST_Motors[i].deadband = 700;
+  }
+  HOST_Motors[MOT_MOTOR_LEFT].k = 0.10575;
+  HOST_Motors[MOT_MOTOR_LEFT].tauMs = 23.0;
+  HOST_Motors[MOT_MOTOR_RIGHT].k = 0.10275;
+  HOST_Motors[MOT_MOTOR_RIGHT].tauMs = 23.6;
+}
+
+/*! \brief Steady state speed of a motor for a PWM value, in steps per second. */
+static double HOST_MotorSteadySpeed(const HOST_Motor *m, int32_t pwm) {
+  double drive = fabs((double)pwm)-m->deadband;
+
+  if (drive<=0) {
+    return 0;
+  }
+  drive = m->k*drive-m->load;
+  if (drive<0) {
+    drive = 0;
+  }
+  return pwm<0 ? -drive : drive;
+}
+
+/*! \brief Advances both motors by one millisecond. */
+static void HOST_MotorOnMs(void) {
+  double a;
+  int32_t pwm;
+  int i;
+
+  for(i=0;i<2;i++) {
+    HOST_Motor *m = &HOST_Motors[i];
+
+    m->pwm = 0xFFFF-HOST_MotorDev[i].currPWMvalue;
+    if (HOST_MotorDir[i]==MOT_DIR_BACKWARD) {
+      m->pwm = -m->pwm;
+    }
+    if (m->deadMs>0) {
+      if (m->delayIdx>=(unsigned int)m->deadMs) { /* dead time changed */
+        m->delayIdx = 0;
+      }
+      pwm = m->delayed[m->delayIdx]; /* applied deadMs milliseconds ago */
+      m->delayed[m->delayIdx] = m->pwm;
+      m->delayIdx = (m->delayIdx+1)%m->deadMs;
+    } else {
+      pwm = m->pwm;
+    }
+    a = exp(-1.0/m->tauMs);
+    m->pos += m->speed/1000; /* 1 ms */
+    m->speed = a*m->speed+(1-a)*HOST_MotorSteadySpeed(m, pwm);
+  }
+}
+
+/* Motor module replacement */
+MOT_MotorDevice *MOT_GetMotorHandle(MOT_MotorSide side) { return &HOST_MotorDev[side]; }
+void MOT_SetVal(MOT_MotorDevice *motor, uint16_t val) { motor->currPWMvalue = val; }
+uint16_t MOT_GetVal(MOT_MotorDevice *motor) { return motor->currPWMvalue; }
+void MOT_SetDirection(MOT_MotorDevice *motor, MOT_Direction dir) { HOST_MotorDir[motor-HOST_MotorDev] = dir; }
+MOT_Direction MOT_GetDirection(MOT_MotorDevice *motor) { return HOST_MotorDir[motor-HOST_MotorDev]; }
+void MOT_UpdatePercent(MOT_MotorDevice *motor, MOT_Direction dir) {
+  int32_t percent = ((0xFFFF-motor->currPWMvalue)*100+0x7FFF)/0xFFFF;
+
+  motor->currSpeedPercent = (MOT_SpeedPercent)(dir==MOT_DIR_BACKWARD ? -percent : percent);
+}
+
+#endif /* HOST_MOTOR_H_ */
@@ -0,0 +1,217 @@
+/**
+ * \file
+ * \brief Simulated reflectance sensor hardware, for the host tests of Reflectance.c.
+ *
+ * Include it once in the test program, after Reflectance.c and HostRtos.h. Each sensor is a
+ * capacitor which discharges through a photo transistor once its pin is switched to input:
+ * the discharge rate is the sum of the IR light (only while the IR LED's are on) and the ambient light.
+ * Switching the IR LED's during a discharge changes the rate from then on.
+ * The pins of the sensor port (IRn components, GPIO registers and pin interrupts) and the RefCnt timer
+ * work on the simulated time, and every register access costs the time configured below.
+ */
+#ifndef HOST_REF_H_
+#define HOST_REF_H_
+
+#include <math.h>
+
+/* light on each sensor, indexed by the sensor position. 0 means no light: the sensor does not discharge */
+static double HOST_RefIrUs[REF_NOF_SENSORS];   /* discharge time with the IR light only, in microseconds */
+static double HOST_RefDarkUs[REF_NOF_SENSORS]; /* discharge time with the ambient light only, in microseconds */
+
+/* cost of the register accesses on the target: assumed values for a 120 MHz K22, not measured */
+static uint32_t HOST_RefCntReadNs = 200;   /* RefCnt_GetCounterValue(), LDD call and peripheral read */
+static uint32_t HOST_RefPinReadNs = 150;   /* one IRn_GetVal() through its wrapper function */
+static uint32_t HOST_RefPortReadNs = 40;   /* one read of the GPIO data input register */
+
+static bool HOST_RefLedOn = FALSE;
+
+uint32_t HOST_PortIsfr = 0;
+uint32_t HOST_PortIrqc[32];
+
+/* state of the port pins */
+static uint32_t HOST_PinDirOut = 0;      /* bit set for each output pin */
+static uint32_t HOST_PinOutVal = 0;      /* output value of each pin */
+static uint64_t HOST_PinEdgeNs[32];      /* time the pin falls below the threshold, UINT64_MAX for never */
+static double HOST_PinCharge[32];        /* charge left to the threshold at HOST_PinChargeNs, 1 at the start of the discharge */
+static uint64_t HOST_PinChargeNs[32];    /* time of the start of the discharge or of the last change of the light */
+static uint32_t HOST_PinEdgeDone = 0;    /* bit set if the interrupt flag has been set for the edge */
+static int8_t HOST_PinSensor[32];        /* sensor position on each pin, -1 for none */
+static uint64_t HOST_RefCntResetNs = 0;  /* time of the last RefCnt reset */
+
+#define HOST_REF_PIN_ENTRY(pos, nr, pin)   [nr] = pin,
+static const uint8_t HOST_IrPin[9] = { REF_SENSOR_TABLE(HOST_REF_PIN_ENTRY) }; /* port pin of each IRn component */
+
+/*! \brief Discharge rate of the sensor on a pin with the current light, charge per microsecond. */
+static double HOST_RefRate(int pin) {
+  int pos = HOST_PinSensor[pin];
+  double rate = 0;
+
+  if (pos<0) {
+    return 0;
+  }
+  if (HOST_RefLedOn && HOST_RefIrUs[pos]>0) {
+    rate += 1.0/HOST_RefIrUs[pos];
+  }
+  if (HOST_RefDarkUs[pos]>0) {
+    rate += 1.0/HOST_RefDarkUs[pos];
+  }
+  return rate;
+}
+
+/*! \brief Sets the edge of a discharging pin from its charge left and the current light. */
+static void HOST_PinSetEdge(int pin) {
+  double rate = HOST_RefRate(pin);
+
+  HOST_PinEdgeNs[pin] = rate==0 ? UINT64_MAX : HOST_PinChargeNs[pin]+(uint64_t)llround(1000.0*HOST_PinCharge[pin]/rate);
+}
+
+static void HOST_PinSetDir(uint32_t mask, bool out) {
+  int pin;
+
+  for(pin=0;pin<32;pin++) {
+    if (mask&(1U<<pin)) {
+      if (out) {
+        HOST_PinDirOut |= 1U<<pin;
+      } else if (HOST_PinDirOut&(1U<<pin)) { /* starts to discharge */
+        HOST_PinDirOut &= ~(1U<<pin);
+        HOST_PinCharge[pin] = 1;
+        HOST_PinChargeNs[pin] = HOST_TimeNs;
+        HOST_PinSetEdge(pin);
+        HOST_PinEdgeDone &= ~(1U<<pin);
+      }
+    }
+  }
+}
+
+static bool HOST_PinGet(int pin) {
+  if (HOST_PinDirOut&(1U<<pin)) {
+    return (HOST_PinOutVal>>pin)&1;
+  }
+  return HOST_TimeNs<HOST_PinEdgeNs[pin];
+}
+
+/* GPIO registers */
+uint32_t HOST_GpioGetInput(void) {
+  uint32_t val = 0;
+  int pin;
+
+  for(pin=0;pin<32;pin++) {
+    if (HOST_PinGet(pin)) {
+      val |= 1U<<pin;
+    }
+  }
+  HOST_AdvanceNs(HOST_RefPortReadNs);
+  return val;
+}
+void HOST_GpioSetOutput(uint32_t mask) { HOST_PinOutVal |= mask; }
+void HOST_GpioSetDirOutput(uint32_t mask) { HOST_PinSetDir(mask, TRUE); }
+void HOST_GpioSetDirInput(uint32_t mask) { HOST_PinSetDir(mask, FALSE); }
+
+/* BitIO components of the sensors */
+#define HOST_REF_IR_FCTS(nr) \
+  void IR##nr##_SetOutput(void) { HOST_PinSetDir(1U<<HOST_IrPin[nr], TRUE); } \
+  void IR##nr##_SetInput(void) { HOST_PinSetDir(1U<<HOST_IrPin[nr], FALSE); } \
+  void IR##nr##_SetVal(void) { HOST_PinOutVal |= 1U<<HOST_IrPin[nr]; } \
+  void IR##nr##_ClrVal(void) { HOST_PinOutVal &= ~(1U<<HOST_IrPin[nr]); } \
+  bool IR##nr##_GetVal(void) { bool val = HOST_PinGet(HOST_IrPin[nr]); HOST_AdvanceNs(HOST_RefPinReadNs); return val; }
+HOST_REF_IR_FCTS(1) HOST_REF_IR_FCTS(2) HOST_REF_IR_FCTS(3) HOST_REF_IR_FCTS(4)
+HOST_REF_IR_FCTS(5) HOST_REF_IR_FCTS(6) HOST_REF_IR_FCTS(7) HOST_REF_IR_FCTS(8)
+
+/*! \brief Switches the IR LED's: the pins still discharging continue with the new light. */
+static void HOST_RefSetLed(bool on) {
+  int pin;
+
+  for(pin=0;pin<32;pin++) {
+    if (!(HOST_PinDirOut&(1U<<pin)) && HOST_PinSensor[pin]>=0 && HOST_TimeNs<HOST_PinEdgeNs[pin]) {
+      HOST_PinCharge[pin] -= HOST_RefRate(pin)*(HOST_TimeNs-HOST_PinChargeNs[pin])/1000.0;
+      HOST_PinChargeNs[pin] = HOST_TimeNs;
+    }
+  }
+  HOST_RefLedOn = on;
+  for(pin=0;pin<32;pin++) {
+    if (!(HOST_PinDirOut&(1U<<pin)) && HOST_PinSensor[pin]>=0 && HOST_TimeNs<HOST_PinEdgeNs[pin]) {
+      HOST_PinSetEdge(pin);
+    }
+  }
+}
+void LED_IR_On(void) { HOST_RefSetLed(TRUE); }
+void LED_IR_Off(void) { HOST_RefSetLed(FALSE); }
+
+/* RefCnt timer */
+LDD_TDeviceData *RefCnt_Init(LDD_TUserData *userData) { (void)userData; return (LDD_TDeviceData*)&HOST_RefCntResetNs; }
+uint8_t RefCnt_ResetCounter(LDD_TDeviceData *handle) { (void)handle; HOST_RefCntResetNs = HOST_TimeNs; return ERR_OK; }
+RefCnt_TValueType RefCnt_GetCounterValue(LDD_TDeviceData *handle) {
+  RefCnt_TValueType val = (RefCnt_TValueType)((HOST_TimeNs-HOST_RefCntResetNs)*(RefCnt_CNT_INP_FREQ_U_0/1000)/1000000);
+
+  (void)handle;
+  HOST_AdvanceNs(HOST_RefCntReadNs);
+  return val;
+}
+/*! \brief RefCnt ticks for a time in nanoseconds, rounded down like the counter. */
+static inline uint32_t HOST_RefNsToCnt(uint64_t ns) { return (uint32_t)(ns*(RefCnt_CNT_INP_FREQ_U_0/1000)/1000000); }
+
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+/* Port interrupt: the flag of a pin is set at its falling edge if the pin interrupt is enabled, and the
+ * interrupt runs HOST_RefIsrLatencyNs later with the flags collected up to then. */
+static uint32_t HOST_RefIsrLatencyNs = 400; /* from the edge to the time stamp in the interrupt, assumed */
+static uint32_t HOST_RefNofInterrupts = 0; /* number of port interrupts run */
+
+static uint64_t HOST_RefNextEdgeNs(void) {
+  uint64_t next = UINT64_MAX;
+  int pin;
+
+  for(pin=0;pin<32;pin++) {
+    if (!(HOST_PinDirOut&(1U<<pin)) && !(HOST_PinEdgeDone&(1U<<pin))
+        && HOST_PortIrqc[pin]==PORT_PDD_INTERRUPT_ON_FALLING && HOST_PinEdgeNs[pin]!=UINT64_MAX
+        && HOST_PinEdgeNs[pin]+HOST_RefIsrLatencyNs<next)
+    {
+      next = HOST_PinEdgeNs[pin]+HOST_RefIsrLatencyNs;
+    }
+  }
+  return next;
+}
+
+static void HOST_RefOnEdge(void) {
+  int pin;
+
+  for(pin=0;pin<32;pin++) {
+    if (!(HOST_PinDirOut&(1U<<pin)) && !(HOST_PinEdgeDone&(1U<<pin))
+        && HOST_PortIrqc[pin]==PORT_PDD_INTERRUPT_ON_FALLING && HOST_PinEdgeNs[pin]<=HOST_TimeNs)
+    {
+      HOST_PortIsfr |= 1U<<pin;
+      HOST_PinEdgeDone |= 1U<<pin;
+    }
+  }
+  HOST_RefNofInterrupts++;
+  REF_OnPortInterrupt();
+}
+#endif
+
+/*!
+ * \brief Sets up the simulated sensors, and the reflectance module with its calibration.
+ * \param minVal Calibrated min value of all sensors, in RefCnt ticks
+ * \param maxVal Calibrated max value of all sensors, in RefCnt ticks
+ */
+static void HOST_RefInit(SensorTimeType minVal, SensorTimeType maxVal) {
+  int i;
+
+  for(i=0;i<32;i++) {
+    HOST_PinSensor[i] = -1;
+    HOST_PinEdgeNs[i] = UINT64_MAX;
+  }
+#define HOST_REF_SENSOR_ENTRY(pos, nr, pin)   HOST_PinSensor[pin] = pos;
+  REF_SENSOR_TABLE(HOST_REF_SENSOR_ENTRY)
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+  HOST_NextEventNs = HOST_RefNextEdgeNs;
+  HOST_OnEvent = HOST_RefOnEdge;
+#endif
+  mutexHandle = xSemaphoreCreateMutex();
+  timerHandle = RefCnt_Init(NULL);
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    SensorCalibMinMax.minVal[i] = minVal;
+    SensorCalibMinMax.maxVal[i] = maxVal;
+  }
+  REF_UpdateScale();
+}
+
+#endif /* HOST_REF_H_ */
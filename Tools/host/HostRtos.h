@@ -0,0 +1,254 @@
+/**
+ * \file
+ * \brief Single threaded stand-in for the RTOS API, for the host tests.
+ *
+ * Include it once in the test program, after the module under test. Time is simulated: it only
+ * advances in the delay and blocking functions. For each millisecond passed, HOST_OnMs is called
+ * if set, so a test can run its plant model, the tick hook or the timer interrupt there. Hardware
+ * events in between (e.g. the edge of a port pin) are run with HOST_NextEventNs/HOST_OnEvent.
+ * Tasks are not run: a test calls the task body functions itself.
+ */
+#ifndef HOST_RTOS_H_
+#define HOST_RTOS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FRTOS1.h"
+#include "WAIT1.h"
+
+uint64_t HOST_TimeNs = 0;          /* simulated time since the start */
+#define HOST_TimeUs  (HOST_TimeNs/1000) /* simulated time in microseconds */
+void (*HOST_OnMs)(void) = NULL;    /* called for each millisecond passed */
+uint64_t (*HOST_NextEventNs)(void) = NULL; /* time of the next hardware event (e.g. an edge), UINT64_MAX for none */
+void (*HOST_OnEvent)(void) = NULL; /* called when the time of the next hardware event has been reached */
+
+static int HOST_NofFailed = 0;     /* number of failed checks */
+
+/*! \brief Checks a condition, prints and counts failures. */
+#define HOST_CHECK(cond, ...) \
+  do { if (!(cond)) { HOST_NofFailed++; printf("FAILED %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while(0)
+
+/*! \brief Result of the test program: prints a summary and returns the exit code for main(). */
+static int HOST_Result(const char *name) {
+  printf("%s: %s\n", name, HOST_NofFailed==0 ? "OK" : "FAILED");
+  return HOST_NofFailed==0 ? 0 : 1;
+}
+
+/*!
+ * \brief Advances the simulated time, running the hardware events and the millisecond callback on the way.
+ * \param end Time to advance to
+ * \param wake Returns early once this is nonzero, NULL to advance to the end
+ */
+static void HOST_AdvanceTo(uint64_t end, volatile uint32_t *wake) {
+  static bool inEvent = FALSE; /* no nested events: time passing in an interrupt only delays the next one */
+
+  while (HOST_TimeNs<end && (wake==NULL || *wake==0)) {
+    uint64_t next = (HOST_TimeNs/1000000+1)*1000000; /* next millisecond */
+    uint64_t event = HOST_NextEventNs!=NULL && !inEvent ? HOST_NextEventNs() : UINT64_MAX;
+
+    if (event<HOST_TimeNs) {
+      event = HOST_TimeNs; /* due now */
+    }
+    if (end<next && end<event) {
+      HOST_TimeNs = end;
+    } else if (event<next) {
+      HOST_TimeNs = event;
+      inEvent = TRUE;
+      HOST_OnEvent();
+      inEvent = FALSE;
+    } else {
+      HOST_TimeNs = next;
+      if (HOST_OnMs!=NULL && !inEvent) {
+        HOST_OnMs();
+      }
+    }
+  }
+}
+
+void HOST_AdvanceNs(uint64_t ns) { HOST_AdvanceTo(HOST_TimeNs+ns, NULL); }
+void HOST_AdvanceUs(uint32_t us) { HOST_AdvanceTo(HOST_TimeNs+us*1000ULL, NULL); }
+
+/* delays */
+void WAIT1_Waitus(uint16_t us) { HOST_AdvanceUs(us); }
+void WAIT1_Waitms(uint16_t ms) { HOST_AdvanceUs(ms*1000U); }
+void WAIT1_WaitOSms(uint16_t ms) { HOST_AdvanceUs(ms*1000U); }
+void vTaskDelay(TickType_t ticks) { HOST_AdvanceTo((HOST_TimeNs/1000000+ticks)*1000000, NULL); }
+void vTaskDelayUntil(TickType_t *prev, TickType_t inc) {
+  *prev += inc;
+  HOST_AdvanceTo(*prev*1000000ULL, NULL);
+}
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(HOST_TimeNs/1000000); }
+TickType_t xTaskGetTickCountFromISR(void) { return (TickType_t)(HOST_TimeNs/1000000); }
+
+/* tasks are created, but not run */
+static int HOST_NofTasks = 0;
+BaseType_t xTaskCreate(void (*fct)(void*), const char *name, uint16_t stack, void *param, UBaseType_t prio, TaskHandle_t *handle) {
+  (void)fct; (void)name; (void)stack; (void)param; (void)prio;
+  HOST_NofTasks++;
+  if (handle!=NULL) {
+    *handle = (TaskHandle_t)(intptr_t)HOST_NofTasks;
+  }
+  return pdPASS;
+}
+TaskHandle_t xTaskGetCurrentTaskHandle(void) { return (TaskHandle_t)(intptr_t)1000; }
+void vTaskSuspendAll(void) {}
+BaseType_t xTaskResumeAll(void) { return pdFALSE; }
+
+/* one notification value for all tasks: tests check the value of the task they are interested in */
+static volatile uint32_t HOST_NotifyValue, HOST_NotifyCount;
+static TaskHandle_t HOST_NotifyTask;
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  HOST_NotifyTask = task;
+  if (action==eSetBits) {
+    HOST_NotifyValue |= value;
+  } else if (action==eSetValueWithOverwrite) {
+    HOST_NotifyValue = value;
+  } else if (action==eIncrement) {
+    HOST_NotifyValue++;
+  }
+  HOST_NotifyCount++;
+  return pdPASS;
+}
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *woken) {
+  *woken = pdTRUE;
+  return xTaskNotify(task, value, action);
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return xTaskNotify(task, 0, eIncrement); }
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) { *woken = pdTRUE; (void)xTaskNotify(task, 0, eIncrement); }
+/*! \brief Time at which a block of the given number of ticks times out: the tick interrupt ends it, not the elapsed time. */
+static uint64_t HOST_TimeoutNs(TickType_t ticks) {
+  return ticks==portMAX_DELAY ? UINT64_MAX : (HOST_TimeNs/1000000+ticks)*1000000;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) {
+  uint32_t val;
+
+  HOST_AdvanceTo(HOST_TimeoutNs(ticks), &HOST_NotifyValue); /* nobody else runs: only an interrupt can notify us */
+  val = HOST_NotifyValue;
+  if (clear) {
+    HOST_NotifyValue = 0;
+  } else if (val>0) {
+    HOST_NotifyValue--;
+  }
+  return val;
+}
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value, TickType_t ticks) {
+  HOST_NotifyValue &= ~clearOnEntry;
+  HOST_AdvanceTo(HOST_TimeoutNs(ticks), &HOST_NotifyCount);
+  if (value!=NULL) {
+    *value = HOST_NotifyValue;
+  }
+  if (HOST_NotifyCount==0) {
+    return pdFALSE;
+  }
+  HOST_NotifyCount = 0;
+  HOST_NotifyValue &= ~clearOnExit;
+  return pdTRUE;
+}
+
+/* semaphores and mutexes: a counter, taking never blocks */
+typedef struct { int cnt; int isMutex; } HOST_Sem;
+void *xSemaphoreCreateMutex(void) { HOST_Sem *s = calloc(1, sizeof(HOST_Sem)); s->cnt = 1; s->isMutex = 1; return s; }
+void *xSemaphoreCreateBinary(void) { return calloc(1, sizeof(HOST_Sem)); }
+BaseType_t xSemaphoreTake(void *sem, TickType_t ticks) {
+  HOST_Sem *s = sem;
+
+  if (s==NULL) {
+    return pdFAIL;
+  }
+  if (s->cnt==0) {
+    if (s->isMutex) {
+      return pdPASS; /* single threaded: nobody else can hold it */
+    }
+    HOST_AdvanceTo(HOST_TimeoutNs(ticks), NULL); /* nobody else gives it */
+    return pdFAIL;
+  }
+  s->cnt--;
+  return pdPASS;
+}
+BaseType_t xSemaphoreGive(void *sem) {
+  HOST_Sem *s = sem;
+
+  if (s==NULL || s->cnt>0) {
+    return pdFAIL;
+  }
+  s->cnt++;
+  return pdPASS;
+}
+BaseType_t xSemaphoreGiveFromISR(void *sem, BaseType_t *woken) { *woken = pdFALSE; return xSemaphoreGive(sem); }
+
+/* queues */
+typedef struct { UBaseType_t len, size, head, nof; uint8_t *buf; } HOST_Queue;
+void *xQueueCreate(UBaseType_t len, UBaseType_t size) {
+  HOST_Queue *q = calloc(1, sizeof(HOST_Queue));
+
+  q->len = len; q->size = size; q->buf = calloc(len, size);
+  return q;
+}
+BaseType_t xQueueSendToBack(void *queue, const void *item, TickType_t ticks) {
+  HOST_Queue *q = queue;
+
+  (void)ticks;
+  if (q->nof==q->len) {
+    return pdFAIL;
+  }
+  memcpy(q->buf+((q->head+q->nof)%q->len)*q->size, item, q->size);
+  q->nof++;
+  return pdPASS;
+}
+BaseType_t xQueueReceive(void *queue, void *item, TickType_t ticks) {
+  HOST_Queue *q = queue;
+
+  (void)ticks;
+  if (q->nof==0) {
+    return pdFAIL;
+  }
+  memcpy(item, q->buf+q->head*q->size, q->size);
+  q->head = (q->head+1)%q->len;
+  q->nof--;
+  return pdPASS;
+}
+UBaseType_t uxQueueMessagesWaiting(void *queue) { return ((HOST_Queue*)queue)->nof; }
+void vQueueDelete(void *queue) { if (queue!=NULL) { free(((HOST_Queue*)queue)->buf); free(queue); } }
+void vQueueAddToRegistry(void *queue, const char *name) { (void)queue; (void)name; }
+
+/* event groups: waiting returns at once, or advances the time until the bits are set by HOST_OnMs */
+typedef struct { EventBits_t bits; } HOST_EventGroup;
+EventGroupHandle_t xEventGroupCreate(void) { return calloc(1, sizeof(HOST_EventGroup)); }
+void vEventGroupDelete(EventGroupHandle_t group) { free(group); }
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) { return ((HOST_EventGroup*)group)->bits |= bits; }
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  EventBits_t old = ((HOST_EventGroup*)group)->bits;
+
+  ((HOST_EventGroup*)group)->bits &= ~bits;
+  return old;
+}
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) { return ((HOST_EventGroup*)group)->bits; }
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t group, EventBits_t bits, BaseType_t *woken) { *woken = pdFALSE; (void)xEventGroupSetBits(group, bits); return pdPASS; }
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks) {
+  HOST_EventGroup *g = group;
+  EventBits_t val;
+
+  for(;;) {
+    val = g->bits;
+    if (all ? (val&bits)==bits : (val&bits)!=0) {
+      if (clear) {
+        g->bits &= ~bits;
+      }
+      return val;
+    }
+    if (ticks==0) {
+      return val;
+    }
+    HOST_AdvanceUs(1000);
+    if (ticks!=portMAX_DELAY) {
+      ticks--;
+    }
+  }
+}
+
+void *pvPortMalloc(size_t size) { return malloc(size); }
+void vPortFree(void *p) { free(p); }
+
+#endif /* HOST_RTOS_H_ */
@@ -0,0 +1,97 @@
+/**
+ * \file
+ * \brief Stand-in for the shell and string utilities (CLS1, UTIL1, SHELL), for the host tests.
+ *
+ * Include it once in the test program. The output of the shell commands is written to stdout
+ * if HOST_ShellEcho is set, and dropped otherwise. HOST_ShellNofChars counts it in both cases.
+ */
+#ifndef HOST_SHELL_H_
+#define HOST_SHELL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CLS1.h"
+#include "UTIL1.h"
+
+static bool HOST_ShellEcho = FALSE; /* write the shell output to stdout */
+static unsigned long HOST_ShellNofChars = 0; /* characters written to the shell so far */
+
+static void HOST_ShellOut(uint8_t ch) { HOST_ShellNofChars++; if (HOST_ShellEcho) { putchar(ch); } }
+static void HOST_ShellIn(uint8_t *ch) { *ch = '\0'; }
+static bool HOST_ShellKeyPressed(void) { return FALSE; }
+static CLS1_ConstStdIOType HOST_ShellStdio = {HOST_ShellIn, HOST_ShellOut, HOST_ShellOut, HOST_ShellKeyPressed};
+
+CLS1_ConstStdIOType *CLS1_GetStdio(void) { return &HOST_ShellStdio; }
+void CLS1_SendStr(const unsigned char *str, CLS1_StdIO_OutErr_FctType out) { while (*str!='\0') { out(*str++); } }
+void CLS1_SendData(const uint8_t *data, uint16_t size, CLS1_StdIO_OutErr_FctType out) { while (size-->0) { out(*data++); } }
+void CLS1_SendHelpStr(const unsigned char *cmd, const unsigned char *help, CLS1_StdIO_OutErr_FctType out) { CLS1_SendStr(cmd, out); CLS1_SendStr((const unsigned char*)" ", out); CLS1_SendStr(help, out); }
+void CLS1_SendStatusStr(const unsigned char *name, const unsigned char *val, CLS1_StdIO_OutErr_FctType out) { CLS1_SendStr(name, out); CLS1_SendStr((const unsigned char*)" ", out); CLS1_SendStr(val, out); }
+static void HOST_SendNum(long long num, CLS1_StdIO_OutErr_FctType out) { char buf[24]; snprintf(buf, sizeof(buf), "%lld", num); CLS1_SendStr((unsigned char*)buf, out); }
+void CLS1_SendNum32s(int32_t num, CLS1_StdIO_OutErr_FctType out) { HOST_SendNum(num, out); }
+void CLS1_SendNum8u(uint8_t num, CLS1_StdIO_OutErr_FctType out) { HOST_SendNum(num, out); }
+void CLS1_SendNum16u(uint16_t num, CLS1_StdIO_OutErr_FctType out) { HOST_SendNum(num, out); }
+void CLS1_SendNum32u(uint32_t num, CLS1_StdIO_OutErr_FctType out) { HOST_SendNum(num, out); }
+void CLS1_SendNum16s(int16_t num, CLS1_StdIO_OutErr_FctType out) { HOST_SendNum(num, out); }
+void SHELL_SendString(unsigned char *msg) { CLS1_SendStr(msg, HOST_ShellOut); }
+
+void UTIL1_strcpy(uint8_t *dst, size_t size, const unsigned char *src) { snprintf((char*)dst, size, "%s", (const char*)src); }
+void UTIL1_strcat(uint8_t *dst, size_t size, const unsigned char *src) {
+  size_t len = strlen((char*)dst);
+
+  while (len+1<size && *src!='\0') {
+    dst[len++] = *src++;
+  }
+  if (len<size) {
+    dst[len] = '\0';
+  }
+}
+void UTIL1_chcat(uint8_t *dst, size_t size, uint8_t ch) { char buf[2] = {(char)ch, '\0'}; UTIL1_strcat(dst, size, (unsigned char*)buf); }
+static void HOST_StrcatFmt(uint8_t *dst, size_t size, const char *fmt, long long num) { char buf[24]; snprintf(buf, sizeof(buf), fmt, num); UTIL1_strcat(dst, size, (unsigned char*)buf); }
+void UTIL1_strcatNum16Hex(uint8_t *dst, size_t size, uint16_t num) { HOST_StrcatFmt(dst, size, "%04llX", num); }
+void UTIL1_strcatNum32Hex(uint8_t *dst, size_t size, uint32_t num) { HOST_StrcatFmt(dst, size, "%08llX", num); }
+void UTIL1_strcatNum16s(uint8_t *dst, size_t size, int16_t num) { HOST_StrcatFmt(dst, size, "%lld", num); }
+void UTIL1_strcatNum16u(uint8_t *dst, size_t size, uint16_t num) { HOST_StrcatFmt(dst, size, "%lld", num); }
+void UTIL1_strcatNum32s(uint8_t *dst, size_t size, int32_t num) { HOST_StrcatFmt(dst, size, "%lld", num); }
+void UTIL1_strcatNum32u(uint8_t *dst, size_t size, uint32_t num) { HOST_StrcatFmt(dst, size, "%lld", num); }
+void UTIL1_strcatNum8u(uint8_t *dst, size_t size, uint8_t num) { HOST_StrcatFmt(dst, size, "%lld", num); }
+void UTIL1_strcatNum32sDotValue100(uint8_t *dst, size_t size, int32_t num) {
+  char buf[24];
+
+  snprintf(buf, sizeof(buf), "%s%d.%02d", num<0 ? "-" : "", abs(num/100), abs(num%100));
+  UTIL1_strcat(dst, size, (unsigned char*)buf);
+}
+void UTIL1_Num32sToStr(uint8_t *dst, size_t size, int32_t num) { dst[0] = '\0'; UTIL1_strcatNum32s(dst, size, num); }
+void UTIL1_Num32uToStr(uint8_t *dst, size_t size, uint32_t num) { dst[0] = '\0'; UTIL1_strcatNum32u(dst, size, num); }
+void UTIL1_Num8uToStr(uint8_t *dst, size_t size, uint8_t num) { dst[0] = '\0'; UTIL1_strcatNum8u(dst, size, num); }
+void UTIL1_Num16uToStr(uint8_t *dst, size_t size, uint16_t num) { dst[0] = '\0'; UTIL1_strcatNum16u(dst, size, num); }
+void UTIL1_Num16sToStr(uint8_t *dst, size_t size, int16_t num) { dst[0] = '\0'; UTIL1_strcatNum16s(dst, size, num); }
+int UTIL1_strcmp(const char *a, const char *b) { return strcmp(a, b); }
+int UTIL1_strncmp(const char *a, const char *b, size_t n) { return strncmp(a, b, n); }
+size_t UTIL1_strlen(const char *str) { return strlen(str); }
+
+/*! \brief Scans a decimal number like the UTIL1 scan functions: skips leading spaces and advances the string pointer. */
+static uint8_t HOST_ScanNumber(const unsigned char **str, long long *val, bool isSigned) {
+  char *end;
+
+  while (**str==' ') {
+    (*str)++;
+  }
+  if (!isSigned && **str=='-') {
+    return ERR_FAILED;
+  }
+  *val = strtoll((const char*)*str, &end, 10);
+  if (end==(const char*)*str) {
+    return ERR_FAILED;
+  }
+  *str = (const unsigned char*)end;
+  return ERR_OK;
+}
+uint8_t UTIL1_ScanDecimal32uNumber(const unsigned char **str, uint32_t *val) { long long v = 0; uint8_t res = HOST_ScanNumber(str, &v, FALSE); *val = (uint32_t)v; return res; }
+uint8_t UTIL1_ScanDecimal16uNumber(const unsigned char **str, uint16_t *val) { long long v = 0; uint8_t res = HOST_ScanNumber(str, &v, FALSE); *val = (uint16_t)v; return res; }
+uint8_t UTIL1_ScanDecimal8uNumber(const unsigned char **str, uint8_t *val) { long long v = 0; uint8_t res = HOST_ScanNumber(str, &v, FALSE); *val = (uint8_t)v; return res; }
+uint8_t UTIL1_ScanDecimal32sNumber(const unsigned char **str, int32_t *val) { long long v = 0; uint8_t res = HOST_ScanNumber(str, &v, TRUE); *val = (int32_t)v; return res; }
+uint8_t UTIL1_ScanDecimal16sNumber(const unsigned char **str, int16_t *val) { long long v = 0; uint8_t res = HOST_ScanNumber(str, &v, TRUE); *val = (int16_t)v; return res; }
+uint8_t UTIL1_xatoi(const unsigned char **str, int32_t *val) { return UTIL1_ScanDecimal32sNumber(str, val); }
+
+#endif /* HOST_SHELL_H_ */
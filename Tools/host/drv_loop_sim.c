@@ -0,0 +1,242 @@
+/**
+ * \file
+ * \brief Host simulation of the wheel control loop of the drive (Drive.c), run by a simulated TI1 timer.
+ *
+ * Runs Drive.c, Pid.c and Profile.c against the motor model of HostMotor.h. The TI1 timer interrupt
+ * calls DRV_OnTimer() every DRV_ISR_PERIOD_US, with an entry latency of 0 to 2 us and now and then up to
+ * 10 us (a critical section). The drive task runs every DRV_PERIOD_MS as DriveTask() does: it takes over
+ * the commands with GetCmd() and publishes the completion conditions, also when the interrupt wakes it
+ * up. With 'busy', higher priority tasks delay it by 0 to 3 ms in each period.
+ * Built with PL_LOCAL_CONFIG_HAS_DRIVE_ISR_DISABLED, the control loop runs in the simulated drive task
+ * instead, every DRV_PERIOD_MS, as before the timer interrupt. Checks, for both:
+ * - a speed step settles within 3% without overshoot (the speed mode has the feedback alone, see pid_ff_sim),
+ *   also with the drive task delayed. In the timer interrupt, the delays of the drive task do not change
+ *   the step response,
+ * - a 90 degree turn with the motion profile ends within MATCH_MARGIN, and DRV_HasTurned() and the
+ *   DRV_EVENT_TARGET event report it,
+ * - the histograms of 'drive status' count every period of the loop,
+ * - in the timer interrupt, the jitter stays within the entry latency even with the drive task
+ *   delayed, and the loop does not run before DRV_Init().
+ * The speed is the one of the motor model, not measured by Tacho.c (see tacho_edge_test and
+ * tacho_lag_test for that). The simulated time stands still in the interrupt, so the execution times
+ * are all 0: on the host only the counting of the histogram is checked.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o drv_loop_sim drv_loop_sim.c -lm
+ *   ./drv_loop_sim
+ * and the same with -DPL_LOCAL_CONFIG_HAS_DRIVE_ISR_DISABLED for the loop in the drive task.
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_PID_TUNE_DISABLED
+#define PL_LOCAL_CONFIG_HAS_MOTOR_MODEL_DISABLED
+#define PL_LOCAL_CONFIG_HAS_ODOMETRY_DISABLED
+
+#include "Drive.c"
+#include "Pid.c"
+#include "Profile.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#if !PL_CONFIG_HAS_MOTION_PROFILE
+  #error "drv_loop_sim needs PL_CONFIG_HAS_MOTION_PROFILE"
+#endif
+
+#define SIM_LATENCY_US       2  /* usual entry latency of the timer interrupt */
+#define SIM_LATENCY_LONG_US  10 /* entry latency in a critical section */
+#define SIM_BUSY_MAX_MS      3  /* largest delay of the drive task by higher priority tasks */
+
+/* speed and position of the motor model, instead of Tacho.c and the quadrature counters */
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+void TACHO_Sample(void) {}
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void) { return (Q4CLeft_QuadCntrType)floor(HOST_Motors[MOT_MOTOR_LEFT].pos); }
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos) { HOST_Motors[MOT_MOTOR_LEFT].pos = pos; }
+Q4CRight_QuadCntrType Q4CRight_GetPos(void) { return (Q4CRight_QuadCntrType)floor(HOST_Motors[MOT_MOTOR_RIGHT].pos); }
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos) { HOST_Motors[MOT_MOTOR_RIGHT].pos = pos; }
+uint32_t HOST_DEMCR, HOST_DWT_CTRL; /* see stubs/Cpu.h */
+uint32_t QUAD_GetTime(void) { return DWT_CYCCNT; } /* as Quad.c */
+
+static bool SimBusy = FALSE; /* drive task delayed by higher priority tasks */
+static uint64_t SimTaskNextMs; /* next period of the drive task */
+static int SimTaskDelayMs; /* delay of the drive task in this period */
+static unsigned long SimNofTaskRuns;
+#if PL_CONFIG_HAS_DRIVE_ISR
+static uint64_t SimTimerNs; /* next timer interrupt, without latency */
+static uint32_t SimLatencyNs; /* entry latency of the next interrupt */
+static unsigned long SimNofTimerIrqs;
+
+static uint64_t SimTimerNextEvent(void) {
+  return SimTimerNs+SimLatencyNs;
+}
+
+/*! \brief TI1 interrupt, as TI1_OnInterrupt() in Events.c. */
+static void SimTimerOnEvent(void) {
+  DRV_OnTimer();
+  SimNofTimerIrqs++;
+  SimTimerNs += DRV_ISR_PERIOD_US*1000ULL;
+  SimLatencyNs = rand()%20==0 ? (uint32_t)(rand()%(SIM_LATENCY_LONG_US*1000+1)) : (uint32_t)(rand()%(SIM_LATENCY_US*1000+1));
+}
+#endif
+
+/*! \brief One period of DriveTask(). */
+static void SimTaskPeriod(void) {
+  GetCmd();
+#if !PL_CONFIG_HAS_DRIVE_ISR
+  DRV_Loop(DRV_CONTROL_PERIOD_US);
+#endif
+  DRV_PublishEvents();
+  SimNofTaskRuns++;
+}
+
+/*! \brief Every millisecond: the motors, and the drive task when it is due or woken up by the interrupt. */
+static void SimOnMs(void) {
+  uint64_t ms = HOST_TimeNs/1000000;
+
+  HOST_MotorOnMs();
+  if (ms>=SimTaskNextMs+SimTaskDelayMs) {
+    SimTaskPeriod();
+    SimTaskNextMs += DRV_PERIOD_MS;
+    SimTaskDelayMs = SimBusy ? rand()%(SIM_BUSY_MAX_MS+1) : 0;
+  } else if (HOST_NotifyValue!=0) { /* woken up by the interrupt */
+    HOST_NotifyValue = 0;
+    DRV_PublishEvents();
+  }
+}
+
+/*! \brief Stopped motors at 0, drive initialized, task and timer running. */
+static void SimInit(bool busy) {
+  HOST_MotorInit();
+  PID_Init();
+  PROF_Init();
+  DRV_Init();
+  SimBusy = busy;
+  SimTaskNextMs = HOST_TimeNs/1000000+1;
+  SimTaskDelayMs = 0;
+  SimNofTaskRuns = 0;
+#if PL_CONFIG_HAS_DRIVE_ISR
+  SimTimerNs = (HOST_TimeNs/1000000+1)*1000000;
+  SimLatencyNs = 0;
+  SimNofTimerIrqs = 0;
+  HOST_NextEventNs = SimTimerNextEvent;
+  HOST_OnEvent = SimTimerOnEvent;
+#endif
+}
+
+/*! \brief Number of periods in a histogram. */
+static uint32_t SimHistCount(const DRV_Histogram *hist) {
+  uint32_t n = 0;
+  int i;
+
+  for(i=0; i<DRV_HIST_NOF_BINS; i++) {
+    n += hist->cnt[i];
+  }
+  return n;
+}
+
+/*! \brief Checks the histograms after a run: every period counted, and the jitter in the interrupt. */
+static void SimCheckHist(const char *name) {
+  uint32_t nofPeriods;
+
+#if PL_CONFIG_HAS_DRIVE_ISR
+  nofPeriods = SimNofTimerIrqs;
+  HOST_CHECK(DRV_JitterHist.max<=SIM_LATENCY_LONG_US+1, "%s: jitter up to %u us in the interrupt", name, (unsigned)DRV_JitterHist.max);
+#else
+  nofPeriods = SimNofTaskRuns;
+#endif
+  HOST_CHECK(SimHistCount(&DRV_ExecHist)==nofPeriods && SimHistCount(&DRV_JitterHist)==nofPeriods-1,
+      "%s: %u periods, %u execution times, %u jitter values", name, (unsigned)nofPeriods,
+      (unsigned)SimHistCount(&DRV_ExecHist), (unsigned)SimHistCount(&DRV_JitterHist));
+  printf("  %lu loop periods, jitter up to %u us (%u of them >10 us)\n", (unsigned long)nofPeriods, (unsigned)DRV_JitterHist.max,
+      (unsigned)(DRV_JitterHist.cnt[4]+DRV_JitterHist.cnt[5]+DRV_JitterHist.cnt[6]+DRV_JitterHist.cnt[7]));
+}
+
+/*! \brief Speed step from a standstill: overshoot, settling within 3%. Returns the overshoot in steps/s. */
+static double TestSpeedStep(int32_t speed, bool busy) {
+  const char *name = busy ? "speed step, task delayed" : "speed step";
+  double overshoot = 0;
+  int t, settleMs = 0;
+
+  SimInit(busy);
+  (void)DRV_SetSpeed(speed, speed);
+  (void)DRV_SetMode(DRV_MODE_SPEED);
+  for(t=1;t<=600;t++) {
+    vTaskDelay(1);
+    if (HOST_Motors[MOT_MOTOR_LEFT].speed-speed>overshoot) {
+      overshoot = HOST_Motors[MOT_MOTOR_LEFT].speed-speed;
+    }
+    if (fabs(HOST_Motors[MOT_MOTOR_LEFT].speed-speed)>0.03*speed || fabs(HOST_Motors[MOT_MOTOR_RIGHT].speed-speed)>0.03*speed) {
+      settleMs = t;
+    }
+  }
+  printf("%s to %d steps/s: overshoot %.0f steps/s, within 3%% after %d ms\n", name, (int)speed, overshoot, settleMs);
+  HOST_CHECK(settleMs<300 && overshoot<0.01*speed, "%s: overshoot %.0f, settled after %d ms", name, overshoot, settleMs);
+  SimCheckHist(name);
+  DRV_Deinit();
+  return overshoot;
+}
+
+/*! \brief 90 degree turn with the motion profile: done, and reported as done. */
+static void TestTurn(bool busy) {
+  const char *name = busy ? "turn, task delayed" : "turn";
+  int t, turnedMs = -1, eventMs = -1;
+  int32_t errL, errR;
+
+  SimInit(busy);
+  (void)DRV_SetPos(720, -720); /* TURN_STEPS_90 of Turn.c */
+  (void)DRV_SetMode(DRV_MODE_POS);
+  for(t=1;t<=2000;t++) {
+    vTaskDelay(1);
+    if (turnedMs<0 && DRV_HasTurned()) {
+      turnedMs = t;
+    }
+    if (eventMs<0 && (FRTOS1_xEventGroupGetBits(DRV_Events)&DRV_EVENT_TARGET)) {
+      eventMs = t;
+    }
+  }
+  errL = (int32_t)Q4CLeft_GetPos()-720;
+  errR = (int32_t)Q4CRight_GetPos()+720;
+  printf("%s: done after %d ms, event after %d ms, error after 2 s %d/%d steps\n", name, turnedMs, eventMs, (int)errL, (int)errR);
+  HOST_CHECK(turnedMs>0 && turnedMs<1500 && eventMs>=turnedMs && eventMs<=turnedMs+DRV_PERIOD_MS,
+      "%s: done after %d ms, event after %d ms", name, turnedMs, eventMs);
+  HOST_CHECK(abs(errL)<=MATCH_MARGIN && abs(errR)<=MATCH_MARGIN, "%s: error %d/%d steps", name, (int)errL, (int)errR);
+  SimCheckHist(name);
+  DRV_Deinit();
+}
+
+#if PL_CONFIG_HAS_DRIVE_ISR
+/*! \brief The timer interrupt runs before DRV_Init(): the loop must not touch the motors. */
+static void TestBeforeInit(void) {
+  int i;
+
+  HOST_MotorInit();
+  for(i=0;i<10;i++) {
+    DRV_OnTimer();
+  }
+  HOST_CHECK(HOST_MotorDev[MOT_MOTOR_LEFT].currPWMvalue==0xFFFF && HOST_MotorDev[MOT_MOTOR_RIGHT].currPWMvalue==0xFFFF,
+      "timer before init: PWM %u/%u", (unsigned)HOST_MotorDev[MOT_MOTOR_LEFT].currPWMvalue, (unsigned)HOST_MotorDev[MOT_MOTOR_RIGHT].currPWMvalue);
+}
+#endif
+
+int main(void) {
+  double overshoot, overshootBusy;
+
+  srand(1);
+  HOST_OnMs = SimOnMs;
+#if PL_CONFIG_HAS_DRIVE_ISR
+  printf("control loop in the timer interrupt, %d us\n", DRV_ISR_PERIOD_US);
+  TestBeforeInit();
+#else
+  printf("control loop in the drive task, %d ms\n", DRV_PERIOD_MS);
+#endif
+  overshoot = TestSpeedStep(1500, FALSE);
+  overshootBusy = TestSpeedStep(1500, TRUE);
+#if PL_CONFIG_HAS_DRIVE_ISR
+  HOST_CHECK(fabs(overshoot-overshootBusy)<15, "speed step: overshoot %.0f, %.0f with the task delayed", overshoot, overshootBusy);
+#else
+  (void)overshoot; (void)overshootBusy;
+#endif
+  TestTurn(FALSE);
+  TestTurn(TRUE);
+  return HOST_Result("drv_loop_sim");
+}
@@ -0,0 +1,363 @@
+/**
+ * \file
+ * \brief Host test of the drive commands (mode queue, speed and position mailboxes of Drive.c) with concurrent setters.
+ *
+ * Checks, single threaded:
+ * - a burst of mode changes before the drive task runs: all are accepted, the oldest ones are dropped when
+ *   the queue is full, the others stay in order, and the last one (a stop) is applied. With the former mode
+ *   queue of 4 entries which rejected new modes when full, the stop got lost and the robot kept driving,
+ * - a new position move is started (PROF_Start()) for a new position setpoint and for setting the position
+ *   mode, also again, but not for other modes,
+ * - the heading of DRV_SetPosHeading() is taken over with its position setpoint, and DRV_SetPos() clears it,
+ * - DRV_EVENT_HEADING within the tolerance, and a new move from the heading error if the wheels have got to
+ *   their positions outside of it,
+ * - DRV_IsPending() until the drive task has taken over a mode,
+ * - the age of the speed setpoints the drive task takes over, with a setter at about 1 kHz against the
+ *   drive task period: through the mailbox, and through a model of the former command queue of 4
+ *   entries where the setter blocked when it was full and the drive task applied every entry in turn.
+ * Then setter threads call DRV_SetMode(), DRV_SetSpeed() and DRV_SetPos() as fast as they can, while a reader
+ * thread takes them over with GetCmd() as the drive task does. The values of each setter count up, and the
+ * left and right value belong together, so the reader can check that each value it takes over is from a
+ * single call, and that it never gets an older value of a setter after a newer one, and that the newest
+ * mode is applied after the setters are done. For comparison, the
+ * reader also counts how often the buffer got overwritten while it was copying, which the sequence
+ * counter catches. To get the interleavings on a single core too, the threads yield in the memory
+ * barriers now and then.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -pthread -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o drv_mailbox_stress drv_mailbox_stress.c -lm
+ *   ./drv_mailbox_stress
+ */
+#define _GNU_SOURCE /* pthreads, __thread */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define SEQ_MEMORY_BARRIER() StressBarrier()
+
+#include <pthread.h>
+#include <sched.h>
+#include "CS1.h"
+/* the setters are on different threads here: the critical section is a mutex */
+static pthread_mutex_t StressLock = PTHREAD_MUTEX_INITIALIZER;
+#undef CS1_CriticalVariable
+#undef CS1_EnterCritical
+#undef CS1_ExitCritical
+#define CS1_CriticalVariable()
+#define CS1_EnterCritical() pthread_mutex_lock(&StressLock)
+#define CS1_ExitCritical()  pthread_mutex_unlock(&StressLock)
+static void StressBarrier(void);
+#include "Drive.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+
+#define STRESS_NOF_SETTERS  3
+#define STRESS_NOF_SETS     200000 /* per setter and kind */
+#define STRESS_PAIR(v)      ((v)^0x5A5A5A5A) /* right value for a left value */
+#define LATENCY_SET_US      990  /* period of the setter in TestLatency(), not in step with the drive task */
+#define LATENCY_QUEUE_LEN   4    /* entries of the former command queue */
+#define LATENCY_NOF_PERIODS 2000 /* drive task periods */
+
+static volatile bool StressDone = FALSE;
+static __thread uint32_t StressRandom = 1; /* per thread random state */
+
+/*! \brief Memory barrier, gives up the processor every fourth time in average. */
+static void StressBarrier(void) {
+  __sync_synchronize();
+  StressRandom ^= StressRandom<<13; StressRandom ^= StressRandom>>17; StressRandom ^= StressRandom<<5;
+  if ((StressRandom&3)==0) {
+    sched_yield();
+  }
+}
+
+/* motion profile, PID, tacho and encoders: only what GetCmd() and the status need */
+static int StressNofProfileStarts, StressNofPidStarts;
+static int32_t StressProfileTo[2];
+void PROF_Start(int32_t fromL, int32_t fromR, int32_t toL, int32_t toR) {
+  (void)fromL; (void)fromR;
+  StressProfileTo[0] = toL;
+  StressProfileTo[1] = toR;
+  StressNofProfileStarts++;
+}
+bool PROF_IsEnabled(void) { return TRUE; }
+bool PROF_IsFinished(void) { return TRUE; }
+bool PROF_Next(uint32_t periodUs, PROF_Setpoint *left, PROF_Setpoint *right) { (void)periodUs; memset(left, 0, sizeof(*left)); memset(right, 0, sizeof(*right)); return FALSE; }
+void PID_Start(void) { StressNofPidStarts++; }
+void PID_Speed(int32_t currSpeed, int32_t setSpeed, bool isLeft, uint32_t periodUs) { (void)currSpeed; (void)setSpeed; (void)isLeft; (void)periodUs; }
+void PID_SpeedAccel(int32_t currSpeed, int32_t setSpeed, int32_t setAccel, bool isLeft, uint32_t periodUs) { (void)currSpeed; (void)setSpeed; (void)setAccel; (void)isLeft; (void)periodUs; }
+void PID_Pos(int32_t currPos, int32_t setPos, bool isLeft, uint32_t periodUs) { (void)currPos; (void)setPos; (void)isLeft; (void)periodUs; }
+int32_t TACHO_GetSpeed(bool isLeft) { (void)isLeft; return 0; }
+void TACHO_Sample(void) {}
+void ODO_Sample(void) {}
+static uint32_t StressTheta; /* heading of the odometry */
+void ODO_GetPose(ODO_Pose *pose) { memset(pose, 0, sizeof(*pose)); pose->theta = StressTheta; }
+int32_t ODO_HeadingToSteps(int64_t theta) { return (int32_t)(theta/0x100000); }
+uint32_t QUAD_GetTime(void) { return 0; }
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void) { return 0; }
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos) { (void)pos; }
+Q4CRight_QuadCntrType Q4CRight_GetPos(void) { return 0; }
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos) { (void)pos; }
+
+/*! \brief Mode of the burst in TestModeBurst(). */
+static DRV_Mode StressBurstMode(int i) {
+  return i==10 ? DRV_MODE_STOP : (i%2==0 ? DRV_MODE_SPEED : DRV_MODE_POS);
+}
+
+/*! \brief Mode changes faster than the drive task: the oldest get dropped, the last one counts. */
+static void TestModeBurst(void) {
+  DRV_Mode mode;
+  int i, nofFailed = 0, nofWrong = 0;
+
+  DRV_Init();
+  GetCmd();
+  StressNofProfileStarts = 0;
+  for(i=0;i<=10;i++) {
+    nofFailed += DRV_SetMode(StressBurstMode(i))!=ERR_OK;
+  }
+  HOST_CHECK(nofFailed==0, "mode burst: %d mode changes rejected", nofFailed);
+  HOST_CHECK(DRV_IsPending(), "mode burst: not pending before the drive task has run");
+  for(i=11-DRV_MODE_QUEUE_LENGTH;i<=10;i++) { /* what the drive task is going to take over */
+    mode = DRV_ModeQueue.mode[(DRV_ModeQueue.tail+i-(11-DRV_MODE_QUEUE_LENGTH))%DRV_MODE_QUEUE_LENGTH];
+    nofWrong += mode!=StressBurstMode(i);
+  }
+  HOST_CHECK(nofWrong==0, "mode burst: %d modes in the queue not in order", nofWrong);
+  GetCmd();
+  HOST_CHECK(DRV_GetMode()==DRV_MODE_STOP && !DRV_IsPending(), "mode burst: mode %d after the drive task, pending %d", DRV_GetMode(), DRV_IsPending());
+  HOST_CHECK(StressNofProfileStarts==0, "mode burst: %d moves started, the position mode was replaced", StressNofProfileStarts);
+  HOST_CHECK(DRV_NofSkipped==11-DRV_MODE_QUEUE_LENGTH && DRV_NofModes==DRV_MODE_QUEUE_LENGTH, "mode burst: %u modes dropped, %u taken over",
+      (unsigned)DRV_NofSkipped, (unsigned)DRV_NofModes);
+}
+
+/*! \brief Which commands start a new position move. */
+static void TestProfileStart(void) {
+  DRV_Init();
+  StressNofProfileStarts = StressNofPidStarts = 0;
+  (void)DRV_SetPos(100, 200);
+  (void)DRV_SetMode(DRV_MODE_POS);
+  GetCmd();
+  HOST_CHECK(StressNofProfileStarts==1 && StressProfileTo[0]==100 && StressProfileTo[1]==200 && StressNofPidStarts==1,
+      "position and mode: %d moves to %d/%d, %d PID resets", StressNofProfileStarts, (int)StressProfileTo[0], (int)StressProfileTo[1], StressNofPidStarts);
+  (void)DRV_SetMode(DRV_MODE_POS); /* again: new move from where the wheels are */
+  GetCmd();
+  HOST_CHECK(StressNofProfileStarts==2, "position mode again: %d moves", StressNofProfileStarts);
+  (void)DRV_SetPos(300, 400); /* new target in position mode */
+  GetCmd();
+  HOST_CHECK(StressNofProfileStarts==3 && StressProfileTo[0]==300 && StressNofPidStarts==2, "new position: %d moves to %d, %d PID resets",
+      StressNofProfileStarts, (int)StressProfileTo[0], StressNofPidStarts);
+  (void)DRV_SetMode(DRV_MODE_SPEED);
+  GetCmd();
+  (void)DRV_SetMode(DRV_MODE_STOP);
+  GetCmd();
+  HOST_CHECK(StressNofProfileStarts==3 && StressNofPidStarts==4 && DRV_GetMode()==DRV_MODE_STOP, "speed and stop: %d moves, %d PID resets, mode %d",
+      StressNofProfileStarts, StressNofPidStarts, DRV_GetMode());
+  GetCmd();
+  HOST_CHECK(StressNofPidStarts==4, "no new command: %d PID resets", StressNofPidStarts);
+}
+
+/*! \brief The heading belongs to the position setpoint it was set with. */
+static void TestHeading(void) {
+  DRV_Init();
+  HOST_CHECK(DRV_SetPosHeading(100, 200, ODO_THETA_90_DEG, 0)==ERR_FAILED && !DRV_IsPending(), "heading without tolerance accepted");
+  (void)DRV_SetPosHeading(100, 200, ODO_THETA_90_DEG, 1000);
+  GetCmd();
+  HOST_CHECK(DRV_Status.pos.left==100 && DRV_Status.heading.theta==ODO_THETA_90_DEG && DRV_Status.heading.tolerance==1000,
+      "heading: position %d, heading 0x%08x +/- %u", (int)DRV_Status.pos.left, (unsigned)DRV_Status.heading.theta, (unsigned)DRV_Status.heading.tolerance);
+  (void)DRV_SetMode(DRV_MODE_POS);
+  GetCmd();
+  StressTheta = ODO_THETA_90_DEG-1000;
+  HOST_CHECK((DRV_CheckEvents()&DRV_EVENT_HEADING)!=0, "heading: not at the heading within the tolerance");
+  StressTheta = ODO_THETA_90_DEG-0x1000000;
+  HOST_CHECK((DRV_CheckEvents()&DRV_EVENT_HEADING)==0, "heading: at the heading outside of the tolerance");
+  StressNofProfileStarts = 0;
+  DRV_LoopEvents = DRV_EVENT_STOPPED; /* still on the way */
+  DRV_HeadingControl();
+  HOST_CHECK(StressNofProfileStarts==0 && DRV_Status.pos.left==100, "heading: moved before the wheels got to their positions");
+  DRV_LoopEvents = DRV_EVENT_STOPPED|DRV_EVENT_TARGET;
+  DRV_HeadingControl();
+  HOST_CHECK(StressNofProfileStarts==1 && DRV_Status.pos.left==-16 && DRV_Status.pos.right==16 && DRV_LoopEvents==0 && DRV_NofHeadingMoves==1,
+      "heading: %d moves to %d/%d after the wheels got to their positions", StressNofProfileStarts, (int)DRV_Status.pos.left, (int)DRV_Status.pos.right);
+  DRV_LoopEvents = DRV_EVENT_STOPPED|DRV_EVENT_TARGET|DRV_EVENT_HEADING;
+  DRV_HeadingControl();
+  HOST_CHECK(StressNofProfileStarts==1, "heading: moved at the heading");
+  (void)DRV_SetPos(300, 400);
+  GetCmd();
+  HOST_CHECK(DRV_Status.pos.left==300 && DRV_Status.heading.tolerance==0 && (DRV_CheckEvents()&DRV_EVENT_HEADING)!=0,
+      "position without heading: heading tolerance %u", (unsigned)DRV_Status.heading.tolerance);
+  StressTheta = 0;
+}
+
+typedef struct {
+  unsigned long applied, stale; /* setpoints applied by the drive task, and how many of them were not the newest one */
+  double sumAgeUs;              /* time from setting to applying, summed up */
+  uint32_t maxAgeUs, maxBlockUs; /* largest age, longest time a setter was blocked */
+} LatencyResult;
+
+/*! \brief Adds a setpoint applied by the drive task: the value is the time it was set. */
+static void LatencyAdd(LatencyResult *res, uint32_t nowUs, uint32_t value, uint32_t newest) {
+  res->applied++;
+  res->stale += value!=newest;
+  res->sumAgeUs += nowUs-value;
+  if (nowUs-value>res->maxAgeUs) {
+    res->maxAgeUs = nowUs-value;
+  }
+}
+
+static void LatencyPrint(const char *name, const LatencyResult *res) {
+  printf("%-8s %lu of %lu applied speeds stale, age %.2f ms in average, max %.2f ms, setter blocked up to %.2f ms\n", name, res->stale, res->applied,
+      res->sumAgeUs/res->applied/1000, res->maxAgeUs/1000.0, res->maxBlockUs/1000.0);
+}
+
+/*!
+ * \brief Speed setpoints every LATENCY_SET_US against the drive task, in simulated time: the mailbox of Drive.c
+ * against a model of the former command queue, where DRV_SetSpeed() blocked while the queue was full and the
+ * drive task applied all queued entries in turn. The value of a setpoint is the time it was set.
+ */
+static void TestLatency(void) {
+  LatencyResult mbox, queue;
+  xQueueHandle q;
+  uint32_t t, v, nextSetUs = LATENCY_SET_US, nextTaskUs = DRV_PERIOD_MS*1000;
+  uint32_t mboxNewest = 0, queueNewest = 0, blockedSince = 0, seq;
+  bool blocked = FALSE; /* setter of the queue waiting for a free entry, with the value queueNewest */
+
+  memset(&mbox, 0, sizeof(mbox));
+  memset(&queue, 0, sizeof(queue));
+  DRV_Init();
+  q = xQueueCreate(LATENCY_QUEUE_LEN, sizeof(uint32_t));
+  for(t=1;t<=LATENCY_NOF_PERIODS*DRV_PERIOD_MS*1000;t++) {
+    if (t==nextSetUs) { /* setter */
+      mboxNewest = t;
+      (void)DRV_SetSpeed((int32_t)t, (int32_t)t);
+      if (!blocked) { /* a blocked setter does not set new values */
+        queueNewest = t;
+        if (xQueueSendToBack(q, &t, 0)!=pdPASS) {
+          blocked = TRUE;
+          blockedSince = t;
+        }
+      }
+      nextSetUs += LATENCY_SET_US;
+    }
+    if (t==nextTaskUs) { /* drive task */
+      seq = DRV_SpeedSeq;
+      GetCmd();
+      if (DRV_SpeedSeq!=seq) {
+        LatencyAdd(&mbox, t, (uint32_t)DRV_Status.speed.left, mboxNewest);
+      }
+      while (xQueueReceive(q, &v, 0)==pdPASS) {
+        LatencyAdd(&queue, t, v, queueNewest);
+      }
+      if (blocked) { /* the setter gets its entry after the drive task has emptied the queue */
+        (void)xQueueSendToBack(q, &queueNewest, 0);
+        if (t-blockedSince>queue.maxBlockUs) {
+          queue.maxBlockUs = t-blockedSince;
+        }
+        blocked = FALSE;
+      }
+      nextTaskUs += DRV_PERIOD_MS*1000;
+    }
+  }
+  vQueueDelete(q);
+  LatencyPrint("queue", &queue);
+  LatencyPrint("mailbox", &mbox);
+  HOST_CHECK(mbox.stale==0 && mbox.maxAgeUs<LATENCY_SET_US, "mailbox: %lu stale speeds, max age %u us", mbox.stale, (unsigned)mbox.maxAgeUs);
+  HOST_CHECK(queue.stale>0 && mbox.sumAgeUs/mbox.applied<queue.sumAgeUs/queue.applied, "queue: %lu stale speeds, age %.0f us against %.0f us of the mailbox",
+      queue.stale, queue.sumAgeUs/queue.applied, mbox.sumAgeUs/mbox.applied);
+}
+
+typedef struct {
+  unsigned long takeOvers, torn, backwards, overwritten;
+} StressResult;
+
+/*! \brief Value of a setter: setter number in the upper bits, then a counter. */
+static int32_t StressValue(int setter, uint32_t cnt) {
+  return (int32_t)(((uint32_t)setter<<24)|(cnt&0xFFFFFF));
+}
+
+static void *StressSetter(void *arg) {
+  int setter = (int)(intptr_t)arg;
+  uint32_t cnt;
+
+  StressRandom = 1+setter;
+  for(cnt=1;cnt<=STRESS_NOF_SETS;cnt++) {
+    (void)DRV_SetSpeed(StressValue(setter, cnt), STRESS_PAIR(StressValue(setter, cnt)));
+    (void)DRV_SetPos(StressValue(setter, cnt), STRESS_PAIR(StressValue(setter, cnt)));
+    (void)DRV_SetMode((DRV_Mode)(cnt%4)); /* DRV_MODE_NONE..DRV_MODE_POS */
+  }
+  return NULL;
+}
+
+/*! \brief Checks a value taken over: both sides from one call, and not older than the last one of its setter. */
+static void StressCheck(int32_t left, int32_t right, uint32_t last[STRESS_NOF_SETTERS], StressResult *res) {
+  int setter = (int)((uint32_t)left>>24);
+
+  if (right!=STRESS_PAIR(left) || setter>=STRESS_NOF_SETTERS) {
+    res->torn++;
+    return;
+  }
+  if (((uint32_t)left&0xFFFFFF)<last[setter]) {
+    res->backwards++;
+  }
+  last[setter] = (uint32_t)left&0xFFFFFF;
+}
+
+static void *StressReader(void *arg) {
+  StressResult *res = arg;
+  uint32_t lastSpeed[STRESS_NOF_SETTERS] = {0}, lastPos[STRESS_NOF_SETTERS] = {0};
+  uint32_t seq;
+
+  StressRandom = 100;
+  while (!StressDone) {
+    seq = DRV_SpeedBox.lock.seq; /* how a copy without the sequence check would do */
+    StressBarrier();
+    if (seq!=DRV_SpeedBox.lock.seq) {
+      res->overwritten++;
+    }
+    GetCmd();
+    res->takeOvers++;
+    if (DRV_SpeedSeq!=0) {
+      StressCheck(DRV_Status.speed.left, DRV_Status.speed.right, lastSpeed, res);
+    }
+    if (DRV_PosSeq!=0) {
+      StressCheck(DRV_Status.pos.left, DRV_Status.pos.right, lastPos, res);
+    }
+    if (DRV_Status.mode>DRV_MODE_POS) {
+      res->torn++;
+    }
+  }
+  return NULL;
+}
+
+static void TestStress(void) {
+  pthread_t setters[STRESS_NOF_SETTERS], reader;
+  StressResult res;
+  int32_t lastMode;
+  int i;
+
+  memset(&res, 0, sizeof(res));
+  DRV_Init();
+  pthread_create(&reader, NULL, StressReader, &res);
+  for(i=0;i<STRESS_NOF_SETTERS;i++) {
+    pthread_create(&setters[i], NULL, StressSetter, (void*)(intptr_t)i);
+  }
+  for(i=0;i<STRESS_NOF_SETTERS;i++) {
+    pthread_join(setters[i], NULL);
+  }
+  lastMode = DRV_ModeQueue.mode[(DRV_ModeQueue.head-1)%DRV_MODE_QUEUE_LENGTH]; /* the newest mode */
+  StressDone = TRUE;
+  pthread_join(reader, NULL);
+  GetCmd(); /* as the drive task in the next period */
+  HOST_CHECK(res.takeOvers>1, "reader did not run");
+  HOST_CHECK(res.torn==0, "%lu torn values", res.torn);
+  HOST_CHECK(res.backwards==0, "%lu older values after newer ones", res.backwards);
+  HOST_CHECK(DRV_GetMode()==(DRV_Mode)lastMode && !DRV_IsPending(), "mode %d after the setters, newest %d", DRV_GetMode(), (int)lastMode);
+  HOST_CHECK(res.overwritten>0, "no buffer overwritten while copying: the test does not get the interleavings");
+  printf("%d setters with %u commands each, %lu take overs without torn or older values, %u commands overwritten unseen\n",
+      STRESS_NOF_SETTERS, 3*STRESS_NOF_SETS, res.takeOvers, (unsigned)DRV_NofSkipped);
+  printf("buffer changed while copying in %lu of %lu take overs\n", res.overwritten, res.takeOvers);
+}
+
+int main(void) {
+  TestModeBurst();
+  TestProfileStart();
+  TestHeading();
+  TestLatency();
+  TestStress();
+  return HOST_Result("drv_mailbox_stress");
+}
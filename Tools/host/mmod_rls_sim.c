@@ -0,0 +1,165 @@
+/**
+ * \file
+ * \brief Host simulation of the online motor model (MotorModel.c) with a change of the motor gain.
+ *
+ * Runs the speed loop of the drive task (MMOD_Update(), then PID_Speed() every 5 ms) against the motor
+ * model of HostMotor.h, with a setpoint switching between two speeds as the excitation and noise on the
+ * measured speed. In the middle of the run the gain of the motor drops to 70% (e.g. a low battery).
+ * Checks:
+ * - before the change, the identified static gain and time constant match the motor model, and the offset
+ *   is in the range of its deadband,
+ * - after the change, the identified gain follows the new one, and the time it takes is printed,
+ * - with 'model adapt on' the speed PID and the feedforward gain get re-derived from the new model, and
+ *   speed steps with them settle without steady state error,
+ * - at a standstill (no excitation) the estimation stops, and the model stays as it is.
+ * The model of HostMotor.h has no noise on the PWM and no load changes, so the identified values are
+ * better than on the robot: the tolerances are for the estimator, not for the robot.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o mmod_rls_sim mmod_rls_sim.c -lm
+ *   ./mmod_rls_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_PID_TUNE_DISABLED
+#define PL_LOCAL_CONFIG_HAS_MOTION_PROFILE_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_ISR_DISABLED
+
+#include "Pid.c"
+#include "MotorModel.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#if !PL_CONFIG_HAS_MOTOR_MODEL
+  #error "mmod_rls_sim needs PL_CONFIG_HAS_MOTOR_MODEL"
+#endif
+
+#define SIM_PERIOD_MS     5    /* as DRV_PERIOD_MS of Drive.c */
+#define SIM_NOISE         20   /* noise of the measured speed, +/- steps/s */
+#define SIM_SPEED_LOW     1500 /* excitation: setpoint switching between these speeds */
+#define SIM_SPEED_HIGH    3000
+#define SIM_SWITCH_MS     300
+#define SIM_GAIN_DROP     0.7  /* motor gain after the change */
+#define SIM_TOLERANCE     0.10 /* of the identified gain against the motor */
+
+static int32_t SimSetpoint = 0;
+static int32_t SimNoise[2];
+
+int32_t TACHO_GetSpeed(bool isLeft) {
+  int i = isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT;
+
+  return (int32_t)lround(HOST_Motors[i].speed)+SimNoise[i];
+}
+
+/*! \brief The drive task: estimation with the values of the last period, then the speed PID. */
+static void SimOnMs(void) {
+  HOST_MotorOnMs();
+  if ((HOST_TimeNs/1000000)%SIM_PERIOD_MS==0) {
+    SimNoise[0] = rand()%(2*SIM_NOISE+1)-SIM_NOISE;
+    SimNoise[1] = rand()%(2*SIM_NOISE+1)-SIM_NOISE;
+    MMOD_Update(SIM_PERIOD_MS);
+    PID_Speed(TACHO_GetSpeed(TRUE), SimSetpoint, TRUE, SIM_PERIOD_MS*1000);
+    PID_Speed(TACHO_GetSpeed(FALSE), SimSetpoint, FALSE, SIM_PERIOD_MS*1000);
+  }
+}
+
+/*! \brief Identified static gain of the left wheel in steps/s per PWM, 0 if not identified. */
+static double ModelK(void) {
+  return MMOD_Models[0].isValid ? MMOD_Models[0].kQ16/65536.0 : 0;
+}
+
+/*! \brief Runs the excitation for a time. Returns the time in ms until the identified gain stays within the tolerance of k, or -1. */
+static int Excite(int ms, double k) {
+  int t, inTolMs = -1;
+
+  for(t=0;t<ms;t+=SIM_SWITCH_MS) {
+    SimSetpoint = (t/SIM_SWITCH_MS)%2==0 ? SIM_SPEED_HIGH : SIM_SPEED_LOW;
+    vTaskDelay(SIM_SWITCH_MS);
+    if (fabs(ModelK()-k)<=SIM_TOLERANCE*k) {
+      if (inTolMs<0) {
+        inTolMs = t+SIM_SWITCH_MS;
+      }
+    } else {
+      inTolMs = -1;
+    }
+  }
+  return inTolMs;
+}
+
+static void PrintModel(const char *when, double k) {
+  const MMOD_Model *m = &MMOD_Models[0];
+
+  printf("%s: K %.5f (motor %.5f), tau %d ms (motor %.1f), offset %d (motor %.0f), PID p %d i %d, ff gain %d\n", when, ModelK(), k,
+      (int)m->tauMs, HOST_Motors[MOT_MOTOR_LEFT].tauMs, (int)m->offset, HOST_Motors[MOT_MOTOR_LEFT].deadband,
+      (int)m->pFactor100, (int)m->iFactor100, (int)speedLeftConfig.ffGain100);
+}
+
+/*! \brief Speed step of the left wheel, returns the steady state error in % over the last 100 ms. */
+static double SpeedStep(int32_t to, int *settleMs) {
+  int32_t from = SimSetpoint;
+  double errSum = 0, speed;
+  int t;
+
+  SimSetpoint = to;
+  *settleMs = 0;
+  for(t=1;t<=600;t++) {
+    vTaskDelay(1);
+    speed = HOST_Motors[MOT_MOTOR_LEFT].speed;
+    if (fabs(speed-to)>0.05*fabs((double)(to-from))) {
+      *settleMs = t;
+    }
+    if (t>500) {
+      errSum += speed-to;
+    }
+  }
+  return 100.0*errSum/100/to;
+}
+
+int main(void) {
+  unsigned char cmd[] = "model adapt on";
+  bool handled = FALSE;
+  double k0, k1, steadyErr;
+  int32_t pBefore, ffBefore, updates;
+  int settleMs, followMs;
+
+  srand(1);
+  HOST_OnMs = SimOnMs;
+  HOST_MotorInit();
+  PID_Init();
+  MMOD_Init();
+  HOST_CHECK(MMOD_ParseCommand(cmd, &handled, CLS1_GetStdio())==ERR_OK && handled, "%s: failed", (char*)cmd);
+  k0 = HOST_Motors[MOT_MOTOR_LEFT].k;
+  /* identification from scratch */
+  followMs = Excite(10000, k0);
+  PrintModel("after 10 s", k0);
+  HOST_CHECK(followMs>0, "identified gain %.5f, motor %.5f", ModelK(), k0);
+  HOST_CHECK(abs(MMOD_Models[0].tauMs-(int)HOST_Motors[MOT_MOTOR_LEFT].tauMs)<=8, "identified tau %d ms, motor %.1f ms",
+      (int)MMOD_Models[0].tauMs, HOST_Motors[MOT_MOTOR_LEFT].tauMs);
+  /* the PWM does not change its sign here, so the offset is only weakly identified (see MMOD_Adapt()) */
+  HOST_CHECK(fabs(MMOD_Models[0].offset-HOST_Motors[MOT_MOTOR_LEFT].deadband)<1000, "identified offset %d, deadband %.0f",
+      (int)MMOD_Models[0].offset, HOST_Motors[MOT_MOTOR_LEFT].deadband);
+  printf("identified within %.0f%% after %d ms\n", SIM_TOLERANCE*100, followMs);
+  /* gain drop */
+  pBefore = speedLeftConfig.pFactor100;
+  ffBefore = speedLeftConfig.ffGain100;
+  k1 = k0*SIM_GAIN_DROP;
+  HOST_Motors[MOT_MOTOR_LEFT].k = k1;
+  HOST_Motors[MOT_MOTOR_RIGHT].k *= SIM_GAIN_DROP;
+  followMs = Excite(15000, k1);
+  PrintModel("15 s after the gain drop", k1);
+  HOST_CHECK(followMs>0, "gain after the drop %.5f, motor %.5f", ModelK(), k1);
+  printf("gain drop to %.0f%%: followed within %.0f%% after %d ms\n", SIM_GAIN_DROP*100, SIM_TOLERANCE*100, followMs);
+  HOST_CHECK(speedLeftConfig.pFactor100>pBefore && speedLeftConfig.ffGain100>ffBefore, "adaption: p %d (before %d), ff gain %d (before %d)",
+      (int)speedLeftConfig.pFactor100, (int)pBefore, (int)speedLeftConfig.ffGain100, (int)ffBefore);
+  steadyErr = SpeedStep(2200, &settleMs);
+  HOST_CHECK(settleMs<300 && fabs(steadyErr)<1, "step with the adapted PID: settled in %d ms, steady state error %.2f%%", settleMs, steadyErr);
+  printf("step with the adapted PID: settled in %d ms, steady state error %+.2f%%\n", settleMs, steadyErr);
+  /* standstill: no estimation, the model stays */
+  updates = (int32_t)MMOD_Models[0].nofUpdates;
+  SimSetpoint = 0;
+  vTaskDelay(5000);
+  HOST_CHECK(fabs(ModelK()-k1)<=SIM_TOLERANCE*k1 && MMOD_Models[0].nofUpdates-updates<100, "standstill: K %.5f, %d estimation steps",
+      ModelK(), (int)(MMOD_Models[0].nofUpdates-updates));
+  return HOST_Result("mmod_rls_sim");
+}
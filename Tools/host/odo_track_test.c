@@ -0,0 +1,224 @@
+/**
+ * \file
+ * \brief Host test of the odometry (Odometry.c) on straight lines and arcs with known poses.
+ *
+ * The wheels move along piecewise straight lines and arcs with a constant speed each. Every millisecond
+ * the wheel ways give the encoder counters (rounded down to full steps) for ODO_Sample(), and the exact
+ * pose is integrated in double precision with the arc formula, which is exact for constant wheel speeds.
+ * Checks:
+ * - the sine table against sin(),
+ * - straight lines forward and backward, circles of 300 mm to the left and 150 mm to the right, spins
+ *   in place and a 500 mm square: the pose of ODO_GetPose() stays within the encoder resolution of the
+ *   exact one (one step of a wheel is 121 um, and 0.063 degree of heading),
+ * - a set of the encoder position (more than 100 steps at once) does not move the pose,
+ * - ODO_HeadingToSteps() gives the 720 steps per 90 degrees of Turn.c,
+ * - 'odo reset', and 'odo radius'/'odo track' with wrong values.
+ * The largest errors and the time per sample on the host are printed.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o odo_track_test odo_track_test.c -lm
+ *   ./odo_track_test
+ */
+#define _POSIX_C_SOURCE 199309L /* clock_gettime() */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+
+#include <time.h>
+#include <math.h>
+#include "Odometry.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+
+#if !PL_CONFIG_HAS_ODOMETRY
+  #error "odo_track_test needs PL_CONFIG_HAS_ODOMETRY"
+#endif
+
+#define TRACK_PI          3.14159265358979
+#define TRACK_UM_PER_STEP (2*TRACK_PI*ODO_DEFAULT_RADIUS_UM/ODO_STEPS_PER_REV) /* way of a wheel per step */
+#define TRACK_MAX_POS_UM  250  /* two steps of a wheel */
+#define TRACK_MAX_DEG     0.1  /* heading of 1.5 steps of difference */
+
+/* exact wheel ways in steps, the encoders count the full steps */
+static double TrackWheel[2];
+static int32_t TrackOffset[2]; /* counter minus way, changed by SetPos() */
+
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void) { return (Q4CLeft_QuadCntrType)((int32_t)floor(TrackWheel[0])+TrackOffset[0]); }
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos) { TrackOffset[0] = (int32_t)pos-(int32_t)floor(TrackWheel[0]); }
+Q4CRight_QuadCntrType Q4CRight_GetPos(void) { return (Q4CRight_QuadCntrType)((int32_t)floor(TrackWheel[1])+TrackOffset[1]); }
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos) { TrackOffset[1] = (int32_t)pos-(int32_t)floor(TrackWheel[1]); }
+
+typedef struct {
+  double x, y, theta; /* um, um, radians */
+} TrackPose;
+
+static TrackPose TrackExact;
+static double TrackMaxPosErr, TrackMaxDegErr; /* largest errors since TrackStart() */
+
+/*! \brief Robot standing at the origin, pose reset. */
+static void TrackStart(void) {
+  TrackWheel[0] = TrackWheel[1] = 0.5; /* in the middle of a step: the noise of the counters is symmetric */
+  TrackOffset[0] = TrackOffset[1] = 0;
+  memset(&TrackExact, 0, sizeof(TrackExact));
+  ODO_Init();
+  TrackMaxPosErr = TrackMaxDegErr = 0;
+}
+
+/*! \brief Compares the pose of the odometry with the exact one. */
+static void TrackCompare(void) {
+  ODO_Pose pose;
+  double posErr, degErr;
+
+  ODO_GetPose(&pose);
+  posErr = hypot(pose.x-TrackExact.x, pose.y-TrackExact.y);
+  degErr = ODO_THETA_TO_CENTIDEG(pose.theta-(uint32_t)(int64_t)llround(TrackExact.theta/(2*TRACK_PI)*4294967296.0))/100.0;
+  TrackMaxPosErr = fmax(TrackMaxPosErr, posErr);
+  TrackMaxDegErr = fmax(TrackMaxDegErr, fabs(degErr));
+}
+
+/*!
+ * \brief Moves with a constant speed and turn rate, sampled every millisecond.
+ * \param speed Speed of the middle between the wheels, mm/s
+ * \param rate Turn rate, degrees per second, counter clockwise
+ * \param ms Duration
+ */
+static void TrackMove(double speed, double rate, int ms) {
+  double w = rate*TRACK_PI/180, v = speed*1000; /* rad/s, um/s */
+  double vL = (v-w*ODO_DEFAULT_TRACK_UM/2)/TRACK_UM_PER_STEP, vR = (v+w*ODO_DEFAULT_TRACK_UM/2)/TRACK_UM_PER_STEP; /* steps/s */
+  double th;
+  int t;
+
+  for(t=0;t<ms;t++) {
+    TrackWheel[0] += vL/1000;
+    TrackWheel[1] += vR/1000;
+    th = TrackExact.theta+w/1000;
+    if (w==0) {
+      TrackExact.x += v/1000*cos(th);
+      TrackExact.y += v/1000*sin(th);
+    } else {
+      TrackExact.x += v/w*(sin(th)-sin(TrackExact.theta));
+      TrackExact.y -= v/w*(cos(th)-cos(TrackExact.theta));
+    }
+    TrackExact.theta = th;
+    ODO_Sample();
+    TrackCompare();
+  }
+}
+
+/*! \brief Checks the errors of a trajectory, prints them and the end pose. */
+static void TrackCheck(const char *name) {
+  ODO_Pose pose;
+
+  ODO_GetPose(&pose);
+  printf("%-22s end at %8.2f/%8.2f mm %8.2f deg (exact %8.2f/%8.2f mm), max error %.3f mm %.3f deg\n", name,
+      pose.x/1000.0, pose.y/1000.0, ODO_THETA_TO_CENTIDEG(pose.theta)/100.0, TrackExact.x/1000, TrackExact.y/1000,
+      TrackMaxPosErr/1000, TrackMaxDegErr);
+  HOST_CHECK(TrackMaxPosErr<=TRACK_MAX_POS_UM && TrackMaxDegErr<=TRACK_MAX_DEG, "%s: error up to %.0f um, %.3f deg",
+      name, TrackMaxPosErr, TrackMaxDegErr);
+}
+
+static void TestSine(void) {
+  double err, maxErr = 0;
+  uint32_t a;
+
+  for(a=0;a<0xFFFF0000u;a+=0x10000u) {
+    err = fabs(ODO_Sin(a)/32768.0-sin(a/4294967296.0*2*TRACK_PI));
+    maxErr = fmax(maxErr, err);
+    err = fabs(ODO_Cos(a)/32768.0-cos(a/4294967296.0*2*TRACK_PI));
+    maxErr = fmax(maxErr, err);
+  }
+  printf("sine table: max error %.1e\n", maxErr);
+  HOST_CHECK(maxErr<1e-4, "sine table: error %.1e", maxErr);
+}
+
+static void TestTrajectories(void) {
+  int i;
+
+  TrackStart();
+  TrackMove(200, 0, 10000);
+  TrackCheck("2 m straight");
+
+  TrackStart();
+  TrackMove(-150, 0, 6000);
+  TrackCheck("900 mm backward");
+
+  TrackStart();
+  TrackMove(200, 200.0/300*180/TRACK_PI, (int)lround(5*2*TRACK_PI*300/200*1000)); /* R=300 mm */
+  TrackCheck("5 circles R=300 mm");
+
+  TrackStart();
+  TrackMove(100, -100.0/150*180/TRACK_PI, (int)lround(3*2*TRACK_PI*150/100*1000)); /* R=-150 mm */
+  TrackCheck("3 circles R=-150 mm");
+
+  TrackStart();
+  TrackMove(0, 360, 10000);
+  TrackCheck("10 spins in place");
+
+  TrackStart();
+  for(i=0;i<4;i++) {
+    TrackMove(250, 0, 2000);
+    TrackMove(0, 180, 500);
+  }
+  TrackCheck("500 mm square");
+}
+
+/*! \brief Position set while driving: the pose must not jump. */
+static void TestPosSet(void) {
+  ODO_Pose before, after;
+
+  TrackStart();
+  TrackMove(200, 30, 1000);
+  ODO_GetPose(&before);
+  Q4CLeft_SetPos(0);
+  Q4CRight_SetPos(0);
+  ODO_Sample();
+  ODO_GetPose(&after);
+  HOST_CHECK(before.x==after.x && before.y==after.y && before.theta==after.theta && after.seq==before.seq+1,
+      "position set: pose %d/%d %u to %d/%d %u", (int)before.x, (int)before.y, (unsigned)before.theta, (int)after.x, (int)after.y, (unsigned)after.theta);
+}
+
+static void TestHeadingToSteps(void) {
+  int32_t steps90 = ODO_HeadingToSteps(ODO_THETA_90_DEG), steps360 = ODO_HeadingToSteps(4*(int64_t)ODO_THETA_90_DEG);
+
+  HOST_CHECK(abs(steps90-720)<=1 && abs(steps360-4*720)<=2 && ODO_HeadingToSteps(-(int64_t)ODO_THETA_90_DEG)==-steps90,
+      "heading to steps: %d for 90 degrees, %d for 360", (int)steps90, (int)steps360);
+}
+
+static void TestShell(void) {
+  bool handled = FALSE;
+  ODO_Pose pose;
+
+  TrackStart();
+  TrackMove(200, 45, 1000);
+  HOST_CHECK(ODO_ParseCommand((const unsigned char*)"odo reset", &handled, CLS1_GetStdio())==ERR_OK && handled, "odo reset not handled");
+  ODO_GetPose(&pose);
+  HOST_CHECK(pose.x==0 && pose.y==0 && pose.theta==0, "odo reset: pose %d/%d %u", (int)pose.x, (int)pose.y, (unsigned)pose.theta);
+  HOST_CHECK(ODO_ParseCommand((const unsigned char*)"odo radius 0", &handled, CLS1_GetStdio())==ERR_FAILED, "odo radius 0 accepted");
+  HOST_CHECK(ODO_ParseCommand((const unsigned char*)"odo track 1000", &handled, CLS1_GetStdio())==ERR_FAILED, "odo track 1000 accepted");
+  HOST_CHECK(ODO_radiusUm==ODO_DEFAULT_RADIUS_UM && ODO_trackUm==ODO_DEFAULT_TRACK_UM, "geometry changed: %d/%d um", (int)ODO_radiusUm, (int)ODO_trackUm);
+}
+
+/*! \brief Time per sample on the host, while turning. */
+static void BenchSample(void) {
+  struct timespec start, end;
+  int i;
+
+  TrackStart();
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(i=0;i<1000000;i++) {
+    TrackWheel[0] += 0.7;
+    TrackWheel[1] += 1.3;
+    ODO_Sample();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("%.0f ns per sample on the host\n", ((end.tv_sec-start.tv_sec)*1e9+(end.tv_nsec-start.tv_nsec))/1e6);
+}
+
+int main(void) {
+  TestSine();
+  TestTrajectories();
+  TestPosSet();
+  TestHeadingToSteps();
+  TestShell();
+  BenchSample();
+  return HOST_Result("odo_track_test");
+}
@@ -0,0 +1,147 @@
+/**
+ * \file
+ * \brief Host simulation of the speed feedforward of the PID engine (ffGain100, ffOffset of PID_Run()).
+ *
+ * Runs the speed loop every 5 ms, as the drive task, with the factors of PID_Init() against the motor model
+ * of HostMotor.h, which is fitted to the step responses in TEAM_Robot/Regler. The feedforward is only used by
+ * PID_SpeedAccel(), for the motion profile: with the factors of PidSpeedTuning.h (SIMC, tuned for the feedback
+ * alone) a setpoint step with the feedforward overshoots by about 50%, the integral still builds up over the
+ * dead time while the feedforward is already right. This is printed. Lower P and I factors avoid it, but then
+ * the motion profile overshoots more (prof_settle_sim). Checks:
+ * - speed steps with PID_Speed() are the feedback alone: the same as with the feedforward factors set to 0,
+ *   without overshoot and steady state error,
+ * - a feedforward beyond the saturation (setpoint above the top speed) does not unwind the integral: with
+ *   the speed at the setpoint it stays at 0, and after a long time at the top speed a step down settles.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o pid_ff_sim pid_ff_sim.c -lm
+ *   ./pid_ff_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Pid.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#define SIM_PERIOD_US  5000 /* as the drive task */
+
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+
+typedef enum {
+  SIM_FB,      /* PID_Speed(): feedback alone */
+  SIM_FF,      /* PID_SpeedAccel(): with the feedforward */
+  SIM_FB_NOFF  /* PID_Speed() with the feedforward factors set to 0 */
+} SimKind;
+
+typedef struct {
+  int riseMs;       /* 10% to 90% of the step */
+  double overshoot; /* beyond the setpoint, % of the step */
+  int settleMs;     /* time until the speed stays within 5% of the step */
+  double steadyErr; /* mean error over the last 100 ms, steps/s */
+} StepResult;
+
+/*! \brief Speed step of the left wheel, from a stand still (from 0) or after 1 s at 'from'. */
+static StepResult Step(SimKind kind, int32_t from, int32_t to, int ms) {
+  StepResult res = {-1, 0, 0, 0};
+  int t, t10 = -1;
+  double speed, frac, errSum = 0;
+
+  PID_Init();
+  PID_Start();
+  if (kind==SIM_FB_NOFF) {
+    speedLeftConfig.ffGain100 = speedLeftConfig.ffOffset = speedLeftConfig.ffAccel100 = 0;
+  }
+  HOST_MotorInit();
+  for(t=0;from!=0 && t<1000;t+=SIM_PERIOD_US/1000) {
+    if (kind==SIM_FF) {
+      PID_SpeedAccel(TACHO_GetSpeed(TRUE), from, 0, TRUE, SIM_PERIOD_US);
+    } else {
+      PID_Speed(TACHO_GetSpeed(TRUE), from, TRUE, SIM_PERIOD_US);
+    }
+    HOST_AdvanceUs(SIM_PERIOD_US);
+  }
+  if (from!=0) {
+    from = TACHO_GetSpeed(TRUE); /* where it really is, e.g. at the top speed */
+  }
+  for(t=0;t<ms;t++) {
+    if (t%(SIM_PERIOD_US/1000)==0) {
+      if (kind==SIM_FF) {
+        PID_SpeedAccel(TACHO_GetSpeed(TRUE), to, 0, TRUE, SIM_PERIOD_US);
+      } else {
+        PID_Speed(TACHO_GetSpeed(TRUE), to, TRUE, SIM_PERIOD_US);
+      }
+    }
+    HOST_AdvanceUs(1000);
+    speed = HOST_Motors[MOT_MOTOR_LEFT].speed;
+    frac = (speed-from)/(to-from);
+    if (t10<0 && frac>=0.1) {
+      t10 = t;
+    }
+    if (res.riseMs<0 && frac>=0.9) {
+      res.riseMs = t-t10;
+    }
+    if (100.0*(speed-to)/(to-from)>res.overshoot) {
+      res.overshoot = 100.0*(speed-to)/(to-from);
+    }
+    if (fabs(speed-to)>0.05*fabs((double)(to-from))) {
+      res.settleMs = t+1;
+    }
+    if (t>=ms-100) {
+      errSum += speed-to;
+    }
+  }
+  res.steadyErr = errSum/100;
+  return res;
+}
+
+static void TestSteps(void) {
+  static const int32_t speeds[] = {1000, 2000, 4000};
+  StepResult fb, noff, ff;
+  unsigned int i;
+
+  for(i=0;i<sizeof(speeds)/sizeof(speeds[0]);i++) {
+    fb = Step(SIM_FB, 0, speeds[i], 1000);
+    noff = Step(SIM_FB_NOFF, 0, speeds[i], 1000);
+    ff = Step(SIM_FF, 0, speeds[i], 1000);
+    HOST_CHECK(fb.riseMs==noff.riseMs && fb.overshoot==noff.overshoot && fb.settleMs==noff.settleMs,
+        "step to %d: rise time %d ms, overshoot %.1f%%, settled in %d ms, without feedforward factors %d ms, %.1f%%, %d ms",
+        speeds[i], fb.riseMs, fb.overshoot, fb.settleMs, noff.riseMs, noff.overshoot, noff.settleMs);
+    HOST_CHECK(fb.overshoot<1 && fabs(fb.steadyErr)<0.01*speeds[i], "step to %d: overshoot %.1f%%, steady state error %.0f",
+        speeds[i], fb.overshoot, fb.steadyErr);
+    printf("step to %4d steps/s: rise time %2d ms, overshoot %4.1f%%, settled in %3d ms, steady state error %+4.1f steps/s (with the feedforward %2d ms, %4.1f%%, %3d ms)\n",
+        speeds[i], fb.riseMs, fb.overshoot, fb.settleMs, fb.steadyErr, ff.riseMs, ff.overshoot, ff.settleMs);
+  }
+}
+
+/*! \brief Feedforward beyond the saturation: the feedback part is not saturated, the integral must not be unwound. */
+static void TestFFSaturation(void) {
+  PID_Config cfg;
+  StepResult res;
+  int n;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.pFactor100 = 300;
+  cfg.iFactor100 = 70;
+  cfg.iAntiWindup = 100000;
+  cfg.setpointWeight100 = 100;
+  cfg.ffGain100 = 2000; /* 2*setpoint: beyond the saturation */
+  for(n=0;n<200;n++) {
+    (void)PID_Run(&cfg, 0xFFFF, 0, TRUE, 0xFFFF, 0, FALSE, SIM_PERIOD_US, 0xFFFF); /* at the setpoint */
+  }
+  HOST_CHECK(cfg.integral==0, "feedforward beyond the saturation: integral unwound to %d", cfg.integral>>8);
+  res = Step(SIM_FF, 9000, 3000, 1000); /* feedforward of 9000 steps/s is above full PWM */
+  HOST_CHECK(res.settleMs<250, "step down from the top speed: overshoot %.1f%%, settled in %d ms", res.overshoot, res.settleMs);
+  HOST_CHECK(fabs(res.steadyErr)<30, "step down from the top speed: steady state error %.0f", res.steadyErr);
+  printf("feedforward beyond the saturation: integral stays %d, step down from the top speed: overshoot %.1f%%, settled in %d ms\n",
+      cfg.integral>>8, res.overshoot, res.settleMs);
+}
+
+int main(void) {
+  HOST_OnMs = HOST_MotorOnMs;
+  TestSteps();
+  TestFFSaturation();
+  return HOST_Result("pid_ff_sim");
+}
@@ -0,0 +1,246 @@
+/**
+ * \file
+ * \brief Host sweep of the line following schedule (PID_LineCfg() of Pid.c) over the line error and the speed.
+ *
+ * Runs PID_LineCfg() with the P part alone (no state from one call to the next) for every line position
+ * under the array and for every wheel speed, and reads back the PWM and direction of both motors from
+ * HostMotor.h. Checks, with the default tables of PID_Init() and with random tables within the limits of
+ * the 'pid fw sched' and 'pid fw vgain' commands:
+ * - continuity: from one line position (or speed) to the next, the wheel speeds change by no more than the
+ *   slope of the schedule allows, so there are no jumps at the table points or at the end of the tables.
+ *   The table position has a Q8 fraction between two points, so the schedule moves in steps of about
+ *   2.5 line units: the slope is checked over one such step,
+ * - bounds: the outer wheel runs at least at the base speed and at most at full PWM, the inner wheel not
+ *   faster than the base speed and not slower than its limit, and a wheel only turns backward where the
+ *   inner wheel limit of the schedule is negative,
+ * - symmetry: the line on the other side gives the same speeds with the wheels swapped,
+ * - the turn direction: the wheel on the side of the line is the inner one,
+ * - the 32 bit PercentQ8() and TablePos() against the 64 bit products they replace, over the value and
+ *   percentage ranges.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o pid_line_sweep pid_line_sweep.c -lm
+ *   ./pid_line_sweep
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Pid.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#define SWEEP_P_FACTOR100  400
+#define SWEEP_MAX_SPEED    60   /* maxSpeedPercent of the line PID */
+#define SWEEP_NOF_TABLES   200  /* random tables */
+#define SWEEP_SPEED_STEP   10   /* steps per second */
+#define SWEEP_LINE_MIN     (REF_MIDDLE_LINE_VALUE-REF_MAX_LINE_VALUE/2) /* line under the first and the last sensor */
+#define SWEEP_LINE_MAX     (REF_MIDDLE_LINE_VALUE+REF_MAX_LINE_VALUE/2)
+/* line steps for one step of the Q8 fraction between two schedule points: the schedule changes in steps this wide */
+#define SWEEP_FRAC_LINES   ((65536+PID_LINE_ERR_TO_POS_Q16-1)/PID_LINE_ERR_TO_POS_Q16)
+
+static int32_t SweepSpeed = 0; /* measured speed of both wheels */
+
+int32_t TACHO_GetSpeed(bool isLeft) { (void)isLeft; return SweepSpeed; }
+
+/*! \brief Signed PWM of a wheel, as set by PID_LineCfg(). */
+static int32_t WheelPwm(MOT_MotorSide side) {
+  int32_t pwm = 0xFFFF-HOST_MotorDev[side].currPWMvalue;
+
+  return HOST_MotorDir[side]==MOT_DIR_BACKWARD ? -pwm : pwm;
+}
+
+/*! \brief One call of the line PID with the P part alone, returns the PWM of both wheels. */
+static void RunLine(int32_t line, int32_t *left, int32_t *right) {
+  PID_Reset(&lineFwConfig);
+  PID_LineCfg((uint16_t)line, 0, REF_MIDDLE_LINE_VALUE, 5, &lineFwConfig);
+  *left = WheelPwm(MOT_MOTOR_LEFT);
+  *right = WheelPwm(MOT_MOTOR_RIGHT);
+}
+
+/*! \brief Largest change of the wheel speeds from one line position (or speed) to the next the tables allow, in PWM. */
+static int32_t MaxSlope(int32_t errorStep, int32_t speedStep) {
+  double maxSpeed = SWEEP_MAX_SPEED*(0xffff/100); /* also the limit of the PID output */
+  double dSpeed = 0, dGain = 0, dInner = 0, gainMax = 0, vgainMax = 0, dVgain = 0, errPerPoint, speedPerPoint, dBase, dSteer;
+  int i;
+
+  for(i=0;i<PID_LINE_SCHED_NOF_POINTS;i++) {
+    gainMax = fmax(gainMax, lineSched[i].gainPercent/100.0);
+    if (i>0) {
+      dSpeed = fmax(dSpeed, abs(lineSched[i].speedPercent-lineSched[i-1].speedPercent)/100.0);
+      dGain = fmax(dGain, abs(lineSched[i].gainPercent-lineSched[i-1].gainPercent)/100.0);
+      dInner = fmax(dInner, abs(lineSched[i].innerMinPercent-lineSched[i-1].innerMinPercent)/100.0);
+    }
+  }
+  for(i=0;i<PID_LINE_VGAIN_NOF_POINTS;i++) {
+    vgainMax = fmax(vgainMax, lineSpeedGain[i]/100.0);
+    if (i>0) {
+      dVgain = fmax(dVgain, abs(lineSpeedGain[i]-lineSpeedGain[i-1])/100.0);
+    }
+  }
+  errPerPoint = (REF_MAX_LINE_VALUE/2.0)/(PID_LINE_SCHED_NOF_POINTS-1);
+  speedPerPoint = (double)PID_LINE_VGAIN_MAX_SPEED/(PID_LINE_VGAIN_NOF_POINTS-1);
+  /* steer = pid*gain*vgain and inner limit = base*inner: each factor changes by its slope, the others at their maximum */
+  dBase = errorStep*maxSpeed*dSpeed/errPerPoint;
+  dSteer = errorStep*(SWEEP_P_FACTOR100/100.0*gainMax*vgainMax+maxSpeed*dGain/errPerPoint*vgainMax)
+      +speedStep*maxSpeed*gainMax*dVgain/speedPerPoint;
+  return (int32_t)(dBase+dSteer+errorStep*maxSpeed*dInner/errPerPoint)+8; /* and the rounding of the fixed point steps */
+}
+
+/*! \brief Expected range of the wheel speeds at a line position, from the interpolated schedule, in PWM. */
+static void Bounds(int32_t line, int32_t *base, int32_t *innerMin) {
+  int32_t maxSpeed = SWEEP_MAX_SPEED*(0xffff/100), error = abs(line-REF_MIDDLE_LINE_VALUE), idx, frac;
+
+  idx = TablePos(error, PID_LINE_ERR_TO_POS_Q16, PID_LINE_SCHED_NOF_POINTS, &frac);
+  *base = PercentQ8(maxSpeed, InterpolateQ8(lineSched[idx].speedPercent, lineSched[idx+1].speedPercent, frac));
+  *innerMin = PercentQ8(*base, InterpolateQ8(lineSched[idx].innerMinPercent, lineSched[idx+1].innerMinPercent, frac));
+}
+
+/*! \brief Sweeps the line from one end of the array to the other at the current speed, returns the largest change in PWM. */
+static int32_t SweepLine(const char *name, int32_t slope) {
+  int32_t line, left, right, prevLeft = 0, prevRight = 0, mirrorLeft, mirrorRight, base, innerMin, outer, inner, maxJump = 0;
+  int errors = 0;
+
+  for(line=SWEEP_LINE_MIN-500;line<=SWEEP_LINE_MAX+500 && errors<3;line++) { /* also beyond the ends of the array */
+    RunLine(line, &left, &right);
+    Bounds(line, &base, &innerMin);
+    outer = line<REF_MIDDLE_LINE_VALUE ? right : left;
+    inner = line<REF_MIDDLE_LINE_VALUE ? left : right;
+    if (line==REF_MIDDLE_LINE_VALUE) {
+      outer = left>right ? left : right;
+      inner = left>right ? right : left;
+    }
+    if (!(outer>=base && outer<=0xFFFF && inner<=base && inner>=innerMin-1 && (inner>=0 || innerMin<0) && outer>=inner)) {
+      HOST_CHECK(FALSE, "%s: line %d: left %d right %d, base %d, inner limit %d", name, (int)line, (int)left, (int)right, (int)base, (int)innerMin);
+      errors++;
+    }
+    {
+      RunLine(2*REF_MIDDLE_LINE_VALUE-line, &mirrorLeft, &mirrorRight);
+      if (mirrorLeft!=right || mirrorRight!=left) {
+        HOST_CHECK(FALSE, "%s: line %d: left %d right %d, mirrored left %d right %d", name, (int)line, (int)left, (int)right, (int)mirrorLeft, (int)mirrorRight);
+        errors++;
+      }
+    }
+    if (line>SWEEP_LINE_MIN-500) {
+      if (abs(left-prevLeft)>maxJump) {
+        maxJump = abs(left-prevLeft);
+      }
+      if (abs(right-prevRight)>maxJump) {
+        maxJump = abs(right-prevRight);
+      }
+      if (abs(left-prevLeft)>slope || abs(right-prevRight)>slope) {
+        HOST_CHECK(FALSE, "%s: line %d: jump left %d right %d, slope %d", name, (int)line, (int)(left-prevLeft), (int)(right-prevRight), (int)slope);
+        errors++;
+      }
+    }
+    prevLeft = left;
+    prevRight = right;
+  }
+  return maxJump;
+}
+
+/*! \brief Sweeps the speed at a fixed line position, returns the largest change in PWM. */
+static int32_t SweepSpeedGain(const char *name, int32_t line, int32_t slope) {
+  int32_t left, right, prevLeft = 0, prevRight = 0, maxJump = 0;
+  int errors = 0;
+
+  for(SweepSpeed=0;SweepSpeed<=PID_LINE_VGAIN_MAX_SPEED+2000 && errors<3;SweepSpeed+=SWEEP_SPEED_STEP) {
+    RunLine(line, &left, &right);
+    if (SweepSpeed>0 && (abs(left-prevLeft)>slope || abs(right-prevRight)>slope)) {
+      HOST_CHECK(FALSE, "%s: speed %d: jump left %d right %d, slope %d", name, (int)SweepSpeed, (int)(left-prevLeft), (int)(right-prevRight), (int)slope);
+      errors++;
+    }
+    if (SweepSpeed>0) {
+      maxJump = abs(left-prevLeft)>maxJump ? abs(left-prevLeft) : maxJump;
+      maxJump = abs(right-prevRight)>maxJump ? abs(right-prevRight) : maxJump;
+    }
+    prevLeft = left;
+    prevRight = right;
+  }
+  SweepSpeed = 0;
+  return maxJump;
+}
+
+/*! \brief 32 bit fixed point helpers of the schedule: the same results as the 64 bit products. */
+static void TestFixedPoint(void) {
+  int32_t val, percent, pos, frac, nofErrors = 0;
+
+  for(val=-0x800000;val<=0x7FFFFF;val+=4099) {
+    for(percent=-PID_PERCENT_Q8_MAX;percent<=PID_PERCENT_Q8_MAX;percent+=997) {
+      if (PercentQ8(val, percent)!=(int32_t)(((int64_t)val*percent*10486)>>28)) {
+        nofErrors++;
+      }
+    }
+    if (val>=0) {
+      pos = (int32_t)(((int64_t)val*PID_LINE_ERR_TO_POS_Q16)>>16);
+      if (pos>(PID_LINE_SCHED_NOF_POINTS-1)*256) {
+        pos = (PID_LINE_SCHED_NOF_POINTS-1)*256;
+      }
+      if (TablePos(val, PID_LINE_ERR_TO_POS_Q16, PID_LINE_SCHED_NOF_POINTS, &frac)*256+frac!=pos) {
+        nofErrors++;
+      }
+    }
+  }
+  HOST_CHECK(nofErrors==0, "%d results of PercentQ8()/TablePos() differ from the 64 bit products", nofErrors);
+}
+
+static void InitLinePid(void) {
+  PID_Init();
+  lineFwConfig.pFactor100 = SWEEP_P_FACTOR100;
+  lineFwConfig.maxSpeedPercent = SWEEP_MAX_SPEED;
+}
+
+static void TestDefault(void) {
+  int32_t left, right, jump, slope, base, innerMin;
+
+  InitLinePid();
+  slope = MaxSlope(SWEEP_FRAC_LINES, 0);
+  jump = SweepLine("default", slope);
+  printf("default schedule: largest change %d PWM per line step (allowed %d over %d line steps)\n", (int)jump, (int)slope, (int)SWEEP_FRAC_LINES);
+  RunLine(REF_MIDDLE_LINE_VALUE, &left, &right);
+  HOST_CHECK(left==right && left==PercentQ8(SWEEP_MAX_SPEED*(0xffff/100), lineSched[0].speedPercent*256), "on the line: left %d right %d", (int)left, (int)right);
+  lineFwConfig.pFactor100 = 10000; /* the PID output saturates at the end of the array */
+  lineFwConfig.gains.periodUs = 0; /* gains changed */
+  RunLine(SWEEP_LINE_MIN, &left, &right);
+  Bounds(SWEEP_LINE_MIN, &base, &innerMin);
+  HOST_CHECK(left<0 && left==innerMin && right==0xFFFF, "line at the end of the array: left %d right %d, has to turn on the spot", (int)left, (int)right);
+}
+
+/*! \brief Random tables within the command limits: speed 0..100, gain 0..255, inner -100..100. */
+static void TestRandom(void) {
+  int32_t slope, jump, maxRatio = 0, i, pt;
+
+  srand(1);
+  for(i=0;i<SWEEP_NOF_TABLES;i++) {
+    InitLinePid();
+    for(pt=0;pt<PID_LINE_SCHED_NOF_POINTS;pt++) {
+      PID_SetLineSchedPoint(pt, (uint8_t)(rand()%101), (uint8_t)(rand()%256), (int8_t)(rand()%201-100));
+    }
+    for(pt=0;pt<PID_LINE_VGAIN_NOF_POINTS;pt++) {
+      lineSpeedGain[pt] = (uint8_t)(rand()%256);
+    }
+    SweepSpeed = rand()%(PID_LINE_VGAIN_MAX_SPEED+1000);
+    slope = MaxSlope(SWEEP_FRAC_LINES, 0);
+    jump = SweepLine("random table", slope);
+    if (jump*100/slope>maxRatio) {
+      maxRatio = jump*100/slope;
+    }
+    SweepSpeed = 0;
+    slope = MaxSlope(0, SWEEP_SPEED_STEP);
+    jump = SweepSpeedGain("random speed gain", REF_MIDDLE_LINE_VALUE-REF_MAX_LINE_VALUE/4, slope);
+    if (jump*100/slope>maxRatio) {
+      maxRatio = jump*100/slope;
+    }
+  }
+  printf("%d random tables: largest change %d%% of the slope the table allows\n", SWEEP_NOF_TABLES, (int)maxRatio);
+}
+
+int main(void) {
+  HOST_MotorInit();
+  (void)HOST_MotorOnMs; /* no time passes, only the PWM set by the line PID is read back */
+  TestFixedPoint();
+  TestDefault();
+  TestRandom();
+  return HOST_Result("pid_line_sweep");
+}
@@ -0,0 +1,311 @@
+/**
+ * \file
+ * \brief Host test and benchmark of the fixed point PID engine (PID_Run() of Pid.c) on a simulated motor.
+ *
+ * Compares PID_Run() with the integer PID it replaces (PID() and PID_Calc(), copied below unchanged), and
+ * runs the speed loop (PID_Speed()) against the motor model of HostMotor.h. Checks:
+ * - with the same factors, a constant setpoint and no saturation, both PIDs give the same output within
+ *   the rounding of the gains,
+ * - no derivative kick: a setpoint step only changes the output by the P part, and the derivative filter
+ *   (dFilterMs) reduces the output noise from a noisy measurement,
+ * - speed steps forward, faster and backward settle without large overshoot and without steady state error,
+ * - the same factors give a similar step response with a 2, 5 or 10 ms sample period (gains scaled),
+ * - after a long time in saturation (setpoint above the top speed), the back-calculation lets the speed
+ *   recover from the saturation faster than the integral clamp of the old PID.
+ * The feedforward is off here: it is tested by pid_ff_sim. Then both PIDs are timed on the host: this
+ * is not the cycle count on the robot. The engine uses SMMUL, QADD/QSUB and SSAT of the Cortex-M4
+ * there, and their portable C replacements here, so the host overstates its cost. On the robot,
+ * 'pid status' shows the cycles of PID_Run() in the speed loop.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o pid_plant_test pid_plant_test.c -lm
+ *   ./pid_plant_test
+ */
+#define _POSIX_C_SOURCE 199309L /* clock_gettime() */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include <time.h>
+#include "Pid.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#define PLANT_P_FACTOR100   333 /* speed PID of the left motor, from PidSpeedTuning.h */
+#define PLANT_I_FACTOR100   72
+#define PLANT_WINDUP        100000 /* the I part alone can reach full PWM (72*100000/100) */
+#define PLANT_BENCH_SAMPLES 4096
+#define PLANT_BENCH_ROUNDS  400
+
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+
+/* old PID, from before the fixed point engine */
+typedef struct {
+  int32_t pFactor100;
+  int32_t iFactor100;
+  int32_t dFactor100;
+  int32_t iAntiWindup;
+  uint8_t maxSpeedPercent; /* max speed if 100% on the line, 0xffff would be full speed */
+  int32_t lastError;
+  int32_t integral;
+} Old_PID_Config;
+
+static int32_t Old_PID_Calc(int32_t error, int32_t dError, Old_PID_Config *config) {
+  int32_t pid;
+
+  pid = (error*config->pFactor100)/100; /* P part */
+  config->integral += error; /* integrate error */
+  if (config->integral>config->iAntiWindup) {
+    config->integral = config->iAntiWindup;
+  } else if (config->integral<-config->iAntiWindup) {
+    config->integral = -config->iAntiWindup;
+  }
+  pid += (config->integral*config->iFactor100)/100; /* add I part */
+  pid += (dError*config->dFactor100)/100; /* add D part */
+  config->lastError = error; /* remember for next iteration of D part */
+  return pid;
+}
+
+static int32_t Old_PID(int32_t currVal, int32_t setVal, Old_PID_Config *config) {
+  int32_t error;
+
+  /* perform PID closed control loop calculation */
+  error = setVal-currVal; /* calculate error */
+  return Old_PID_Calc(error, error-config->lastError, config);
+}
+
+/*! \brief Speed loop of the left motor with the old PID, as the old PID_SpeedCfg(). */
+static void Old_Speed(int32_t currSpeed, int32_t setSpeed, Old_PID_Config *config) {
+  int32_t speed;
+  MOT_Direction direction;
+
+  speed = Old_PID(currSpeed, setSpeed, config);
+  direction = AbsSpeed(&speed);
+  if (speed>0xFFFF) {
+    speed = 0xFFFF;
+  }
+  MOT_SetVal(MOT_GetMotorHandle(MOT_MOTOR_LEFT), 0xFFFF-speed); /* PWM is low active */
+  MOT_SetDirection(MOT_GetMotorHandle(MOT_MOTOR_LEFT), direction);
+}
+
+static void InitConfig(PID_Config *config, int32_t p, int32_t i, int32_t d, int32_t windup) {
+  memset(config, 0, sizeof(*config));
+  config->pFactor100 = p;
+  config->iFactor100 = i;
+  config->dFactor100 = d;
+  config->iAntiWindup = windup;
+  config->maxSpeedPercent = 100;
+  config->setpointWeight100 = 100;
+}
+
+static void InitOldConfig(Old_PID_Config *config, int32_t p, int32_t i, int32_t d, int32_t windup) {
+  memset(config, 0, sizeof(*config));
+  config->pFactor100 = p;
+  config->iFactor100 = i;
+  config->dFactor100 = d;
+  config->iAntiWindup = windup;
+  config->maxSpeedPercent = 100;
+}
+
+/*! \brief Same factors, constant setpoint, no saturation: the outputs have to match the old PID. */
+static void TestSameAsOld(void) {
+  PID_Config cfg;
+  Old_PID_Config old;
+  int32_t curr = 0, newOut, oldOut, maxDiff = 0, diff;
+  int n;
+
+  InitConfig(&cfg, 1500, 5, 100, PLANT_WINDUP);
+  InitOldConfig(&old, 1500, 5, 100, PLANT_WINDUP);
+  srand(11);
+  for(n=0;n<5000;n++) {
+    curr += rand()%201-100; /* random walk of the measured value around the setpoint */
+    curr = Limit(curr, -3000, 3000);
+    newOut = PID_Run(&cfg, 0, 0, FALSE, curr, 0, FALSE, PID_REF_PERIOD_US, 0x7FFFFFFF);
+    oldOut = Old_PID(curr, 0, &old);
+    if (n==0) {
+      continue; /* the old PID has a derivative kick from lastError 0 in the first sample */
+    }
+    diff = newOut-oldOut;
+    if (diff<0) {
+      diff = -diff;
+    }
+    if (diff>maxDiff) {
+      maxDiff = diff;
+    }
+    HOST_CHECK(diff<=2+abs(oldOut)/1000, "sample %d: %d instead of %d", n, newOut, oldOut);
+  }
+  printf("same factors as the old PID: max output difference %d (gain rounding)\n", maxDiff);
+}
+
+/*! \brief Setpoint step with the D part on the measurement: no kick, and the filter reduces the noise. */
+static void TestDerivative(void) {
+  PID_Config cfg;
+  int32_t out0, out1, noise;
+  double sumSq[2];
+  int f, n;
+
+  InitConfig(&cfg, 200, 0, 5000, 0);
+  out0 = PID_Run(&cfg, 1000, 0, FALSE, 1000, 0, FALSE, PID_REF_PERIOD_US, 0xFFFF);
+  out1 = PID_Run(&cfg, 1100, 0, FALSE, 1000, 0, FALSE, PID_REF_PERIOD_US, 0xFFFF);
+  HOST_CHECK(out1-out0==200, "setpoint step of 100: output changed by %d instead of the P part 200", out1-out0);
+  for(f=0;f<2;f++) {
+    InitConfig(&cfg, 200, 0, 5000, 0);
+    cfg.dFilterMs = f==0 ? 0 : 20;
+    srand(12);
+    sumSq[f] = 0;
+    for(n=0;n<2000;n++) {
+      noise = rand()%21-10;
+      out0 = PID_Run(&cfg, 1000, 0, FALSE, 1000+noise, 0, FALSE, PID_REF_PERIOD_US, 0xFFFF);
+      sumSq[f] += (double)out0*out0;
+    }
+  }
+  HOST_CHECK(sqrt(sumSq[1])<0.5*sqrt(sumSq[0]), "derivative filter: output noise %.0f, %.0f without filter", sqrt(sumSq[1]/2000), sqrt(sumSq[0]/2000));
+  printf("derivative: no setpoint kick, output noise %.0f without and %.0f with a 20 ms filter\n", sqrt(sumSq[0]/2000), sqrt(sumSq[1]/2000));
+}
+
+typedef struct {
+  double overshoot;  /* % of the step */
+  int settleMs;      /* time until the speed stays within 5% of the step */
+  double steadyErr;  /* mean error over the last 100 ms, % of the setpoint */
+} StepResult;
+
+/*! \brief Runs the left speed loop for a time, with the new PID if old is NULL, and rates the step from 'from' to 'to'. */
+static StepResult RunSpeed(Old_PID_Config *old, int32_t from, int32_t to, uint32_t periodUs, int ms) {
+  StepResult res = {0, 0, 0};
+  double speed, step = to-from, over, errSum = 0;
+  int t, nofErr = 0;
+
+  for(t=0;t<ms;t+=periodUs/1000) {
+    if (old!=NULL) {
+      Old_Speed(TACHO_GetSpeed(TRUE), to, old);
+    } else {
+      PID_Speed(TACHO_GetSpeed(TRUE), to, TRUE, periodUs);
+    }
+    HOST_AdvanceUs(periodUs);
+    speed = HOST_Motors[MOT_MOTOR_LEFT].speed;
+    over = 100.0*(speed-to)/step;
+    if (over>res.overshoot) {
+      res.overshoot = over;
+    }
+    if (fabs(speed-to)>0.05*fabs(step)) {
+      res.settleMs = t+periodUs/1000;
+    }
+    if (t>=ms-100) {
+      errSum += speed-to;
+      nofErr++;
+    }
+  }
+  res.steadyErr = to!=0 ? 100.0*errSum/nofErr/fabs((double)to) : errSum/nofErr;
+  return res;
+}
+
+static void TestSteps(void) {
+  static const int32_t steps[][2] = {{0, 2000}, {2000, 4000}, {4000, -2000}, {-2000, 0}};
+  Old_PID_Config old;
+  StepResult res, oldRes;
+  unsigned int i;
+
+  HOST_MotorInit();
+  InitConfig(&speedLeftConfig, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+  for(i=0;i<sizeof(steps)/sizeof(steps[0]);i++) {
+    res = RunSpeed(NULL, steps[i][0], steps[i][1], 5000, 600);
+    HOST_CHECK(res.overshoot<10, "step %d to %d: overshoot %.1f%%", steps[i][0], steps[i][1], res.overshoot);
+    HOST_CHECK(res.settleMs<300, "step %d to %d: settled after %d ms", steps[i][0], steps[i][1], res.settleMs);
+    HOST_CHECK(steps[i][1]==0 ? fabs(res.steadyErr)<5 : fabs(res.steadyErr)<1, "step %d to %d: steady state error %.2f", steps[i][0], steps[i][1], res.steadyErr);
+    printf("speed step %5d to %5d steps/s: overshoot %4.1f%%, settled in %3d ms, steady state error %+.2f%%\n",
+        steps[i][0], steps[i][1], res.overshoot, res.settleMs, res.steadyErr);
+  }
+  /* the old PID with the same factors: same response, as there is no saturation */
+  HOST_MotorInit();
+  InitConfig(&speedLeftConfig, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+  res = RunSpeed(NULL, 0, 2000, 5000, 600);
+  HOST_MotorInit();
+  InitOldConfig(&old, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+  oldRes = RunSpeed(&old, 0, 2000, 5000, 600);
+  HOST_CHECK(fabs(res.overshoot-oldRes.overshoot)<1 && abs(res.settleMs-oldRes.settleMs)<=10, "step 0 to 2000: %.1f%%/%d ms, old PID %.1f%%/%d ms",
+      res.overshoot, res.settleMs, oldRes.overshoot, oldRes.settleMs);
+}
+
+static void TestPeriods(void) {
+  static const uint32_t periodsUs[] = {2000, 5000, 10000};
+  StepResult res;
+  unsigned int i;
+
+  for(i=0;i<sizeof(periodsUs)/sizeof(periodsUs[0]);i++) {
+    HOST_MotorInit();
+    InitConfig(&speedLeftConfig, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+    res = RunSpeed(NULL, 0, 3000, periodsUs[i], 800);
+    HOST_CHECK(res.overshoot<15 && res.settleMs<350 && fabs(res.steadyErr)<1, "period %u us: overshoot %.1f%%, settled in %d ms, steady state error %.2f%%",
+        (unsigned)periodsUs[i], res.overshoot, res.settleMs, res.steadyErr);
+    printf("period %2u ms, step to 3000 steps/s: overshoot %4.1f%%, settled in %3d ms, steady state error %+.2f%%\n",
+        (unsigned)periodsUs[i]/1000, res.overshoot, res.settleMs, res.steadyErr);
+  }
+}
+
+/*! \brief One second at a setpoint above the top speed, then a step down: time until the speed is within 5% again. */
+static void TestWindup(void) {
+  Old_PID_Config old;
+  StepResult res, oldRes;
+
+  HOST_MotorInit();
+  InitConfig(&speedLeftConfig, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+  (void)RunSpeed(NULL, 0, 9000, 5000, 1000);
+  res = RunSpeed(NULL, 6800, 3000, 5000, 1000);
+  HOST_MotorInit();
+  InitOldConfig(&old, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 0, PLANT_WINDUP);
+  (void)RunSpeed(&old, 0, 9000, 5000, 1000);
+  oldRes = RunSpeed(&old, 6800, 3000, 5000, 1000);
+  HOST_CHECK(res.settleMs<300, "after saturation: settled in %d ms", res.settleMs);
+  HOST_CHECK(res.settleMs<oldRes.settleMs, "after saturation: settled in %d ms, old PID %d ms", res.settleMs, oldRes.settleMs);
+  printf("after 1 s in saturation, step to 3000 steps/s: settled in %d ms, old PID with integral clamp %d ms\n", res.settleMs, oldRes.settleMs);
+}
+
+static double NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+static void Bench(void) {
+  static int32_t meas[PLANT_BENCH_SAMPLES];
+  PID_Config cfg;
+  Old_PID_Config old;
+  volatile int32_t sink = 0;
+  double start, oldNs, newNs;
+  int r, n;
+
+  for(n=0;n<PLANT_BENCH_SAMPLES;n++) {
+    meas[n] = 2000+rand()%400-200;
+  }
+  InitOldConfig(&old, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 10, PLANT_WINDUP);
+  start = NowNs();
+  for(r=0;r<PLANT_BENCH_ROUNDS;r++) {
+    for(n=0;n<PLANT_BENCH_SAMPLES;n++) {
+      sink += Old_PID(meas[n], 2000, &old);
+    }
+  }
+  oldNs = (NowNs()-start)/(PLANT_BENCH_ROUNDS*PLANT_BENCH_SAMPLES);
+  InitConfig(&cfg, PLANT_P_FACTOR100, PLANT_I_FACTOR100, 10, PLANT_WINDUP);
+  cfg.dFilterMs = 10;
+  start = NowNs();
+  for(r=0;r<PLANT_BENCH_ROUNDS;r++) {
+    for(n=0;n<PLANT_BENCH_SAMPLES;n++) {
+      sink += PID_Run(&cfg, 2000, 0, FALSE, meas[n], 0, FALSE, 5000, 0xFFFF);
+    }
+  }
+  newNs = (NowNs()-start)/(PLANT_BENCH_ROUNDS*PLANT_BENCH_SAMPLES);
+  printf("host time per call: old PID %.1f ns, fixed point engine %.1f ns (host, not target cycles)\n", oldNs, newNs);
+}
+
+int main(void) {
+  HOST_OnMs = HOST_MotorOnMs;
+  TestSameAsOld();
+  TestDerivative();
+  TestSteps();
+  TestPeriods();
+  TestWindup();
+  Bench();
+  return HOST_Result("pid_plant_test");
+}
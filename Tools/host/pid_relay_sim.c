@@ -0,0 +1,183 @@
+/**
+ * \file
+ * \brief Host simulation of the relay auto-tuning of the speed PID (PidTune.c and PidRelay.c).
+ *
+ * Runs PIDT_AutoTuneSpeed() unchanged, through the 'pid autotune speed' shell command, against the motor
+ * model of HostMotor.h (first order plus dead time, fitted by Tools/motor_ident to the step responses in
+ * TEAM_Robot/Regler). The drive is replaced by its speed loop: in speed mode, PID_Speed() runs every
+ * DRV_PERIOD_MS for both wheels, as in the drive task. Checks:
+ * - the ultimate period and gain found by the relay experiment match the ones of the model, for the
+ *   effective dead time of the sampled loop (dead time plus half a sample for the switching of the relay),
+ * - the static gain at the operating point matches the model, including its deadband,
+ * - for each tuning rule, the factors are applied to the speed PID, and speed steps with them are stable:
+ *   they settle without steady state error, and Tyreus-Luyben and SIMC overshoot less than Ziegler-Nichols
+ *   (with the feedforward off, the rules are for the feedback alone),
+ * - a motor which does not move (no speed at the operating point) makes the tuning fail and stops the drive.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o pid_relay_sim pid_relay_sim.c -lm
+ *   ./pid_relay_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+
+#include "Pid.c"
+#include "PidRelay.c"
+#include "PidTune.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#if !PL_CONFIG_HAS_PID_TUNE
+  #error "pid_relay_sim needs PL_CONFIG_HAS_PID_TUNE"
+#endif
+
+#define SIM_PI            3.14159265358979
+#define SIM_DRV_PERIOD_MS 5 /* as DRV_PERIOD_MS of Drive.c */
+#define SIM_STEP_MS       1500 /* duration of a speed step, Tyreus-Luyben has a slow integral */
+
+/* drive replacement: the speed loop of the drive task */
+static DRV_Mode SimMode = DRV_MODE_NONE;
+static int32_t SimSpeedLeft, SimSpeedRight;
+
+uint8_t DRV_SetMode(DRV_Mode mode) { SimMode = mode; return ERR_OK; }
+uint8_t DRV_SetSpeed(int32_t left, int32_t right) { SimSpeedLeft = left; SimSpeedRight = right; return ERR_OK; }
+uint8_t DRV_Stop(int32_t timeoutMs) { (void)timeoutMs; SimMode = DRV_MODE_STOP; return ERR_OK; }
+
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+
+static void SimOnMs(void) {
+  HOST_MotorOnMs();
+  if ((HOST_TimeNs/1000000)%SIM_DRV_PERIOD_MS==0) {
+    if (SimMode==DRV_MODE_SPEED) {
+      PID_Speed(TACHO_GetSpeed(TRUE), SimSpeedLeft, TRUE, SIM_DRV_PERIOD_MS*1000);
+      PID_Speed(TACHO_GetSpeed(FALSE), SimSpeedRight, FALSE, SIM_DRV_PERIOD_MS*1000);
+    } else if (SimMode==DRV_MODE_STOP) {
+      PID_Speed(TACHO_GetSpeed(TRUE), 0, TRUE, SIM_DRV_PERIOD_MS*1000);
+      PID_Speed(TACHO_GetSpeed(FALSE), 0, FALSE, SIM_DRV_PERIOD_MS*1000);
+    }
+  }
+}
+
+/*! \brief Ultimate period (s) and gain of the model with the effective dead time of the sampled relay loop. */
+static void ModelUltimate(const HOST_Motor *m, double *tu, double *ku) {
+  double theta = (m->deadMs+PIDT_PERIOD_MS/2.0)/1000, tau = m->tauMs/1000, w = SIM_PI/(theta+tau), f;
+  int i;
+
+  for(i=0;i<100;i++) { /* solve w*theta+atan(w*tau)=pi with Newton */
+    f = w*theta+atan(w*tau)-SIM_PI;
+    w -= f/(theta+tau/(1+w*w*tau*tau));
+  }
+  *tu = 2*SIM_PI/w;
+  *ku = sqrt(1+w*w*tau*tau)/m->k;
+}
+
+/*! \brief Stops the motors and lets them come to a stand still. */
+static void SimStop(void) {
+  SimMode = DRV_MODE_NONE;
+  PIDT_SetMotor(MOT_GetMotorHandle(MOT_MOTOR_LEFT), 0);
+  PIDT_SetMotor(MOT_GetMotorHandle(MOT_MOTOR_RIGHT), 0);
+  vTaskDelay(500);
+}
+
+/*! \brief Runs a speed step of the left wheel with the speed PID, returns the overshoot in % and the settling time (5%). */
+static void SpeedStep(int32_t from, int32_t to, double *overshoot, int *settleMs, double *steadyErr) {
+  int t;
+  double speed, over, errSum = 0;
+
+  SimMode = DRV_MODE_SPEED;
+  (void)DRV_SetSpeed(from, 0);
+  vTaskDelay(800);
+  (void)DRV_SetSpeed(to, 0);
+  *overshoot = 0;
+  *settleMs = 0;
+  for(t=1;t<=SIM_STEP_MS;t++) {
+    vTaskDelay(1);
+    speed = HOST_Motors[MOT_MOTOR_LEFT].speed;
+    over = 100.0*(speed-to)/(to-from);
+    if (over>*overshoot) {
+      *overshoot = over;
+    }
+    if (fabs(speed-to)>0.05*fabs((double)(to-from))) {
+      *settleMs = t;
+    }
+    if (t>SIM_STEP_MS-100) {
+      errSum += speed-to;
+    }
+  }
+  *steadyErr = 100.0*errSum/100/to;
+}
+
+static const char *RuleName(PIDR_Rule rule) {
+  return rule==PIDR_RULE_ZN ? "zn" : rule==PIDR_RULE_TL ? "tl" : "simc";
+}
+
+/*! \brief Runs the auto-tuning, directly and with the shell command, and returns the overshoot of a speed step with the new factors (left wheel only). */
+static double TestRule(bool isLeft, PIDR_Rule rule) {
+  unsigned char cmd[48];
+  bool handled = FALSE;
+  PIDR_Result result;
+  PIDR_Factors factors;
+  PID_Config *config;
+  const HOST_Motor *m = &HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT];
+  double tu, ku, k, overshoot = 0, steadyErr;
+  int settleMs;
+
+  PID_Init();
+  HOST_MotorInit();
+  HOST_CHECK(PIDT_AutoTuneSpeed(isLeft, rule, &result, &factors)==ERR_OK, "%s %s: experiment failed", isLeft ? "left" : "right", RuleName(rule));
+  HOST_CHECK(SimMode==DRV_MODE_STOP, "%s %s: drive not stopped", isLeft ? "left" : "right", RuleName(rule));
+  /* the same with the shell command: it has to apply the same factors (the simulation is deterministic) */
+  PID_Init();
+  HOST_MotorInit();
+  snprintf((char*)cmd, sizeof(cmd), "pid autotune speed %s %s", isLeft ? "L" : "R", RuleName(rule));
+  HOST_CHECK(PID_ParseCommand(cmd, &handled, CLS1_GetStdio())==ERR_OK && handled, "%s: failed", (char*)cmd);
+  (void)PID_GetPIDConfig(isLeft ? PID_CONFIG_SPEED_LEFT : PID_CONFIG_SPEED_RIGHT, &config);
+  HOST_CHECK(config->pFactor100==factors.pFactor100 && config->iFactor100==factors.iFactor100 && config->dFactor100==factors.dFactor100,
+      "%s: factors not applied", (char*)cmd);
+  ModelUltimate(m, &tu, &ku);
+  k = PIDT_SPEED/(PIDT_SPEED/m->k+m->deadband); /* speed per PWM at the operating point */
+  HOST_CHECK(fabs(result.tu-tu)/tu<0.15, "%s: Tu %.1f ms, model %.1f ms", (char*)cmd, result.tu*1000, tu*1000);
+  HOST_CHECK(fabs(result.ku-ku)/ku<0.25, "%s: Ku %.3f, model %.3f", (char*)cmd, result.ku, ku);
+  HOST_CHECK(fabs(result.k-k)/k<0.05, "%s: K %.5f, model %.5f", (char*)cmd, result.k, k);
+  printf("%s: Tu %.1f ms (model %.1f), Ku %.3f (model %.3f), K %.5f (model %.5f), factors p %d i %d d %d\n", isLeft ? "left" : "right",
+      result.tu*1000, tu*1000, result.ku, ku, result.k, k, (int)config->pFactor100, (int)config->iFactor100, (int)config->dFactor100);
+  if (isLeft) {
+    config->ffGain100 = config->ffOffset = config->ffAccel100 = 0; /* the rules are for the feedback alone */
+    config->gains.periodUs = 0;
+    SimStop();
+    SpeedStep(1000, 2500, &overshoot, &settleMs, &steadyErr);
+    HOST_CHECK(settleMs<SIM_STEP_MS-300 && fabs(steadyErr)<1, "%s: step settled in %d ms, steady state error %.2f%%", (char*)cmd, settleMs, steadyErr);
+    printf("  rule %-4s: step 1000 to 2500 steps/s, overshoot %4.1f%%, settled in %3d ms, steady state error %+.2f%%\n",
+        RuleName(rule), overshoot, settleMs, steadyErr);
+    SimStop();
+  }
+  return overshoot;
+}
+
+/*! \brief A blocked wheel: the speed PID does not reach the operating point, the tuning has to fail. */
+static void TestBlocked(void) {
+  unsigned char cmd[] = "pid autotune speed L";
+  bool handled = FALSE;
+
+  PID_Init();
+  HOST_MotorInit();
+  HOST_Motors[MOT_MOTOR_LEFT].deadband = 0x10000; /* does not move at all */
+  HOST_CHECK(PID_ParseCommand(cmd, &handled, CLS1_GetStdio())!=ERR_OK && handled, "blocked wheel: tuning did not fail");
+  HOST_CHECK(SimMode==DRV_MODE_STOP, "blocked wheel: drive not stopped");
+  printf("blocked wheel: tuning failed, drive stopped\n");
+  SimStop();
+}
+
+int main(void) {
+  double zn, tl, simc;
+
+  HOST_OnMs = SimOnMs;
+  zn = TestRule(TRUE, PIDR_RULE_ZN);
+  tl = TestRule(TRUE, PIDR_RULE_TL);
+  simc = TestRule(TRUE, PIDR_RULE_SIMC);
+  HOST_CHECK(tl<zn && simc<zn, "overshoot zn %.1f%%, tl %.1f%%, simc %.1f%%", zn, tl, simc);
+  (void)TestRule(FALSE, PIDR_RULE_SIMC);
+  TestBlocked();
+  return HOST_Result("pid_relay_sim");
+}
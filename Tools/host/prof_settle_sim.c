@@ -0,0 +1,214 @@
+/**
+ * \file
+ * \brief Host simulation of the settle time of position moves: setpoint jump with the position PID against
+ * the motion profile (Profile.c), with and without the acceleration feedforward of the speed PID.
+ *
+ * Runs the position control of the drive every millisecond, as the drive interrupt, against the motor
+ * model of HostMotor.h:
+ * - jump: PID_Pos() with the target as setpoint ('profile off'),
+ * - profile: DRV_FollowProfile() of Drive.c, copied below: speed of the trajectory plus the position
+ *   error times DRV_PROFILE_POS_GAIN for the speed PID, with the acceleration of the trajectory for the
+ *   feedforward (ffAccel100). And the same with ffAccel100 set to 0, and with the feedback alone (PID_Speed()
+ *   instead of PID_SpeedAccel(), no feedforward at all).
+ * The move is done with the condition of DRV_HasTurned(): trajectory finished, both wheels below
+ * DRV_TURN_SPEED_LOW and within MATCH_MARGIN of the target. Checks:
+ * - with the profile, 90 and 180 degree turns and a straight move are done, while the jump does not
+ *   settle within MATCH_MARGIN. The profile (PROF_DEFAULT_ACCEL of Profile.c) overshoots by at most
+ *   MATCH_MARGIN, with the 25 ms dead time of the motors, and ends within MATCH_MARGIN,
+ * - PROF_DurationMs() is the time until the trajectory is finished,
+ * - the acceleration feedforward reduces the tracking error and does not delay the move,
+ * - with the feedforward the overshoot and the time until the move is done are not worse than with the
+ *   feedback alone,
+ * - a speed step in speed mode (no acceleration given) does not get a feedforward kick: the first PWM
+ *   after the step is the same with and without ffAccel100.
+ * The times, tracking errors and overshoots are printed. The motor model has no load and no friction
+ * beyond its deadband, so the times on the robot are longer.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o prof_settle_sim prof_settle_sim.c -lm
+ *   ./prof_settle_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_PID_TUNE_DISABLED
+
+#include "Pid.c"
+#include "Profile.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#if !PL_CONFIG_HAS_MOTION_PROFILE
+  #error "prof_settle_sim needs PL_CONFIG_HAS_MOTION_PROFILE"
+#endif
+
+#define SIM_PERIOD_US    1000 /* DRV_ISR_PERIOD_US */
+#define SIM_MS           3000 /* simulated time of a move */
+#define SIM_POS_GAIN     10   /* DRV_PROFILE_POS_GAIN of Drive.c */
+#define SIM_POS_FILTER   3    /* DRV_PROFILE_POS_FILTER of Drive.c */
+#define SIM_MATCH_MARGIN 10   /* MATCH_MARGIN of Drive.c */
+#define SIM_SPEED_LOW    50   /* DRV_TURN_SPEED_LOW of Drive.c */
+
+typedef enum {
+  SIM_JUMP,        /* position PID with the target as setpoint */
+  SIM_PROFILE,     /* motion profile with the acceleration feedforward */
+  SIM_PROFILE_NOFF, /* motion profile, ffAccel100 0 */
+  SIM_PROFILE_FB    /* motion profile, feedback alone */
+} SimKind;
+
+static const char *const SimKindNames[] = {"jump", "profile", "profile, no accel ff", "profile, feedback"};
+
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+
+static int32_t SimPos(bool isLeft) { return (int32_t)floor(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].pos); }
+
+/*! \brief DRV_ProfileSpeed() of Drive.c */
+static int32_t SimProfileSpeed(const PROF_Setpoint *set, int32_t pos) {
+  int32_t error;
+
+  error = set->pos-pos;
+  if (set->speed==0 && error>-SIM_POS_FILTER && error<SIM_POS_FILTER) { /* avoid jitter at the target */
+    return 0;
+  }
+  return set->speed+error*SIM_POS_GAIN;
+}
+
+typedef struct {
+  int doneMs;          /* time until the DRV_HasTurned() condition, -1 if never */
+  int profMs;          /* time until the trajectory is finished */
+  int32_t maxTrackErr; /* largest distance to the trajectory during the move, steps */
+  int32_t overshoot;   /* largest position beyond the target, steps */
+  int32_t finalErr;    /* distance to the target at the end of the simulation, steps */
+} MoveResult;
+
+/*! \brief Distance of a wheel beyond the target, in the direction of the move. */
+static int32_t Beyond(bool isLeft, int32_t to) {
+  return to>=0 ? SimPos(isLeft)-to : to-SimPos(isLeft);
+}
+
+/*! \brief Position move of both wheels from a standstill at 0. */
+static MoveResult Move(SimKind kind, int32_t toL, int32_t toR) {
+  MoveResult res = {-1, 0, 0, 0, 0};
+  PROF_Setpoint left, right;
+  int32_t err;
+  bool moving = FALSE;
+  int t;
+
+  PID_Init();
+  PID_Start();
+  if (kind==SIM_PROFILE_NOFF) {
+    speedLeftConfig.ffAccel100 = speedRightConfig.ffAccel100 = 0;
+  }
+  PROF_Init();
+  HOST_MotorInit();
+  PROF_Start(0, 0, toL, toR);
+  for(t=0;t<SIM_MS;t++) {
+    if (kind==SIM_JUMP) {
+      PID_Pos(SimPos(TRUE), toL, TRUE, SIM_PERIOD_US);
+      PID_Pos(SimPos(FALSE), toR, FALSE, SIM_PERIOD_US);
+    } else {
+      moving = PROF_Next(SIM_PERIOD_US, &left, &right);
+      if (kind==SIM_PROFILE_FB) {
+        PID_Speed(TACHO_GetSpeed(TRUE), SimProfileSpeed(&left, SimPos(TRUE)), TRUE, SIM_PERIOD_US);
+        PID_Speed(TACHO_GetSpeed(FALSE), SimProfileSpeed(&right, SimPos(FALSE)), FALSE, SIM_PERIOD_US);
+      } else {
+        PID_SpeedAccel(TACHO_GetSpeed(TRUE), SimProfileSpeed(&left, SimPos(TRUE)), left.accel, TRUE, SIM_PERIOD_US);
+        PID_SpeedAccel(TACHO_GetSpeed(FALSE), SimProfileSpeed(&right, SimPos(FALSE)), right.accel, FALSE, SIM_PERIOD_US);
+      }
+    }
+    HOST_AdvanceUs(SIM_PERIOD_US);
+    if (moving) {
+      res.profMs = t+2; /* PROF_Next() of the next period is the first one at the target */
+      err = abs(left.pos-SimPos(TRUE));
+      if (abs(right.pos-SimPos(FALSE))>err) {
+        err = abs(right.pos-SimPos(FALSE));
+      }
+      if (err>res.maxTrackErr) {
+        res.maxTrackErr = err;
+      }
+    } else if (res.doneMs<0 && abs(TACHO_GetSpeed(TRUE))<SIM_SPEED_LOW && abs(TACHO_GetSpeed(FALSE))<SIM_SPEED_LOW
+        && abs(toL-SimPos(TRUE))<=SIM_MATCH_MARGIN && abs(toR-SimPos(FALSE))<=SIM_MATCH_MARGIN) {
+      res.doneMs = t+1;
+    }
+    if (Beyond(TRUE, toL)>res.overshoot) {
+      res.overshoot = Beyond(TRUE, toL);
+    }
+    if (Beyond(FALSE, toR)>res.overshoot) {
+      res.overshoot = Beyond(FALSE, toR);
+    }
+  }
+  res.finalErr = abs(toL-SimPos(TRUE));
+  if (abs(toR-SimPos(FALSE))>res.finalErr) {
+    res.finalErr = abs(toR-SimPos(FALSE));
+  }
+  return res;
+}
+
+static void TestMoves(void) {
+  static const struct {
+    const char *name;
+    int32_t toL, toR;
+  } moves[] = {
+    {"90 deg turn", 720, -720}, /* TURN_STEPS_90 of Turn.c */
+    {"180 deg turn", 1440, -1440},
+    {"straight", 2000, 2000},
+    {"curve", 3000, 1500},
+  };
+  MoveResult res[4];
+  char done[24];
+  unsigned int i;
+  int k;
+
+  for(i=0;i<sizeof(moves)/sizeof(moves[0]);i++) {
+    for(k=SIM_JUMP;k<=SIM_PROFILE_FB;k++) {
+      res[k] = Move((SimKind)k, moves[i].toL, moves[i].toR);
+      if (res[k].doneMs<0) {
+        snprintf(done, sizeof(done), "never,");
+      } else {
+        snprintf(done, sizeof(done), "after %4d ms,", res[k].doneMs);
+      }
+      printf("%-12s %-22s done %-14s tracking error %3d steps, overshoot %3d steps, error after %d s %d steps\n",
+          k==SIM_JUMP ? moves[i].name : "", SimKindNames[k], done, (int)res[k].maxTrackErr, (int)res[k].overshoot,
+          SIM_MS/1000, (int)res[k].finalErr);
+    }
+    HOST_CHECK(abs((int)PROF_DurationMs(moves[i].toL, moves[i].toR)-res[SIM_PROFILE].profMs)<=1, "%s: duration %u ms, trajectory finished after %d ms",
+        moves[i].name, (unsigned)PROF_DurationMs(moves[i].toL, moves[i].toR), res[SIM_PROFILE].profMs);
+    HOST_CHECK(res[SIM_PROFILE].doneMs>0 && (res[SIM_JUMP].doneMs<0 || res[SIM_PROFILE].doneMs<res[SIM_JUMP].doneMs),
+        "%s: done after %d ms, %d ms with the jump", moves[i].name, res[SIM_PROFILE].doneMs, res[SIM_JUMP].doneMs);
+    HOST_CHECK(res[SIM_PROFILE].overshoot<=SIM_MATCH_MARGIN && res[SIM_PROFILE].finalErr<=SIM_MATCH_MARGIN,
+        "%s: overshoot %d steps, error %d steps", moves[i].name, (int)res[SIM_PROFILE].overshoot, (int)res[SIM_PROFILE].finalErr);
+    HOST_CHECK(res[SIM_PROFILE].maxTrackErr<res[SIM_PROFILE_NOFF].maxTrackErr && res[SIM_PROFILE].doneMs<=res[SIM_PROFILE_NOFF].doneMs,
+        "%s: tracking error %d steps, done after %d ms, without accel ff %d steps, %d ms", moves[i].name,
+        (int)res[SIM_PROFILE].maxTrackErr, res[SIM_PROFILE].doneMs, (int)res[SIM_PROFILE_NOFF].maxTrackErr, res[SIM_PROFILE_NOFF].doneMs);
+    HOST_CHECK(res[SIM_PROFILE].overshoot<=res[SIM_PROFILE_FB].overshoot && res[SIM_PROFILE].doneMs<=res[SIM_PROFILE_FB].doneMs,
+        "%s: overshoot %d steps, done after %d ms, with the feedback alone %d steps, %d ms", moves[i].name,
+        (int)res[SIM_PROFILE].overshoot, res[SIM_PROFILE].doneMs, (int)res[SIM_PROFILE_FB].overshoot, res[SIM_PROFILE_FB].doneMs);
+  }
+}
+
+/*! \brief Speed step without an acceleration: the output must not depend on ffAccel100. */
+static void TestNoKick(void) {
+  int32_t pwm[2];
+  int i;
+
+  for(i=0;i<2;i++) {
+    PID_Init();
+    PID_Start();
+    if (i==1) {
+      speedLeftConfig.ffAccel100 = 0;
+    }
+    HOST_MotorInit();
+    PID_Speed(0, 0, TRUE, SIM_PERIOD_US);
+    PID_Speed(0, 2000, TRUE, SIM_PERIOD_US); /* step 0 to 2000 steps/s, as DRV_SetSpeed() */
+    pwm[i] = 0xFFFF-HOST_MotorDev[MOT_MOTOR_LEFT].currPWMvalue;
+  }
+  printf("speed step 0 to 2000 steps/s: PWM %d with ffAccel100 %d, %d with 0\n", (int)pwm[0], (int)PID_SPEED_LEFT_FF_ACCEL100, (int)pwm[1]);
+  HOST_CHECK(pwm[0]==pwm[1] && pwm[0]<0xFFFF, "speed step: PWM %d, %d without accel ff", (int)pwm[0], (int)pwm[1]);
+}
+
+int main(void) {
+  HOST_OnMs = HOST_MotorOnMs;
+  TestMoves();
+  TestNoKick();
+  return HOST_Result("prof_settle_sim");
+}
@@ -0,0 +1,136 @@
+/**
+ * \file
+ * \brief Host test of the ambient light compensation of the reflectance measurement (REF_AMBIENT_COMPENSATION).
+ *
+ * Runs REF_MeasureRaw() of Reflectance.c against the simulated sensors of HostRef.h, first with the IR
+ * light only, to get the reference value of each sensor, then with an ambient light offset added on all
+ * sensors. After the ambient filter has settled (ambient frame every REF_AMBIENT_INTERVAL measurements),
+ * the compensated values have to match the reference values:
+ * - ambient light from weak (5 ms discharge) to stronger than the IR light (150 us, which discharges the
+ *   sensors in the dark part of the ambient frame already) is removed, within the quantization of the
+ *   measurement: as the IR light is the difference of two measured intensities, the error grows with the
+ *   ambient to IR light ratio,
+ * - the ambient frames take no longer than the other measurements,
+ * - ambient light going away again decays in the filter, and the values return to the reference.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_ambient_test ref_ambient_test.c -lm
+ *   ./ref_ambient_test
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#if !REF_AMBIENT_COMPENSATION
+  #error "ref_ambient_test needs REF_AMBIENT_COMPENSATION"
+#endif
+
+#define TEST_CALIB_MAX      2600 /* above the timeout: no sensor falls back to the calibrated max */
+#define TEST_SETTLE_MEAS    (40*REF_AMBIENT_INTERVAL) /* measurements until the ambient filter has settled */
+#define TEST_TOL_PERCENT    1    /* allowed error of the compensated value, times the ambient to IR ratio (plus one), plus TEST_TOL_CNT */
+#define TEST_TOL_CNT        4
+
+static const double TestIrUs[] = {150, 300, 600, 900, 1200, 1400, 250, 750}; /* IR light only, per sensor */
+
+static void SetLight(double darkUs) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = TestIrUs[i];
+    HOST_RefDarkUs[i] = darkUs;
+  }
+}
+
+static uint32_t TestMaxUs; /* longest measurement */
+
+/*! \brief Measures n times, like ReflTask, and returns the values of the last measurement. */
+static void Measure(SensorTimeType raw[REF_NOF_SENSORS], int n) {
+  uint64_t start;
+
+  while (n-->0) {
+    start = HOST_TimeNs;
+    REF_MeasureRaw(raw);
+    if ((HOST_TimeNs-start)/1000>TestMaxUs) {
+      TestMaxUs = (uint32_t)((HOST_TimeNs-start)/1000);
+    }
+    HOST_AdvanceUs(1000);
+  }
+}
+
+/*! \brief Discharge time in RefCnt ticks with both IR and ambient light, without compensation. */
+static double CombinedCnt(double irUs, double darkUs) {
+  double us = darkUs>0 ? 1.0/(1.0/irUs+1.0/darkUs) : irUs;
+
+  return us*(RefCnt_CNT_INP_FREQ_U_0/1e6);
+}
+
+/*! \brief Allowed error of a compensated value in RefCnt ticks. */
+static int Tolerance(SensorTimeType ref, double irUs, double darkUs) {
+  double ratio = darkUs>0 ? irUs/darkUs : 0; /* ambient to IR intensity */
+
+  return (int)(ref*TEST_TOL_PERCENT*(1+ratio)/100)+TEST_TOL_CNT;
+}
+
+static void TestAmbient(const SensorTimeType ref[REF_NOF_SENSORS], double darkUs) {
+  SensorTimeType raw[REF_NOF_SENSORS];
+  double maxErr = 0, maxUncomp = 0, err, uncomp;
+  int i, n;
+
+  SetLight(darkUs);
+  Measure(raw, TEST_SETTLE_MEAS);
+  for(n=0;n<REF_AMBIENT_INTERVAL;n++) { /* each measurement, the ambient frame too */
+    Measure(raw, 1);
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      err = 100.0*((double)raw[i]-ref[i])/ref[i];
+      uncomp = 100.0*(CombinedCnt(TestIrUs[i], darkUs)-ref[i])/ref[i];
+      HOST_CHECK(refAmbient[i]!=0, "ambient %.0f us, sensor %d: no ambient light measured", darkUs, i);
+      HOST_CHECK(abs((int)raw[i]-(int)ref[i])<=Tolerance(ref[i], TestIrUs[i], darkUs), "ambient %.0f us, sensor %d: %u instead of %u (%+.1f%%)",
+          darkUs, i, raw[i], ref[i], err);
+      if (fabs(err)>fabs(maxErr)) {
+        maxErr = err;
+      }
+      if (fabs(uncomp)>fabs(maxUncomp)) {
+        maxUncomp = uncomp;
+      }
+    }
+  }
+  printf("ambient discharge %4.0f us: max error %+5.1f%% (uncompensated %+5.1f%%)\n", darkUs, maxErr, maxUncomp);
+}
+
+static void TestAmbientGone(const SensorTimeType ref[REF_NOF_SENSORS]) {
+  SensorTimeType raw[REF_NOF_SENSORS];
+  int i;
+
+  SetLight(150); /* strong ambient light */
+  Measure(raw, TEST_SETTLE_MEAS);
+  SetLight(0);   /* and off again */
+  Measure(raw, TEST_SETTLE_MEAS);
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_CHECK(abs((int)raw[i]-(int)ref[i])<=Tolerance(ref[i], TestIrUs[i], 0), "ambient gone, sensor %d: %u instead of %u", i, raw[i], ref[i]);
+  }
+}
+
+int main(void) {
+  static const double darkUs[] = {5000, 1000, 450, 300, 200, 150};
+  SensorTimeType ref[REF_NOF_SENSORS];
+  unsigned int i;
+
+  HOST_RefInit(0, TEST_CALIB_MAX);
+  SetLight(0);
+  Measure(ref, TEST_SETTLE_MEAS); /* IR light only */
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_CHECK(fabs(ref[i]-CombinedCnt(TestIrUs[i], 0))<=TEST_TOL_CNT, "sensor %d without ambient light: %u instead of %.0f", i, ref[i], CombinedCnt(TestIrUs[i], 0));
+  }
+  for(i=0;i<sizeof(darkUs)/sizeof(darkUs[0]);i++) {
+    TestAmbient(ref, darkUs[i]);
+  }
+  TestAmbientGone(ref);
+  printf("longest measurement %u us\n", (unsigned)TestMaxUs);
+  HOST_CHECK(TestMaxUs<=50+REF_LED_SETTLE_US+REF_SENSOR_TIMEOUT_US+1, "measurement took %u us", (unsigned)TestMaxUs);
+  return HOST_Result("ref_ambient_test");
+}
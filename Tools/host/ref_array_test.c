@@ -0,0 +1,175 @@
+/**
+ * \file
+ * \brief Host golden output test of the reflectance array description (REF_SENSOR_TABLE) for 4, 6 and 8 sensors.
+ *
+ * Built once for each array width with -DREF_NOF_SENSORS=4, 6 or 8 (see run_tests.sh). Checks:
+ * - the measurement: each sensor discharges after its own time on the simulated port of HostRef.h, and has
+ *   to get its value at its position in the array, so the pin wrappers of the table are wired right,
+ * - the line kernels (ReadCalibratedLine(), ReadLineKind(), REF_PeakPosition()) on a set of patterns: a
+ *   single sensor on the line gives its weight, a line swept under the array is found within a quarter of
+ *   the sensor distance, all white is no line and all black a full line,
+ * - the table derived data (pins, masks, weights) and the kernel results of all patterns against the golden
+ *   output in golden/ref_array_<n>.txt, so any change for one of the widths shows up.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -DREF_NOF_SENSORS=8 -o ref_array_test ref_array_test.c -lm
+ *   ./ref_array_test
+ * Write the golden output again after an intended change (and review the diff):
+ *   ./ref_array_test -u
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include <stdarg.h>
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#define ARRAY_CALIB_MIN    200  /* calibration of all sensors, in RefCnt ticks */
+#define ARRAY_CALIB_MAX    2200
+#define ARRAY_GOLDEN_SIZE  (64*1024)
+
+static char ArrayOut[ARRAY_GOLDEN_SIZE]; /* output compared with the golden file */
+static size_t ArrayOutLen = 0;
+
+static void ArrayPrintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void ArrayPrintf(const char *fmt, ...) {
+  va_list args;
+
+  va_start(args, fmt);
+  ArrayOutLen += vsnprintf(ArrayOut+ArrayOutLen, sizeof(ArrayOut)-ArrayOutLen, fmt, args);
+  va_end(args);
+  if (ArrayOutLen>=sizeof(ArrayOut)) {
+    ArrayOutLen = sizeof(ArrayOut)-1;
+  }
+}
+
+static void PrintTable(void) {
+#define ARRAY_PRINT_ENTRY(pos, nr, pin) \
+  ArrayPrintf("sensor %d: IR%d pin %d mask 0x%08x weight %d\n", pos, nr, pin, 1U<<(pin), SensorWeight[pos]);
+  REF_SENSOR_TABLE(ARRAY_PRINT_ENTRY)
+  ArrayPrintf("middle %d, max line value %d, min pos %d, max pos %d\n", REF_MIDDLE_LINE_VALUE, REF_MAX_LINE_VALUE, REF_MIN_POS, REF_MAX_POS);
+}
+
+/*! \brief Each sensor with its own discharge time: the measured values have to be in the same order. */
+static void TestMeasurement(void) {
+  SensorTimeType raw[REF_NOF_SENSORS];
+  uint32_t expected;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = 200+150*i;
+    HOST_RefDarkUs[i] = 0;
+  }
+  for(i=0;i<2*REF_AMBIENT_INTERVAL;i++) { /* with an ambient frame in between */
+    REF_MeasureRaw(raw);
+  }
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    expected = HOST_RefNsToCnt((uint64_t)HOST_RefIrUs[i]*1000);
+    HOST_CHECK(abs((int)raw[i]-(int)expected)<=4, "sensor %d: %u instead of %u, pin wiring of the table?", i, raw[i], (unsigned)expected);
+  }
+}
+
+/*! \brief Runs the kernels on a pattern of calibrated values (0..1000), prints the results and returns the peak position. */
+static int32_t RunPattern(const char *name, const int32_t ideal[REF_NOF_SENSORS], REF_LineKind *kind, int16_t *lineValue) {
+  SensorTimeType raw[REF_NOF_SENSORS], calib[REF_NOF_SENSORS];
+  int32_t pos = 0, peak = 0;
+  bool found;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    raw[i] = ARRAY_CALIB_MIN+(ideal[i]*(ARRAY_CALIB_MAX-ARRAY_CALIB_MIN))/1000;
+  }
+  *lineValue = ReadCalibratedLine(calib, raw, REF_USE_WHITE_LINE);
+  *kind = ReadLineKind(calib);
+  found = REF_PeakPosition(calib, REF_USE_WHITE_LINE, &pos, &peak);
+  ArrayPrintf("%-12s calib", name);
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    ArrayPrintf(" %4u", calib[i]);
+  }
+  ArrayPrintf(" | line %4d kind %-8s peak %s %4d %4d\n", *lineValue, REF_LineKindStr(*kind), found ? "yes" : "no", (int)pos, (int)peak);
+  return found ? pos : -1;
+}
+
+static void TestPatterns(void) {
+  int32_t ideal[REF_NOF_SENSORS], pos, linePos;
+  int16_t lineValue;
+  REF_LineKind kind;
+  char name[16];
+  double d;
+  int i, k;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) { ideal[i] = 0; }
+  (void)RunPattern("white", ideal, &kind, &lineValue);
+  HOST_CHECK(kind==REF_LINE_NONE && lineValue==0, "all white: kind %d, line %d", kind, lineValue);
+  for(i=0;i<REF_NOF_SENSORS;i++) { ideal[i] = 1000; }
+  (void)RunPattern("black", ideal, &kind, &lineValue);
+  HOST_CHECK(kind==REF_LINE_FULL, "all black: kind %d", kind);
+  for(k=0;k<REF_NOF_SENSORS;k++) { /* one sensor on the line */
+    for(i=0;i<REF_NOF_SENSORS;i++) { ideal[i] = i==k ? 1000 : 0; }
+    snprintf(name, sizeof(name), "single %d", k);
+    pos = RunPattern(name, ideal, &kind, &lineValue);
+    HOST_CHECK(lineValue==REF_WEIGHT(k) && pos==REF_WEIGHT(k), "sensor %d alone: line %d, peak %d instead of %d", k, lineValue, (int)pos, REF_WEIGHT(k));
+  }
+  for(k=0;k<2;k++) { /* half of the array */
+    for(i=0;i<REF_NOF_SENSORS;i++) { ideal[i] = (k==0)==(i<REF_NOF_SENSORS/2) ? 1000 : 0; }
+    (void)RunPattern(k==0 ? "half pos 0" : "half last", ideal, &kind, &lineValue);
+  }
+  for(linePos=REF_WEIGHT(0)-500;linePos<=REF_WEIGHT(REF_NOF_SENSORS-1)+500;linePos+=250) { /* line swept under the array */
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      d = (linePos-REF_WEIGHT(i))/700.0;
+      ideal[i] = (int32_t)(900*exp(-d*d));
+    }
+    snprintf(name, sizeof(name), "sweep %d", (int)linePos);
+    pos = RunPattern(name, ideal, &kind, &lineValue);
+    if (linePos>=REF_MIN_POS && linePos<=REF_MAX_POS) {
+      HOST_CHECK(abs((int)(pos-linePos))<=abs(REF_WEIGHT_STEP)/4, "line at %d: peak at %d", (int)linePos, (int)pos);
+    }
+  }
+}
+
+/*! \brief Compares the output with the golden file, or writes it. */
+static void CheckGolden(bool update) {
+  static char golden[ARRAY_GOLDEN_SIZE];
+  char fileName[64];
+  size_t len, line = 1, i;
+  FILE *f;
+
+  snprintf(fileName, sizeof(fileName), "golden/ref_array_%d.txt", REF_NOF_SENSORS);
+  if (update) {
+    f = fopen(fileName, "w");
+    HOST_CHECK(f!=NULL && fwrite(ArrayOut, 1, ArrayOutLen, f)==ArrayOutLen, "cannot write %s", fileName);
+    if (f!=NULL) {
+      fclose(f);
+    }
+    printf("%s written\n", fileName);
+    return;
+  }
+  f = fopen(fileName, "r");
+  if (f==NULL) {
+    HOST_CHECK(FALSE, "no golden output %s, write it with -u", fileName);
+    return;
+  }
+  len = fread(golden, 1, sizeof(golden), f);
+  fclose(f);
+  for(i=0;i<len && i<ArrayOutLen && golden[i]==ArrayOut[i];i++) {
+    if (golden[i]=='\n') {
+      line++;
+    }
+  }
+  HOST_CHECK(i==len && i==ArrayOutLen, "output differs from %s in line %u", fileName, (unsigned)line);
+  if (i==len && i==ArrayOutLen) {
+    printf("%d sensors: output matches %s (%u lines)\n", REF_NOF_SENSORS, fileName, (unsigned)line-1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  HOST_RefInit(ARRAY_CALIB_MIN, ARRAY_CALIB_MAX);
+  PrintTable();
+  TestMeasurement();
+  TestPatterns();
+  CheckGolden(argc==2 && strcmp(argv[1], "-u")==0);
+  return HOST_Result(REF_NOF_SENSORS==4 ? "ref_array_test (4 sensors)" : REF_NOF_SENSORS==6 ? "ref_array_test (6 sensors)" : "ref_array_test (8 sensors)");
+}
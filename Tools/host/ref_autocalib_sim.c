@@ -0,0 +1,173 @@
+/**
+ * \file
+ * \brief Host simulation of the automatic spin calibration of the reflectance array (REF_CalibrateAuto()).
+ *
+ * Runs the state machine of Reflectance.c on the simulated sensors of HostRef.h, with the robot spinning
+ * on the spot over a straight line of black tape. The drive is replaced by a spin model: the wheel speed
+ * set with DRV_SetSpeed() is reached with a first order lag, and the heading follows from the wheel speeds
+ * (TURN_STEPS_90 steps of each wheel for 90 degree). Each sensor sees a blend of its white and black
+ * discharge time, by how much of its spot is over the tape. Checks:
+ * - placed on the line, with different headings and offsets: the calibration converges, every sensor gets
+ *   a min/max close to its white and black discharge time, the robot is stopped and the module is ready,
+ * - placed beside the line: the calibration times out, the robot is stopped, and the previous calibration
+ *   data and state are restored.
+ * The geometry of the array is assumed (typical line follower array), not measured on the robot.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_autocalib_sim ref_autocalib_sim.c -lm
+ *   ./ref_autocalib_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#if !REF_AUTO_CALIB
+  #error "ref_autocalib_sim needs REF_AUTO_CALIB"
+#endif
+
+#define SIM_PI               3.14159265358979
+#define SIM_STEPS_90         720    /* wheel steps for a 90 degree turn on the spot, as TURN_STEPS_90 */
+#define SIM_WHEEL_TAU_MS     30.0   /* lag of the wheel speed */
+#define SIM_ARRAY_FWD_MM     25.0   /* sensor array in front of the wheel axis (assumed) */
+#define SIM_SENSOR_PITCH_MM  9.5    /* distance between two sensors (assumed) */
+#define SIM_SPOT_MM          3.0    /* width of the transition while a sensor spot moves over the tape edge */
+#define SIM_TAPE_MM          19.0   /* width of the line */
+#define SIM_MAX_MS           (REF_AUTO_CALIB_TIMEOUT_MS+1000)
+
+/* drive replacement */
+static DRV_Mode SimMode = DRV_MODE_NONE;
+static int32_t SimCmdLeft, SimCmdRight;  /* speed set with DRV_SetSpeed(), steps/sec */
+static double SimLeft, SimRight;         /* actual wheel speeds, steps/sec */
+static double SimHeading;                /* heading of the robot, rad */
+static double SimOffsetMm;               /* distance of the spin center from the middle of the tape */
+
+uint8_t DRV_SetMode(DRV_Mode mode) { SimMode = mode; return ERR_OK; }
+uint8_t DRV_SetSpeed(int32_t left, int32_t right) { SimCmdLeft = left; SimCmdRight = right; return ERR_OK; }
+
+/* white and black discharge time of each sensor, in microseconds: sensors differ, that is what the calibration is for */
+static double SimWhiteUs(int i) { return 180+20*i; }
+static double SimBlackUs(int i) { return 900+60*i; }
+
+/*! \brief Sets the light on each sensor for the current pose. */
+static void SimSetLight(void) {
+  double x, y, cover;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    x = (i-(REF_NOF_SENSORS-1)/2.0)*SIM_SENSOR_PITCH_MM; /* sideways in the robot */
+    y = SimOffsetMm+SIM_ARRAY_FWD_MM*sin(SimHeading)+x*cos(SimHeading); /* distance from the middle of the tape */
+    cover = (SIM_TAPE_MM/2-fabs(y))/SIM_SPOT_MM+0.5;
+    if (cover<0) {
+      cover = 0;
+    } else if (cover>1) {
+      cover = 1;
+    }
+    HOST_RefIrUs[i] = SimWhiteUs(i)+cover*(SimBlackUs(i)-SimWhiteUs(i));
+  }
+}
+
+/*! \brief Robot model, each millisecond. */
+static void SimOnMs(void) {
+  double cmdLeft = SimMode==DRV_MODE_SPEED ? SimCmdLeft : 0, cmdRight = SimMode==DRV_MODE_SPEED ? SimCmdRight : 0;
+
+  SimLeft += (cmdLeft-SimLeft)/SIM_WHEEL_TAU_MS;
+  SimRight += (cmdRight-SimRight)/SIM_WHEEL_TAU_MS;
+  SimHeading += ((SimLeft-SimRight)/2)/SIM_STEPS_90*(SIM_PI/2)/1000;
+  SimSetLight();
+}
+
+/*! \brief Runs the reflectance task until the auto calibration is over, returns its duration in ms. */
+static uint32_t SimRunCalibration(void) {
+  uint64_t start = HOST_TimeNs;
+
+  HOST_CHECK(REF_CalibrateAuto()==ERR_OK, "calibration not started");
+  for(;;) {
+    REF_StateMachine();
+    if (!(refState==REF_STATE_START_AUTO_CALIBRATION || refState==REF_STATE_AUTO_CALIBRATING || refState==REF_STATE_STOP_CALIBRATION || refAutoCalibRequest)
+        || HOST_TimeNs-start>=SIM_MAX_MS*1000000ULL)
+    {
+      break;
+    }
+    (void)xSemaphoreTake(refWakeSem, pdMS_TO_TICKS(REF_GetPeriodMs(NULL))); /* like ReflTask */
+  }
+  return (uint32_t)((HOST_TimeNs-start)/1000000);
+}
+
+/*! \brief Lets the robot come to a stand still, and returns the maximum wheel speed at the end. */
+static double SimSettle(void) {
+  vTaskDelay(pdMS_TO_TICKS(300));
+  return fmax(fabs(SimLeft), fabs(SimRight));
+}
+
+static void TestOnLine(double headingDeg, double offsetMm) {
+  uint32_t ms;
+  double minErr = 0, maxErr = 0, err;
+  int i;
+
+  SimHeading = headingDeg*SIM_PI/180;
+  SimOffsetMm = offsetMm;
+  SimSetLight();
+  refState = REF_STATE_NOT_CALIBRATED;
+  ms = SimRunCalibration();
+  HOST_CHECK(refState==REF_STATE_READY, "heading %.0f, offset %.0f mm: state %s after %u ms", headingDeg, offsetMm, REF_GetStateString(), ms);
+  HOST_CHECK(SimMode==DRV_MODE_STOP, "heading %.0f, offset %.0f mm: drive not stopped", headingDeg, offsetMm);
+  HOST_CHECK(ms<REF_AUTO_CALIB_TIMEOUT_MS, "heading %.0f, offset %.0f mm: %u ms", headingDeg, offsetMm, ms);
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    double white = HOST_RefNsToCnt(SimWhiteUs(i)*1000), black = HOST_RefNsToCnt(SimBlackUs(i)*1000);
+
+    err = 100.0*(SensorCalibMinMax.minVal[i]-white)/white;
+    HOST_CHECK(fabs(err)<=3, "heading %.0f, offset %.0f mm, sensor %d: min %u for white %.0f", headingDeg, offsetMm, i, SensorCalibMinMax.minVal[i], white);
+    if (fabs(err)>fabs(minErr)) {
+      minErr = err;
+    }
+    err = 100.0*(SensorCalibMinMax.maxVal[i]-black)/black;
+    HOST_CHECK(err>=-3 && err<=2, "heading %.0f, offset %.0f mm, sensor %d: max %u for black %.0f", headingDeg, offsetMm, i, SensorCalibMinMax.maxVal[i], black);
+    if (fabs(err)>fabs(maxErr)) {
+      maxErr = err;
+    }
+    HOST_CHECK(SensorScale.range[i]==SensorCalibMinMax.maxVal[i]-SensorCalibMinMax.minVal[i], "sensor %d: scale not updated", i);
+  }
+  HOST_CHECK(SimSettle()<1, "heading %.0f, offset %.0f mm: robot still moving", headingDeg, offsetMm);
+  printf("heading %3.0f deg, offset %2.0f mm: done in %4u ms, turned %3.0f deg, min error %+.1f%%, max error %+.1f%%\n",
+      headingDeg, offsetMm, ms, SimHeading*180/SIM_PI-headingDeg, minErr, maxErr);
+}
+
+static void TestBesideLine(void) {
+  SensorCalibT prev;
+  uint32_t ms;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) { /* a previous calibration */
+    SensorCalibMinMax.minVal[i] = 100+i;
+    SensorCalibMinMax.maxVal[i] = 2000+i;
+  }
+  REF_UpdateScale();
+  prev = SensorCalibMinMax;
+  SimHeading = 0;
+  SimOffsetMm = 80; /* no sensor reaches the tape */
+  SimSetLight();
+  refState = REF_STATE_READY;
+  ms = SimRunCalibration();
+  HOST_CHECK(refState==REF_STATE_READY, "beside the line: state %s after %u ms", REF_GetStateString(), ms);
+  HOST_CHECK(ms>=REF_AUTO_CALIB_TIMEOUT_MS && ms<REF_AUTO_CALIB_TIMEOUT_MS+50, "beside the line: gave up after %u ms", ms);
+  HOST_CHECK(SimMode==DRV_MODE_STOP, "beside the line: drive not stopped");
+  HOST_CHECK(memcmp(&prev, &SensorCalibMinMax, sizeof(prev))==0, "beside the line: previous calibration not restored");
+  HOST_CHECK(SimSettle()<1, "beside the line: robot still moving");
+  printf("beside the line: gave up after %u ms, previous calibration restored\n", ms);
+}
+
+int main(void) {
+  REF_Init();
+  HOST_RefInit(0, 0);
+  HOST_OnMs = SimOnMs;
+  TestOnLine(0, 0);
+  TestOnLine(90, 0);
+  TestOnLine(45, 10);
+  TestOnLine(180, -20);
+  TestBesideLine();
+  return HOST_Result("ref_autocalib_sim");
+}
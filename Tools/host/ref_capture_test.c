@@ -0,0 +1,172 @@
+/**
+ * \file
+ * \brief Host test of the reflectance measurement with the port interrupt (REF_MEASURE_PORT_ISR).
+ *
+ * Runs REF_MeasureDischarge() and REF_MeasureRaw() of Reflectance.c against the simulated sensor
+ * port of HostRef.h: the port interrupt time stamps the falling edges while the task waits for
+ * its notification. Checks the time stamps, the timeout of sensors which do not discharge (in time),
+ * the fallback to the calibrated max value, the IR LED's switched on during the discharge of an ambient
+ * frame, and that interrupt flags of other port pins are left alone.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_capture_test ref_capture_test.c -lm
+ *   ./ref_capture_test
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+#define REF_MEASURE_METHOD   REF_MEASURE_PORT_ISR
+
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#define TEST_STRAY_PIN  20 /* pin of the sensor port which is not a sensor */
+#define TEST_CALIB_MAX  2500
+
+/*! \brief Expected time stamp of a sensor which discharges after the given time. */
+static SensorTimeType ExpectedCnt(double us) {
+  return (SensorTimeType)HOST_RefNsToCnt((uint64_t)llround(us*1000)+HOST_RefIsrLatencyNs);
+}
+
+static void TestAllDischarge(void) {
+  static const double irUs[] = {120, 260, 260, 610, 905, 1340, 1400, 1450}; /* two sensors with the same edge */
+  SensorTimeType raw[REF_NOF_SENSORS];
+  uint64_t start, elapsedUs;
+  uint32_t nofIrq;
+  bool isTimeout;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = irUs[i];
+    HOST_RefDarkUs[i] = 0;
+  }
+  HOST_RefLedOn = TRUE;
+  nofIrq = HOST_RefNofInterrupts;
+  start = HOST_TimeNs;
+  isTimeout = REF_MeasureDischarge(raw, REF_SENSOR_TIMEOUT_US, 0, NULL);
+  elapsedUs = (HOST_TimeNs-start)/1000;
+  HOST_RefLedOn = FALSE;
+  HOST_CHECK(!isTimeout, "all sensors discharged, but timeout reported");
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_CHECK(raw[i]==ExpectedCnt(irUs[i]), "sensor %d: time stamp %u, expected %u", i, raw[i], ExpectedCnt(irUs[i]));
+  }
+  /* woken up by the interrupt of the last edge, not by the tick timeout */
+  HOST_CHECK(elapsedUs<=50+irUs[REF_NOF_SENSORS-1]+2, "task not woken up by the last edge: %u us", (unsigned)elapsedUs);
+  HOST_CHECK(HOST_RefNofInterrupts-nofIrq==REF_NOF_SENSORS-1, "%u interrupts for %d edges", (unsigned)(HOST_RefNofInterrupts-nofIrq), REF_NOF_SENSORS-1);
+  printf("all discharged: measurement %u us, %u interrupts\n", (unsigned)elapsedUs, (unsigned)(HOST_RefNofInterrupts-nofIrq));
+}
+
+static void TestTimeout(void) {
+  SensorTimeType raw[REF_NOF_SENSORS];
+  uint64_t start, elapsedUs, maxUs = 0;
+  bool isTimeout;
+  int i, phaseUs;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = 300+100*i;
+    HOST_RefDarkUs[i] = 0;
+  }
+  HOST_RefIrUs[1] = 0;    /* never discharges */
+  HOST_RefIrUs[2] = 1700; /* edge after the timeout */
+  for(phaseUs=0;phaseUs<1000;phaseUs+=250) { /* start at different times within the tick period */
+    HOST_AdvanceTo((HOST_TimeNs/1000000+1)*1000000+phaseUs*1000ULL, NULL);
+    HOST_RefLedOn = TRUE;
+    start = HOST_TimeNs;
+    isTimeout = REF_MeasureDischarge(raw, REF_SENSOR_TIMEOUT_US, 0, NULL);
+    elapsedUs = (HOST_TimeNs-start)/1000;
+    HOST_RefLedOn = FALSE;
+    HOST_CHECK(isTimeout, "timeout not reported");
+    HOST_CHECK(raw[1]==MAX_SENSOR_VALUE, "sensor without edge: %u", raw[1]);
+    HOST_CHECK(raw[2]==MAX_SENSOR_VALUE, "sensor with edge after the timeout: %u", raw[2]);
+    for(i=3;i<REF_NOF_SENSORS;i++) {
+      HOST_CHECK(raw[i]==ExpectedCnt(HOST_RefIrUs[i]), "sensor %d: time stamp %u, expected %u", i, raw[i], ExpectedCnt(HOST_RefIrUs[i]));
+    }
+    /* blocked for the full ticks and the rest busy waited: never longer than the timeout, whatever the tick phase */
+    HOST_CHECK(elapsedUs>=50+REF_SENSOR_TIMEOUT_US && elapsedUs<=50+REF_SENSOR_TIMEOUT_US+1, "timeout %d us into the tick after %u us",
+        phaseUs, (unsigned)elapsedUs);
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      HOST_CHECK(HOST_PortIrqc[SensorPinArray[i]]==PORT_PDD_INTERRUPT_DMA_DISABLED, "pin interrupt of sensor %d still enabled", i);
+    }
+    if (elapsedUs>maxUs) {
+      maxUs = elapsedUs;
+    }
+  }
+  printf("timeout: measurement up to %u us (charge 50 us, timeout %u us)\n", (unsigned)maxUs, (unsigned)REF_SENSOR_TIMEOUT_US);
+}
+
+static void TestMeasureRawFallback(void) {
+  SensorTimeType raw[REF_NOF_SENSORS];
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = 400;
+    HOST_RefDarkUs[i] = 0;
+  }
+  HOST_RefIrUs[REF_NOF_SENSORS-1] = 0;
+  refAmbientCnt = 1; /* no ambient frame */
+  REF_MeasureRaw(raw);
+  for(i=0;i<REF_NOF_SENSORS-1;i++) {
+    HOST_CHECK(raw[i]==ExpectedCnt(400), "sensor %d: %u", i, raw[i]);
+  }
+  HOST_CHECK(raw[REF_NOF_SENSORS-1]==TEST_CALIB_MAX, "timed out sensor gets %u instead of the calibrated max value", raw[REF_NOF_SENSORS-1]);
+}
+
+/*! \brief Edge of a sensor in an ambient frame: in the dark up to darkUs, with the IR light after it. */
+static double AmbientFrameUs(double irUs, double ambientUs, double darkUs) {
+  double charge = 1;
+
+  if (ambientUs>0) {
+    if (ambientUs<=darkUs) {
+      return ambientUs;
+    }
+    charge -= darkUs/ambientUs;
+  }
+  return darkUs+charge/((irUs>0?1/irUs:0)+(ambientUs>0?1/ambientUs:0));
+}
+
+static void TestAmbientFrame(void) {
+  static const double irUs[] = {0, 400, 500, 300, 0, 900, 700, 200};
+  static const double ambientUs[] = {100, 0, 1000, 250, 0, 5000, 180, 0};
+  SensorTimeType raw[REF_NOF_SENSORS];
+  RefCnt_TValueType ledOnCnt = 0;
+  uint64_t start, elapsedUs;
+  bool isTimeout;
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_RefIrUs[i] = irUs[i];
+    HOST_RefDarkUs[i] = ambientUs[i];
+  }
+  start = HOST_TimeNs;
+  isTimeout = REF_MeasureDischarge(raw, REF_LED_SETTLE_US+REF_SENSOR_TIMEOUT_US, REF_LED_SETTLE_US, &ledOnCnt);
+  elapsedUs = (HOST_TimeNs-start)/1000;
+  HOST_CHECK(HOST_RefLedOn, "IR LED's not switched on");
+  LED_IR_Off();
+  HOST_CHECK(ledOnCnt>=REF_US_TO_CNT(REF_LED_SETTLE_US) && ledOnCnt<=REF_US_TO_CNT(REF_LED_SETTLE_US)+1, "IR LED's on at %u, expected %u",
+      (unsigned)ledOnCnt, (unsigned)REF_US_TO_CNT(REF_LED_SETTLE_US));
+  HOST_CHECK(isTimeout==(REF_NOF_SENSORS>4), "timeout %d", isTimeout); /* sensor 4 has no light */
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (irUs[i]==0 && ambientUs[i]==0) {
+      HOST_CHECK(raw[i]==MAX_SENSOR_VALUE, "sensor %d without light: %u", i, raw[i]);
+    } else { /* the LED's are switched on within the busy wait loop: up to one counter read late */
+      double us = AmbientFrameUs(irUs[i], ambientUs[i], ledOnCnt*1e6/RefCnt_CNT_INP_FREQ_U_0);
+
+      HOST_CHECK(abs((int)raw[i]-(int)ExpectedCnt(us))<=1, "sensor %d: time stamp %u, expected %u", i, raw[i], ExpectedCnt(us));
+    }
+  }
+  HOST_CHECK(elapsedUs<=50+REF_LED_SETTLE_US+REF_SENSOR_TIMEOUT_US+1, "ambient frame took %u us", (unsigned)elapsedUs);
+  printf("ambient frame: measurement up to %u us, IR LED's on at %u ticks\n", (unsigned)elapsedUs, (unsigned)ledOnCnt);
+}
+
+int main(void) {
+  HOST_RefInit(100, TEST_CALIB_MAX);
+  HOST_PortIsfr = 1U<<TEST_STRAY_PIN; /* pending interrupt of another pin on the port */
+  TestAllDischarge();
+  TestTimeout();
+  TestMeasureRawFallback();
+  TestAmbientFrame();
+  HOST_CHECK(HOST_PortIsfr==(1U<<TEST_STRAY_PIN), "flags of the port 0x%08x, only the flag of pin %d should be left", (unsigned)HOST_PortIsfr, TEST_STRAY_PIN);
+  return HOST_Result("ref_capture_test");
+}
@@ -0,0 +1,266 @@
+/**
+ * \file
+ * \brief Host test and benchmark of the reflectance normalization and line kernel (ReadCalibratedLine()).
+ *
+ * Compares ReadCalibratedLine() of Reflectance.c, which normalizes with the precomputed reciprocals (one
+ * 32x32->64 bit multiply per sensor, no correction step, see REF_UpdateScale()), with the integer division
+ * kernel it replaces (ReadCalibrated() and ReadLine(), copied below unchanged except for the measurement).
+ * The calibrated values and the line value have to be bit identical:
+ * - for all raw values of all calibration ranges up to 2048 ticks,
+ * - for the edge values and random values of each range up to 65535 ticks,
+ * - for random sensor arrays, with dark and white line.
+ * Without a calibration (max not above min) all values are 0, and with no value above the noise level
+ * the line value is 0: the old kernel divided by zero there, so these cases are not compared.
+ * Then both kernels are timed on the host.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_kernel_test ref_kernel_test.c -lm
+ *   ./ref_kernel_test
+ */
+#define _POSIX_C_SOURCE 199309L /* clock_gettime() */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include <time.h>
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#define KERNEL_NOF_ARRAYS    200000 /* random sensor arrays */
+#define KERNEL_BENCH_SAMPLES 4096
+#define KERNEL_BENCH_ROUNDS  400
+
+/* old kernel, from before the reciprocal scales */
+static void Old_ReadCalibrated(SensorTimeType calib[REF_NOF_SENSORS], SensorTimeType raw[REF_NOF_SENSORS]) {
+  int i;
+  int32_t x, denominator;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    x = 0;
+    denominator = SensorCalibMinMax.maxVal[i]-SensorCalibMinMax.minVal[i];
+    if (denominator!=0) {
+      x = (((int32_t)raw[i]-SensorCalibMinMax.minVal[i])*1000)/denominator;
+    }
+    if (x<0) {
+      x = 0;
+    } else if (x>1000) {
+      x = 1000;
+    }
+    calib[i] = x;
+  }
+}
+
+static int Old_ReadLine(SensorTimeType calib[REF_NOF_SENSORS], SensorTimeType raw[REF_NOF_SENSORS], bool white_line) {
+  int i;
+  unsigned long avg; /* this is for the weighted total, which is long */
+  /* before division */
+  unsigned int sum; /* this is for the denominator which is <= 64000 */
+  unsigned int mul; /* multiplication factor, 0, 1000, 2000, 3000 ... */
+  int value;
+
+  (void)raw; /* unused */
+  avg = 0;
+  sum = 0;
+  mul = 1000;
+#if REF_SENSOR1_IS_LEFT
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+#else
+  for(i=REF_NOF_SENSORS-1;i>=0;i--) {
+#endif
+    value = calib[i];
+    if(white_line) {
+      value = 1000-value;
+    }
+    /* only average in values that are above a noise threshold */
+    if(value > REF_MIN_NOISE_VAL) {
+      avg += ((long)value)*mul;
+      sum += value;
+    }
+    mul += 1000;
+  }
+  return avg/sum;
+}
+
+/*! \brief TRUE if the old ReadLine() would divide by zero for these values. */
+static bool Old_NoLine(const SensorTimeType calib[REF_NOF_SENSORS], bool white_line) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if ((white_line ? 1000-calib[i] : calib[i])>REF_MIN_NOISE_VAL) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static void SetCalib(int i, SensorTimeType min, SensorTimeType max) {
+  SensorCalibMinMax.minVal[i] = min;
+  SensorCalibMinMax.maxVal[i] = max;
+}
+
+static unsigned long NofCompared = 0;
+
+/*! \brief Compares the normalization of one raw value by both kernels, on sensor 0. */
+static void CompareValue(SensorTimeType raw) {
+  SensorTimeType rawArr[REF_NOF_SENSORS] = {0}, oldCalib[REF_NOF_SENSORS], newCalib[REF_NOF_SENSORS];
+
+  rawArr[0] = raw;
+  Old_ReadCalibrated(oldCalib, rawArr);
+  (void)ReadCalibratedLine(newCalib, rawArr, FALSE);
+  NofCompared++;
+  if (oldCalib[0]!=newCalib[0]) {
+    HOST_CHECK(FALSE, "min %u max %u raw %u: %u instead of %u", SensorCalibMinMax.minVal[0], SensorCalibMinMax.maxVal[0], raw, newCalib[0], oldCalib[0]);
+  }
+}
+
+static void TestNormalization(void) {
+  uint32_t d, n, min;
+  int k;
+
+  for(d=1;d<=0xffff;d++) {
+    min = d<=0xffff-100 ? 100 : 0xffff-d; /* range starting at a nonzero min */
+    SetCalib(0, min, min+d);
+    REF_UpdateScale();
+    if (d<=2048) { /* all raw values, and some outside of the range */
+      for(n=0;n<=min+d+10 && n<=0xffff;n++) {
+        CompareValue(n);
+      }
+    } else { /* edges, the values just around each step of the result, and random ones */
+      CompareValue(0); CompareValue(min); CompareValue(min+1); CompareValue(min+d-1); CompareValue(min+d);
+      for(k=1;k<1000;k+=37) {
+        n = (uint32_t)((uint64_t)k*d/1000);
+        CompareValue(min+n-1); CompareValue(min+n); CompareValue(min+n+1);
+      }
+      for(k=0;k<16;k++) {
+        CompareValue(min+rand()%d);
+      }
+    }
+    if (HOST_NofFailed>20) {
+      return;
+    }
+  }
+  printf("normalization: %lu values bit identical\n", NofCompared);
+}
+
+static void TestNotCalibrated(void) {
+  SensorTimeType raw[REF_NOF_SENSORS], calib[REF_NOF_SENSORS];
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    SetCalib(i, 500, i%2==0 ? 500 : 200); /* max equal or below min */
+    raw[i] = 100+200*i;
+  }
+  REF_UpdateScale();
+  HOST_CHECK(ReadCalibratedLine(calib, raw, FALSE)==0, "line without calibration");
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    HOST_CHECK(calib[i]==0, "sensor %d without calibration: %u", i, calib[i]);
+  }
+}
+
+/*! \brief Random calibration like on the robot: min around the white value, max around black. */
+static void RandomCalib(void) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    SensorTimeType min = 50+rand()%400;
+
+    SetCalib(i, min, min+1+rand()%(rand()%8==0 ? 65000-min : 3000));
+  }
+  REF_UpdateScale();
+}
+
+/*! \brief Random raw values, mostly within the calibrated range. */
+static void RandomRaw(SensorTimeType raw[REF_NOF_SENSORS]) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    uint32_t min = SensorCalibMinMax.minVal[i], max = SensorCalibMinMax.maxVal[i];
+
+    switch(rand()%8) {
+      case 0: raw[i] = rand()%(min+1); break; /* below min */
+      case 1: raw[i] = max+rand()%(0x10000-max); break; /* above max */
+      case 2: raw[i] = min+rand()%((max-min)/8+1); break; /* white */
+      default: raw[i] = min+rand()%(max-min+1); break;
+    }
+  }
+}
+
+static void TestArrays(void) {
+  SensorTimeType raw[REF_NOF_SENSORS], oldCalib[REF_NOF_SENSORS], newCalib[REF_NOF_SENSORS];
+  unsigned long nofLines = 0, nofNoLine = 0;
+  int n, i, oldLine, newLine;
+  bool white;
+
+  for(n=0;n<KERNEL_NOF_ARRAYS && HOST_NofFailed<20;n++) {
+    if (n%100==0) {
+      RandomCalib();
+    }
+    RandomRaw(raw);
+    white = n%2;
+    Old_ReadCalibrated(oldCalib, raw);
+    newLine = ReadCalibratedLine(newCalib, raw, white);
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      HOST_CHECK(oldCalib[i]==newCalib[i], "array %d sensor %d: %u instead of %u", n, i, newCalib[i], oldCalib[i]);
+    }
+    if (Old_NoLine(oldCalib, white)) {
+      HOST_CHECK(newLine==0, "array %d: line %d without value above the noise level", n, newLine);
+      nofNoLine++;
+    } else {
+      oldLine = Old_ReadLine(oldCalib, raw, white);
+      HOST_CHECK(oldLine==newLine, "array %d (white %d): line %d instead of %d", n, white, newLine, oldLine);
+      nofLines++;
+    }
+  }
+  printf("arrays: %lu line values bit identical, %lu without line\n", nofLines, nofNoLine);
+}
+
+static double NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+static void Bench(void) {
+  static SensorTimeType raw[KERNEL_BENCH_SAMPLES][REF_NOF_SENSORS];
+  SensorTimeType calib[REF_NOF_SENSORS];
+  volatile int sink = 0;
+  double start, oldNs, newNs;
+  int r, n;
+
+  RandomCalib();
+  for(n=0;n<KERNEL_BENCH_SAMPLES;n++) {
+    do {
+      RandomRaw(raw[n]);
+      Old_ReadCalibrated(calib, raw[n]);
+    } while (Old_NoLine(calib, FALSE)); /* the old kernel cannot handle this */
+  }
+  start = NowNs();
+  for(r=0;r<KERNEL_BENCH_ROUNDS;r++) {
+    for(n=0;n<KERNEL_BENCH_SAMPLES;n++) {
+      Old_ReadCalibrated(calib, raw[n]);
+      sink += Old_ReadLine(calib, raw[n], FALSE);
+    }
+  }
+  oldNs = (NowNs()-start)/(KERNEL_BENCH_ROUNDS*KERNEL_BENCH_SAMPLES);
+  start = NowNs();
+  for(r=0;r<KERNEL_BENCH_ROUNDS;r++) {
+    for(n=0;n<KERNEL_BENCH_SAMPLES;n++) {
+      sink += ReadCalibratedLine(calib, raw[n], FALSE);
+    }
+  }
+  newNs = (NowNs()-start)/(KERNEL_BENCH_ROUNDS*KERNEL_BENCH_SAMPLES);
+  printf("host time per sample, %d sensors: division kernel %.1f ns, reciprocal kernel %.1f ns\n", REF_NOF_SENSORS, oldNs, newNs);
+}
+
+int main(void) {
+  srand(4);
+  HOST_RefInit(0, 0);
+  TestNormalization();
+  TestNotCalibrated();
+  TestArrays();
+  Bench();
+  return HOST_Result("ref_kernel_test");
+}
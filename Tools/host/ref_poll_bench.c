@@ -0,0 +1,136 @@
+/**
+ * \file
+ * \brief Host benchmark of the reflectance poll loops (REF_MEASURE_POLL_FCT and REF_MEASURE_POLL_PORT).
+ *
+ * Runs REF_MeasurePoll() of Reflectance.c against a simulated sensor port which is a plain table
+ * lookup: the RefCnt counter advances by one tick per read, and the port register returns the pin
+ * state of the current tick. So the loop body is timed with the cost of the register accesses close
+ * to the ones on the target, and every sensor has to get the time stamp of the tick before its edge.
+ * The benchmark is built once for each method, see run_tests.sh.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -DREF_MEASURE_METHOD=0 -o ref_poll_bench ref_poll_bench.c -lm
+ *   ./ref_poll_bench
+ */
+#define _POSIX_C_SOURCE 199309L /* clock_gettime() */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+#ifndef REF_MEASURE_METHOD
+  #define REF_MEASURE_METHOD   REF_MEASURE_POLL_PORT
+#endif
+
+#include <time.h>
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+
+#if REF_MEASURE_METHOD==REF_MEASURE_PORT_ISR
+  #error "ref_poll_bench is for the poll methods, see ref_capture_test.c for the port interrupt"
+#endif
+
+#define BENCH_NOF_RUNS   4000
+#define BENCH_MAX_TICKS  3000 /* longer than the timeout */
+
+static volatile uint32_t BenchPort[BENCH_MAX_TICKS+2]; /* port data input register at each tick */
+static volatile uint32_t BenchCnt; /* RefCnt counter */
+static uint32_t BenchPinDirOut = 0, BenchPinOutVal = 0;
+
+/* port register and counter */
+uint32_t HOST_PortIsfr = 0;
+uint32_t HOST_PortIrqc[32];
+uint32_t HOST_GpioGetInput(void) { return BenchPort[BenchCnt]; }
+void HOST_GpioSetOutput(uint32_t mask) { BenchPinOutVal |= mask; }
+void HOST_GpioSetDirOutput(uint32_t mask) { BenchPinDirOut |= mask; }
+void HOST_GpioSetDirInput(uint32_t mask) { BenchPinDirOut &= ~mask; }
+LDD_TDeviceData *RefCnt_Init(LDD_TUserData *userData) { (void)userData; return NULL; }
+uint8_t RefCnt_ResetCounter(LDD_TDeviceData *handle) { (void)handle; BenchCnt = 0; return ERR_OK; }
+RefCnt_TValueType RefCnt_GetCounterValue(LDD_TDeviceData *handle) {
+  uint32_t cnt = BenchCnt;
+
+  (void)handle;
+  if (cnt<BENCH_MAX_TICKS) {
+    BenchCnt = cnt+1;
+  }
+  return (RefCnt_TValueType)cnt;
+}
+void LED_IR_On(void) {}
+void LED_IR_Off(void) {}
+
+#define BENCH_IR_FCTS(nr, pin) \
+  void IR##nr##_SetOutput(void) { BenchPinDirOut |= 1U<<(pin); } \
+  void IR##nr##_SetInput(void) { BenchPinDirOut &= ~(1U<<(pin)); } \
+  void IR##nr##_SetVal(void) { BenchPinOutVal |= 1U<<(pin); } \
+  void IR##nr##_ClrVal(void) { BenchPinOutVal &= ~(1U<<(pin)); } \
+  bool IR##nr##_GetVal(void) { return (BenchPort[BenchCnt]>>(pin))&1; }
+#define BENCH_SENSOR_FCTS(pos, nr, pin)  BENCH_IR_FCTS(nr, pin)
+REF_SENSOR_TABLE(BENCH_SENSOR_FCTS)
+
+/*! \brief Fills the port register table: each sensor pin is high until its discharge tick, 0 for never. */
+static void BenchSetDischarge(const uint32_t ticks[REF_NOF_SENSORS]) {
+  static const uint8_t pins[REF_NOF_SENSORS] = {
+#define BENCH_PIN_ENTRY(pos, nr, pin)  [pos] = pin,
+    REF_SENSOR_TABLE(BENCH_PIN_ENTRY)
+  };
+  uint32_t t;
+  int i;
+
+  for(t=0;t<sizeof(BenchPort)/sizeof(BenchPort[0]);t++) {
+    uint32_t val = 0xffffffffU; /* floating pins of the port read as high */
+
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      if (ticks[i]!=0 && t>=ticks[i]) {
+        val &= ~(1U<<pins[i]);
+      }
+    }
+    BenchPort[t] = val;
+  }
+}
+
+static double NowNs(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9+ts.tv_nsec;
+}
+
+int main(void) {
+  uint32_t ticks[REF_NOF_SENSORS];
+  SensorTimeType raw[REF_NOF_SENSORS];
+  const uint32_t timeoutCnt = REF_US_TO_CNT(REF_SENSOR_TIMEOUT_US);
+  unsigned long long loops = 0;
+  double hostNs = 0, start;
+  bool isTimeout;
+  int run, i;
+
+  srand(1);
+  timerHandle = RefCnt_Init(NULL);
+  for(run=0;run<BENCH_NOF_RUNS;run++) {
+    bool hasNoEdge = FALSE;
+
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      ticks[i] = 1+rand()%(timeoutCnt-1);
+    }
+    if (run%10==0) { /* every 10th measurement with a sensor over a gap */
+      ticks[rand()%REF_NOF_SENSORS] = 0;
+      hasNoEdge = TRUE;
+    }
+    BenchSetDischarge(ticks);
+    start = NowNs();
+    isTimeout = REF_MeasurePoll(raw, REF_SENSOR_TIMEOUT_US, 0, NULL);
+    hostNs += NowNs()-start;
+    loops += refPollLoopCnt;
+    HOST_CHECK(isTimeout==hasNoEdge, "run %d: timeout %d", run, isTimeout);
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      if (ticks[i]==0) {
+        HOST_CHECK(raw[i]==MAX_SENSOR_VALUE, "run %d sensor %d: %u without edge", run, i, raw[i]);
+      } else { /* the pins are read after the counter: the time stamp is the tick before the edge */
+        HOST_CHECK(raw[i]==ticks[i]-1, "run %d sensor %d: %u for the edge at %u", run, i, raw[i], (unsigned)ticks[i]);
+      }
+    }
+  }
+  printf("%s, %d sensors: %.1f loops per measurement, %.2f ns per loop on the host\n",
+      REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT ? "POLL_PORT" : "POLL_FCT", REF_NOF_SENSORS,
+      (double)loops/BENCH_NOF_RUNS, hostNs/loops);
+  return HOST_Result(REF_MEASURE_METHOD==REF_MEASURE_POLL_PORT ? "ref_poll_bench (POLL_PORT)" : "ref_poll_bench (POLL_FCT)");
+}
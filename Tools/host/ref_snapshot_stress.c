@@ -0,0 +1,150 @@
+/**
+ * \file
+ * \brief Host stress test of the reflectance snapshot (REF_GetSnapshot()) with concurrent readers.
+ *
+ * A writer thread publishes snapshots with REF_PublishSnapshot() as fast as it can, while reader
+ * threads on the other cores call REF_GetSnapshot(). All fields of a published snapshot are derived
+ * from its sequence number, so a reader can check that each copy is from a single snapshot, and that
+ * the sequence numbers it sees never go back. For comparison, the same readers also copy the buffer
+ * like REF_GetSnapshot() does, but without checking the sequence number again, and count how often
+ * this copy is torn. To get the interleavings on a single core too, the readers yield in the memory
+ * barriers now and then, and the writer while it fills the buffer (in xTaskGetTickCount()).
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -pthread -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_snapshot_stress ref_snapshot_stress.c -lm
+ *   ./ref_snapshot_stress
+ */
+#define _GNU_SOURCE /* pthreads, __thread */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+#define SEQ_MEMORY_BARRIER() StressBarrier()
+#define xTaskGetTickCount    StressGetTickCount /* only for Reflectance.c */
+
+#include <pthread.h>
+#include <sched.h>
+static void StressBarrier(void);
+#include "Reflectance.c"
+#undef xTaskGetTickCount
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#define STRESS_NOF_READERS   3
+#define STRESS_NOF_PUBLISH   300000
+
+static volatile bool StressDone = FALSE;
+
+static pthread_t StressWriterThread;
+static __thread uint32_t StressRandom = 1; /* per thread random state */
+
+/*! \brief Memory barrier, in the readers it gives up the processor every fourth time in average. */
+static void StressBarrier(void) {
+  __sync_synchronize();
+  if (!pthread_equal(pthread_self(), StressWriterThread)) {
+    StressRandom ^= StressRandom<<13; StressRandom ^= StressRandom>>17; StressRandom ^= StressRandom<<5;
+    if ((StressRandom&3)==0) {
+      sched_yield();
+    }
+  }
+}
+
+/*! \brief Called by REF_PublishSnapshot() after it has started to fill the buffer: the writer gives up the processor there. */
+TickType_t StressGetTickCount(void) {
+  sched_yield();
+  return 0;
+}
+
+typedef struct {
+  unsigned long reads, torn, backwards; /* with REF_GetSnapshot() */
+  unsigned long naiveReads, naiveTorn;  /* plain copy of the current buffer */
+} StressResult;
+
+/*! \brief Checks that all fields of a snapshot belong to its sequence number, as published by StressWriter(). */
+static bool StressIsCoherent(const REF_Snapshot *s) {
+  int i;
+
+  for(i=0;i<REF_NOF_SENSORS;i++) {
+    if (s->calib[i]!=(uint16_t)(s->seq+i)) {
+      return FALSE;
+    }
+  }
+  return s->lineValue==(uint16_t)(s->seq&0x7fff) && s->lineKind==(REF_LineKind)(s->seq%REF_NOF_LINES)
+      && s->linePos==(uint16_t)(s->seq&0x7fff) && s->lineVel==(int32_t)s->seq && s->lineConfidence==(uint8_t)s->seq;
+}
+
+static void *StressWriter(void *arg) {
+  SensorTimeType calib[REF_NOF_SENSORS];
+  uint32_t seq;
+  int i;
+
+  (void)arg;
+  StressWriterThread = pthread_self();
+  while (refSnapshotLock.seq<STRESS_NOF_PUBLISH) {
+    seq = refSnapshotLock.seq+1; /* sequence number REF_PublishSnapshot() is going to use */
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      calib[i] = (SensorTimeType)(seq+i);
+    }
+    refTracker.posQ8 = (int32_t)(seq&0x7fff)<<8;
+    refTracker.vel = (int32_t)seq;
+    refTracker.confidence = (uint8_t)seq;
+    REF_PublishSnapshot(calib, (int16_t)(seq&0x7fff), (REF_LineKind)(seq%REF_NOF_LINES));
+  }
+  StressDone = TRUE;
+  return NULL;
+}
+
+static void *StressReader(void *arg) {
+  StressResult *res = arg;
+  REF_Snapshot snapshot;
+  uint32_t seq, lastSeq = 0;
+
+  while (!StressDone) {
+    REF_GetSnapshot(&snapshot);
+    res->reads++;
+    if (snapshot.seq!=0 && !StressIsCoherent(&snapshot)) {
+      res->torn++;
+    }
+    if (snapshot.seq<lastSeq) {
+      res->backwards++;
+    }
+    lastSeq = snapshot.seq;
+    seq = refSnapshotLock.seq; /* same as REF_GetSnapshot(), but without the check of the sequence number */
+    SEQ_MEMORY_BARRIER();
+    snapshot = refSnapshotBuf[seq&1];
+    res->naiveReads++;
+    if (snapshot.seq!=0 && !StressIsCoherent(&snapshot)) {
+      res->naiveTorn++;
+    }
+  }
+  return NULL;
+}
+
+int main(void) {
+  pthread_t writer, readers[STRESS_NOF_READERS];
+  StressResult res[STRESS_NOF_READERS];
+  unsigned long reads = 0, naiveReads = 0, naiveTorn = 0;
+  int i;
+
+  memset(res, 0, sizeof(res));
+  HOST_RefInit(0, 0);
+  StressWriterThread = pthread_self(); /* not a reader */
+  for(i=0;i<STRESS_NOF_READERS;i++) {
+    pthread_create(&readers[i], NULL, StressReader, &res[i]);
+  }
+  pthread_create(&writer, NULL, StressWriter, NULL);
+  pthread_join(writer, NULL);
+  for(i=0;i<STRESS_NOF_READERS;i++) {
+    pthread_join(readers[i], NULL);
+    HOST_CHECK(res[i].torn==0, "reader %d: %lu torn snapshots", i, res[i].torn);
+    HOST_CHECK(res[i].backwards==0, "reader %d: sequence went back %lu times", i, res[i].backwards);
+    reads += res[i].reads;
+    naiveReads += res[i].naiveReads;
+    naiveTorn += res[i].naiveTorn;
+  }
+  HOST_CHECK(reads>STRESS_NOF_READERS, "readers did not run");
+  HOST_CHECK(naiveTorn>0, "no torn copy without the sequence check: the test does not get the interleavings");
+  printf("%u snapshots published, %lu reads by %d readers without torn snapshot\n", (unsigned)refSnapshotLock.seq, reads, STRESS_NOF_READERS);
+  printf("copy without sequence check: %lu of %lu reads torn\n", naiveTorn, naiveReads);
+  return HOST_Result("ref_snapshot_stress");
+}
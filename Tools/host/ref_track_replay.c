@@ -0,0 +1,268 @@
+/**
+ * \file
+ * \brief Host replay of recorded reflectance traces through the line tracker (REF_TrackLine()).
+ *
+ * Reads traces in the CSV format of Tools/ref_decode.py (the decoded 'ref rec dump' of the recorder) and
+ * feeds the calibrated values of each frame, at its recorded time, through REF_TrackLine(), ReadLineKind()
+ * and REF_PublishSnapshot(), like REF_Measure() does. For each frame the published snapshot is checked:
+ * - lineKind is the kind of the sample itself: a gap in the line is reported as REF_LINE_NONE at once,
+ * - lineHeld is set only if the sample has no line, and the line has been seen within REF_TRACK_HOLD_MS,
+ * - while held, the confidence halves with each sample and linePos moves with the held velocity,
+ * - linePos stays within the sensor array.
+ * The recorded line kind has to be the one of the sample too. Traces recorded before lineHeld was
+ * added report a held gap as REF_LINE_STRAIGHT: these frames are counted, not failed.
+ *
+ * Without arguments, the traces in traces/ are replayed. These are synthetic (see TraceGenerate()):
+ * a line weaving under the sensors with gaps of different length, a crossing line and the end of the
+ * line, sampled every 2 ms and 10 ms. Dumps recorded on the robot can be replayed the same way.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o ref_track_replay ref_track_replay.c -lm
+ *   ./ref_track_replay [trace.csv ...]
+ * Generate the synthetic traces again:
+ *   ./ref_track_replay -g traces/ref_track_gaps_2ms.csv 2
+ *   ./ref_track_replay -g traces/ref_track_gaps_10ms.csv 10
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Reflectance.c"
+#include "HostRtos.h"
+#include "HostRef.h"
+#include "HostShell.h"
+
+#define TRACE_MAX_LINE     512
+#define TRACE_CALIB_MIN    300   /* calibration of the synthetic traces, in RefCnt ticks */
+#define TRACE_CALIB_MAX    2500
+
+static const char *const TraceDefaultFiles[] = {
+  "traces/ref_track_gaps_2ms.csv",
+  "traces/ref_track_gaps_10ms.csv",
+};
+
+static const char *const TraceKindNames[REF_NOF_LINES] = {"NONE", "STRAIGHT", "LEFT", "RIGHT", "FULL"};
+
+/*! \brief Line kind from its name in the trace (or its number), -1 if unknown. */
+static int TraceKind(const char *str) {
+  int i;
+
+  for(i=0;i<REF_NOF_LINES;i++) {
+    if (strcmp(str, TraceKindNames[i])==0) {
+      return i;
+    }
+  }
+  return (str[0]>='0' && str[0]<='9') ? atoi(str) : -1;
+}
+
+/*! \brief Splits a CSV line in place, returns the number of fields. */
+static int TraceSplit(char *line, char *fields[], int maxFields) {
+  int n = 0;
+
+  line[strcspn(line, "\r\n")] = '\0';
+  while (n<maxFields) {
+    fields[n++] = line;
+    line = strchr(line, ',');
+    if (line==NULL) {
+      break;
+    }
+    *line++ = '\0';
+  }
+  return n;
+}
+
+typedef struct {
+  unsigned long frames, noLine, held, oldStraight;
+  unsigned long gaps, gapsBridged; /* gaps in the line after it has been seen, and the ones held until the line is back */
+} TraceStats;
+
+/*! \brief Replays one trace, returns FALSE if it cannot be read. */
+static bool TraceReplay(const char *fileName, TraceStats *stats) {
+  char line[TRACE_MAX_LINE], *fields[64];
+  int colTime = -1, colCalib = -1, colKind = -1, nofCols, nofSensors = 0, i, recKind;
+  SensorTimeType calib[REF_NOF_SENSORS];
+  REF_LineKind kind;
+  REF_Snapshot snap, prev;
+  uint32_t timeMs, lastSeenMs = 0;
+  bool seenOnce = FALSE, inGap = FALSE, gapHeld = FALSE, seen;
+  int32_t pos, peak;
+  FILE *f;
+
+  f = fopen(fileName, "r");
+  if (f==NULL || fgets(line, sizeof(line), f)==NULL) {
+    printf("%s: cannot read trace\n", fileName);
+    if (f!=NULL) {
+      fclose(f);
+    }
+    return FALSE;
+  }
+  nofCols = TraceSplit(line, fields, 64);
+  for(i=0;i<nofCols;i++) {
+    if (strcmp(fields[i], "time_ms")==0) {
+      colTime = i;
+    } else if (strcmp(fields[i], "calib0")==0) {
+      colCalib = i;
+    } else if (strncmp(fields[i], "calib", 5)==0) {
+      nofSensors++;
+    } else if (strcmp(fields[i], "line_kind")==0) {
+      colKind = i;
+    }
+  }
+  nofSensors++; /* calib0 */
+  if (colTime<0 || colCalib<0 || colKind<0 || nofSensors!=REF_NOF_SENSORS) {
+    printf("%s: not a trace of %d sensors\n", fileName, REF_NOF_SENSORS);
+    fclose(f);
+    return FALSE;
+  }
+  memset(&refTracker, 0, sizeof(refTracker)); /* each trace starts without a line */
+  memset(&prev, 0, sizeof(prev));
+  while (fgets(line, sizeof(line), f)!=NULL && HOST_NofFailed<20) {
+    if (TraceSplit(line, fields, 64)!=nofCols) {
+      continue;
+    }
+    timeMs = strtoul(fields[colTime], NULL, 10);
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      calib[i] = (SensorTimeType)strtoul(fields[colCalib+i], NULL, 10);
+    }
+    recKind = TraceKind(fields[colKind]);
+    HOST_TimeNs = (uint64_t)timeMs*1000000; /* REF_TrackLine() uses the tick count */
+    kind = ReadLineKind(calib);
+    REF_TrackLine(calib);
+    REF_PublishSnapshot(calib, 0, kind);
+    REF_GetSnapshot(&snap);
+    stats->frames++;
+
+    seen = REF_PeakPosition(calib, REF_USE_WHITE_LINE, &pos, &peak);
+    HOST_CHECK(snap.lineKind==kind, "%s at %u ms: kind %s instead of %s", fileName, timeMs, TraceKindNames[snap.lineKind], TraceKindNames[kind]);
+    if (recKind==REF_LINE_STRAIGHT && kind==REF_LINE_NONE && snap.lineHeld) {
+      stats->oldStraight++; /* recorded by the tracker which reported held gaps as straight line */
+    } else {
+      HOST_CHECK(recKind==(int)kind, "%s at %u ms: recorded kind %s, the sample is %s", fileName, timeMs, fields[colKind], TraceKindNames[kind]);
+    }
+    HOST_CHECK(snap.linePos>=REF_MIN_POS && snap.linePos<=REF_MAX_POS, "%s at %u ms: line position %u", fileName, timeMs, snap.linePos);
+    if (seen) {
+      HOST_CHECK(!snap.lineHeld, "%s at %u ms: held with the line seen", fileName, timeMs);
+      if (inGap && gapHeld) {
+        stats->gapsBridged++;
+      }
+      inGap = FALSE;
+      seenOnce = TRUE;
+      lastSeenMs = timeMs;
+    } else {
+      bool expectHeld = seenOnce && timeMs-lastSeenMs<=REF_TRACK_HOLD_MS;
+
+      stats->noLine++;
+      if (!inGap && seenOnce) {
+        stats->gaps++;
+        inGap = TRUE;
+        gapHeld = TRUE;
+      }
+      HOST_CHECK(snap.lineHeld==expectHeld, "%s at %u ms: held %d, %u ms after the line has been lost", fileName, timeMs, snap.lineHeld, timeMs-lastSeenMs);
+      if (snap.lineHeld) {
+        int32_t dt = timeMs-prev.timestamp, maxMove = (abs(prev.lineVel)*dt)/1000+1;
+
+        stats->held++;
+        HOST_CHECK(snap.lineConfidence==prev.lineConfidence/2, "%s at %u ms: confidence %u while held, before %u", fileName, timeMs, snap.lineConfidence, prev.lineConfidence);
+        HOST_CHECK(snap.lineVel==prev.lineVel, "%s at %u ms: velocity changed while held", fileName, timeMs);
+        HOST_CHECK(abs((int)snap.linePos-(int)prev.linePos)<=maxMove, "%s at %u ms: held position jumps from %u to %u", fileName, timeMs, prev.linePos, snap.linePos);
+      } else {
+        gapHeld = FALSE;
+        HOST_CHECK(snap.lineConfidence==0, "%s at %u ms: confidence %u with the line lost", fileName, timeMs, snap.lineConfidence);
+      }
+    }
+    prev = snap;
+  }
+  fclose(f);
+  return TRUE;
+}
+
+/*! \brief Small deterministic noise for the generator, -amp..amp. */
+static int TraceNoise(int amp) {
+  static uint32_t state = 12345;
+
+  state = state*1103515245U+12345U;
+  return (int)((state>>16)%(2*amp+1))-amp;
+}
+
+/*!
+ * \brief Writes a synthetic trace: the line weaves under the sensors (gaussian profile over the
+ * sensor positions) with gaps of 10 to 120 ms in it, crosses a line and ends. The raw values are
+ * derived from a calibration of TRACE_CALIB_MIN..TRACE_CALIB_MAX, and the calibrated values, line value
+ * and kind are computed by Reflectance.c, as the recorder would store them.
+ */
+static int TraceGenerate(const char *fileName, int periodMs) {
+  static const struct { int startMs, lengthMs; } gaps[] = {
+    {300, 10}, {600, 24}, {900, 40}, {1200, 50}, {1500, 60}, {1800, 120}, {2300, 30},
+  };
+  SensorTimeType raw[REF_NOF_SENSORS], calib[REF_NOF_SENSORS], ideal;
+  int t, i, g, frame = 0, lineValue;
+  double linePos, d;
+  bool gap;
+  FILE *f;
+
+  f = fopen(fileName, "w");
+  if (f==NULL) {
+    printf("cannot write %s\n", fileName);
+    return 1;
+  }
+  fprintf(f, "frame,time_ms");
+  for(i=0;i<REF_NOF_SENSORS;i++) { fprintf(f, ",raw%d", i); }
+  for(i=0;i<REF_NOF_SENSORS;i++) { fprintf(f, ",calib%d", i); }
+  fprintf(f, ",line_value,line_kind\n");
+  for(t=0;t<=3000;t+=periodMs) {
+    linePos = REF_MIDDLE_LINE_VALUE+1800*sin(2*3.14159265358979*t/1300.0);
+    gap = t>=2800; /* end of the line */
+    for(g=0;g<(int)(sizeof(gaps)/sizeof(gaps[0]));g++) {
+      if (t>=gaps[g].startMs && t<gaps[g].startMs+gaps[g].lengthMs) {
+        gap = TRUE;
+      }
+    }
+    for(i=0;i<REF_NOF_SENSORS;i++) {
+      d = (linePos-REF_WEIGHT(i))/700.0;
+      ideal = 25+TraceNoise(15); /* white background, below the noise level */
+      if (t>=2600 && t<2620) {
+        ideal = 950+TraceNoise(30); /* crossing line */
+      } else if (!gap) {
+        ideal += (SensorTimeType)(900*exp(-d*d))+TraceNoise(20);
+      }
+      if (ideal>1000) {
+        ideal = 1000;
+      }
+      raw[i] = TRACE_CALIB_MIN+(ideal*(TRACE_CALIB_MAX-TRACE_CALIB_MIN))/1000;
+    }
+    lineValue = ReadCalibratedLine(calib, raw, REF_USE_WHITE_LINE);
+    fprintf(f, "%d,%d", frame++, t);
+    for(i=0;i<REF_NOF_SENSORS;i++) { fprintf(f, ",%u", raw[i]); }
+    for(i=0;i<REF_NOF_SENSORS;i++) { fprintf(f, ",%u", calib[i]); }
+    fprintf(f, ",%d,%s\n", lineValue, TraceKindNames[ReadLineKind(calib)]);
+  }
+  fclose(f);
+  printf("%s: %d frames, every %d ms\n", fileName, frame, periodMs);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *const *files = TraceDefaultFiles;
+  int nofFiles = sizeof(TraceDefaultFiles)/sizeof(TraceDefaultFiles[0]), i;
+  TraceStats stats;
+
+  HOST_RefInit(TRACE_CALIB_MIN, TRACE_CALIB_MAX);
+  if (argc==4 && strcmp(argv[1], "-g")==0) {
+    return TraceGenerate(argv[2], atoi(argv[3]));
+  }
+  if (argc>1) {
+    files = (const char *const *)&argv[1];
+    nofFiles = argc-1;
+  }
+  for(i=0;i<nofFiles;i++) {
+    memset(&stats, 0, sizeof(stats));
+    HOST_CHECK(TraceReplay(files[i], &stats), "%s not replayed", files[i]);
+    printf("%s: %lu frames, %lu without line, %lu held; %lu gaps, %lu bridged by the hold",
+        files[i], stats.frames, stats.noLine, stats.held, stats.gaps, stats.gapsBridged);
+    if (stats.oldStraight>0) {
+      printf("; %lu held frames recorded as STRAIGHT", stats.oldStraight);
+    }
+    printf("\n");
+  }
+  return HOST_Result("ref_track_replay");
+}
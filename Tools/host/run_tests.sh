@@ -0,0 +1,52 @@
+#!/bin/sh
+# Builds and runs all host tests, see README.txt. Returns nonzero if a test failed.
+cd "$(dirname "$0")" || exit 1
+CC=${CC:-cc}
+CFLAGS="-std=c99 -O2 -Wall -Wno-comment -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources"
+mkdir -p build
+failed=0
+
+# run <name> [extra compiler flags]: builds <name>.c into build/<name> and runs it
+run() {
+  name=$1
+  shift
+  echo "=== $name $*"
+  if ! $CC $CFLAGS "$@" -o "build/$name" "$name.c" -lm; then
+    echo "$name: BUILD FAILED"
+    failed=1
+  elif ! "./build/$name"; then
+    failed=1
+  fi
+}
+
+run ref_capture_test
+run ref_poll_bench -DREF_MEASURE_METHOD=0
+run ref_poll_bench -DREF_MEASURE_METHOD=2
+run ref_snapshot_stress -pthread
+run ref_kernel_test
+run ref_ambient_test
+run ref_autocalib_sim
+run ref_track_replay
+run ref_array_test -DREF_NOF_SENSORS=4
+run ref_array_test -DREF_NOF_SENSORS=6
+run ref_array_test -DREF_NOF_SENSORS=8
+run pid_plant_test
+run pid_relay_sim
+run pid_ff_sim
+run prof_settle_sim
+run pid_line_sweep
+run mmod_rls_sim
+run tacho_edge_test
+run tacho_lag_test
+run drv_mailbox_stress -pthread
+run drv_loop_sim
+run drv_loop_sim -DPL_LOCAL_CONFIG_HAS_DRIVE_ISR_DISABLED
+run odo_track_test
+run turn_sim
+
+if [ $failed -ne 0 ]; then
+  echo "host tests: FAILED"
+else
+  echo "host tests: OK"
+fi
+exit $failed
@@ -0,0 +1,17 @@
+/* Host stand-in for the Processor Expert component CLS1, see ../README.txt */
+#ifndef CLS1_H
+#define CLS1_H
+#include "PE_Types.h"
+typedef void (*CLS1_StdIO_OutErr_FctType)(uint8_t); typedef void (*CLS1_StdIO_In_FctType)(uint8_t*);
+typedef struct { CLS1_StdIO_In_FctType stdIn; CLS1_StdIO_OutErr_FctType stdOut; CLS1_StdIO_OutErr_FctType stdErr; bool (*keyPressed)(void);} CLS1_StdIOType;
+typedef const CLS1_StdIOType CLS1_ConstStdIOType;
+typedef uint8_t (*CLS1_ParseCommandCallback)(const unsigned char*, bool*, const CLS1_StdIOType*);
+#define CLS1_CMD_HELP "help"
+#define CLS1_CMD_STATUS "status"
+#define CLS1_DEFAULT_SHELL_BUFFER_SIZE 48
+void CLS1_SendStr(const unsigned char*, CLS1_StdIO_OutErr_FctType); void CLS1_SendHelpStr(const unsigned char*, const unsigned char*, CLS1_StdIO_OutErr_FctType);
+void CLS1_SendStatusStr(const unsigned char*, const unsigned char*, CLS1_StdIO_OutErr_FctType); void CLS1_SendNum32s(int32_t, CLS1_StdIO_OutErr_FctType); void CLS1_SendNum8u(uint8_t, CLS1_StdIO_OutErr_FctType);
+void CLS1_SendNum16u(uint16_t, CLS1_StdIO_OutErr_FctType); void CLS1_SendNum32u(uint32_t, CLS1_StdIO_OutErr_FctType); void CLS1_SendNum16s(int16_t, CLS1_StdIO_OutErr_FctType);
+CLS1_ConstStdIOType *CLS1_GetStdio(void);
+void CLS1_SendData(const uint8_t*, uint16_t, CLS1_StdIO_OutErr_FctType);
+#endif
@@ -0,0 +1,7 @@
+/* Host stand-in for the Processor Expert component CS1, see ../README.txt */
+#ifndef HOST_CS1_H
+#define HOST_CS1_H
+#define CS1_CriticalVariable() unsigned char cpuSR;
+#define CS1_EnterCritical() do{(void)cpuSR;}while(0)
+#define CS1_ExitCritical()  do{}while(0)
+#endif
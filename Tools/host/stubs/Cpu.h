@@ -0,0 +1,13 @@
+/* Host stand-in for the Processor Expert component Cpu, see ../README.txt */
+#ifndef HOST_CPU_H
+#define HOST_CPU_H
+#include "PE_Types.h"
+#define PEcfg_RoboV2 1
+#define CPU_CORE_CLK_HZ 120000000U
+/* cycle counter of the Cortex-M4 (Quad.c): runs with the simulated time of HostRtos.h */
+extern uint64_t HOST_TimeNs;
+extern uint32_t HOST_DEMCR, HOST_DWT_CTRL;
+#define DEMCR       HOST_DEMCR
+#define DWT_CTRL    HOST_DWT_CTRL
+#define DWT_CYCCNT  ((uint32_t)(HOST_TimeNs*(CPU_CORE_CLK_HZ/1000000)/1000))
+#endif
@@ -0,0 +1,68 @@
+/* Host stand-in for the Processor Expert component FRTOS1, see ../README.txt */
+#ifndef FRTOS1_H
+#define FRTOS1_H
+#include "PE_Types.h"
+typedef uint32_t TickType_t; typedef TickType_t portTickType; typedef long BaseType_t; typedef unsigned long UBaseType_t; typedef BaseType_t portBASE_TYPE;
+typedef void *xSemaphoreHandle; typedef void *SemaphoreHandle_t; typedef void *xQueueHandle; typedef void *QueueHandle_t; typedef void *xTaskHandle; typedef void *TaskHandle_t; typedef uint32_t StackType_t;
+typedef void *EventGroupHandle_t; typedef uint32_t EventBits_t;
+typedef enum {eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite} eNotifyAction;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errQUEUE_EMPTY 0
+#define portMAX_DELAY 0xffffffffUL
+#define portTICK_PERIOD_MS 1
+#define portTICK_RATE_MS 1
+#define configTICK_RATE_HZ 1000
+#define configMINIMAL_STACK_SIZE 200
+#define tskIDLE_PRIORITY 0
+#define pdMS_TO_TICKS(x) (x)
+#define taskENTER_CRITICAL() do{}while(0)
+#define taskEXIT_CRITICAL() do{}while(0)
+#define FRTOS1_taskENTER_CRITICAL() do{}while(0)
+#define FRTOS1_taskEXIT_CRITICAL() do{}while(0)
+#define taskDISABLE_INTERRUPTS() do{}while(0)
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define FRTOS1_taskYIELD() do{}while(0)
+#define taskYIELD() do{}while(0)
+#define vSemaphoreCreateBinary(s) do { (s) = xSemaphoreCreateBinary(); if ((s)!=NULL) { (void)xSemaphoreGive(s); } } while(0)
+BaseType_t xSemaphoreTake(void*, TickType_t); BaseType_t xSemaphoreGive(void*); BaseType_t xSemaphoreGiveFromISR(void*, BaseType_t*);
+#define FRTOS1_xSemaphoreTake xSemaphoreTake
+#define FRTOS1_xSemaphoreGive xSemaphoreGive
+void *xSemaphoreCreateMutex(void); void *xSemaphoreCreateBinary(void);
+void vQueueAddToRegistry(void*, const char*);
+#define FRTOS1_vQueueAddToRegistry vQueueAddToRegistry
+BaseType_t xTaskCreate(void (*)(void*), const char*, uint16_t, void*, UBaseType_t, TaskHandle_t*);
+#define FRTOS1_xTaskCreate xTaskCreate
+void vTaskDelay(TickType_t); void vTaskDelayUntil(TickType_t*, TickType_t);
+#define FRTOS1_vTaskDelay vTaskDelay
+#define FRTOS1_vTaskDelayUntil vTaskDelayUntil
+TickType_t xTaskGetTickCount(void); TickType_t xTaskGetTickCountFromISR(void);
+#define FRTOS1_xTaskGetTickCount xTaskGetTickCount
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t); void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction); BaseType_t xTaskNotifyFromISR(TaskHandle_t, uint32_t, eNotifyAction, BaseType_t*);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t*, TickType_t); BaseType_t xTaskNotifyGive(TaskHandle_t);
+void *xQueueCreate(UBaseType_t, UBaseType_t);
+#define FRTOS1_xQueueCreate xQueueCreate
+BaseType_t xQueueSendToBack(void*, const void*, TickType_t); BaseType_t xQueueReceive(void*, void*, TickType_t); UBaseType_t uxQueueMessagesWaiting(void*); void vQueueDelete(void*);
+#define FRTOS1_xQueueSendToBack xQueueSendToBack
+#define FRTOS1_xQueueReceive xQueueReceive
+#define FRTOS1_uxQueueMessagesWaiting uxQueueMessagesWaiting
+#define FRTOS1_vQueueDelete vQueueDelete
+EventGroupHandle_t xEventGroupCreate(void); EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t); EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t); EventBits_t xEventGroupGetBits(EventGroupHandle_t);
+BaseType_t xEventGroupSetBitsFromISR(EventGroupHandle_t, EventBits_t, BaseType_t*);
+#define FRTOS1_xEventGroupCreate xEventGroupCreate
+#define FRTOS1_xEventGroupSetBits xEventGroupSetBits
+#define FRTOS1_xEventGroupClearBits xEventGroupClearBits
+#define FRTOS1_xEventGroupWaitBits xEventGroupWaitBits
+#define FRTOS1_xEventGroupGetBits xEventGroupGetBits
+void vEventGroupDelete(EventGroupHandle_t);
+#define FRTOS1_vEventGroupDelete vEventGroupDelete
+void vTaskSuspendAll(void); BaseType_t xTaskResumeAll(void);
+#define FRTOS1_vTaskSuspendAll vTaskSuspendAll
+#define FRTOS1_xTaskResumeAll xTaskResumeAll
+void *pvPortMalloc(size_t); void vPortFree(void*);
+#endif
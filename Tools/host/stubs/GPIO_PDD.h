@@ -0,0 +1,15 @@
+/* Host stand-in for the Processor Expert component GPIO_PDD, see ../README.txt */
+#ifndef HOST_GPIO_PDD_H
+#define HOST_GPIO_PDD_H
+#include "PE_Types.h"
+/* the port is simulated by the test program, each register access can take simulated time */
+#define PTD_BASE_PTR  0
+uint32_t HOST_GpioGetInput(void);
+void HOST_GpioSetOutput(uint32_t mask);
+void HOST_GpioSetDirOutput(uint32_t mask);
+void HOST_GpioSetDirInput(uint32_t mask);
+#define GPIO_PDD_GetPortDataInput(base)                 HOST_GpioGetInput()
+#define GPIO_PDD_SetPortDataOutputMask(base, mask)      HOST_GpioSetOutput(mask)
+#define GPIO_PDD_SetPortOutputDirectionMask(base, mask) HOST_GpioSetDirOutput(mask)
+#define GPIO_PDD_SetPortInputDirectionMask(base, mask)  HOST_GpioSetDirInput(mask)
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR1, see ../README.txt */
+#ifndef HOST_IR1_H
+#define HOST_IR1_H
+#include "PE_Types.h"
+void IR1_SetOutput(void);
+void IR1_SetInput(void);
+void IR1_SetVal(void);
+void IR1_ClrVal(void);
+bool IR1_GetVal(void);
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR2, see ../README.txt */
+#ifndef HOST_IR2_H
+#define HOST_IR2_H
+#include "PE_Types.h"
+void IR2_SetOutput(void);
+void IR2_SetInput(void);
+void IR2_SetVal(void);
+void IR2_ClrVal(void);
+bool IR2_GetVal(void);
+#endif
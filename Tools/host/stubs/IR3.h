@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR3, see ../README.txt */
+#ifndef HOST_IR3_H
+#define HOST_IR3_H
+#include "PE_Types.h"
+void IR3_SetOutput(void);
+void IR3_SetInput(void);
+void IR3_SetVal(void);
+void IR3_ClrVal(void);
+bool IR3_GetVal(void);
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR4, see ../README.txt */
+#ifndef HOST_IR4_H
+#define HOST_IR4_H
+#include "PE_Types.h"
+void IR4_SetOutput(void);
+void IR4_SetInput(void);
+void IR4_SetVal(void);
+void IR4_ClrVal(void);
+bool IR4_GetVal(void);
+#endif
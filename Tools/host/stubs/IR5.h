@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR5, see ../README.txt */
+#ifndef HOST_IR5_H
+#define HOST_IR5_H
+#include "PE_Types.h"
+void IR5_SetOutput(void);
+void IR5_SetInput(void);
+void IR5_SetVal(void);
+void IR5_ClrVal(void);
+bool IR5_GetVal(void);
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR6, see ../README.txt */
+#ifndef HOST_IR6_H
+#define HOST_IR6_H
+#include "PE_Types.h"
+void IR6_SetOutput(void);
+void IR6_SetInput(void);
+void IR6_SetVal(void);
+void IR6_ClrVal(void);
+bool IR6_GetVal(void);
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR7, see ../README.txt */
+#ifndef HOST_IR7_H
+#define HOST_IR7_H
+#include "PE_Types.h"
+void IR7_SetOutput(void);
+void IR7_SetInput(void);
+void IR7_SetVal(void);
+void IR7_ClrVal(void);
+bool IR7_GetVal(void);
+#endif
@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component IR8, see ../README.txt */
+#ifndef HOST_IR8_H
+#define HOST_IR8_H
+#include "PE_Types.h"
+void IR8_SetOutput(void);
+void IR8_SetInput(void);
+void IR8_SetVal(void);
+void IR8_ClrVal(void);
+bool IR8_GetVal(void);
+#endif
@@ -0,0 +1,7 @@
+/* Host stand-in for the Processor Expert component LED_IR, see ../README.txt */
+#ifndef HOST_LED_IR_H
+#define HOST_LED_IR_H
+#include "PE_Types.h"
+void LED_IR_On(void);
+void LED_IR_Off(void);
+#endif
@@ -0,0 +1,25 @@
+/* Host stand-in for the Processor Expert component PE_Types, see ../README.txt */
+#ifndef HOST_PE_TYPES_H
+#define HOST_PE_TYPES_H
+#include <stdint.h>
+#include <stddef.h>
+typedef unsigned char bool;
+typedef unsigned char byte;
+typedef unsigned short word;
+typedef unsigned long dword;
+#define TRUE  1
+#define FALSE 0
+#define ERR_OK       0
+#define ERR_FAILED   1
+#define ERR_BUSY     2
+#define ERR_OVERFLOW 3
+#define ERR_RXEMPTY  4
+#define ERR_VALUE    5
+#define ERR_RANGE    6
+#define ERR_NOTAVAIL 7
+typedef void LDD_TDeviceData;
+typedef void *LDD_TUserData;
+#define EnterCritical() do{}while(0)
+#define ExitCritical()  do{}while(0)
+#define PE_ISR(x) void x(void)
+#endif
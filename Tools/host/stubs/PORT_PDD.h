@@ -0,0 +1,15 @@
+/* Host stand-in for the Processor Expert component PORT_PDD, see ../README.txt */
+#ifndef HOST_PORT_PDD_H
+#define HOST_PORT_PDD_H
+#include "PE_Types.h"
+/* the port registers are variables of the test program */
+extern uint32_t HOST_PortIsfr;        /* interrupt status flags of the port */
+extern uint32_t HOST_PortIrqc[32];    /* interrupt configuration of each pin */
+#define PORTD_BASE_PTR                    0
+#define PORT_PDD_INTERRUPT_DMA_DISABLED   0x0U
+#define PORT_PDD_INTERRUPT_ON_FALLING     0xAU
+#define PORT_PDD_GetInterruptFlags(base)                         (HOST_PortIsfr)
+#define PORT_PDD_ClearInterruptFlags(base, mask)                 (HOST_PortIsfr &= ~(uint32_t)(mask))
+#define PORT_PDD_ClearPinInterruptFlag(base, pin)                (HOST_PortIsfr &= ~(1U<<(pin)))
+#define PORT_PDD_SetPinInterruptConfiguration(base, pin, cfg)    (HOST_PortIrqc[pin] = (cfg))
+#endif
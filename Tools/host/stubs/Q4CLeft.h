@@ -0,0 +1,11 @@
+/* Host stand-in for the Processor Expert component Q4CLeft, see ../README.txt */
+#ifndef HOST_Q4CLEFT_H
+#define HOST_Q4CLEFT_H
+#include "PE_Types.h"
+typedef uint32_t Q4CLeft_QuadCntrType;
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void);
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos);
+uint16_t Q4CLeft_NofErrors(void);
+void Q4CLeft_Sample(void);
+uint8_t Q4CLeft_SwapPins(bool swap);
+#endif
@@ -0,0 +1,11 @@
+/* Host stand-in for the Processor Expert component Q4CRight, see ../README.txt */
+#ifndef HOST_Q4CRIGHT_H
+#define HOST_Q4CRIGHT_H
+#include "PE_Types.h"
+typedef uint32_t Q4CRight_QuadCntrType;
+Q4CRight_QuadCntrType Q4CRight_GetPos(void);
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos);
+uint16_t Q4CRight_NofErrors(void);
+void Q4CRight_Sample(void);
+uint8_t Q4CRight_SwapPins(bool swap);
+#endif
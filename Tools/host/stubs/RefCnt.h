@@ -0,0 +1,10 @@
+/* Host stand-in for the Processor Expert component RefCnt, see ../README.txt */
+#ifndef HOST_REFCNT_H
+#define HOST_REFCNT_H
+#include "PE_Types.h"
+typedef uint16_t RefCnt_TValueType;
+#define RefCnt_CNT_INP_FREQ_U_0 1875000UL
+LDD_TDeviceData *RefCnt_Init(LDD_TUserData *userData);
+RefCnt_TValueType RefCnt_GetCounterValue(LDD_TDeviceData *handle);
+uint8_t RefCnt_ResetCounter(LDD_TDeviceData *handle);
+#endif
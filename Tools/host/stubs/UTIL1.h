@@ -0,0 +1,15 @@
+/* Host stand-in for the Processor Expert component UTIL1, see ../README.txt */
+#ifndef UTIL1_H
+#define UTIL1_H
+#include "PE_Types.h"
+void UTIL1_strcpy(uint8_t*, size_t, const unsigned char*); void UTIL1_strcat(uint8_t*, size_t, const unsigned char*);
+void UTIL1_strcatNum16Hex(uint8_t*, size_t, uint16_t); void UTIL1_strcatNum16s(uint8_t*, size_t, int16_t); void UTIL1_strcatNum16u(uint8_t*, size_t, uint16_t);
+void UTIL1_strcatNum32s(uint8_t*, size_t, int32_t); void UTIL1_strcatNum32u(uint8_t*, size_t, uint32_t); void UTIL1_strcatNum8u(uint8_t*, size_t, uint8_t); void UTIL1_strcatNum32Hex(uint8_t*, size_t, uint32_t);
+void UTIL1_Num32sToStr(uint8_t*, size_t, int32_t); void UTIL1_Num32uToStr(uint8_t*, size_t, uint32_t); void UTIL1_Num8uToStr(uint8_t*, size_t, uint8_t); void UTIL1_Num16uToStr(uint8_t*, size_t, uint16_t); void UTIL1_Num16sToStr(uint8_t*, size_t, int16_t);
+void UTIL1_strcatNum32sDotValue100(uint8_t*, size_t, int32_t);
+int UTIL1_strcmp(const char*, const char*); int UTIL1_strncmp(const char*, const char*, size_t); size_t UTIL1_strlen(const char*);
+uint8_t UTIL1_ScanDecimal32uNumber(const unsigned char**, uint32_t*); uint8_t UTIL1_ScanDecimal16uNumber(const unsigned char**, uint16_t*); uint8_t UTIL1_ScanDecimal8uNumber(const unsigned char**, uint8_t*);
+uint8_t UTIL1_ScanDecimal32sNumber(const unsigned char**, int32_t*); uint8_t UTIL1_ScanDecimal16sNumber(const unsigned char**, int16_t*);
+uint8_t UTIL1_xatoi(const unsigned char**, int32_t*);
+void UTIL1_chcat(uint8_t*, size_t, uint8_t);
+#endif
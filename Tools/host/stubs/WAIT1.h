@@ -0,0 +1,8 @@
+/* Host stand-in for the Processor Expert component WAIT1, see ../README.txt */
+#ifndef HOST_WAIT1_H
+#define HOST_WAIT1_H
+#include "PE_Types.h"
+void WAIT1_Waitus(uint16_t us);
+void WAIT1_Waitms(uint16_t ms);
+void WAIT1_WaitOSms(uint16_t ms);
+#endif
@@ -0,0 +1,215 @@
+/**
+ * \file
+ * \brief Host test of the edge timestamps (Quad.c) and the edge based speed measurement (Tacho.c) on synthetic encoder signals.
+ *
+ * The encoders of HostEncoder.h are sampled every 80 us by the simulated QuadInt interrupt, which
+ * timestamps the edges with QUAD_SampleEdges(), and TACHO_Sample() runs every millisecond as from the
+ * tick hook. Checks:
+ * - at a constant speed, each edge is timestamped in the sample after the wheel crossed it, and the speed
+ *   from two edges (steps over the time between them, the M/T method) is within the sampling period: up to
+ *   80 us per edge interval, 8% at 1000 steps/s,
+ * - only samples with a changed counter read the time base and update the edges, the others return early,
+ * - the fraction of a step since the last edge with the reciprocal of the edge interval against the division,
+ * - an encoder sitting on an edge (the counter chatters between two values) gives no edges and no speed,
+ * - a reversal gives an edge in the new direction after two steps back (a single step back is taken as chatter),
+ * - with clean edges and with edge jitter, the speed of TACHO_GetSpeed() at crawl and at cruise speed has
+ *   a lower RMS error than the difference of the counter over 16 ms, the speed measurement before the
+ *   edge timestamps. Both are printed.
+ * The edge jitter is uniform, not measured on the robot encoders.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o tacho_edge_test tacho_edge_test.c -lm
+ *   ./tacho_edge_test
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Quad.c"
+#include "Tacho.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostEncoder.h"
+
+#define EDGE_WINDOW_MS   16  /* position window of the speed measurement before the edge timestamps */
+#define EDGE_JITTER      0.3 /* steps */
+
+/* recorded in the tick hook */
+static int32_t EdgeWindow[EDGE_WINDOW_MS]; /* counter of the last samples, for the window speed */
+static unsigned int EdgeWindowIdx = 0;
+static double EdgeErrTacho, EdgeErrWindow; /* sums of the squared speed errors */
+static int EdgeNofErr = 0;
+static bool EdgeRecordErr = FALSE;
+static uint32_t EdgeStartTime; /* QUAD_GetTime() at the start of a test */
+
+static void EdgeOnMs(void) {
+  int32_t windowSpeed;
+
+  TACHO_Sample();
+  windowSpeed = (HOST_Encoders[0].cnt-EdgeWindow[EdgeWindowIdx])*1000/EDGE_WINDOW_MS; /* oldest sample */
+  EdgeWindow[EdgeWindowIdx] = HOST_Encoders[0].cnt;
+  EdgeWindowIdx = (EdgeWindowIdx+1)%EDGE_WINDOW_MS;
+  if (EdgeRecordErr) {
+    EdgeErrTacho += pow(TACHO_GetSpeed(TRUE)-HOST_Encoders[0].speed, 2);
+    EdgeErrWindow += pow(windowSpeed-HOST_Encoders[0].speed, 2);
+    EdgeNofErr++;
+  }
+}
+
+static void EdgeInit(double pos, double speed, double jitter) {
+  HOST_EncoderInit();
+  HOST_Encoders[0].pos = HOST_Encoders[1].pos = pos;
+  HOST_Encoders[0].speed = HOST_Encoders[1].speed = speed;
+  HOST_Encoders[0].jitter = HOST_Encoders[1].jitter = jitter;
+  HOST_Encoders[0].cnt = HOST_EncoderCount(&HOST_Encoders[0]);
+  HOST_Encoders[1].cnt = HOST_EncoderCount(&HOST_Encoders[1]);
+  QUAD_Init();
+  TACHO_Init();
+  EdgeStartTime = QUAD_GetTime();
+  EdgeRecordErr = FALSE;
+}
+
+/*! \brief Constant speed with clean edges: timestamps and M/T speed from the edges. */
+static void TestTimestamps(double speed) {
+  int32_t pos, lastPos = 0;
+  uint32_t time, lastTime = 0, sampleCycles = (uint32_t)((uint64_t)HOST_ENCODER_PERIOD_NS*QUAD_TIME_HZ/1000000000);
+  double cross, late, mt, maxLate = 0, maxMtErr = 0;
+  int8_t dir;
+  int ms, nofEdges = 0;
+
+  EdgeInit(0.5, speed, 0);
+  QUAD_ResetLoad();
+  for(ms=0;ms<1000;ms++) {
+    vTaskDelay(1);
+    QUAD_GetLastEdge(TRUE, &pos, &time, &dir);
+    if (dir==0 || time==lastTime) {
+      continue;
+    }
+    cross = (pos-0.5)/speed*QUAD_TIME_HZ; /* the wheel started at 0.5 */
+    late = (double)(uint32_t)(time-EdgeStartTime-(uint32_t)cross); /* cycles from the crossing to the timestamp */
+    maxLate = fmax(maxLate, late);
+    HOST_CHECK(dir==1 && late<=sampleCycles, "%.0f steps/s: edge %d timestamped %.0f cycles after the crossing", speed, (int)pos, late);
+    if (lastTime!=0) {
+      mt = (pos-lastPos)*(double)QUAD_TIME_HZ/(uint32_t)(time-lastTime);
+      maxMtErr = fmax(maxMtErr, fabs(mt-speed)/speed);
+      HOST_CHECK(fabs(mt-speed)/speed<=(double)sampleCycles/(uint32_t)(time-lastTime), "%.0f steps/s: M/T speed %.1f", speed, mt);
+    }
+    lastPos = pos;
+    lastTime = time;
+    nofEdges++;
+  }
+  HOST_CHECK(nofEdges>=speed/2, "%.0f steps/s: %d edges read", speed, nofEdges);
+  /* both wheels cross their edges in the same sample */
+  HOST_CHECK(QUAD_nofChanges>=speed-1 && QUAD_nofChanges<=speed+1, "%.0f steps/s: %u samples timestamped", speed, (unsigned)QUAD_nofChanges);
+  printf("%5.0f steps/s: %3d edges read, timestamped up to %.1f us after the crossing, M/T speed error up to %.2f%%, %u of %u samples timestamped\n",
+      speed, nofEdges, maxLate*1e6/QUAD_TIME_HZ, maxMtErr*100, (unsigned)QUAD_nofChanges, (unsigned)QUAD_isrCount);
+}
+
+/*! \brief TACHO_Measure() with the reciprocal of the edge interval against the 64 bit division. */
+static void TestMeasure(void) {
+  static const uint32_t deltas[] = {1, 2, 3, 1000, 40000, 65535, 65536, 1200000, 0x00FFFFFF, 0x7FFFFFFF};
+  TACHO_Observer obs;
+  uint32_t since, exact, dist, maxErr = 0;
+  unsigned int i, j;
+
+  memset(&obs, 0, sizeof(obs));
+  obs.edgePos = 7;
+  for(i=0;i<sizeof(deltas)/sizeof(deltas[0]);i++) {
+    obs.edgeDelta = deltas[i];
+    obs.edgeRecip = 0xFFFFFFFFu/deltas[i];
+    for(j=0;j<=1000;j++) {
+      since = (uint32_t)((uint64_t)(deltas[i]-1)*j/1000);
+      exact = (uint32_t)(((uint64_t)since<<16)/deltas[i]);
+      dist = TACHO_Measure(&obs, 1, since)-(7u<<16);
+      /* the reciprocal is rounded down: the fraction is never too high, and too low by at most 1+delta/65536 */
+      HOST_CHECK(dist<=exact && exact-dist<=1+(deltas[i]>>16), "interval %u, %u since the edge: %u instead of %u",
+          (unsigned)deltas[i], (unsigned)since, (unsigned)dist, (unsigned)exact);
+      if (deltas[i]<=QUAD_TIME_HZ/100 && exact-dist>maxErr) {
+        maxErr = exact-dist;
+      }
+    }
+  }
+  printf("fraction of a step with the reciprocal: up to %u/65536 steps low for intervals up to 10 ms\n", (unsigned)maxErr);
+}
+
+/*! \brief Encoder standing on an edge: the counter chatters, there must be no edges and no speed. */
+static void TestChatter(void) {
+  int32_t pos, maxSpeed = 0;
+  uint32_t time, firstTime;
+  int8_t dir;
+  int ms, nofEdges = 0;
+
+  EdgeInit(10.0, 0, EDGE_JITTER); /* the counter toggles between 9 and 10 */
+  vTaskDelay(5);
+  QUAD_GetLastEdge(TRUE, &pos, &firstTime, &dir);
+  for(ms=0;ms<1000;ms++) {
+    vTaskDelay(1);
+    QUAD_GetLastEdge(TRUE, &pos, &time, &dir);
+    if (time!=firstTime) {
+      nofEdges++;
+      firstTime = time;
+    }
+    if (abs(TACHO_GetSpeed(TRUE))>maxSpeed) {
+      maxSpeed = abs(TACHO_GetSpeed(TRUE));
+    }
+  }
+  HOST_CHECK(nofEdges==0 && maxSpeed<=2, "chatter on an edge: %d edges, speed up to %d steps/s", nofEdges, (int)maxSpeed);
+  printf("chatter on an edge for 1 s: %d edges, speed up to %d steps/s\n", nofEdges, (int)maxSpeed);
+}
+
+/*! \brief Forward, then backward: the direction of the edges follows after two steps back. */
+static void TestReversal(void) {
+  int32_t pos, turnPos;
+  uint32_t time;
+  int8_t dir;
+  int ms;
+
+  EdgeInit(0.5, 200, 0);
+  vTaskDelay(200);
+  turnPos = HOST_Encoders[0].cnt;
+  HOST_Encoders[0].speed = -200;
+  for(ms=0;ms<30;ms++) {
+    vTaskDelay(1);
+    QUAD_GetLastEdge(TRUE, &pos, &time, &dir);
+    if (dir<0) {
+      break;
+    }
+  }
+  HOST_CHECK(dir==-1 && pos==turnPos-2, "reversal at %d: direction %d at %d after %d ms", (int)turnPos, dir, (int)pos, ms);
+  vTaskDelay(100);
+  HOST_CHECK(abs(TACHO_GetSpeed(TRUE)+200)<=4, "after the reversal: %d steps/s", (int)TACHO_GetSpeed(TRUE));
+  printf("reversal: edge direction changed after 2 steps back (%d ms), speed %d steps/s 100 ms later\n", ms, (int)TACHO_GetSpeed(TRUE));
+}
+
+/*! \brief Cruise at a speed, returns the RMS error of TACHO_GetSpeed() and of the 16 ms window. */
+static void TestNoise(double speed, double jitter) {
+  double tacho, window;
+
+  EdgeInit(0.5, speed, jitter);
+  vTaskDelay(500); /* settle */
+  EdgeErrTacho = EdgeErrWindow = 0;
+  EdgeNofErr = 0;
+  EdgeRecordErr = TRUE;
+  vTaskDelay(2000);
+  EdgeRecordErr = FALSE;
+  tacho = sqrt(EdgeErrTacho/EdgeNofErr);
+  window = sqrt(EdgeErrWindow/EdgeNofErr);
+  printf("%5.0f steps/s, jitter %.1f steps: RMS error %5.1f steps/s, %2d ms window %5.1f steps/s\n", speed, jitter, tacho, EDGE_WINDOW_MS, window);
+  HOST_CHECK(tacho<window, "%.0f steps/s, jitter %.1f: RMS error %.1f, window %.1f", speed, jitter, tacho, window);
+}
+
+int main(void) {
+  HOST_OnMs = EdgeOnMs;
+  TestMeasure();
+  TestTimestamps(100);
+  TestTimestamps(1000);
+  TestChatter();
+  TestReversal();
+  TestNoise(25, 0);
+  TestNoise(100, 0);
+  TestNoise(2950, 0);
+  TestNoise(25, EDGE_JITTER);
+  TestNoise(100, EDGE_JITTER);
+  TestNoise(2950, EDGE_JITTER);
+  return HOST_Result("tacho_edge_test");
+}
@@ -0,0 +1,127 @@
+/**
+ * \file
+ * \brief Host test of the lag of the speed observer (Tacho.c) for ramp and step inputs.
+ *
+ * The encoders of HostEncoder.h are sampled every 80 us by the simulated QuadInt interrupt, and
+ * TACHO_Sample() runs every millisecond as from the tick hook. As reference, the speed is also measured
+ * as before the observer: the difference of the counter over a window of 16 samples. Checks:
+ * - on a speed ramp (constant acceleration), the lag of the observer speed (speed error over the
+ *   acceleration) is smaller than the lag of the window, and the observer acceleration matches the ramp,
+ * - on a speed step, the observer speed gets to 90% of the step earlier than the window, and its
+ *   overshoot stays bounded,
+ * - after both, the speed settles to the new speed.
+ * The step is a jump of the wheel speed, which a real wheel can not do: it is the worst case input for the
+ * observer, and shows its overshoot. The lags and rise times are printed.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o tacho_lag_test tacho_lag_test.c -lm
+ *   ./tacho_lag_test
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_DRIVE_DISABLED
+
+#include "Quad.c"
+#include "Tacho.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostEncoder.h"
+
+#define LAG_WINDOW  16 /* samples of the speed measurement before the observer */
+
+static int32_t LagWindow[LAG_WINDOW]; /* counter of the last samples, for the window speed */
+static unsigned int LagWindowIdx = 0;
+static int32_t LagWindowSpeed; /* speed over the window, steps/s */
+
+static void LagOnMs(void) {
+  TACHO_Sample();
+  LagWindowSpeed = (HOST_Encoders[0].cnt-LagWindow[LagWindowIdx])*1000/LAG_WINDOW; /* oldest sample */
+  LagWindow[LagWindowIdx] = HOST_Encoders[0].cnt;
+  LagWindowIdx = (LagWindowIdx+1)%LAG_WINDOW;
+}
+
+/*! \brief Starts both wheels at a speed, and waits until the observer and the window have settled. */
+static void LagInit(double speed) {
+  unsigned int i;
+
+  HOST_EncoderInit();
+  HOST_Encoders[0].pos = HOST_Encoders[1].pos = 0.5;
+  HOST_Encoders[0].speed = HOST_Encoders[1].speed = speed;
+  QUAD_Init();
+  TACHO_Init();
+  for(i=0;i<LAG_WINDOW;i++) {
+    LagWindow[i] = 0;
+  }
+  vTaskDelay(500);
+}
+
+/*! \brief Speed ramp from 'from' with 'accel' for 'ms': lag of the speeds over the second half of the ramp. */
+static void TestRamp(double from, double accel, int ms) {
+  TACHO_State state;
+  double tachoLag = 0, windowLag = 0, accelSum = 0;
+  int t, n = 0;
+
+  LagInit(from);
+  HOST_Encoders[0].accel = HOST_Encoders[1].accel = accel;
+  for(t=0;t<ms;t++) {
+    vTaskDelay(1);
+    if (t>=ms/2) {
+      TACHO_GetState(TRUE, &state);
+      tachoLag += (HOST_Encoders[0].speed-state.speed)/accel;
+      windowLag += (HOST_Encoders[0].speed-LagWindowSpeed)/accel;
+      accelSum += state.accel;
+      n++;
+    }
+  }
+  tachoLag = tachoLag*1000/n; /* ms */
+  windowLag = windowLag*1000/n;
+  accelSum /= n;
+  HOST_Encoders[0].accel = HOST_Encoders[1].accel = 0;
+  printf("ramp %+6.0f steps/s^2 from %4.0f steps/s: lag %5.2f ms, %2d sample window %5.2f ms, acceleration %6.0f steps/s^2\n",
+      accel, from, tachoLag, LAG_WINDOW, windowLag, accelSum);
+  HOST_CHECK(fabs(tachoLag)<fabs(windowLag)/4, "ramp %.0f: lag %.2f ms, window %.2f ms", accel, tachoLag, windowLag);
+  HOST_CHECK(fabs(accelSum-accel)<0.1*fabs(accel), "ramp %.0f: observer acceleration %.0f", accel, accelSum);
+  vTaskDelay(300);
+  HOST_CHECK(abs(TACHO_GetSpeed(TRUE)-(int32_t)lround(HOST_Encoders[0].speed))<=0.02*fabs(HOST_Encoders[0].speed)+2,
+      "ramp %.0f: speed %d after the ramp, wheel %.0f", accel, (int)TACHO_GetSpeed(TRUE), HOST_Encoders[0].speed);
+}
+
+/*! \brief Speed step: time to 90% of the step, overshoot and settling of the observer and of the window. */
+static void TestStep(double from, double to) {
+  double frac, overshoot = 0;
+  int t, tacho90 = -1, window90 = -1, settleMs = 0;
+
+  LagInit(from);
+  HOST_Encoders[0].speed = HOST_Encoders[1].speed = to;
+  for(t=1;t<=300;t++) {
+    vTaskDelay(1);
+    frac = (TACHO_GetSpeed(TRUE)-from)/(to-from);
+    if (tacho90<0 && frac>=0.9) {
+      tacho90 = t;
+    }
+    if (window90<0 && (LagWindowSpeed-from)/(to-from)>=0.9) {
+      window90 = t;
+    }
+    if (100*(frac-1)>overshoot) {
+      overshoot = 100*(frac-1);
+    }
+    if (fabs(frac-1)>0.02) {
+      settleMs = t;
+    }
+  }
+  printf("step %4.0f to %4.0f steps/s: 90%% after %2d ms (%2d sample window %2d ms), overshoot %4.1f%%, within 2%% after %2d ms\n",
+      from, to, tacho90, LAG_WINDOW, window90, overshoot, settleMs);
+  HOST_CHECK(tacho90>0 && tacho90<window90, "step to %.0f: 90%% after %d ms, window %d ms", to, tacho90, window90);
+  HOST_CHECK(overshoot<40 && settleMs<100, "step to %.0f: overshoot %.1f%%, settled after %d ms", to, overshoot, settleMs);
+}
+
+int main(void) {
+  HOST_OnMs = LagOnMs;
+  TestRamp(200, 4000, 400);
+  TestRamp(2500, -4000, 400);
+  TestRamp(100, 1000, 400);
+  TestStep(500, 1500);
+  TestStep(2000, 1000);
+  TestStep(0, 300);
+  return HOST_Result("tacho_lag_test");
+}
@@ -0,0 +1,172 @@
+/**
+ * \file
+ * \brief Host simulation of turns (Turn.c): fixed steps per wheel against the turn to a heading of the odometry.
+ *
+ * Runs Turn.c, Drive.c, Pid.c, Profile.c and Odometry.c against the differential drive of HostMotor.h:
+ * the encoder counters are the wheel positions of the motor model, rounded down to full steps. The control
+ * loop of the drive runs every millisecond as from the TI1 timer interrupt, with the odometry sampled in
+ * it, and the drive task every DRV_PERIOD_MS. TURN_TurnAngle() runs as the calling task: its waits advance
+ * the simulated time. Each turn is done once with 'turn heading off' (TURN_Steps90 steps per 90 degrees,
+ * stop first) and once to the heading (DRV_SetPosHeading(), done at DRV_EVENT_HEADING), from a standstill and
+ * out of driving straight ahead.
+ * The duration is the time in TURN_TurnAngle(). The heading error is from the wheel positions of the
+ * motor model 300 ms after the turn, with the track width the odometry uses. Checks:
+ * - the heading turn is faster than the fixed steps for every turn,
+ * - no turn runs into its timeout, which is from the planned duration of the motion profile (no
+ *   timeout message on the shell),
+ * - its heading error is at most 1 degree (the tolerance of the turn), and the wheels stand still after it:
+ *   the drive keeps the target after the turn,
+ * - from a standstill, the fixed steps end within 1.5 degree too.
+ * The motor model has no wheel slip and no load: turn times on the robot are longer, and slip is
+ * not seen by either method.
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -I stubs -I ../../TEAM_Common -I ../../TEAM_Robot/Sources -o turn_sim turn_sim.c -lm
+ *   ./turn_sim
+ */
+#define PL_LOCAL_CONFIG_HAS_CONFIG_NVM_DISABLED
+#define PL_LOCAL_CONFIG_HAS_BUZZER_DISABLED
+#define PL_LOCAL_CONFIG_HAS_PID_TUNE_DISABLED
+#define PL_LOCAL_CONFIG_HAS_MOTOR_MODEL_DISABLED
+
+#include "Drive.c"
+#include "Pid.c"
+#include "Profile.c"
+#include "Odometry.c"
+#include "Turn.c"
+#include "HostRtos.h"
+#include "HostShell.h"
+#include "HostMotor.h"
+
+#if !PL_CONFIG_HAS_DRIVE_ISR || !TURN_HAS_HEADING
+  #error "turn_sim needs PL_CONFIG_HAS_DRIVE_ISR and the heading turn"
+#endif
+
+#define SIM_PI            3.14159265358979
+#define SIM_SETTLE_MS     300 /* time after the turn to measure the heading */
+#define SIM_TOLERANCE_DEG 1.0 /* TURN_HEADING_TOLERANCE_CDEG */
+
+/* speed and position of the motor model, instead of Tacho.c and the quadrature counters */
+int32_t TACHO_GetSpeed(bool isLeft) { return (int32_t)lround(HOST_Motors[isLeft ? MOT_MOTOR_LEFT : MOT_MOTOR_RIGHT].speed); }
+void TACHO_Sample(void) {}
+static int32_t SimOffset[2]; /* counter minus wheel position, changed by SetPos() */
+Q4CLeft_QuadCntrType Q4CLeft_GetPos(void) { return (Q4CLeft_QuadCntrType)((int32_t)floor(HOST_Motors[MOT_MOTOR_LEFT].pos)+SimOffset[0]); }
+void Q4CLeft_SetPos(Q4CLeft_QuadCntrType pos) { SimOffset[0] = (int32_t)pos-(int32_t)floor(HOST_Motors[MOT_MOTOR_LEFT].pos); }
+Q4CRight_QuadCntrType Q4CRight_GetPos(void) { return (Q4CRight_QuadCntrType)((int32_t)floor(HOST_Motors[MOT_MOTOR_RIGHT].pos)+SimOffset[1]); }
+void Q4CRight_SetPos(Q4CRight_QuadCntrType pos) { SimOffset[1] = (int32_t)pos-(int32_t)floor(HOST_Motors[MOT_MOTOR_RIGHT].pos); }
+uint32_t HOST_DEMCR, HOST_DWT_CTRL; /* see stubs/Cpu.h */
+uint32_t QUAD_GetTime(void) { return DWT_CYCCNT; } /* as Quad.c */
+uint16_t Q4CLeft_NofErrors(void) { return 0; }
+uint16_t Q4CRight_NofErrors(void) { return 0; }
+void MOT_SetSpeedPercent(MOT_MotorDevice *motor, MOT_SpeedPercent percent) { (void)percent; motor->currPWMvalue = 0xFFFF; } /* only used to stop */
+
+static uint64_t SimTaskNextMs; /* next period of the drive task */
+
+/*! \brief Every millisecond: the motors, the timer interrupt with the control loop, and the drive task. */
+static void SimOnMs(void) {
+  HOST_MotorOnMs();
+  DRV_OnTimer();
+  if (HOST_TimeNs/1000000>=SimTaskNextMs) { /* DriveTask() */
+    GetCmd();
+    DRV_HeadingControl();
+    DRV_PublishEvents();
+    SimTaskNextMs += DRV_PERIOD_MS;
+  } else if (HOST_NotifyValue!=0) { /* woken up by the interrupt */
+    HOST_NotifyValue = 0;
+    DRV_HeadingControl();
+    DRV_PublishEvents();
+  }
+}
+
+/*! \brief Heading of the robot from the wheel positions of the motor model, degrees counter clockwise. */
+static double SimHeading(void) {
+  return (HOST_Motors[MOT_MOTOR_RIGHT].pos-HOST_Motors[MOT_MOTOR_LEFT].pos)
+      *(2*SIM_PI*ODO_DEFAULT_RADIUS_UM/ODO_STEPS_PER_REV)/ODO_DEFAULT_TRACK_UM*180/SIM_PI;
+}
+
+typedef struct {
+  int ms;          /* time in TURN_TurnAngle() */
+  double errDeg;   /* heading after settling minus the heading before plus the angle */
+  int32_t speed;   /* largest wheel speed after settling, steps/s */
+  bool isTimeout;  /* timeout message on the shell */
+} TurnResult;
+
+/*!
+ * \brief Turns from a standstill or out of driving straight.
+ * \param angle Angle in degrees, negative is left
+ * \param speed Speed to drive straight before the turn, steps/s, 0 for a standstill
+ * \param useHeading Heading control, or fixed steps
+ */
+static TurnResult SimTurn(int16_t angle, int32_t speed, bool useHeading) {
+  TurnResult res;
+  uint64_t start;
+  double startDeg;
+  unsigned long nofChars;
+
+  HOST_MotorInit();
+  SimOffset[0] = SimOffset[1] = 0;
+  PID_Init();
+  PROF_Init();
+  DRV_Init();
+  ODO_Init();
+  TURN_Init();
+  TURN_UseHeading = useHeading;
+  SimTaskNextMs = HOST_TimeNs/1000000+1;
+  HOST_OnMs = SimOnMs;
+  if (speed!=0) {
+    (void)DRV_SetSpeed(speed, speed);
+    (void)DRV_SetMode(DRV_MODE_SPEED);
+    vTaskDelay(400);
+  } else {
+    (void)DRV_SetMode(DRV_MODE_STOP);
+    vTaskDelay(20);
+  }
+  startDeg = SimHeading();
+  start = HOST_TimeNs;
+  nofChars = HOST_ShellNofChars;
+  TURN_TurnAngle(angle, NULL);
+  res.ms = (int)((HOST_TimeNs-start)/1000000);
+  res.isTimeout = HOST_ShellNofChars!=nofChars;
+  vTaskDelay(SIM_SETTLE_MS);
+  res.errDeg = SimHeading()-startDeg+angle; /* heading is counter clockwise, the angle clockwise */
+  res.speed = abs(TACHO_GetSpeed(TRUE))>abs(TACHO_GetSpeed(FALSE)) ? abs(TACHO_GetSpeed(TRUE)) : abs(TACHO_GetSpeed(FALSE));
+  HOST_OnMs = NULL;
+  DRV_Deinit();
+  return res;
+}
+
+static void TestTurns(void) {
+  static const struct {
+    const char *name;
+    int16_t angle;
+    int32_t speed;
+  } turns[] = {
+    {"90 right", 90, 0},
+    {"45 left", -45, 0},
+    {"180 left", -180, 0},
+    {"130 escape", 130, 0}, /* sumo: turn away from the border */
+    {"270 right", 270, 0},
+    {"90 right at 1500", 90, 1500},
+    {"130 escape at 2500", 130, 2500},
+  };
+  TurnResult steps, heading;
+  unsigned int i;
+
+  printf("%-20s %22s %22s\n", "turn", "fixed steps", "heading");
+  for(i=0;i<sizeof(turns)/sizeof(turns[0]);i++) {
+    steps = SimTurn(turns[i].angle, turns[i].speed, FALSE);
+    heading = SimTurn(turns[i].angle, turns[i].speed, TRUE);
+    printf("%-20s %7d ms %+7.2f deg %7d ms %+7.2f deg\n", turns[i].name, steps.ms, steps.errDeg, heading.ms, heading.errDeg);
+    HOST_CHECK(heading.ms<steps.ms, "%s: %d ms with the heading, %d ms with fixed steps", turns[i].name, heading.ms, steps.ms);
+    HOST_CHECK(!steps.isTimeout && !heading.isTimeout, "%s: timeout with %s", turns[i].name, steps.isTimeout ? "fixed steps" : "the heading");
+    HOST_CHECK(fabs(heading.errDeg)<=SIM_TOLERANCE_DEG && heading.speed<DRV_HEADING_RATE_MAX,
+        "%s: heading error %.2f deg, wheels at %d steps/s after the turn", turns[i].name, heading.errDeg, (int)heading.speed);
+    HOST_CHECK(fabs(steps.errDeg)<=1.5*SIM_TOLERANCE_DEG || turns[i].speed!=0,
+        "%s: heading error %.2f deg with fixed steps", turns[i].name, steps.errDeg);
+  }
+}
+
+int main(void) {
+  TestTurns();
+  return HOST_Result("turn_sim");
+}
@@ -0,0 +1,473 @@
+/**
+ * \file
+ * \brief Motor identification and speed PID synthesis from step response logs.
+ *
+ * Reads the semicolon separated logs of TEAM_Robot/Regler
+ * (Timestamp [us];TACHO_currLeftSpeed;TACHO_currRightSpeed;currSpeedPercent L;currSpeedPercent R),
+ * finds the steps of the motor duty, and fits per wheel a first order plus dead time (FOPDT)
+ * and a second order plus dead time (SOPDT) model by least squares over all steps.
+ * From the models the PID factors are calculated with several tuning rules, and a header
+ * with the pFactor100/iFactor100/dFactor100 values for PID_Init() is written, together with the
+ * speed feedforward (inverse static gain, deadband offset and acceleration term of the FOPDT model).
+ *
+ * Build and run on the host:
+ *   cc -std=c99 -O2 -o motor_ident motor_ident.c -lm
+ *   ./motor_ident -r simc -o ../TEAM_Common/PidSpeedTuning.h ../TEAM_Robot/Regler/motorLeft_stepResponse.csv ../TEAM_Robot/Regler/motorRight_stepResponse.csv
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MI_MAX_SAMPLES    20000
+#define MI_MAX_STEPS      32
+#define MI_PWM_PER_PERCENT (65536.0/100.0) /* same scaling as the motor driver */
+#define MI_BASE_SAMPLES   20    /* samples before a step used for the initial speed */
+#define MI_FIT_WINDOW     1.0   /* seconds after a step used for the fit */
+#define MI_REF_PERIOD_MS  5     /* PID_REF_PERIOD_MS of the firmware */
+
+typedef enum {
+  MI_WHEEL_LEFT,
+  MI_WHEEL_RIGHT,
+  MI_NOF_WHEELS
+} MI_Wheel;
+
+typedef struct {
+  int nofSamples;
+  double t[MI_MAX_SAMPLES];   /* time in seconds */
+  double y[MI_NOF_WHEELS][MI_MAX_SAMPLES]; /* speed in steps/s */
+  double u[MI_NOF_WHEELS][MI_MAX_SAMPLES]; /* duty in PWM units */
+} MI_Log;
+
+typedef struct {
+  const MI_Log *log;
+  MI_Wheel wheel;
+  int start, end; /* samples used for the fit: start is the last sample before the step */
+  double y0;      /* speed before the step */
+  double du;      /* size of the step */
+} MI_Step;
+
+typedef struct {
+  int nofSteps;
+  MI_Step steps[MI_MAX_STEPS];
+} MI_Data;
+
+typedef struct {
+  int order;        /* 1: FOPDT, 2: SOPDT */
+  double k;         /* static gain, steps/s per PWM unit */
+  double tau1, tau2; /* time constants in seconds, tau2 only for SOPDT */
+  double theta;     /* dead time in seconds */
+  double rms;       /* RMS fit error in steps/s */
+} MI_Model;
+
+typedef struct {
+  const char *name;
+  const char *desc;
+  int order; /* model needed */
+} MI_Rule;
+
+static const MI_Rule rules[] = {
+  {"zn",    "Ziegler-Nichols reaction curve PID", 1},
+  {"chr",   "Chien-Hrones-Reswick 0% overshoot PID", 1},
+  {"simc",  "SIMC PI, tc=theta", 1},
+  {"simc2", "SIMC PID on the second order model, tc=theta", 2},
+};
+#define MI_NOF_RULES ((int)(sizeof(rules)/sizeof(rules[0])))
+
+static MI_Log logs[4];
+
+/*!
+ * \brief Reads a step response log.
+ * \return 0 for success
+ */
+static int ReadLog(const char *fileName, MI_Log *log) {
+  FILE *f;
+  char line[256];
+  long time;
+  int speedL, speedR, percentL, percentR;
+
+  f = fopen(fileName, "r");
+  if (f==NULL) {
+    perror(fileName);
+    return -1;
+  }
+  log->nofSamples = 0;
+  while (fgets(line, sizeof(line), f)!=NULL) {
+    if (sscanf(line, "%ld;%d;%d;%d;%d", &time, &speedL, &speedR, &percentL, &percentR)!=5) {
+      continue; /* header or broken line */
+    }
+    if (log->nofSamples==MI_MAX_SAMPLES) {
+      fprintf(stderr, "%s: too many samples, ignoring the rest\n", fileName);
+      break;
+    }
+    log->t[log->nofSamples] = time/1e6;
+    log->y[MI_WHEEL_LEFT][log->nofSamples] = speedL;
+    log->y[MI_WHEEL_RIGHT][log->nofSamples] = speedR;
+    log->u[MI_WHEEL_LEFT][log->nofSamples] = percentL*MI_PWM_PER_PERCENT;
+    log->u[MI_WHEEL_RIGHT][log->nofSamples] = percentR*MI_PWM_PER_PERCENT;
+    log->nofSamples++;
+  }
+  fclose(f);
+  return 0;
+}
+
+/*!
+ * \brief Finds the steps of the duty for a wheel in a log.
+ */
+static void FindSteps(const MI_Log *log, MI_Wheel wheel, MI_Data *data) {
+  const double *u = log->u[wheel], *y = log->y[wheel];
+  int i, j, first;
+  MI_Step *step;
+
+  for(i=1; i<log->nofSamples; i++) {
+    if (u[i]==u[i-1]) {
+      continue;
+    }
+    if (data->nofSteps==MI_MAX_STEPS) {
+      fprintf(stderr, "too many steps, ignoring the rest\n");
+      return;
+    }
+    step = &data->steps[data->nofSteps];
+    step->log = log;
+    step->wheel = wheel;
+    step->start = i-1; /* duty changed after this sample */
+    step->du = u[i]-u[i-1];
+    /* initial speed: average before the step, but not before the previous step */
+    first = i-MI_BASE_SAMPLES;
+    if (first<0) {
+      first = 0;
+    }
+    for(j=i-1; j>first; j--) {
+      if (u[j-1]!=u[j]) {
+        break;
+      }
+    }
+    first = j;
+    step->y0 = 0;
+    for(j=first; j<i; j++) {
+      step->y0 += y[j];
+    }
+    step->y0 /= i-first;
+    /* fit window: until the next step or the window is over */
+    for(j=i; j<log->nofSamples && u[j]==u[i] && log->t[j]-log->t[i-1]<MI_FIT_WINDOW; j++) {
+      /* find end */
+    }
+    step->end = j;
+    data->nofSteps++;
+  }
+}
+
+/*! \brief Normalized step response of the model without gain. */
+static double Response(const MI_Model *m, double t) {
+  t -= m->theta;
+  if (t<=0) {
+    return 0;
+  }
+  if (m->order==1) {
+    return 1-exp(-t/m->tau1);
+  }
+  if (fabs(m->tau1-m->tau2)<1e-6) { /* double pole */
+    return 1-(1+t/m->tau1)*exp(-t/m->tau1);
+  }
+  return 1-(m->tau1*exp(-t/m->tau1)-m->tau2*exp(-t/m->tau2))/(m->tau1-m->tau2);
+}
+
+/*!
+ * \brief Calculates the best gain for the time constants and dead time of the model.
+ * \return Sum of squared errors
+ */
+static double FitGain(const MI_Data *data, MI_Model *m) {
+  double sxy = 0, sxx = 0, syy = 0, x, dy, sse;
+  int i, j, n = 0;
+  const MI_Step *s;
+
+  for(i=0; i<data->nofSteps; i++) {
+    s = &data->steps[i];
+    for(j=s->start; j<s->end; j++) {
+      x = s->du*Response(m, s->log->t[j]-s->log->t[s->start]);
+      dy = s->log->y[s->wheel][j]-s->y0;
+      sxy += x*dy;
+      sxx += x*x;
+      syy += dy*dy;
+      n++;
+    }
+  }
+  if (sxx==0 || n==0) {
+    return INFINITY;
+  }
+  m->k = sxy/sxx;
+  sse = syy-sxy*sxy/sxx; /* residual of the linear least squares for k */
+  m->rms = sqrt((sse>0 ? sse : 0)/n);
+  return sse;
+}
+
+/*!
+ * \brief Fits the model: coarse grid over dead time and time constants, then refinement with a pattern search.
+ */
+static void FitModel(const MI_Data *data, MI_Model *model, int order) {
+  MI_Model m, best;
+  double sse, bestSse = INFINITY, step[3], *p[3], saved;
+  int i, j, k, nofParams, improved;
+
+  memset(&m, 0, sizeof(m));
+  m.order = order;
+  best = m;
+  for(m.theta=0; m.theta<=0.15; m.theta+=0.002) {
+    for(m.tau1=0.002; m.tau1<=0.5; m.tau1*=1.1) {
+      if (order==1) {
+        sse = FitGain(data, &m);
+        if (sse<bestSse) {
+          bestSse = sse;
+          best = m;
+        }
+      } else {
+        for(m.tau2=0.001; m.tau2<=m.tau1; m.tau2*=1.2) {
+          sse = FitGain(data, &m);
+          if (sse<bestSse) {
+            bestSse = sse;
+            best = m;
+          }
+        }
+      }
+    }
+  }
+  m = best;
+  p[0] = &m.theta; p[1] = &m.tau1; p[2] = &m.tau2;
+  nofParams = order==1 ? 2 : 3;
+  for(i=0; i<nofParams; i++) {
+    step[i] = 0.002;
+  }
+  for(k=0; k<200; k++) {
+    improved = 0;
+    for(i=0; i<nofParams; i++) {
+      for(j=-1; j<=1; j+=2) {
+        saved = *p[i];
+        *p[i] += j*step[i];
+        if (*p[i]<0 || (i>0 && *p[i]<1e-4) || (order==2 && m.tau2>m.tau1)) {
+          *p[i] = saved;
+          continue;
+        }
+        sse = FitGain(data, &m);
+        if (sse<bestSse) {
+          bestSse = sse;
+          best = m;
+          improved = 1;
+        } else {
+          *p[i] = saved;
+        }
+      }
+    }
+    if (!improved) {
+      for(i=0; i<nofParams; i++) {
+        step[i] /= 2;
+      }
+      if (step[0]<1e-5) {
+        break;
+      }
+    }
+  }
+  (void)FitGain(data, &best); /* gain and RMS for the final parameters */
+  *model = best;
+}
+
+/*!
+ * \brief Calculates the PID factors of the firmware with a tuning rule.
+ * \return 0 for success
+ */
+static int CalcFactors(const MI_Model *fo, const MI_Model *so, int rule, double refPeriod, long factors[3]) {
+  double kp, ti, td, tc, theta, tis, tds;
+
+  /* the sampled controller adds about half a sample period of dead time */
+  if (rules[rule].order==1) {
+    theta = fo->theta+refPeriod/2;
+  } else {
+    theta = so->theta+refPeriod/2;
+  }
+  if (strcmp(rules[rule].name, "zn")==0) {
+    kp = 1.2*fo->tau1/(fo->k*theta);
+    ti = 2*theta;
+    td = 0.5*theta;
+  } else if (strcmp(rules[rule].name, "chr")==0) {
+    kp = 0.6*fo->tau1/(fo->k*theta);
+    ti = fo->tau1;
+    td = 0.5*theta;
+  } else if (strcmp(rules[rule].name, "simc")==0) {
+    tc = theta;
+    kp = fo->tau1/(fo->k*(tc+theta));
+    ti = fo->tau1<4*(tc+theta) ? fo->tau1 : 4*(tc+theta);
+    td = 0;
+  } else if (strcmp(rules[rule].name, "simc2")==0) {
+    tc = theta;
+    kp = so->tau1/(so->k*(tc+theta));
+    tis = so->tau1<4*(tc+theta) ? so->tau1 : 4*(tc+theta);
+    tds = so->tau2;
+    /* series (cascade) form to the parallel form of the firmware */
+    kp = kp*(1+tds/tis);
+    ti = tis+tds;
+    td = tis*tds/(tis+tds);
+  } else {
+    return -1;
+  }
+  if (kp<=0 || ti<=0) {
+    return -1;
+  }
+  /* factors are per reference period: I part sums the error each sample, D part uses the change per sample */
+  factors[0] = lround(kp*100);
+  factors[1] = lround(kp*refPeriod/ti*100);
+  factors[2] = lround(kp*td/refPeriod*100);
+  return 0;
+}
+
+/*!
+ * \brief Calculates the feedforward from the FOPDT model: u = offset + v/K + tau/K*dv/dt.
+ * The offset is the duty needed beyond the linear model at the speeds before the steps (deadband).
+ * A negative offset does not fit a deadband (the model gain is too low at low speeds): it is reported and 0 is used.
+ */
+static void CalcFeedForward(const char *wheelName, const MI_Data *data, const MI_Model *fo, long ff[3]) {
+  double offset = 0;
+  int i, n = 0;
+  const MI_Step *s;
+
+  for(i=0; i<data->nofSteps; i++) {
+    s = &data->steps[i];
+    if (s->y0>0) { /* wheel was turning before the step */
+      offset += s->log->u[s->wheel][s->start]-s->y0/fo->k;
+      n++;
+    }
+  }
+  if (n>0) {
+    offset /= n;
+  }
+  ff[0] = lround(100/fo->k);
+  if (lround(offset)<0) {
+    fprintf(stderr, "warning: %s feedforward offset is %ld (no deadband in the model), using 0: check the fit or set it by hand\n", wheelName, lround(offset));
+    offset = 0;
+  }
+  ff[1] = lround(offset);
+  ff[2] = lround(fo->tau1*100/fo->k);
+}
+
+static void PrintModel(const char *wheelName, const MI_Model *m) {
+  if (m->order==1) {
+    printf("%s FOPDT: K=%.5f tau=%.1f ms theta=%.1f ms (rms %.0f steps/s)\n",
+        wheelName, m->k, m->tau1*1000, m->theta*1000, m->rms);
+  } else {
+    printf("%s SOPDT: K=%.5f tau1=%.1f ms tau2=%.1f ms theta=%.1f ms (rms %.0f steps/s)\n",
+        wheelName, m->k, m->tau1*1000, m->tau2*1000, m->theta*1000, m->rms);
+  }
+}
+
+static void Usage(const char *prog) {
+  int i;
+
+  fprintf(stderr, "usage: %s [-r rule] [-T periodMs] [-o header.h] log.csv...\n", prog);
+  fprintf(stderr, "  -r rule      tuning rule for the header (default simc):\n");
+  for(i=0; i<MI_NOF_RULES; i++) {
+    fprintf(stderr, "                 %-6s %s\n", rules[i].name, rules[i].desc);
+  }
+  fprintf(stderr, "  -T periodMs  period the factors are given for (default %d, PID_REF_PERIOD_MS)\n", MI_REF_PERIOD_MS);
+  fprintf(stderr, "  -o header.h  write the factors for PID_Init() into the header\n");
+}
+
+int main(int argc, char *argv[]) {
+  static const char *wheelNames[MI_NOF_WHEELS] = {"left", "right"};
+  static const char *macroNames[MI_NOF_WHEELS] = {"LEFT", "RIGHT"};
+  const char *outName = NULL;
+  int i, w, r, rule = -1, nofLogs = 0, periodMs = MI_REF_PERIOD_MS;
+  static MI_Data data[MI_NOF_WHEELS];
+  MI_Model fo[MI_NOF_WHEELS], so[MI_NOF_WHEELS];
+  long factors[MI_NOF_WHEELS][3], ff[MI_NOF_WHEELS][3];
+  int valid[MI_NOF_WHEELS];
+  FILE *out;
+
+  for(i=1; i<argc; i++) {
+    if (strcmp(argv[i], "-r")==0 && i+1<argc) {
+      i++;
+      for(rule=0; rule<MI_NOF_RULES; rule++) {
+        if (strcmp(argv[i], rules[rule].name)==0) {
+          break;
+        }
+      }
+      if (rule==MI_NOF_RULES) {
+        Usage(argv[0]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-T")==0 && i+1<argc) {
+      periodMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o")==0 && i+1<argc) {
+      outName = argv[++i];
+    } else if (argv[i][0]=='-' || nofLogs==(int)(sizeof(logs)/sizeof(logs[0]))) {
+      Usage(argv[0]);
+      return 1;
+    } else {
+      if (ReadLog(argv[i], &logs[nofLogs])!=0) {
+        return 1;
+      }
+      for(w=0; w<MI_NOF_WHEELS; w++) {
+        FindSteps(&logs[nofLogs], (MI_Wheel)w, &data[w]);
+      }
+      nofLogs++;
+    }
+  }
+  if (nofLogs==0 || periodMs<=0) {
+    Usage(argv[0]);
+    return 1;
+  }
+  if (rule<0) {
+    rule = 2; /* simc */
+  }
+  for(w=0; w<MI_NOF_WHEELS; w++) {
+    valid[w] = 0;
+    if (data[w].nofSteps==0) {
+      printf("%s: no steps found\n", wheelNames[w]);
+      continue;
+    }
+    printf("%s: %d steps\n", wheelNames[w], data[w].nofSteps);
+    FitModel(&data[w], &fo[w], 1);
+    FitModel(&data[w], &so[w], 2);
+    PrintModel(wheelNames[w], &fo[w]);
+    PrintModel(wheelNames[w], &so[w]);
+    CalcFeedForward(wheelNames[w], &data[w], &fo[w], ff[w]);
+    printf("  ff     g: %ld o: %ld a: %ld\n", ff[w][0], ff[w][1], ff[w][2]);
+    for(r=0; r<MI_NOF_RULES; r++) {
+      if (CalcFactors(&fo[w], &so[w], r, periodMs/1000.0, factors[w])==0) {
+        printf("  %-6s p: %ld i: %ld d: %ld\n", rules[r].name, factors[w][0], factors[w][1], factors[w][2]);
+      } else {
+        printf("  %-6s not applicable\n", rules[r].name);
+      }
+    }
+    valid[w] = CalcFactors(&fo[w], &so[w], rule, periodMs/1000.0, factors[w])==0;
+  }
+  if (outName==NULL) {
+    return 0;
+  }
+  if (!valid[MI_WHEEL_LEFT] || !valid[MI_WHEEL_RIGHT]) {
+    fprintf(stderr, "need valid factors for both wheels to write %s\n", outName);
+    return 1;
+  }
+  out = fopen(outName, "w");
+  if (out==NULL) {
+    perror(outName);
+    return 1;
+  }
+  fprintf(out, "/**\n * \\file\n * \\brief Speed PID factors from the motor identification.\n *\n");
+  fprintf(out, " * Generated by Tools/motor_ident with rule '%s' (%s) for a %d ms period, do not edit.\n", rules[rule].name, rules[rule].desc, periodMs);
+  for(w=0; w<MI_NOF_WHEELS; w++) {
+    fprintf(out, " * %s: K=%.5f tau=%.1f ms theta=%.1f ms, tau1=%.1f ms tau2=%.1f ms theta=%.1f ms\n", wheelNames[w],
+        fo[w].k, fo[w].tau1*1000, fo[w].theta*1000, so[w].tau1*1000, so[w].tau2*1000, so[w].theta*1000);
+  }
+  fprintf(out, " */\n\n#ifndef PIDSPEEDTUNING_H_\n#define PIDSPEEDTUNING_H_\n\n");
+  for(w=0; w<MI_NOF_WHEELS; w++) {
+    fprintf(out, "#define PID_SPEED_%s_P_FACTOR100  %ld\n", macroNames[w], factors[w][0]);
+    fprintf(out, "#define PID_SPEED_%s_I_FACTOR100  %ld\n", macroNames[w], factors[w][1]);
+    fprintf(out, "#define PID_SPEED_%s_D_FACTOR100  %ld\n", macroNames[w], factors[w][2]);
+    fprintf(out, "#define PID_SPEED_%s_FF_GAIN100   %ld\n", macroNames[w], ff[w][0]);
+    fprintf(out, "#define PID_SPEED_%s_FF_OFFSET    %ld\n", macroNames[w], ff[w][1]);
+    fprintf(out, "#define PID_SPEED_%s_FF_ACCEL100  %ld\n", macroNames[w], ff[w][2]);
+  }
+  fprintf(out, "\n#endif /* PIDSPEEDTUNING_H_ */\n");
+  fclose(out);
+  printf("written %s\n", outName);
+  return 0;
+}
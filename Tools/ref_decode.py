@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""
+Decodes the binary dump of the reflectance recorder ('ref rec dump') into CSV.
+
+Capture the shell output into a file (e.g. with the RTT logger or a terminal
+logging to a file), then run:
+
+  ./ref_decode.py dump.bin > run.csv
+
+The dump starts with the magic 'REFR', any shell text before it is skipped.
+"""
+
+import struct
+import sys
+
+MAGIC = b'REFR'
+VERSION = 1
+LINE_KINDS = ['NONE', 'STRAIGHT', 'LEFT', 'RIGHT', 'FULL']
+
+
+def decode(data, out):
+    start = data.find(MAGIC)
+    if start < 0:
+        raise ValueError('no recorder dump found (missing magic)')
+    version, nofSensors, frameSize, nofFrames, tickMs = struct.unpack_from('<BBHHH', data, start+4)
+    if version != VERSION:
+        raise ValueError('unsupported dump version %d' % version)
+    if frameSize != 4+4*nofSensors+4:
+        raise ValueError('unexpected frame size %d for %d sensors' % (frameSize, nofSensors))
+    pos = start+12
+    end = pos+nofFrames*frameSize
+    if end+2 > len(data):
+        raise ValueError('dump truncated: %d of %d frames' % ((len(data)-pos)//frameSize, nofFrames))
+    checksum, = struct.unpack_from('<H', data, end)
+    if (sum(data[start:end]) & 0xffff) != checksum:
+        raise ValueError('checksum mismatch')
+
+    frameFmt = '<I%dH%dHHBB' % (nofSensors, nofSensors)
+    out.write(','.join(['frame', 'time_ms']
+                       + ['raw%d' % i for i in range(nofSensors)]
+                       + ['calib%d' % i for i in range(nofSensors)]
+                       + ['line_value', 'line_kind'])+'\n')
+    for i in range(nofFrames):
+        values = struct.unpack_from(frameFmt, data, pos+i*frameSize)
+        tick = values[0]
+        raw = values[1:1+nofSensors]
+        calib = values[1+nofSensors:1+2*nofSensors]
+        lineValue, lineKind = values[1+2*nofSensors], values[2+2*nofSensors]
+        kind = LINE_KINDS[lineKind] if lineKind < len(LINE_KINDS) else str(lineKind)
+        out.write(','.join([str(i), str(tick*tickMs)]
+                           + [str(v) for v in raw]
+                           + [str(v) for v in calib]
+                           + [str(lineValue), kind])+'\n')
+    return nofFrames
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.stderr.write('usage: %s <dump file>\n' % sys.argv[0])
+        return 1
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+    try:
+        n = decode(data, sys.stdout)
+    except ValueError as e:
+        sys.stderr.write('error: %s\n' % e)
+        return 1
+    sys.stderr.write('%d frames decoded\n' % n)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())